@@ -0,0 +1,111 @@
+#ifndef RIRC_BENCH_H
+#define RIRC_BENCH_H
+
+/* bench.h -- microbenchmark helpers for rirc
+ *
+ * Benchmarks replay recorded IRC traffic, one message per CRLF or LF
+ * terminated line, reporting the mean time per message over a number
+ * of rounds:
+ *
+ *   bench_read(path)                - read a traffic file
+ *   bench_lines(buf, &lines, &n)    - split traffic into lines, in place
+ *   bench_time()                    - monotonic time, in nanoseconds
+ *   bench_report(name, n, ns)       - print time per message
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_ROUNDS 1000
+
+static void
+bench_fatal(const char *msg)
+{
+	fprintf(stderr, "bench: %s: %s\n", msg, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static uint64_t
+bench_time(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		bench_fatal("clock_gettime");
+
+	return ((uint64_t) ts.tv_sec * 1000000000) + (uint64_t) ts.tv_nsec;
+}
+
+static char*
+bench_read(const char *path)
+{
+	/* Read a traffic file, returning its contents */
+
+	FILE *f;
+	char *buf;
+	long len;
+
+	if ((f = fopen(path, "rb")) == NULL)
+		bench_fatal(path);
+
+	if (fseek(f, 0, SEEK_END) < 0 || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) < 0)
+		bench_fatal(path);
+
+	if ((buf = malloc((size_t) len + 1)) == NULL)
+		bench_fatal("malloc");
+
+	if (fread(buf, 1, (size_t) len, f) != (size_t) len)
+		bench_fatal(path);
+
+	fclose(f);
+
+	buf[len] = 0;
+
+	return buf;
+}
+
+static void
+bench_lines(char *buf, char ***lines, size_t *n)
+{
+	/* Split traffic into lines, omitting CRLF and empty lines */
+
+	char *p;
+
+	*lines = NULL;
+	*n = 0;
+
+	for (p = buf; *p;) {
+
+		char *end;
+
+		if ((end = strchr(p, '\n')) == NULL)
+			end = p + strlen(p);
+
+		if (end > p && *(end - 1) == '\r')
+			*(end - 1) = 0;
+
+		if (*end)
+			*end++ = 0;
+
+		if (*p) {
+			if ((*lines = realloc(*lines, sizeof(**lines) * (*n + 1))) == NULL)
+				bench_fatal("realloc");
+			(*lines)[(*n)++] = p;
+		}
+
+		p = end;
+	}
+}
+
+static void
+bench_report(const char *name, size_t n, uint64_t ns)
+{
+	printf("%-32s %10zu msgs %10.1f ns/msg %12.0f msgs/sec\n",
+		name, n, (double) ns / n, n / ((double) ns / 1e9));
+}
+
+#endif
@@ -0,0 +1,208 @@
+#include "bench/bench.h"
+
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Frames are written to a counter rather than the terminal, and drawn on
+ * a simulated clock advanced by each socket read */
+static size_t bench_tty_bytes;
+static size_t bench_tty_writes;
+static uint64_t bench_clock_ms;
+
+static int
+bench_clock_gettime(clockid_t id, struct timespec *ts)
+{
+	(void) id;
+
+	ts->tv_sec = (time_t) (bench_clock_ms / 1000);
+	ts->tv_nsec = (long) (bench_clock_ms % 1000) * 1000000;
+
+	return 0;
+}
+
+static ssize_t
+bench_write(int fd, const void *buf, size_t len)
+{
+	(void) fd;
+	(void) buf;
+
+	bench_tty_bytes += len;
+	bench_tty_writes++;
+
+	return (ssize_t) len;
+}
+
+#define clock_gettime(ID, TS) bench_clock_gettime((ID), (TS))
+#define write(FD, BUF, LEN)   bench_write((FD), (BUF), (LEN))
+#include "src/draw.c"
+#undef clock_gettime
+#undef write
+
+#include "src/components/buffer.c"
+#include "src/components/channel.c"
+#include "src/components/highlight.c"
+#include "src/components/input.c"
+#include "src/components/ircv3.c"
+#include "src/components/mode.c"
+#include "src/components/server.c"
+#include "src/components/user.c"
+#include "src/handlers/irc_ctcp.c"
+#include "src/handlers/irc_recv.c"
+#include "src/handlers/irc_send.c"
+#include "src/handlers/ircv3.c"
+#include "src/state.c"
+#include "src/utils/utils.c"
+
+/* Mocks shared with the tests assert on results not checked here */
+#define assert_gt(X, Y) do { (void)(X); (void)(Y); } while (0)
+
+#include "test/io.mock.c"
+#include "test/rirc.mock.c"
+
+/* Synthetic flood, received in socket reads of BENCH_READ_SIZE bytes,
+ * each BENCH_READ_MS after the last */
+#define BENCH_LINES     10000
+#define BENCH_NAMES     200
+#define BENCH_READ_MS   1
+#define BENCH_READ_SIZE 1024
+
+#define BENCH_COLS 160
+#define BENCH_ROWS 48
+#define BENCH_NICK "rirc"
+
+static char*
+bench_synth(size_t *len)
+{
+	static const char *text =
+		"the quick brown fox jumps over the lazy dog, again and again, "
+		"while everyone else in the channel watches";
+
+	char *buf;
+	size_t size = (size_t) BENCH_LINES * 256;
+
+	if ((buf = malloc(size)) == NULL)
+		bench_fatal("malloc");
+
+	*len = 0;
+
+	for (unsigned m = 0; m < BENCH_LINES; m++) {
+
+		int ret = snprintf(buf + *len, size - *len,
+			":names%u!~names@bench.host PRIVMSG #chan :%.*s\r\n",
+			m % BENCH_NAMES, (int) (m % 64) + 16, text);
+
+		if (ret < 0 || (size_t) ret >= size - *len)
+			bench_fatal("snprintf");
+
+		*len += (size_t) ret;
+	}
+
+	return buf;
+}
+
+static struct server*
+bench_server(void)
+{
+	/* Registered and joined to #chan, drawn with the channel current */
+
+	static char buf[IRC_MESSAGE_LEN + 2];
+
+	struct server *s;
+
+	state_init();
+	draw_init();
+
+	state_tty_cols = BENCH_COLS;
+	state_tty_rows = BENCH_ROWS;
+
+	s = server("irc.bench.net", "6667", NULL, "user", "real", NULL);
+
+	server_nick_set(s, BENCH_NICK);
+	server_list_add(state_server_list(), s);
+
+	snprintf(buf, sizeof(buf), ":irc.bench.net 001 " BENCH_NICK " :Welcome\r\n");
+	io_cb_read_soc(buf, strlen(buf), s);
+
+	snprintf(buf, sizeof(buf), ":" BENCH_NICK "!user@bench.host JOIN #chan\r\n");
+	io_cb_read_soc(buf, strlen(buf), s);
+
+	channel_set_current(channel_list_get(&(s->clist), "#chan", s->casemapping));
+
+	draw(DRAW_ALL);
+	draw(DRAW_FLUSH);
+
+	return s;
+}
+
+static void
+bench_flood(const char *name, const char *stream, size_t len, int flush)
+{
+	/* Replay the flood, either flushing a frame after each read as when
+	 * frames weren't deferred, or drawing deferred frames when due as the
+	 * io loop does before waiting on events */
+
+	static char buf[BENCH_READ_SIZE];
+
+	struct server *s;
+	uint64_t ns = 0;
+	uint64_t t;
+
+	bench_clock_ms = 1000;
+
+	s = bench_server();
+
+	bench_tty_bytes = 0;
+	bench_tty_writes = 0;
+
+	for (size_t i = 0; i < len; i += BENCH_READ_SIZE) {
+
+		size_t n = MIN(len - i, BENCH_READ_SIZE);
+
+		memcpy(buf, stream + i, n);
+
+		bench_clock_ms += BENCH_READ_MS;
+
+		t = bench_time();
+
+		(void) draw_deferred();
+
+		io_cb_read_soc(buf, n, s);
+
+		if (flush)
+			draw(DRAW_FLUSH);
+
+		ns += bench_time() - t;
+	}
+
+	/* The io loop waits for the last deferred frame */
+	bench_clock_ms += DRAW_FRAME_MS;
+
+	t = bench_time();
+	(void) draw_deferred();
+	ns += bench_time() - t;
+
+	printf("%-32s %10zu frames %10zu bytes %10.1f ns/line\n",
+		name, bench_tty_writes, bench_tty_bytes, (double) ns / BENCH_LINES);
+
+	draw_term();
+	state_term();
+}
+
+int
+main(void)
+{
+	char *stream;
+	size_t len;
+
+	stream = bench_synth(&len);
+
+	printf("synthetic: %d lines, %zu bytes, %d byte reads every %d ms, %dx%d, %d fps\n",
+		BENCH_LINES, len, BENCH_READ_SIZE, BENCH_READ_MS, BENCH_COLS, BENCH_ROWS, DRAW_FPS);
+
+	bench_flood("tty per read", stream, len, 1);
+	bench_flood("tty per deferred frame", stream, len, 0);
+
+	free(stream);
+
+	return EXIT_SUCCESS;
+}
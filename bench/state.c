@@ -0,0 +1,330 @@
+#include "bench/bench.h"
+
+#include <sys/resource.h>
+
+#include "src/components/buffer.c"
+#include "src/components/channel.c"
+#include "src/components/highlight.c"
+#include "src/components/input.c"
+#include "src/components/ircv3.c"
+#include "src/components/mode.c"
+#include "src/components/server.c"
+#include "src/components/user.c"
+#include "src/handlers/irc_ctcp.c"
+#include "src/handlers/irc_recv.c"
+#include "src/handlers/irc_send.c"
+#include "src/handlers/ircv3.c"
+#include "src/state.c"
+#include "src/utils/utils.c"
+
+/* Mocks shared with the tests assert on results not checked here */
+#define assert_gt(X, Y) do { (void)(X); (void)(Y); } while (0)
+
+#include "test/draw.mock.c"
+#include "test/io.mock.c"
+#include "test/rirc.mock.c"
+
+/* Synthetic traffic */
+#define BENCH_NAMES   500   /* Users listed by RPL_NAMEREPLY, per channel */
+#define BENCH_JOINS   2000  /* Users joining, changing nick, then quitting */
+#define BENCH_JOINED  4     /* Channels joined per joining user */
+#define BENCH_PRIVMSG 32000 /* Messages, one in BENCH_PINGED pinging */
+#define BENCH_PINGED  20
+
+#define BENCH_CHANNELS  16
+#define BENCH_HANDLERS  64
+#define BENCH_NICK      "rirc"
+#define BENCH_READ_SIZE 16384
+#define BENCH_STATE_ROUNDS 10
+
+struct bench_handler
+{
+	char command[32];
+	size_t n;
+	uint64_t ns;
+};
+
+static struct bench_handler handlers[BENCH_HANDLERS];
+static size_t handlers_n;
+
+static char *synth;
+static size_t synth_len;
+static size_t synth_size;
+
+static void
+bench_synthf(const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	for (;;) {
+
+		va_start(ap, fmt);
+		ret = vsnprintf(synth + synth_len, synth_size - synth_len, fmt, ap);
+		va_end(ap);
+
+		if (ret < 0)
+			bench_fatal("vsnprintf");
+
+		if (synth_len + (size_t) ret < synth_size)
+			break;
+
+		synth_size = (synth_size ? synth_size * 2 : BENCH_READ_SIZE);
+
+		if ((synth = realloc(synth, synth_size)) == NULL)
+			bench_fatal("realloc");
+	}
+
+	synth_len += (size_t) ret;
+}
+
+static char*
+bench_synth(void)
+{
+	/* Registration, joining every channel with a NAMES burst, a mass JOIN
+	 * across channels, a PRIVMSG flood, nick changes, a mass QUIT and
+	 * parting, such that the traffic leaves no state and can be replayed */
+
+	static const char *text =
+		"the quick brown fox jumps over the lazy dog, again and again, "
+		"while everyone else in the channel watches";
+
+	bench_synthf(":irc.bench.net 001 " BENCH_NICK " :Welcome to the bench network " BENCH_NICK "\r\n");
+	bench_synthf(":irc.bench.net 005 " BENCH_NICK " CASEMAPPING=rfc1459 CHANTYPES=# "
+		"CHANMODES=beI,k,l,imnpst PREFIX=(ov)@+ NICKLEN=16 :are supported by this server\r\n");
+
+	for (unsigned c = 0; c < BENCH_CHANNELS; c++) {
+
+		bench_synthf(":" BENCH_NICK "!user@bench.host JOIN #chan%u\r\n", c);
+		bench_synthf(":irc.bench.net 332 " BENCH_NICK " #chan%u :channel %u topic\r\n", c, c);
+
+		for (unsigned u = 0; u < BENCH_NAMES;) {
+
+			bench_synthf(":irc.bench.net 353 " BENCH_NICK " = #chan%u :", c);
+
+			for (unsigned k = 0; k < 20 && u < BENCH_NAMES; k++, u++)
+				bench_synthf("%s%snames%u", (k ? " " : ""), (u % 10 ? (u % 4 ? "" : "+") : "@"), u);
+
+			bench_synthf("\r\n");
+		}
+
+		bench_synthf(":irc.bench.net 366 " BENCH_NICK " #chan%u :End of /NAMES list.\r\n", c);
+	}
+
+	/* Joining users are each on BENCH_JOINED of the channels */
+	for (unsigned u = 0; u < BENCH_JOINS; u++) {
+		for (unsigned c = 0; c < BENCH_JOINED; c++)
+			bench_synthf(":joins%u!~joins@%u.bench.host JOIN #chan%u\r\n", u, u, (u + c) % BENCH_CHANNELS);
+	}
+
+	for (unsigned m = 0; m < BENCH_PRIVMSG; m++) {
+
+		unsigned c = m % BENCH_CHANNELS;
+
+		if (m % BENCH_PINGED == 0)
+			bench_synthf(":names%u!~names@bench.host PRIVMSG #chan%u :" BENCH_NICK ": %.*s\r\n",
+				m % BENCH_NAMES, c, (int) (m % 64) + 16, text);
+		else
+			bench_synthf(":names%u!~names@bench.host PRIVMSG #chan%u :%.*s\r\n",
+				m % BENCH_NAMES, c, (int) (m % 64) + 16, text);
+	}
+
+	for (unsigned u = 0; u < BENCH_JOINS; u++)
+		bench_synthf(":joins%u!~joins@%u.bench.host NICK :nicks%u\r\n", u, u, u);
+
+	for (unsigned u = 0; u < BENCH_JOINS; u++)
+		bench_synthf(":nicks%u!~joins@%u.bench.host QUIT :Quit: leaving\r\n", u, u);
+
+	bench_synthf(":irc.bench.net PING :irc.bench.net\r\n");
+
+	for (unsigned c = 0; c < BENCH_CHANNELS; c++)
+		bench_synthf(":" BENCH_NICK "!user@bench.host PART #chan%u :bye\r\n", c);
+
+	return synth;
+}
+
+static struct server*
+bench_server(void)
+{
+	struct server *s;
+
+	state_init();
+
+	s = server("irc.bench.net", "6667", NULL, "user", "real", NULL);
+
+	server_nick_set(s, BENCH_NICK);
+	server_list_add(state_server_list(), s);
+	channel_set_current(s->channel);
+
+	return s;
+}
+
+static struct bench_handler*
+bench_handler(const char *line)
+{
+	/* Handler for a message's command */
+
+	const char *p = line;
+	size_t len;
+
+	if (*p == ':')
+		p += strcspn(p, " ");
+
+	p += strspn(p, " ");
+
+	len = MIN(strcspn(p, " "), sizeof(handlers[0].command) - 1);
+
+	for (size_t i = 0; i < handlers_n; i++) {
+		if (!strncmp(handlers[i].command, p, len) && !handlers[i].command[len])
+			return &handlers[i];
+	}
+
+	if (handlers_n == BENCH_HANDLERS)
+		return NULL;
+
+	memcpy(handlers[handlers_n].command, p, len);
+
+	return &handlers[handlers_n++];
+}
+
+static int
+bench_handler_cmp(const void *h1, const void *h2)
+{
+	uint64_t ns1 = ((const struct bench_handler *)h1)->ns;
+	uint64_t ns2 = ((const struct bench_handler *)h2)->ns;
+
+	return (ns1 < ns2) - (ns1 > ns2);
+}
+
+static void
+bench_io_cb_read_soc(const char *stream, size_t len, size_t n)
+{
+	/* Replay the stream in socket sized reads */
+
+	static char buf[BENCH_READ_SIZE];
+
+	uint64_t ns = 0;
+
+	for (int r = 0; r < BENCH_STATE_ROUNDS; r++) {
+
+		struct server *s = bench_server();
+
+		for (size_t i = 0; i < len; i += BENCH_READ_SIZE) {
+
+			size_t n_read = MIN(len - i, BENCH_READ_SIZE);
+			uint64_t t;
+
+			memcpy(buf, stream + i, n_read);
+
+			t = bench_time();
+			io_cb_read_soc(buf, n_read, s);
+			ns += bench_time() - t;
+		}
+
+		state_term();
+	}
+
+	bench_report("io_cb_read_soc", n * BENCH_STATE_ROUNDS, ns);
+}
+
+static void
+bench_irc_recv(char **lines, size_t n)
+{
+	/* Replay the stream one message per read, by handler, less the
+	 * overhead of timing each message */
+
+	static char buf[IRC_MESSAGE_LEN + 2];
+
+	uint64_t overhead;
+	uint64_t t;
+
+	t = bench_time();
+
+	for (size_t i = 0; i < n; i++)
+		(void) bench_time();
+
+	overhead = (bench_time() - t) / n;
+
+	for (int r = 0; r < BENCH_STATE_ROUNDS; r++) {
+
+		struct server *s = bench_server();
+
+		for (size_t i = 0; i < n; i++) {
+
+			struct bench_handler *h;
+			size_t len = MIN(strlen(lines[i]), IRC_MESSAGE_LEN);
+
+			if ((h = bench_handler(lines[i])) == NULL)
+				continue;
+
+			memcpy(buf, lines[i], len);
+			buf[len++] = '\r';
+			buf[len++] = '\n';
+
+			t = bench_time();
+			io_cb_read_soc(buf, len, s);
+			t = bench_time() - t;
+
+			h->ns += (t > overhead ? t - overhead : 0);
+			h->n++;
+		}
+
+		state_term();
+	}
+
+	qsort(handlers, handlers_n, sizeof(handlers[0]), bench_handler_cmp);
+
+	for (size_t i = 0; i < handlers_n; i++) {
+
+		char name[64];
+
+		snprintf(name, sizeof(name), "  irc_recv %.31s", handlers[i].command);
+
+		bench_report(name, handlers[i].n, handlers[i].ns);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Replay recorded traffic, or synthetic traffic by default. Recorded
+	 * traffic is expected to register with nick BENCH_NICK */
+
+	char **lines;
+	char *buf;
+	char *stream;
+	size_t len;
+	size_t n;
+	struct rusage ru;
+
+	buf = (argc > 1 ? bench_read(argv[1]) : bench_synth());
+
+	if ((stream = strdup(buf)) == NULL)
+		bench_fatal("strdup");
+
+	len = strlen(stream);
+
+	bench_lines(buf, &lines, &n);
+
+	if (n == 0) {
+		fprintf(stderr, "bench: no messages\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%s: %zu messages, %zu bytes, %d rounds\n",
+		(argc > 1 ? argv[1] : "synthetic"), n, len, BENCH_STATE_ROUNDS);
+
+	bench_io_cb_read_soc(stream, len, n);
+	bench_irc_recv(lines, n);
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0)
+		bench_fatal("getrusage");
+
+	printf("peak rss: %ld KiB\n", ru.ru_maxrss);
+
+	free(lines);
+	free(stream);
+	free(buf);
+
+	return EXIT_SUCCESS;
+}
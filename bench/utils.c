@@ -0,0 +1,109 @@
+#include "bench/bench.h"
+
+#include "src/utils/utils.c"
+
+static char line[1024];
+
+static size_t
+bench_irc_command(char **lines, size_t n, const char *command, char **filtered)
+{
+	/* Copy to `filtered` the messages of `command`, returning their number */
+
+	size_t count = 0;
+	struct irc_message m;
+
+	for (size_t i = 0; i < n; i++) {
+
+		strcpy(line, lines[i]);
+
+		if (irc_message_parse(&m, line) == 0 && !strcmp(m.command, command))
+			filtered[count++] = lines[i];
+	}
+
+	return count;
+}
+
+static void
+bench_irc_message_parse(const char *name, char **lines, size_t n)
+{
+	/* Parse each message and all of its params, less the time spent
+	 * copying messages to be parsed in place */
+
+	size_t params = 0;
+	struct irc_message m;
+	uint64_t t0;
+	uint64_t t1;
+
+	t0 = bench_time();
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		for (size_t i = 0; i < n; i++) {
+			strcpy(line, lines[i]);
+			__asm__ volatile("" : : "r"(line) : "memory");
+		}
+	}
+
+	t1 = bench_time();
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		for (size_t i = 0; i < n; i++) {
+
+			char *param;
+
+			strcpy(line, lines[i]);
+
+			if (irc_message_parse(&m, line) == 0) {
+				while (irc_message_param(&m, &param))
+					params++;
+			}
+		}
+	}
+
+	if (params == 0)
+		fprintf(stderr, "bench: no params parsed\n");
+
+	bench_report(name, n * BENCH_ROUNDS, (bench_time() - t1) - (t1 - t0));
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *commands[] = { "PRIVMSG", "005", "353" };
+	char name[64];
+	char **filtered;
+	char **lines;
+	char *buf;
+	size_t n;
+
+	buf = bench_read(argc > 1 ? argv[1] : "bench/traffic.log");
+
+	bench_lines(buf, &lines, &n);
+
+	for (size_t i = 0; i < n; i++) {
+		if (strlen(lines[i]) >= sizeof(line))
+			lines[i][sizeof(line) - 1] = 0;
+	}
+
+	bench_irc_message_parse("irc_message_parse", lines, n);
+
+	/* Messages of distinct shape: short params and a trailing param, many
+	 * middle params, and middle params preceding a long trailing param */
+	if ((filtered = malloc(sizeof(*filtered) * n)) == NULL)
+		bench_fatal("malloc");
+
+	for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+
+		size_t count = bench_irc_command(lines, n, commands[i], filtered);
+
+		snprintf(name, sizeof(name), "irc_message_parse (%s)", commands[i]);
+
+		if (count)
+			bench_irc_message_parse(name, filtered, count);
+	}
+
+	free(filtered);
+	free(lines);
+	free(buf);
+
+	return EXIT_SUCCESS;
+}
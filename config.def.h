@@ -40,9 +40,21 @@
 #define BUFFER_TEXT_FG -1;
 #define BUFFER_TEXT_BG -1;
 
-/* Number of buffer lines to keep in history, must be power of 2 */
+/* Default number of buffer lines to keep in history, must be power of 2
+ *   Set per channel with :set scrollback <lines> */
 #define BUFFER_LINES_MAX (1 << 10)
 
+/* Bytes of buffer memory across all channels before evicting the oldest
+ * lines of the least recently viewed channels, 0: no limit. The current
+ * channel is never evicted, and may exceed the limit alone
+ *   Set with :set scrollback-memory <bytes>[k|m|g] */
+#define BUFFER_MEMORY_MAX 0
+
+/* Directory for temporary files storing lines removed from buffers, paged
+ * back in when scrolling back past a buffer's oldest line in memory
+ *   "": disabled, removed lines are discarded */
+#define BUFFER_SPILL_DIR ""
+
 /* Colours used for nicks */
 #define NICK_COLOURS {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14};
 
@@ -105,9 +117,20 @@
  */
 #define BUFFER_PADDING 1
 
+/* Comma separated set of words highlighting messages, as the nick does
+ *   String
+ *   Set with :set highlight [<words>] */
+#define HIGHLIGHT_WORDS ""
+
 /* Raise terminal bell when pinged in chat */
 #define BELL_ON_PINGED 1
 
+/* Frames drawn per second at most in response to network activity,
+ * coalescing changes between frames. Input is drawn immediately
+ *   Integer, [0, 30, 1000]
+ *   (0: no limit) */
+#define DRAW_FPS 30
+
 /* [NETWORK] */
 
 /* Default CA certificate file path
@@ -118,6 +141,28 @@
  *   ("": a list of known paths is checked) */
 #define CA_CERT_PATH ""
 
+/* Directory for files persisting each server's last TLS session, such
+ * that connecting after restarting resumes the session. Sessions are
+ * otherwise resumed only when reconnecting, and only by connections with
+ * required TLS verification
+ *   ("": disabled) */
+#define IO_TLS_SESSION_DIR ""
+
+/* Milliseconds between starting connection attempts to each of a host's
+ * addresses, unless the previous attempt fails sooner (RFC 8305)
+ *   Integer, [10, 250, 2000] */
+#define IO_CONNECT_DELAY 250
+
+/* Seconds before abandoning a connection attempt to an address
+ *   Integer, [1, 10, 300] */
+#define IO_CONNECT_TIMEOUT 10
+
+/* Seconds resolved hosts are cached, at most, reconnecting without
+ * querying nameservers while their records' TTL hasn't expired
+ *   Integer, [0, 3600, 86400]
+ *   (0: no caching) */
+#define DNS_CACHE_TTL_MAX 3600
+
 /* Seconds before displaying ping
  *   Integer, [0, 150, 86400]
  *   (0: no ping handling) */
@@ -144,3 +189,11 @@
 /* Reconnect backoff maximum
  *   Integer, [1, 86400, 86400] */
 #define IO_RECONNECT_BACKOFF_MAX 86400
+
+/* Run all connections on a single threaded epoll event loop, rather than
+ * a thread per connection, Linux only. TLS 1.3 is supported only when set
+ * in CFLAGS, e.g. `make CFLAGS='-O2 -DIO_EPOLL=1'`, building mbedtls with it
+ *   (0: disabled, 1: enabled) */
+#ifndef IO_EPOLL
+#define IO_EPOLL 0
+#endif
@@ -33,7 +33,8 @@
 	MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,       \
 	MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,         \
 	MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CCM,              \
-	MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8
+	MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8             \
+	RIRC_TLS1_3_CIPHERSUITES
 
 /* Supported ECC curves */
 #define MBEDTLS_ECP_DP_BP256R1_ENABLED
@@ -69,6 +70,28 @@
 #define MBEDTLS_SSL_CLI_C
 #define MBEDTLS_SSL_PROTO_TLS1_2
 
+/* TLS 1.3 client, only negotiated by the single threaded io loop, since
+ * the PSA crypto keystore isn't used concurrently by connection threads.
+ * IO_EPOLL must be set in CFLAGS for mbedtls to be built with it */
+#if defined(IO_EPOLL) && IO_EPOLL
+#define MBEDTLS_HKDF_C
+#define MBEDTLS_PKCS1_V21
+#define MBEDTLS_PSA_CRYPTO_C
+#define MBEDTLS_SSL_KEEP_PEER_CERTIFICATE
+#define MBEDTLS_SSL_PROTO_TLS1_3
+#define MBEDTLS_SSL_TLS1_3_COMPATIBILITY_MODE
+#define MBEDTLS_SSL_TLS1_3_KEY_EXCHANGE_MODE_EPHEMERAL_ENABLED
+#define MBEDTLS_SSL_TLS1_3_KEY_EXCHANGE_MODE_PSK_EPHEMERAL_ENABLED
+#define RIRC_TLS1_3_CIPHERSUITES                 \
+	,                                            \
+	MBEDTLS_TLS1_3_CHACHA20_POLY1305_SHA256,     \
+	MBEDTLS_TLS1_3_AES_256_GCM_SHA384,           \
+	MBEDTLS_TLS1_3_AES_128_GCM_SHA256,           \
+	MBEDTLS_TLS1_3_AES_128_CCM_SHA256
+#else
+#define RIRC_TLS1_3_CIPHERSUITES
+#endif
+
 /* TLS modules */
 #define MBEDTLS_AESNI_C
 #define MBEDTLS_AES_C
@@ -97,6 +120,7 @@
 #define MBEDTLS_SHA1_C
 #define MBEDTLS_SHA224_C
 #define MBEDTLS_SHA256_C
+#define MBEDTLS_SHA384_C
 #define MBEDTLS_SHA512_C
 #define MBEDTLS_SSL_TLS_C
 #define MBEDTLS_X509_CRT_PARSE_C
@@ -105,6 +129,7 @@
 /* TLS extensions */
 #define MBEDTLS_SSL_EXTENDED_MASTER_SECRET /* RFC 7627 */
 #define MBEDTLS_SSL_SERVER_NAME_INDICATION /* RFC 6066 */
+#define MBEDTLS_SSL_SESSION_TICKETS        /* RFC 5077 */
 
 /* Crypto features */
 #define MBEDTLS_ECDSA_DETERMINISTIC
@@ -2,22 +2,163 @@
 
 #include "src/utils/utils.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-#define BUFFER_MASK(X) ((X) & (BUFFER_LINES_MAX - 1))
+#define BUFFER_MASK(B, X) ((X) & ((B)->buffer_lines_size - 1))
 
-#if BUFFER_MASK(BUFFER_LINES_MAX)
+#if BUFFER_LINES_MAX & (BUFFER_LINES_MAX - 1)
 #error BUFFER_LINES_MAX must be a power of 2
 #endif
 
+#if BUFFER_LINES_MIN & (BUFFER_LINES_MIN - 1)
+#error BUFFER_LINES_MIN must be a power of 2
+#endif
+
+#if BUFFER_LINES_MIN > BUFFER_LINES_MAX
+#error BUFFER_LINES_MIN must not exceed BUFFER_LINES_MAX
+#endif
+
+#if BUFFER_LINES_MAX > BUFFER_LINES_LIMIT
+#error BUFFER_LINES_MAX must not exceed BUFFER_LINES_LIMIT
+#endif
+
+#if BUFFER_PAGE_SIZE < 1024
+#error BUFFER_PAGE_SIZE must be at least 1024
+#endif
+
+#if BUFFER_SPILL_SEGMENT_SIZE & (BUFFER_SPILL_SEGMENT_SIZE - 1)
+#error BUFFER_SPILL_SEGMENT_SIZE must be a power of 2
+#endif
+
+#if BUFFER_SPILL_SEGMENT_SIZE < (1 << 16)
+#error BUFFER_SPILL_SEGMENT_SIZE must be at least 65536
+#endif
+
+#define BUFFER_PAGE_DATA (BUFFER_PAGE_SIZE - sizeof(struct buffer_page))
+
+/* Slots in an index's table when first allocated */
+#define BUFFER_INDEX_SIZE_MIN 256
+
+/* Slot of trigram `K` in index `I`'s table */
+#define BUFFER_INDEX_SLOT(I, K) \
+	(((uint32_t)((K) * 2654435761u) >> 8) & ((I)->size - 1))
+
+/* Nonzero key of the case folded trigram at `S[I]`, `N` bytes long, padded with NUL */
+#define BUFFER_TRIGRAM(S, N, I) \
+	((uint32_t)1 << 24 | \
+	 (uint32_t)tolower((unsigned char)(S)[(I)]) << 16 | \
+	 (uint32_t)((I) + 1 < (N) ? tolower((unsigned char)(S)[(I) + 1]) : 0) << 8 | \
+	 (uint32_t)((I) + 2 < (N) ? tolower((unsigned char)(S)[(I) + 2]) : 0))
+
+/* Bytes of a spill record storing `F` and `T` bytes of from/text, aligned for the
+ * record header and followed by its size, for reading records back to front */
+#define BUFFER_SPILL_RECORD_SIZE(F, T) \
+	((offsetof(struct buffer_record, data) + (F) + (T) + 2 + sizeof(uint32_t) + 7) & ~(size_t)7)
+
+/* Buffer line text is stored in a FIFO list of fixed size pages, in the
+ * same order as lines are pushed to the ring. A page is freed once every
+ * line referencing it has been overwritten, so memory scales with the
+ * length of the lines actually stored rather than their maximum length */
+struct buffer_page
+{
+	struct buffer_page *next;
+	size_t size;    /* Bytes used in `data` */
+	unsigned lines; /* Lines referencing `data` */
+	char data[];
+};
+
+/* Lines are indexed by the case folded trigram starting at each byte of
+ * their text, padded with NUL past its end. Lines containing a string of
+ * 3 or more bytes are found by intersecting its trigrams' postings, and
+ * shorter strings by the union of postings of the trigrams they prefix.
+ *
+ * A posting lists line indexes in ascending order. Lines are appended as
+ * pushed to the ring, and removed from the front as the ring's tail, so
+ * postings are updated at either end. Paged lines move as the paged window
+ * slides, so they're indexed separately, and only when searched */
+struct buffer_posting
+{
+	uint32_t key;    /* Trigram, 0: empty slot */
+	unsigned start;  /* Position in `lines` of the oldest line */
+	unsigned n;      /* Positions used in `lines` */
+	unsigned size;   /* Positions allocated in `lines` */
+	unsigned *lines;
+};
+
+/* Lines removed from a buffer's ring are appended to a temporary spill file
+ * as records, split into fixed size segments which are memory mapped while
+ * written to, or while lines paged back into the ring reference them:
+ *
+ *   |time|size|from_len|text_len|type|from\0|text\0|pad|size|
+ *
+ * Paged lines point directly at the record's text in the mapped segment.
+ * Paged lines are limited to the buffer's line limit, as a window over the
+ * spill file sliding back and forth as the buffer is scrolled, such that
+ * the spill file's lines are reachable without holding them all in memory */
+struct buffer_record
+{
+	int64_t time;
+	uint32_t size;
+	uint16_t from_len;
+	uint16_t text_len;
+	uint8_t type;
+	char data[];
+};
+
+struct buffer_segment
+{
+	char *map;      /* Mapped segment, or NULL */
+	size_t size;    /* Bytes of records written */
+	unsigned lines; /* Paged lines referencing `map` */
+};
+
+static char* buffer_page_alloc(struct buffer*, struct buffer_line*, size_t);
+static int buffer_index_search(struct buffer*, struct buffer_index*, const char*, size_t, unsigned*);
+static int buffer_line_match(struct buffer_line*, const char*, size_t);
+static char* buffer_spill_map(struct buffer*, unsigned);
+static int buffer_spill_open(struct buffer*);
 static struct buffer_line* buffer_push(struct buffer*);
+static struct buffer_posting* buffer_index_find(struct buffer_index*, uint32_t);
+static struct buffer_posting* buffer_index_insert(struct buffer_index*, uint32_t);
+static unsigned buffer_posting_seek(struct buffer_posting*, unsigned, unsigned, unsigned);
+static void buffer_grow(struct buffer*);
+static void buffer_index_add(struct buffer_index*, unsigned, const char*, size_t);
+static void buffer_index_del(struct buffer_index*, unsigned, const char*, size_t);
+static void buffer_index_free(struct buffer_index*);
+static void buffer_index_grow(struct buffer_index*);
+static void buffer_index_remove(struct buffer_index*, struct buffer_posting*);
+static void buffer_line_free(struct buffer*, struct buffer_line*);
+static void buffer_lines_free(struct buffer*);
+static void buffer_pop(struct buffer*);
+static void buffer_posting_resize(struct buffer_index*, struct buffer_posting*, unsigned);
+static void buffer_resize(struct buffer*, unsigned);
+static void buffer_spill_drop(struct buffer*, unsigned);
+static void buffer_spill_free(struct buffer*);
+static void buffer_spill_line(struct buffer*, struct buffer_line*, struct buffer_record*);
+static void buffer_spill_release(struct buffer*, struct buffer_line*);
+static void buffer_spill_unref(struct buffer*, unsigned);
+static void buffer_spill_write(struct buffer*, struct buffer_line*);
+
+/* Bytes allocated for lines, text and indexes across all buffers */
+static size_t buffer_memory_all;
+
+/* Directory for spill files, empty: lines removed from the ring are discarded */
+static const char *buffer_spill_dir = BUFFER_SPILL_DIR;
 
 struct buffer_line*
 buffer_head(struct buffer *b)
 {
 	/* Return the first printable line in a buffer */
 
-	return buffer_size(b) == 0 ? NULL : &b->buffer_lines[BUFFER_MASK(b->head - 1)];
+	return buffer_size(b) == 0 ? NULL : &b->buffer_lines[BUFFER_MASK(b, b->head - 1)];
 }
 
 struct buffer_line*
@@ -25,7 +166,7 @@ buffer_tail(struct buffer *b)
 {
 	/* Return the last printable line in a buffer */
 
-	return buffer_size(b) == 0 ? NULL : &b->buffer_lines[BUFFER_MASK(b->tail)];
+	return buffer_size(b) == 0 ? NULL : &b->buffer_lines[BUFFER_MASK(b, b->tail)];
 }
 
 struct buffer_line*
@@ -57,7 +198,7 @@ buffer_line(struct buffer *b, unsigned i)
 	    ((b->tail > b->head) && (i < b->tail && i >= b->head)))
 		fatal("invalid index: %d", i);
 
-	return &b->buffer_lines[BUFFER_MASK(i)];
+	return &b->buffer_lines[BUFFER_MASK(b, i)];
 }
 
 void
@@ -70,6 +211,8 @@ buffer_newline(
 		size_t text_len,
 		char prefix)
 {
+	char *from;
+	char *text;
 	struct buffer_line *line;
 
 	if (from_str == NULL)
@@ -83,18 +226,25 @@ buffer_newline(
 	line->from_len = MIN(from_len + (!!prefix), FROM_LENGTH_MAX);
 	line->text_len = MIN(text_len,              TEXT_LENGTH_MAX);
 
+	from = buffer_page_alloc(b, line, line->from_len + line->text_len + 2);
+	text = from + line->from_len + 1;
+
 	if (prefix)
-		*line->from = prefix;
+		*from = prefix;
 
-	memcpy(line->from + (!!prefix), from_str, line->from_len);
-	memcpy(line->text,              text_str, line->text_len);
+	memcpy(from + (!!prefix), from_str, line->from_len - (!!prefix));
+	memcpy(text,              text_str, line->text_len);
 
-	*(line->from + line->from_len) = '\0';
-	*(line->text + line->text_len) = '\0';
+	*(from + line->from_len) = '\0';
+	*(text + line->text_len) = '\0';
 
+	line->from = from;
+	line->text = text;
 	line->time = time(NULL);
 	line->type = type;
 
+	buffer_index_add(&(b->index.lines), b->head - 1, text, line->text_len);
+
 	if (line->from_len > b->pad)
 		b->pad = line->from_len;
 }
@@ -105,6 +255,127 @@ buffer(struct buffer *b)
 	/* Initialize a buffer */
 
 	memset(b, 0, sizeof(*b));
+
+	b->buffer_lines_max = BUFFER_LINES_MAX;
+	b->spill.fd = -1;
+}
+
+void
+buffer_clear(struct buffer *b)
+{
+	/* Remove all lines from a buffer, keeping its configured line limit */
+
+	unsigned lines_max = b->buffer_lines_max;
+
+	buffer_free(b);
+	buffer(b);
+
+	b->buffer_lines_max = lines_max;
+}
+
+void
+buffer_free(struct buffer *b)
+{
+	/* Free a buffer's ring, page arena and spill file, invalidating all lines */
+
+	buffer_lines_free(b);
+	buffer_spill_free(b);
+}
+
+static void
+buffer_lines_free(struct buffer *b)
+{
+	/* Free a buffer's ring, page arena and indexes */
+
+	struct buffer_page *p;
+
+	buffer_index_free(&(b->index.lines));
+	buffer_index_free(&(b->index.paged));
+
+	while ((p = b->pages.tail)) {
+		b->pages.tail = p->next;
+		free(p);
+	}
+
+	free(b->buffer_lines);
+
+	buffer_memory_all -= sizeof(*b->buffer_lines) * b->buffer_lines_size;
+	buffer_memory_all -= (size_t)BUFFER_PAGE_SIZE * b->pages.count;
+
+	b->buffer_lines = NULL;
+	b->buffer_lines_size = 0;
+	b->pages.head = NULL;
+	b->pages.count = 0;
+}
+
+size_t
+buffer_memory(struct buffer *b)
+{
+	/* Return number of bytes allocated for a buffer */
+
+	return sizeof(*b)
+		+ sizeof(*b->buffer_lines) * b->buffer_lines_size
+		+ (size_t)BUFFER_PAGE_SIZE * b->pages.count
+		+ b->index.lines.memory
+		+ b->index.paged.memory;
+}
+
+size_t
+buffer_memory_total(void)
+{
+	/* Return number of bytes allocated for lines and text across all buffers */
+
+	return buffer_memory_all;
+}
+
+size_t
+buffer_evict(struct buffer *b)
+{
+	/* Remove the lines stored in a buffer's oldest page, returning the
+	 * number of bytes freed. The ring is released when the buffer empties,
+	 * and halved when it becomes mostly unused */
+
+	size_t memory = buffer_memory(b);
+	struct buffer_page *page;
+
+	if (buffer_size(b) == 0)
+		return 0;
+
+	page = buffer_tail(b)->page;
+
+	do {
+		buffer_pop(b);
+	} while (buffer_size(b) && buffer_tail(b)->page == page);
+
+	if (buffer_size(b) == 0)
+		buffer_lines_free(b);
+	else if (buffer_size(b) <= b->buffer_lines_size / 4 && b->buffer_lines_size > BUFFER_LINES_MIN)
+		buffer_resize(b, b->buffer_lines_size / 2);
+
+	return memory - buffer_memory(b);
+}
+
+void
+buffer_set_lines_max(struct buffer *b, unsigned lines_max)
+{
+	/* Set the number of lines kept by a buffer, removing excess lines
+	 * from the tail and shrinking the ring to fit */
+
+	unsigned size = b->buffer_lines_size;
+
+	if (lines_max == 0 || lines_max > BUFFER_LINES_LIMIT)
+		fatal("invalid lines max: %u", lines_max);
+
+	b->buffer_lines_max = lines_max;
+
+	while (buffer_size(b) > lines_max)
+		buffer_pop(b);
+
+	while (size > BUFFER_LINES_MIN && size / 2 >= lines_max)
+		size /= 2;
+
+	if (b->buffer_lines && size != b->buffer_lines_size)
+		buffer_resize(b, size);
 }
 
 unsigned
@@ -115,23 +386,976 @@ buffer_size(struct buffer *b)
 	return b->head - b->tail;
 }
 
+int
+buffer_search(struct buffer *b, const char *str, unsigned *i)
+{
+	/* Search backwards from the line preceding index `*i` to the buffer's
+	 * tail for a line containing `str`, ignoring case. On match, `*i` is
+	 * set to the line's index and returns 1, otherwise 0. Lines in memory
+	 * are searched before the older lines paged in from the spill file */
+
+	struct buffer_line *line;
+	size_t len = strlen(str);
+	unsigned j;
+
+	if (len == 0 || len > TEXT_LENGTH_MAX)
+		return 0;
+
+	if (buffer_index_search(b, &(b->index.lines), str, len, i))
+		return 1;
+
+	/* Index the paged lines, freed as the paged window changes */
+	if (b->index.paged.table == NULL) {
+		for (j = b->tail; j != b->head; j++) {
+
+			if ((line = &(b->buffer_lines[BUFFER_MASK(b, j)]))->page)
+				break;
+
+			buffer_index_add(&(b->index.paged), j, line->text, line->text_len);
+		}
+	}
+
+	return buffer_index_search(b, &(b->index.paged), str, len, i);
+}
+
+unsigned
+buffer_spill_size(struct buffer *b)
+{
+	/* Return number of spilled lines preceding the ring's tail */
+
+	return (b->spill.fd < 0) ? 0 : (b->tail - b->spill.gap - b->spill.begin);
+}
+
+unsigned
+buffer_spill_load(struct buffer *b, unsigned n)
+{
+	/* Page up to `n` spilled lines back into the ring preceding its tail,
+	 * returning the number of lines loaded. The lines reference their
+	 * records in place and are removed from the ring as any other line.
+	 * The newest paged lines are released as required to keep within the
+	 * buffer's line limit, and paged back in by buffer_spill_load_forw */
+
+	char *map;
+	size_t off;
+	struct buffer_record *record;
+	uint32_t size;
+	unsigned count = 0;
+	unsigned empty = (buffer_size(b) == 0);
+	unsigned paged;
+	unsigned seg;
+
+	if ((n = MIN(n, MIN(buffer_spill_size(b), b->buffer_lines_max))) == 0)
+		return 0;
+
+	buffer_index_free(&(b->index.paged));
+
+	if ((paged = b->spill.end - b->tail) == 0) {
+		b->spill.seg_next = b->spill.seg;
+		b->spill.off_next = b->spill.off;
+	}
+
+	if (paged + n > b->buffer_lines_max)
+		buffer_spill_drop(b, paged + n - b->buffer_lines_max);
+
+	while (count < n) {
+
+		seg = b->spill.seg;
+		off = b->spill.off;
+
+		if (off == 0)
+			off = b->spill.segments[--seg].size;
+
+		if ((map = buffer_spill_map(b, seg)) == NULL)
+			break;
+
+		memcpy(&size, map + off - sizeof(size), sizeof(size));
+
+		record = (struct buffer_record *)(map + off - size);
+
+		if (b->buffer_lines == NULL || buffer_size(b) == b->buffer_lines_size)
+			buffer_grow(b);
+
+		buffer_spill_line(b, &(b->buffer_lines[BUFFER_MASK(b, --b->tail)]), record);
+
+		b->spill.segments[seg].lines++;
+		b->spill.seg = seg;
+		b->spill.off = off - size;
+
+		count++;
+	}
+
+	if (empty && count)
+		b->scrollback = b->head - 1;
+
+	return count;
+}
+
+unsigned
+buffer_spill_load_forw(struct buffer *b, unsigned n)
+{
+	/* Page up to `n` spilled lines released by buffer_spill_load back into
+	 * the ring following the newest paged line, returning the number of
+	 * lines loaded. The oldest paged lines are released as required to
+	 * keep within the buffer's line limit */
+
+	unsigned *indexes[] = { &(b->scrollback), &(b->buffer_i_top), &(b->buffer_i_bot) };
+	unsigned end = b->spill.end;
+	unsigned tail = b->tail;
+	unsigned seg = b->spill.seg_next;
+	size_t off = b->spill.off_next;
+	unsigned i;
+	unsigned k;
+
+	n = MIN(n, MIN(b->spill.gap, b->buffer_lines_max));
+
+	/* Map and reference the records' segments before modifying the ring,
+	 * such that releasing paged lines doesn't unmap them */
+	for (i = 0; i < n; i++) {
+
+		char *map;
+
+		if (off == b->spill.segments[seg].size) {
+			seg++;
+			off = 0;
+		}
+
+		if ((map = buffer_spill_map(b, seg)) == NULL)
+			break;
+
+		off += ((struct buffer_record *)(map + off))->size;
+
+		b->spill.segments[seg].lines++;
+	}
+
+	if ((n = i) == 0)
+		return 0;
+
+	buffer_index_free(&(b->index.paged));
+
+	k = (end - tail + n > b->buffer_lines_max) ? (end - tail + n - b->buffer_lines_max) : 0;
+
+	for (i = 0; i < k; i++)
+		buffer_spill_release(b, &(b->buffer_lines[BUFFER_MASK(b, b->tail++)]));
+
+	while (buffer_size(b) + n > b->buffer_lines_size)
+		buffer_grow(b);
+
+	/* Move the remaining paged lines back `n` lines, preceding those loaded */
+	for (i = b->tail; i != end; i++)
+		b->buffer_lines[BUFFER_MASK(b, i - n)] = b->buffer_lines[BUFFER_MASK(b, i)];
+
+	for (i = 0; i < ARR_LEN(indexes); i++) {
+		if (*indexes[i] - tail < k)
+			*indexes[i] = tail + k - n;
+		else if (*indexes[i] - tail < end - tail)
+			*indexes[i] -= n;
+	}
+
+	b->tail -= n;
+
+	for (i = end - n; i != end; i++) {
+
+		struct buffer_record *record;
+
+		if (b->spill.off_next == b->spill.segments[b->spill.seg_next].size) {
+			b->spill.seg_next++;
+			b->spill.off_next = 0;
+		}
+
+		record = (struct buffer_record *)(b->spill.segments[b->spill.seg_next].map + b->spill.off_next);
+
+		buffer_spill_line(b, &(b->buffer_lines[BUFFER_MASK(b, i)]), record);
+
+		b->spill.off_next += record->size;
+	}
+
+	b->spill.gap -= n;
+
+	return n;
+}
+
 static struct buffer_line*
 buffer_push(struct buffer *b)
 {
 	/* Return a new `struct buffer_line *` pushed to a buffer */
 
-	/* lock scrollback to head */
-	if (buffer_line(b, b->scrollback) == buffer_head(b))
+	if (b->buffer_lines == NULL
+	 || (buffer_size(b) == b->buffer_lines_size && b->buffer_lines_size < b->buffer_lines_max))
+		buffer_grow(b);
+
+	/* lock scrollback to head, releasing any lines paged in from the spill file */
+	if (buffer_line(b, b->scrollback) == buffer_head(b)) {
 		b->scrollback = b->head;
 
+		while (buffer_size(b) > b->buffer_lines_max)
+			buffer_pop(b);
+	}
+
+	if (buffer_size(b) >= b->buffer_lines_max)
+		buffer_pop(b);
+
+	return &(b->buffer_lines[BUFFER_MASK(b, b->head++)]);
+}
+
+static void
+buffer_pop(struct buffer *b)
+{
+	/* Remove the last line from a buffer, appending it to the spill file
+	 * unless it was paged in from it */
+
+	struct buffer_line *line = &(b->buffer_lines[BUFFER_MASK(b, b->tail)]);
+
 	/* lock scrollback to tail */
-	if (buffer_size(b) == BUFFER_LINES_MAX) {
+	if (b->scrollback == b->tail)
+		b->scrollback++;
+
+	if (line->page)
+		buffer_index_del(&(b->index.lines), b->tail, line->text, line->text_len);
+	else
+		buffer_index_free(&(b->index.paged));
+
+	if (b->spill.fd >= 0 && b->tail != b->spill.end)
+		buffer_spill_release(b, line);
+	else
+		buffer_spill_write(b, line);
+
+	b->tail++;
+
+	/* Spilled lines skipped by the paged lines precede the ring's tail
+	 * once all paged lines are released */
+	if (b->tail == b->spill.end && b->spill.gap) {
+		b->spill.gap = 0;
+		b->spill.seg = b->spill.count - 1;
+		b->spill.off = b->spill.segments[b->spill.seg].size;
+	}
+
+	buffer_line_free(b, line);
+}
+
+static void
+buffer_resize(struct buffer *b, unsigned size)
+{
+	/* Move a buffer's lines to a newly allocated ring of `size` lines */
+
+	struct buffer_line *lines;
+	unsigned i;
+
+	if (size < buffer_size(b))
+		fatal("invalid size: %u", size);
+
+	if ((lines = calloc(size, sizeof(*lines))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	for (i = b->tail; i != b->head; i++)
+		lines[i & (size - 1)] = b->buffer_lines[BUFFER_MASK(b, i)];
+
+	free(b->buffer_lines);
+
+	buffer_memory_all -= sizeof(*lines) * b->buffer_lines_size;
+	buffer_memory_all += sizeof(*lines) * size;
+
+	b->buffer_lines = lines;
+	b->buffer_lines_size = size;
+}
+
+static void
+buffer_grow(struct buffer *b)
+{
+	/* Allocate a buffer's ring, or double its size
+	 *
+	 * Lines are indexed by masking with the ring size, so when doubling,
+	 * any line whose index has the old size's bit set moves to the newly
+	 * allocated upper half of the ring, e.g. for lines [6, 10) and size 4 -> 8:
+	 *
+	 *   old: |8|9|6|7|
+	 *   new: |8|9| | | | |6|7|
+	 */
+
+	struct buffer_line *lines;
+	unsigned i;
+	unsigned size = b->buffer_lines_size;
+
+	if (b->buffer_lines == NULL) {
+
+		if ((lines = calloc(BUFFER_LINES_MIN, sizeof(*lines))) == NULL)
+			fatal("calloc: %s", strerror(errno));
+
+		buffer_memory_all += sizeof(*lines) * BUFFER_LINES_MIN;
+
+		b->buffer_lines = lines;
+		b->buffer_lines_size = BUFFER_LINES_MIN;
+		return;
+	}
+
+	if ((lines = realloc(b->buffer_lines, sizeof(*lines) * size * 2)) == NULL)
+		fatal("realloc: %s", strerror(errno));
+
+	for (i = b->tail; i != b->head; i++) {
+		if (i & size)
+			lines[i & (size * 2 - 1)] = lines[i & (size - 1)];
+	}
+
+	buffer_memory_all += sizeof(*lines) * size;
+
+	b->buffer_lines = lines;
+	b->buffer_lines_size = size * 2;
+}
+
+static void
+buffer_line_free(struct buffer *b, struct buffer_line *line)
+{
+	/* Release a line's arena storage, freeing any unreferenced pages */
+
+	struct buffer_page *p;
+
+	if (line->page)
+		line->page->lines--;
+
+	while ((p = b->pages.tail) != b->pages.head && p->lines == 0) {
+		b->pages.tail = p->next;
+		b->pages.count--;
+		free(p);
+		buffer_memory_all -= BUFFER_PAGE_SIZE;
+	}
+}
+
+static int
+buffer_line_match(struct buffer_line *line, const char *str, size_t len)
+{
+	/* Return whether a line's text contains `str`, ignoring case */
+
+	const char *p;
+	const char *end;
+	size_t i;
+
+	if (line->text_len < len)
+		return 0;
+
+	for (p = line->text, end = line->text + line->text_len - len; p <= end; p++) {
+
+		if (tolower((unsigned char)*p) != tolower((unsigned char)*str))
+			continue;
+
+		for (i = 1; i < len; i++) {
+			if (tolower((unsigned char)p[i]) != tolower((unsigned char)str[i]))
+				break;
+		}
+
+		if (i == len)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+buffer_index_search(struct buffer *b, struct buffer_index *idx, const char *str, size_t len, unsigned *i)
+{
+	/* Search an index for the newest line preceding index `*i` containing
+	 * `str`, ignoring case. Strings of 3 or more bytes leapfrog over the
+	 * postings of their trigrams, rarest first, until all agree on a line
+	 * which is then matched against `str`. Shorter strings take the newest
+	 * line of any posting they prefix, which always matches */
+
+	struct buffer_posting *postings[TEXT_LENGTH_MAX];
+	struct buffer_posting *p;
+	unsigned ends[TEXT_LENGTH_MAX];
+	unsigned agree = 0;
+	unsigned found = 0;
+	unsigned n = 0;
+	unsigned j;
+	unsigned k;
+	unsigned x;
+	unsigned y = 0;
+
+	if (idx->table == NULL || *i == b->tail)
+		return 0;
+
+	x = *i - 1;
+
+	if (len < 3) {
 
-		if (b->scrollback == b->tail)
-			b->scrollback++;
+		uint32_t mask = (len == 1) ? 0xffff0000 : 0xffffff00;
+		uint32_t key = BUFFER_TRIGRAM(str, len, 0) & mask;
 
-		b->tail++;
+		for (j = 0; j < idx->size; j++) {
+
+			p = &(idx->table[j]);
+
+			if ((p->key & mask) != key)
+				continue;
+
+			if ((k = buffer_posting_seek(p, p->n, x, b->tail)) == p->start)
+				continue;
+
+			if (!found || p->lines[k - 1] - b->tail > y - b->tail) {
+				y = p->lines[k - 1];
+				found = 1;
+			}
+		}
+
+		if (found)
+			*i = y;
+
+		return found;
+	}
+
+	for (j = 0; j + 2 < len; j++) {
+
+		if ((p = buffer_index_find(idx, BUFFER_TRIGRAM(str, len, j))) == NULL)
+			return 0;
+
+		for (k = 0; k < n && postings[k] != p; k++)
+			;
+
+		if (k < n)
+			continue;
+
+		for (k = n++; k && postings[k - 1]->n - postings[k - 1]->start > p->n - p->start; k--)
+			postings[k] = postings[k - 1];
+
+		postings[k] = p;
+	}
+
+	for (k = 0; k < n; k++)
+		ends[k] = postings[k]->n;
+
+	for (k = 0;; k = (k + 1) % n) {
+
+		p = postings[k];
+
+		if ((ends[k] = buffer_posting_seek(p, ends[k], x, b->tail)) == p->start)
+			return 0;
+
+		if ((y = p->lines[ends[k] - 1]) != x) {
+			x = y;
+			agree = 0;
+		}
+
+		if (++agree < n)
+			continue;
+
+		if (buffer_line_match(&(b->buffer_lines[BUFFER_MASK(b, x)]), str, len)) {
+			*i = x;
+			return 1;
+		}
+
+		if (x == b->tail)
+			return 0;
+
+		x--;
+		agree = 0;
+	}
+}
+
+static struct buffer_posting*
+buffer_index_find(struct buffer_index *idx, uint32_t key)
+{
+	/* Return the posting of trigram `key`, or NULL */
+
+	unsigned i;
+
+	if (idx->table == NULL)
+		return NULL;
+
+	for (i = BUFFER_INDEX_SLOT(idx, key); idx->table[i].key; i = (i + 1) & (idx->size - 1)) {
+		if (idx->table[i].key == key)
+			return &(idx->table[i]);
+	}
+
+	return NULL;
+}
+
+static struct buffer_posting*
+buffer_index_insert(struct buffer_index *idx, uint32_t key)
+{
+	/* Return the posting of trigram `key`, adding it when missing */
+
+	struct buffer_posting *p;
+	unsigned i;
+
+	if ((p = buffer_index_find(idx, key)))
+		return p;
+
+	if (idx->count >= idx->size / 2)
+		buffer_index_grow(idx);
+
+	for (i = BUFFER_INDEX_SLOT(idx, key); idx->table[i].key; i = (i + 1) & (idx->size - 1))
+		;
+
+	p = memset(&(idx->table[i]), 0, sizeof(*p));
+	p->key = key;
+
+	idx->count++;
+
+	return p;
+}
+
+static void
+buffer_index_add(struct buffer_index *idx, unsigned i, const char *text, size_t len)
+{
+	/* Append line index `i` to the postings of its text's trigrams */
+
+	struct buffer_posting *p;
+	size_t j;
+
+	for (j = 0; j < len; j++) {
+
+		p = buffer_index_insert(idx, BUFFER_TRIGRAM(text, len, j));
+
+		if (p->n > p->start && p->lines[p->n - 1] == i)
+			continue;
+
+		if (p->n == p->size)
+			buffer_posting_resize(idx, p, (p->n - p->start) + (p->n - p->start) / 2 + 2);
+
+		p->lines[p->n++] = i;
+	}
+}
+
+static void
+buffer_index_del(struct buffer_index *idx, unsigned i, const char *text, size_t len)
+{
+	/* Remove line index `i`, the oldest indexed, from the postings of its
+	 * text's trigrams, shrinking postings as they become mostly unused */
+
+	struct buffer_posting *p;
+	size_t j;
+
+	for (j = 0; j < len; j++) {
+
+		p = buffer_index_find(idx, BUFFER_TRIGRAM(text, len, j));
+
+		if (p == NULL || p->start == p->n || p->lines[p->start] != i)
+			continue;
+
+		if (++p->start == p->n)
+			buffer_index_remove(idx, p);
+		else if (p->n - p->start <= p->size / 4)
+			buffer_posting_resize(idx, p, p->size / 2);
+	}
+}
+
+static void
+buffer_index_free(struct buffer_index *idx)
+{
+	/* Free an index's table and postings */
+
+	unsigned i;
+
+	for (i = 0; i < idx->size; i++)
+		free(idx->table[i].lines);
+
+	free(idx->table);
+
+	buffer_memory_all -= idx->memory;
+
+	memset(idx, 0, sizeof(*idx));
+}
+
+static void
+buffer_index_grow(struct buffer_index *idx)
+{
+	/* Double the size of an index's table, rehashing its postings */
+
+	struct buffer_posting *table = idx->table;
+	unsigned size = idx->size;
+	unsigned i;
+	unsigned j;
+
+	idx->size = (size ? (size * 2) : BUFFER_INDEX_SIZE_MIN);
+
+	if ((idx->table = calloc(idx->size, sizeof(*idx->table))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	for (i = 0; i < size; i++) {
+
+		if (table[i].key == 0)
+			continue;
+
+		for (j = BUFFER_INDEX_SLOT(idx, table[i].key); idx->table[j].key; j = (j + 1) & (idx->size - 1))
+			;
+
+		idx->table[j] = table[i];
+	}
+
+	free(table);
+
+	idx->memory += sizeof(*idx->table) * (idx->size - size);
+	buffer_memory_all += sizeof(*idx->table) * (idx->size - size);
+}
+
+static void
+buffer_index_remove(struct buffer_index *idx, struct buffer_posting *p)
+{
+	/* Remove an emptied posting from an index's table, shifting back the
+	 * postings following it in its probe sequence */
+
+	unsigned mask = idx->size - 1;
+	unsigned i = p - idx->table;
+	unsigned j = i;
+	unsigned k;
+
+	buffer_posting_resize(idx, p, 0);
+
+	while (idx->table[(j = (j + 1) & mask)].key) {
+
+		k = BUFFER_INDEX_SLOT(idx, idx->table[j].key);
+
+		if (((j - k) & mask) >= ((j - i) & mask)) {
+			idx->table[i] = idx->table[j];
+			i = j;
+		}
+	}
+
+	memset(&(idx->table[i]), 0, sizeof(idx->table[i]));
+
+	idx->count--;
+}
+
+static void
+buffer_posting_resize(struct buffer_index *idx, struct buffer_posting *p, unsigned size)
+{
+	/* Resize a posting to `size` lines, moving its lines to the front */
+
+	unsigned *lines;
+
+	if (p->start) {
+		memmove(p->lines, p->lines + p->start, sizeof(*p->lines) * (p->n - p->start));
+		p->n -= p->start;
+		p->start = 0;
+	}
+
+	if (size == 0) {
+		free(p->lines);
+		p->lines = NULL;
+	} else if ((lines = realloc(p->lines, sizeof(*p->lines) * size)) == NULL) {
+		fatal("realloc: %s", strerror(errno));
+	} else {
+		p->lines = lines;
+	}
+
+	idx->memory -= sizeof(*p->lines) * p->size;
+	idx->memory += sizeof(*p->lines) * size;
+	buffer_memory_all -= sizeof(*p->lines) * p->size;
+	buffer_memory_all += sizeof(*p->lines) * size;
+
+	p->size = size;
+}
+
+static unsigned
+buffer_posting_seek(struct buffer_posting *p, unsigned end, unsigned x, unsigned base)
+{
+	/* Return the position following a posting's last line at or before
+	 * index `x`, among those preceding position `end`, galloping back
+	 * from `end`. Indexes are compared relative to `base`, the oldest */
+
+	unsigned lo = p->start;
+	unsigned hi = end;
+	unsigned mid;
+	unsigned step = 1;
+
+	while (hi - lo > step && p->lines[hi - step] - base > x - base) {
+		hi -= step;
+		step *= 2;
 	}
 
-	return &(b->buffer_lines[BUFFER_MASK(b->head++)]);
+	if (hi - lo > step)
+		lo = hi - step + 1;
+
+	while (lo < hi) {
+
+		mid = lo + (hi - lo) / 2;
+
+		if (p->lines[mid] - base > x - base)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+static char*
+buffer_page_alloc(struct buffer *b, struct buffer_line *line, size_t len)
+{
+	/* Return `len` bytes from the buffer's page arena for storing `line` */
+
+	struct buffer_page *p = b->pages.head;
+
+	if (len > BUFFER_PAGE_DATA)
+		fatal("invalid length: %zu", len);
+
+	/* Reuse the head page when all of its lines have been overwritten */
+	if (p && p->lines == 0)
+		p->size = 0;
+
+	if (p == NULL || p->size + len > BUFFER_PAGE_DATA) {
+
+		if ((p = malloc(BUFFER_PAGE_SIZE)) == NULL)
+			fatal("malloc: %s", strerror(errno));
+
+		p->next = NULL;
+		p->size = 0;
+		p->lines = 0;
+
+		b->pages.count++;
+		buffer_memory_all += BUFFER_PAGE_SIZE;
+
+		if (b->pages.head)
+			b->pages.head->next = p;
+		else
+			b->pages.tail = p;
+
+		b->pages.head = p;
+	}
+
+	line->page = p;
+
+	p->lines++;
+	p->size += len;
+
+	return p->data + p->size - len;
+}
+
+static int
+buffer_spill_open(struct buffer *b)
+{
+	/* Create a buffer's spill file, unlinked such that it's removed on exit */
+
+	char path[1024];
+	int fd;
+
+	if (b->spill.disabled || *buffer_spill_dir == 0)
+		return -1;
+
+	if (snprintf(path, sizeof(path), "%s/rirc.XXXXXX", buffer_spill_dir) >= (int)sizeof(path))
+		return -1;
+
+	if ((fd = mkstemp(path)) < 0)
+		return -1;
+
+	unlink(path);
+
+	b->spill.fd = fd;
+	b->spill.begin = b->tail;
+	b->spill.end = b->tail;
+
+	return 0;
+}
+
+static char*
+buffer_spill_map(struct buffer *b, unsigned seg)
+{
+	/* Return a segment of the spill file, mapping it as required */
+
+	struct buffer_segment *s = &(b->spill.segments[seg]);
+	void *map;
+
+	if (s->map)
+		return s->map;
+
+	map = mmap(NULL, BUFFER_SPILL_SEGMENT_SIZE, PROT_READ, MAP_SHARED,
+		b->spill.fd, (off_t)seg * BUFFER_SPILL_SEGMENT_SIZE);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	return (s->map = map);
+}
+
+static void
+buffer_spill_write(struct buffer *b, struct buffer_line *line)
+{
+	/* Append a line's record to the spill file, starting a new segment when
+	 * full. Lines are discarded when spilling is disabled or fails */
+
+	size_t size = BUFFER_SPILL_RECORD_SIZE(line->from_len, line->text_len);
+	struct buffer_record *record;
+	struct buffer_segment *s;
+	uint32_t size32 = size;
+	void *map;
+
+	if (b->spill.fd < 0 && buffer_spill_open(b))
+		goto discard;
+
+	if (b->spill.count == 0 || b->spill.segments[b->spill.count - 1].size + size > BUFFER_SPILL_SEGMENT_SIZE) {
+
+		if ((s = realloc(b->spill.segments, sizeof(*s) * (b->spill.count + 1))) == NULL)
+			fatal("realloc: %s", strerror(errno));
+
+		b->spill.segments = s;
+
+		if (ftruncate(b->spill.fd, (off_t)(b->spill.count + 1) * BUFFER_SPILL_SEGMENT_SIZE) < 0)
+			goto discard;
+
+		map = mmap(NULL, BUFFER_SPILL_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+			b->spill.fd, (off_t)b->spill.count * BUFFER_SPILL_SEGMENT_SIZE);
+
+		if (map == MAP_FAILED)
+			goto discard;
+
+		/* The previous segment remains mapped only while referenced */
+		if (b->spill.count && s[b->spill.count - 1].lines == 0) {
+			munmap(s[b->spill.count - 1].map, BUFFER_SPILL_SEGMENT_SIZE);
+			s[b->spill.count - 1].map = NULL;
+		}
+
+		s = &(b->spill.segments[b->spill.count++]);
+		s->map = map;
+		s->size = 0;
+		s->lines = 0;
+	}
+
+	s = &(b->spill.segments[b->spill.count - 1]);
+
+	record = (struct buffer_record *)(s->map + s->size);
+	record->time = (int64_t)line->time;
+	record->size = size32;
+	record->from_len = line->from_len;
+	record->text_len = line->text_len;
+	record->type = line->type;
+
+	memcpy(record->data, line->from, line->from_len + 1);
+	memcpy(record->data + line->from_len + 1, line->text, line->text_len + 1);
+	memcpy(s->map + s->size + size - sizeof(size32), &size32, sizeof(size32));
+
+	s->size += size;
+
+	b->spill.end++;
+	b->spill.seg = b->spill.count - 1;
+	b->spill.off = s->size;
+
+	return;
+
+discard:
+	buffer_spill_free(b);
+
+	b->spill.disabled = 1;
+	b->spill.begin = b->tail + 1;
+	b->spill.end = b->tail + 1;
+}
+
+static void
+buffer_spill_drop(struct buffer *b, unsigned k)
+{
+	/* Release the newest `k` paged lines, moving the older paged lines
+	 * forward to precede the ring's lines in memory. The released lines'
+	 * records are skipped by the ring until paged back in */
+
+	unsigned *indexes[] = { &(b->scrollback), &(b->buffer_i_top), &(b->buffer_i_bot) };
+	unsigned end = b->spill.end;
+	unsigned tail = b->tail;
+	uint32_t size;
+	unsigned i;
+
+	for (i = 0; i < k; i++) {
+
+		unsigned seg = b->spill.seg_next;
+		size_t off = b->spill.off_next;
+
+		if (off == 0)
+			off = b->spill.segments[--seg].size;
+
+		memcpy(&size, b->spill.segments[seg].map + off - sizeof(size), sizeof(size));
+
+		b->spill.seg_next = seg;
+		b->spill.off_next = off - size;
+
+		buffer_spill_unref(b, seg);
+	}
+
+	for (i = end - k; i != tail;) {
+		i--;
+		b->buffer_lines[BUFFER_MASK(b, i + k)] = b->buffer_lines[BUFFER_MASK(b, i)];
+	}
+
+	for (i = 0; i < ARR_LEN(indexes); i++) {
+		if (*indexes[i] - (end - k) < k)
+			*indexes[i] = end - 1;
+		else if (*indexes[i] - tail < end - k - tail)
+			*indexes[i] += k;
+	}
+
+	b->tail += k;
+	b->spill.gap += k;
+}
+
+static void
+buffer_spill_line(struct buffer *b, struct buffer_line *line, struct buffer_record *record)
+{
+	/* Initialize a paged line referencing its record */
+
+	memset(line, 0, sizeof(*line));
+
+	line->from = record->data;
+	line->text = record->data + record->from_len + 1;
+	line->from_len = record->from_len;
+	line->text_len = record->text_len;
+	line->time = (time_t)record->time;
+	line->type = record->type;
+
+	if (line->from_len > b->pad)
+		b->pad = line->from_len;
+}
+
+static void
+buffer_spill_release(struct buffer *b, struct buffer_line *line)
+{
+	/* Advance past a paged line's record, unmapping its segment when no
+	 * longer referenced */
+
+	unsigned seg = b->spill.seg;
+
+	b->spill.off += BUFFER_SPILL_RECORD_SIZE(line->from_len, line->text_len);
+
+	if (b->spill.off == b->spill.segments[seg].size && seg + 1 < b->spill.count) {
+		b->spill.seg++;
+		b->spill.off = 0;
+	}
+
+	buffer_spill_unref(b, seg);
+}
+
+static void
+buffer_spill_unref(struct buffer *b, unsigned seg)
+{
+	/* Release a paged line's reference to its segment, unmapping it when
+	 * unreferenced unless being written to */
+
+	struct buffer_segment *s = &(b->spill.segments[seg]);
+
+	if (--s->lines == 0 && seg + 1 < b->spill.count) {
+		munmap(s->map, BUFFER_SPILL_SEGMENT_SIZE);
+		s->map = NULL;
+	}
+}
+
+static void
+buffer_spill_free(struct buffer *b)
+{
+	/* Unmap and close a buffer's spill file, discarding spilled lines */
+
+	unsigned i;
+
+	for (i = 0; i < b->spill.count; i++) {
+		if (b->spill.segments[i].map)
+			munmap(b->spill.segments[i].map, BUFFER_SPILL_SEGMENT_SIZE);
+	}
+
+	if (b->spill.fd >= 0)
+		close(b->spill.fd);
+
+	free(b->spill.segments);
+
+	b->spill.segments = NULL;
+	b->spill.fd = -1;
+	b->spill.count = 0;
+	b->spill.begin = b->tail;
+	b->spill.end = b->tail;
+	b->spill.seg = 0;
+	b->spill.off = 0;
+	b->spill.gap = 0;
+	b->spill.seg_next = 0;
+	b->spill.off_next = 0;
 }
@@ -12,6 +12,25 @@
 #define BUFFER_LINES_MAX (1 << 10)
 #endif
 
+#ifndef BUFFER_LINES_MIN
+#define BUFFER_LINES_MIN (1 << 4)
+#endif
+
+/* Upper bound for a buffer's runtime configured line limit */
+#define BUFFER_LINES_LIMIT (1 << 20)
+
+#ifndef BUFFER_PAGE_SIZE
+#define BUFFER_PAGE_SIZE (1 << 12)
+#endif
+
+#ifndef BUFFER_SPILL_DIR
+#define BUFFER_SPILL_DIR ""
+#endif
+
+#ifndef BUFFER_SPILL_SEGMENT_SIZE
+#define BUFFER_SPILL_SEGMENT_SIZE (1 << 20)
+#endif
+
 /* Buffer line types, in order of precedence */
 enum buffer_line_type
 {
@@ -27,14 +46,19 @@ enum buffer_line_type
 	BUFFER_LINE_T_SIZE
 };
 
+struct buffer_page;
+struct buffer_posting;
+struct buffer_segment;
+
 struct buffer_line
 {
 	enum buffer_line_type type;
 	char prefix; /* TODO as part of `from` */
-	char from[FROM_LENGTH_MAX + 1]; /* TODO: from/text as struct string */
-	char text[TEXT_LENGTH_MAX + 1];
+	const char *from; /* Stored in the buffer's page arena */
+	const char *text; /* Stored in the buffer's page arena */
 	size_t from_len;
 	size_t text_len;
+	struct buffer_page *page; /* Arena page containing `from` and `text`, NULL when spilled */
 	time_t time;
 	struct {
 		unsigned colour; /* Cached colour of `from` text */
@@ -44,21 +68,64 @@ struct buffer_line
 	} cached;
 };
 
+/* Trigram posting index of a buffer's lines, for searching */
+struct buffer_index
+{
+	struct buffer_posting *table; /* Open addressed by trigram, allocated on first line */
+	unsigned count;               /* Trigrams in `table` */
+	unsigned size;                /* Slots in `table`, a power of 2 */
+	size_t memory;                /* Bytes allocated for `table` and its postings */
+};
+
 struct buffer
 {
 	unsigned head;
 	unsigned tail;
 	unsigned scrollback; /* Index of the current line between [tail, head) for scrollback */
 	size_t pad;              /* Pad 'from' when printing to be at least this wide */
-	struct buffer_line buffer_lines[BUFFER_LINES_MAX];
+	struct buffer_line *buffer_lines; /* Ring, allocated on first newline */
+	unsigned buffer_lines_size;       /* Ring size, grows up to fit buffer_lines_max */
+	unsigned buffer_lines_max;        /* Lines kept before overwriting the tail */
+	struct {
+		struct buffer_page *head; /* Page currently written to */
+		struct buffer_page *tail; /* Oldest page referenced by a line */
+		unsigned count;
+	} pages;
+	struct {
+		struct buffer_segment *segments; /* Mapped regions of the spill file, in order written */
+		unsigned count;  /* Segments in the spill file */
+		unsigned begin;  /* Index of the oldest spilled line */
+		unsigned end;    /* Index following the newest spilled line */
+		unsigned seg;    /* Segment of the tail line's record, or the next record when tail == end */
+		size_t off;      /* Offset in `seg` of the tail line's record */
+		unsigned gap;    /* Spilled lines between the newest paged line and the oldest in memory */
+		unsigned seg_next; /* Segment of the record following the newest paged line */
+		size_t off_next;   /* Offset in `seg_next` of the record following the newest paged line */
+		int fd;
+		unsigned disabled : 1;
+	} spill;
+	struct {
+		struct buffer_index lines; /* Lines in memory */
+		struct buffer_index paged; /* Lines paged in from the spill file, built when searched */
+	} index;
 	unsigned buffer_i_bot; /* index of last drawn bottom buffer line */
 	unsigned buffer_i_top; /* index of last drawn top buffer line */
 	time_t time_last;
 };
 
+int buffer_search(struct buffer*, const char*, unsigned*);
+size_t buffer_evict(struct buffer*);
+size_t buffer_memory(struct buffer*);
+size_t buffer_memory_total(void);
 unsigned buffer_size(struct buffer*);
+unsigned buffer_spill_load(struct buffer*, unsigned);
+unsigned buffer_spill_load_forw(struct buffer*, unsigned);
+unsigned buffer_spill_size(struct buffer*);
 
 void buffer(struct buffer*);
+void buffer_clear(struct buffer*);
+void buffer_free(struct buffer*);
+void buffer_set_lines_max(struct buffer*, unsigned);
 
 struct buffer_line* buffer_head(struct buffer*);
 struct buffer_line* buffer_tail(struct buffer*);
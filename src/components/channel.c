@@ -6,6 +6,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define CHANNEL_LIST_SIZE 16 /* Initial channel list buckets, a power of 2 */
+
+static inline uint32_t channel_hash(struct channel*, enum casemapping);
+static void channel_list_casemap(struct channel_list*, enum casemapping);
+static void channel_list_grow(struct channel_list*);
+static void channel_list_link(struct channel_list*, struct channel*);
+
 struct channel*
 channel(const char *name, enum channel_type type)
 {
@@ -29,6 +36,8 @@ channel(const char *name, enum channel_type type)
 void
 channel_free(struct channel *c)
 {
+	channel_views_del(c);
+	buffer_free(&c->buffer);
 	input_free(&c->input);
 	user_list_free(&(c->users));
 	free((void *)c->key);
@@ -40,14 +49,17 @@ channel_list_free(struct channel_list *cl)
 {
 	struct channel *c1, *c2;
 
-	if ((c1 = cl->head) == NULL)
-		return;
+	if ((c1 = cl->head) != NULL) {
+		do {
+			c2 = c1;
+			c1 = c2->next;
+			channel_free(c2);
+		} while (c1 != cl->head);
+	}
 
-	do {
-		c2 = c1;
-		c1 = c2->next;
-		channel_free(c2);
-	} while (c1 != cl->head);
+	user_registry_free(&(cl->registry));
+
+	free(cl->table);
 }
 
 void
@@ -67,8 +79,18 @@ channel_key_del(struct channel *c)
 void
 channel_list_add(struct channel_list *cl, struct channel *c)
 {
+	if (cl->cm == CASEMAPPING_INVALID)
+		cl->cm = CASEMAPPING_RFC1459;
+
+	if (cl->count == cl->size)
+		channel_list_grow(cl);
+
+	channel_list_link(cl, c);
+
 	cl->count++;
 
+	user_list_register(&(c->users), &(cl->registry));
+
 	if (cl->head == NULL) {
 		cl->head = c->next = c;
 		cl->tail = c->prev = c;
@@ -84,11 +106,25 @@ channel_list_add(struct channel_list *cl, struct channel *c)
 void
 channel_list_del(struct channel_list *cl, struct channel *c)
 {
+	struct channel **p;
+
+	for (p = &(cl->table[channel_hash(c, cl->cm) & (cl->size - 1)]); *p != c; p = &((*p)->hash_next))
+		;
+
+	*p = c->hash_next;
+
+	c->hash_next = NULL;
+
 	cl->count--;
 
+	user_list_register(&(c->users), NULL);
+
 	if (cl->head == c && cl->tail == c) {
 		cl->head = NULL;
 		cl->tail = NULL;
+		free(cl->table);
+		cl->table = NULL;
+		cl->size = 0;
 	} else if (cl->head == c) {
 		cl->head = cl->tail->next = cl->head->next;
 		cl->head->prev = cl->tail;
@@ -107,17 +143,19 @@ channel_list_del(struct channel_list *cl, struct channel *c)
 struct channel*
 channel_list_get(struct channel_list *cl, const char *name, enum casemapping cm)
 {
-	struct channel *tmp;
+	struct channel *c;
+	uint32_t hash;
 
-	if ((tmp = cl->head) == NULL)
+	if (cl->count == 0)
 		return NULL;
 
-	if (!irc_strcmp(cm, cl->head->name, name))
-		return cl->head;
+	channel_list_casemap(cl, cm);
 
-	while ((tmp = tmp->next) != cl->head) {
-		if (!irc_strcmp(cm, tmp->name, name))
-			return tmp;
+	hash = irc_strhash(cm, name);
+
+	for (c = cl->table[hash & (cl->size - 1)]; c; c = c->hash_next) {
+		if (c->hash == hash && !irc_strcmp(cm, c->name, name))
+			return c;
 	}
 
 	return NULL;
@@ -138,3 +176,127 @@ channel_reset(struct channel *c)
 	user_list_free(&(c->users));
 	c->joined = 0;
 }
+
+void
+channel_views_add(struct channel_views *views, struct channel *c)
+{
+	/* Link a channel in order of its last view, after those viewed before
+	 * it, from the tail such that the channel viewed last links in O(1) */
+
+	struct channel *prev;
+
+	if (c->views)
+		return;
+
+	for (prev = views->tail; prev && prev->viewed > c->viewed; prev = prev->view_prev)
+		;
+
+	c->view_prev = prev;
+	c->view_next = (prev ? prev->view_next : views->head);
+
+	if (c->view_next)
+		c->view_next->view_prev = c;
+	else
+		views->tail = c;
+
+	if (prev)
+		prev->view_next = c;
+	else
+		views->head = c;
+
+	c->views = views;
+}
+
+void
+channel_views_del(struct channel *c)
+{
+	/* Unlink a channel from its views list, if any */
+
+	if (!c->views)
+		return;
+
+	if (c->view_prev)
+		c->view_prev->view_next = c->view_next;
+	else
+		c->views->head = c->view_next;
+
+	if (c->view_next)
+		c->view_next->view_prev = c->view_prev;
+	else
+		c->views->tail = c->view_prev;
+
+	c->view_next = NULL;
+	c->view_prev = NULL;
+	c->views = NULL;
+}
+
+static inline uint32_t
+channel_hash(struct channel *c, enum casemapping cm)
+{
+	/* Hash of the channel's name, computed once per casemapping */
+
+	if (c->hash_cm != cm) {
+		c->hash = irc_strhash(cm, c->name);
+		c->hash_cm = cm;
+	}
+
+	return c->hash;
+}
+
+static void
+channel_list_casemap(struct channel_list *cl, enum casemapping cm)
+{
+	/* Reindex all channels when the casemapping changes, names that
+	 * were distinct might now compare equal, and vice versa */
+
+	struct channel *c;
+
+	if (cl->cm == cm)
+		return;
+
+	cl->cm = cm;
+
+	memset(cl->table, 0, sizeof(*cl->table) * cl->size);
+
+	if ((c = cl->head) == NULL)
+		return;
+
+	do {
+		channel_list_link(cl, c);
+	} while ((c = c->next) != cl->head);
+}
+
+static void
+channel_list_grow(struct channel_list *cl)
+{
+	struct channel **table;
+	struct channel *c, *next;
+	unsigned size = (cl->size ? cl->size * 2 : CHANNEL_LIST_SIZE);
+
+	if ((table = calloc(size, sizeof(*table))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	for (unsigned i = 0; i < cl->size; i++) {
+		for (c = cl->table[i]; c; c = next) {
+			next = c->hash_next;
+			c->hash_next = table[c->hash & (size - 1)];
+			table[c->hash & (size - 1)] = c;
+		}
+	}
+
+	free(cl->table);
+
+	cl->table = table;
+	cl->size = size;
+}
+
+static void
+channel_list_link(struct channel_list *cl, struct channel *c)
+{
+	/* Add a channel to the list's index, under the list's casemapping */
+
+	uint32_t hash = channel_hash(c, cl->cm);
+
+	c->hash_next = cl->table[hash & (cl->size - 1)];
+	cl->table[hash & (cl->size - 1)] = c;
+}
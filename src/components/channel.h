@@ -6,6 +6,13 @@
 #include "src/components/mode.h"
 #include "src/components/user.h"
 
+#include <stddef.h>
+#include <stdint.h>
+
+/* Channel of a channel_list's registered user list */
+#define CHANNEL_USERS(UL) \
+	((struct channel *)((char *)(UL) - offsetof(struct channel, users)))
+
 /* Channel activity types, in order of precedence */
 enum activity
 {
@@ -26,6 +33,13 @@ enum channel_type
 	CHANNEL_T_SIZE
 };
 
+/* Channels in order of last view, least recent first */
+struct channel_views
+{
+	struct channel *head;
+	struct channel *tail;
+};
+
 struct channel
 {
 	const char *name;
@@ -34,23 +48,35 @@ struct channel
 	enum channel_type type;
 	size_t name_len;
 	struct buffer buffer;
+	struct channel *hash_next;
 	struct channel *next;
 	struct channel *prev;
+	struct channel *view_next;
+	struct channel *view_prev;
+	struct channel_views *views; /* Views list linking the channel, or NULL */
 	struct input input;
 	struct mode chanmodes;
 	struct mode_str chanmodes_str;
 	struct server *server;
 	struct user_list users;
+	enum casemapping hash_cm; /* Casemapping of the cached name hash */
+	uint32_t hash;            /* Casefolded name hash, rejecting name comparisons */
+	unsigned viewed; /* Order of last view, for evicting buffer lines */
 	unsigned parted : 1;
 	unsigned joined : 1;
 	char _[];
 };
 
+/* Channels in navigation order, indexed by casefolded name */
 struct channel_list
 {
 	struct channel *head;
 	struct channel *tail;
+	struct channel **table;
+	struct user_registry registry;
+	enum casemapping cm;
 	unsigned count;
+	unsigned size;
 };
 
 struct channel* channel(const char*, enum channel_type);
@@ -63,5 +89,7 @@ void channel_list_del(struct channel_list*, struct channel*);
 void channel_list_free(struct channel_list*);
 void channel_part(struct channel*);
 void channel_reset(struct channel*);
+void channel_views_add(struct channel_views*, struct channel*);
+void channel_views_del(struct channel*);
 
 #endif
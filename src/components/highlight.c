@@ -0,0 +1,265 @@
+#include "src/components/highlight.h"
+
+#include "src/utils/utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int highlight_match_at(const char*, const char*, const struct highlight_pattern*);
+static int highlight_match_one(enum casemapping, const char*, const struct highlight_pattern*);
+static void highlight_compile(struct highlight*, enum casemapping);
+
+static char *highlight_words_str;
+static unsigned highlight_words_gen;
+
+int
+highlight_match(struct highlight *h, enum casemapping cm, const char *mesg)
+{
+	/* Return 1 if any pattern matches in mesg */
+
+	uint32_t s = 0;
+
+	if (h->cm != cm || h->words != highlight_words_gen)
+		highlight_compile(h, cm);
+
+	if (h->patterns_n == 1)
+		return highlight_match_one(cm, mesg, h->patterns);
+
+	for (const char *p = mesg; *p; p++) {
+
+		s = h->delta[(s & ~HIGHLIGHT_OUT) + h->class[(unsigned char) *p]];
+
+		if (!(s & HIGHLIGHT_OUT))
+			continue;
+
+		for (unsigned t = (s & ~HIGHLIGHT_OUT) / h->classes; t; t = h->dict[t]) {
+			if (h->out[t] && highlight_match_at(mesg, p, &(h->patterns[h->out[t] - 1])))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+int
+highlight_words(const char *words)
+{
+	/* Set the comma separated highlight words of all servers */
+
+	if (words && strlen(words) > HIGHLIGHT_WORDS_MAX)
+		return -1;
+
+	free(highlight_words_str);
+
+	highlight_words_str = ((words && *words) ? irc_strdup(words) : NULL);
+	highlight_words_gen++;
+
+	return 0;
+}
+
+void
+highlight_free(struct highlight *h)
+{
+	free(h->nick);
+	free(h->strs);
+	free(h->patterns);
+	free(h->delta);
+	free(h->dict);
+	free(h->out);
+
+	memset(h, 0, sizeof(*h));
+}
+
+void
+highlight_nick(struct highlight *h, const char *nick)
+{
+	free(h->nick);
+
+	h->nick = (nick ? irc_strdup(nick) : NULL);
+	h->cm = CASEMAPPING_INVALID;
+}
+
+static int
+highlight_match_at(const char *mesg, const char *end, const struct highlight_pattern *pattern)
+{
+	/* As a nick is found in a message: skipping from the start of each
+	 * word to the first nick character, or the pattern's first character,
+	 * the pattern must match there and not be followed by a nick character */
+
+	const char *start = end + 1 - pattern->len;
+
+	if (irc_isnickchar(*(end + 1), 0))
+		return 0;
+
+	if (*start != *pattern->str && !irc_isnickchar(*start, 1))
+		return 0;
+
+	while (start > mesg && *--start != ' ') {
+		if (*start == *pattern->str || irc_isnickchar(*start, 1))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int
+highlight_match_one(enum casemapping cm, const char *mesg, const struct highlight_pattern *pattern)
+{
+	const char *str = pattern->str;
+	size_t len = pattern->len;
+
+	while (*mesg) {
+
+		while (*mesg && *mesg != *str && !irc_isnickchar(*mesg, 1))
+			mesg++;
+
+		if (!irc_strncmp(cm, mesg, str, len) && !irc_isnickchar(*(mesg + len), 0))
+			return 1;
+
+		while (*mesg && *mesg != ' ')
+			mesg++;
+	}
+
+	return 0;
+}
+
+static void
+highlight_compile(struct highlight *h, enum casemapping cm)
+{
+	/* Build the trie of the nick and highlight words over classes of
+	 * their casefolded characters, then complete its transitions with
+	 * the failure transitions, breadth first */
+
+	const signed char *fold = irc_casefold(cm);
+	char *p;
+	size_t len;
+	size_t nick_len = (h->nick ? strlen(h->nick) : 0);
+	size_t words_len = (highlight_words_str ? strlen(highlight_words_str) : 0);
+	uint16_t *fail;
+	uint16_t *queue;
+	unsigned char classes[256] = {0};
+	unsigned head = 0;
+	unsigned tail = 0;
+	unsigned n = 0;
+	unsigned states = 1;
+	unsigned states_max = nick_len + words_len + 1;
+
+	free(h->strs);
+	free(h->patterns);
+	free(h->delta);
+	free(h->dict);
+	free(h->out);
+
+	if ((h->strs = malloc(nick_len + words_len + 2)) == NULL)
+		fatal("malloc: %s", strerror(errno));
+
+	if ((h->patterns = calloc(words_len + 2, sizeof(*h->patterns))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	memcpy(h->strs, (h->nick ? h->nick : ""), nick_len + 1);
+	memcpy(h->strs + nick_len + 1, (highlight_words_str ? highlight_words_str : ""), words_len + 1);
+
+	if (nick_len) {
+		h->patterns[n].str = h->strs;
+		h->patterns[n].len = nick_len;
+		n++;
+	}
+
+	for (p = h->strs + nick_len + 1; *p; p += len + !!p[len]) {
+
+		len = strcspn(p, ",");
+
+		if (len) {
+			h->patterns[n].str = p;
+			h->patterns[n].len = len;
+			n++;
+		}
+	}
+
+	h->classes = 1;
+
+	for (unsigned i = 0; i < n; i++) {
+		for (size_t j = 0; j < h->patterns[i].len; j++) {
+
+			unsigned char c = (unsigned char) fold[(unsigned char) h->patterns[i].str[j]];
+
+			if (!classes[c])
+				classes[c] = h->classes++;
+		}
+	}
+
+	for (unsigned i = 0; i < 256; i++)
+		h->class[i] = classes[(unsigned char) fold[i]];
+
+	if ((h->delta = calloc(states_max * h->classes, sizeof(*h->delta))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	if ((h->dict = calloc(states_max, sizeof(*h->dict))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	if ((h->out = calloc(states_max, sizeof(*h->out))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	if ((fail = calloc(states_max, sizeof(*fail))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	if ((queue = calloc(states_max, sizeof(*queue))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	for (unsigned i = 0; i < n; i++) {
+
+		unsigned s = 0;
+
+		for (size_t j = 0; j < h->patterns[i].len; j++) {
+
+			uint32_t *t = &(h->delta[s * h->classes + h->class[(unsigned char) h->patterns[i].str[j]]]);
+
+			if (*t == 0)
+				*t = states++;
+
+			s = *t;
+		}
+
+		if (h->out[s] == 0)
+			h->out[s] = i + 1;
+	}
+
+	for (unsigned c = 0; c < h->classes; c++) {
+		if (h->delta[c])
+			queue[tail++] = h->delta[c];
+	}
+
+	while (head < tail) {
+
+		unsigned s = queue[head++];
+
+		for (unsigned c = 0; c < h->classes; c++) {
+
+			uint32_t *t = &(h->delta[s * h->classes + c]);
+			unsigned f = h->delta[fail[s] * h->classes + c];
+
+			if (*t == 0) {
+				*t = f;
+			} else {
+				fail[*t] = f;
+				h->dict[*t] = (h->out[f] ? f : h->dict[f]);
+				queue[tail++] = *t;
+			}
+		}
+	}
+
+	for (unsigned i = 0; i < states * h->classes; i++) {
+
+		uint32_t t = h->delta[i];
+
+		h->delta[i] = (t * h->classes) | ((h->out[t] || h->dict[t]) ? HIGHLIGHT_OUT : 0);
+	}
+
+	free(fail);
+	free(queue);
+
+	h->cm = cm;
+	h->patterns_n = n;
+	h->words = highlight_words_gen;
+}
@@ -0,0 +1,53 @@
+#ifndef RIRC_COMPONENTS_HIGHLIGHT_H
+#define RIRC_COMPONENTS_HIGHLIGHT_H
+
+/* Messages are matched against the server's nick and the highlight words
+ * in a single pass, by an Aho-Corasick automaton over the casefolded
+ * characters of the patterns, compiled when first matched after the nick,
+ * the words or the casemapping change.
+ *
+ * A pattern matches where a nick mentioned in a message would be, i.e.
+ * preceded within its word by no nick characters, and not followed by one.
+ * A single pattern, i.e. the nick without highlight words, is compared
+ * directly at each word instead */
+
+#include "src/utils/utils.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Highlight words, comma separated, are limited such that automaton
+ * states are indexed by 16 bits */
+#define HIGHLIGHT_WORDS_MAX 4096
+
+/* Transitions are to a state's offset in delta, flagged if a pattern
+ * ends at the state */
+#define HIGHLIGHT_OUT (1U << 31)
+
+struct highlight_pattern
+{
+	const char *str;
+	size_t len;
+};
+
+struct highlight
+{
+	char *nick;
+	char *strs;                         /* Compiled patterns' strings */
+	enum casemapping cm;                /* Compiled casemapping, invalid if uncompiled */
+	struct highlight_pattern *patterns;
+	uint32_t *delta;                    /* State transitions, by character class */
+	uint16_t *dict;                     /* State's longest proper suffix with a pattern */
+	uint16_t *out;                      /* State's pattern, 1-indexed */
+	unsigned classes;
+	unsigned patterns_n;
+	unsigned words;                     /* Compiled highlight words generation */
+	unsigned char class[256];           /* Character classes, by casefolded character */
+};
+
+int highlight_match(struct highlight*, enum casemapping, const char*);
+int highlight_words(const char*);
+void highlight_free(struct highlight*);
+void highlight_nick(struct highlight*, const char*);
+
+#endif
@@ -152,6 +152,7 @@ void
 server_free(struct server *s)
 {
 	channel_list_free(&(s->clist));
+	highlight_free(&(s->highlight));
 
 	free((void *)s->host);
 	free((void *)s->port);
@@ -469,6 +470,8 @@ server_nick_set(struct server *s, const char *nick)
 		free((void *)s->nick);
 
 	s->nick = irc_strdup(nick);
+
+	highlight_nick(&(s->highlight), nick);
 }
 
 void
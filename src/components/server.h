@@ -3,6 +3,7 @@
 
 #include "src/components/buffer.h"
 #include "src/components/channel.h"
+#include "src/components/highlight.h"
 #include "src/components/ircv3.h"
 #include "src/components/mode.h"
 
@@ -27,6 +28,7 @@ struct server
 	} nicks;
 	struct channel *channel;
 	struct channel_list clist;
+	struct highlight highlight;
 	struct ircv3_caps ircv3_caps;
 	struct ircv3_sasl ircv3_sasl;
 	struct mode usermodes;
@@ -42,8 +44,7 @@ struct server
 	// TODO: move this to utils
 	struct {
 		size_t i;
-		char cl;
-		char buf[IRC_MESSAGE_LEN + 1]; /* callback message buffer */
+		char buf[IRC_MESSAGE_LEN + 1]; /* partial message buffer */
 	} read;
 };
 
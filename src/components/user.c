@@ -4,10 +4,42 @@
 #include <stdlib.h>
 #include <string.h>
 
-static struct user* user(const char*, struct mode);
+#define USER_REGISTRY_SIZE 64 /* Initial registry buckets, a power of 2 */
+#define USER_SLAB_MIN 8       /* Users in a list's first slab */
+#define USER_SLAB_MAX 1024    /* Users in a list's slabs, doubling from USER_SLAB_MIN */
+
+struct user_key
+{
+	uint64_t key;
+	struct user *u;
+};
+
+struct user_slab
+{
+	struct user_slab *next;
+	unsigned size;
+	unsigned used;
+	struct user users[];
+};
+
+static struct user* user(struct user_list*, const char*, struct mode);
 static inline int user_cmp(struct user*, struct user*, void *arg);
 static inline int user_ncmp(struct user*, struct user*, void *arg, size_t);
-static inline void user_free(struct user*);
+static inline void user_free(struct user_list*, struct user*);
+static void user_release(struct user*);
+static void user_slabs_free(struct user_list*);
+static void user_slabs_reset(struct user_list*);
+static struct user* user_list_build(struct user_key*, size_t);
+static void user_keys_sort(struct user_key*, struct user_key*, size_t, enum casemapping);
+
+static struct user_nick* user_registry_find(struct user_registry*, const char*, uint32_t);
+static void user_registry_casemap(struct user_registry*, enum casemapping);
+static void user_registry_grow(struct user_registry*);
+static void user_registry_link(struct user_registry*, struct user_list*, struct user*, const char*);
+static void user_registry_link_rec(struct user_list*, struct user*);
+static void user_registry_unlink(struct user*);
+static void user_registry_unlink_copy(struct user*);
+static void user_nick_free(struct user_nick*);
 
 AVL_GENERATE(user_list, user, ul, user_cmp, user_ncmp)
 
@@ -24,22 +56,171 @@ user_ncmp(struct user *u1, struct user *u2, void *arg, size_t n)
 }
 
 static inline void
-user_free(struct user *u)
+user_free(struct user_list *ul, struct user *u)
+{
+	user_release(u);
+
+	TREE_LEFT(u, ul) = ul->free;
+	ul->free = u;
+}
+
+static void
+user_release(struct user *u)
+{
+	/* Release a user's nick, the user's memory is the list's */
+
+	if (u->rec)
+		user_registry_unlink(u);
+	else
+		free((void *)u->nick);
+}
+
+static struct user*
+user_list_build(struct user_key *keys, size_t n)
+{
+	/* Balanced tree of sorted users */
+
+	size_t mid = n / 2;
+	struct user *l, *r, *u;
+
+	if (n == 0)
+		return NULL;
+
+	u = keys[mid].u;
+	l = TREE_LEFT(u, ul) = user_list_build(keys, mid);
+	r = TREE_RIGHT(u, ul) = user_list_build(keys + mid + 1, n - mid - 1);
+
+	AVL_HEIGHT(u, ul) = 1 + MAX((l ? AVL_HEIGHT(l, ul) : 0), (r ? AVL_HEIGHT(r, ul) : 0));
+
+	return u;
+}
+
+static void
+user_keys_sort(struct user_key *keys, struct user_key *tmp, size_t n, enum casemapping cm)
+{
+	/* LSD radix sort on keys, skipping bytes keys share, then ordering
+	 * users with equal keys by user_cmp */
+
+	size_t count[256];
+	struct user_key *sorted = keys;
+
+	for (unsigned shift = 0; shift < 64; shift += 8) {
+
+		size_t sum = 0;
+		struct user_key *swap;
+
+		memset(count, 0, sizeof(count));
+
+		for (size_t i = 0; i < n; i++)
+			count[(keys[i].key >> shift) & 0xff]++;
+
+		if (count[(keys[0].key >> shift) & 0xff] == n)
+			continue;
+
+		for (size_t i = 0; i < 256; i++) {
+			size_t c = count[i];
+			count[i] = sum;
+			sum += c;
+		}
+
+		for (size_t i = 0; i < n; i++)
+			tmp[count[(keys[i].key >> shift) & 0xff]++] = keys[i];
+
+		swap = keys;
+		keys = tmp;
+		tmp = swap;
+	}
+
+	if (keys != sorted) {
+		memcpy(sorted, keys, sizeof(*keys) * n);
+		keys = sorted;
+	}
+
+	for (size_t i = 1; i < n; i++) {
+
+		struct user_key k = keys[i];
+		size_t j = i;
+
+		while (j > 0 && keys[j - 1].key == k.key && user_cmp(keys[j - 1].u, k.u, &cm) > 0) {
+			keys[j] = keys[j - 1];
+			j--;
+		}
+
+		keys[j] = k;
+	}
+}
+
+static void
+user_slabs_free(struct user_list *ul)
+{
+	struct user_slab *slab;
+
+	while ((slab = ul->slabs)) {
+		ul->slabs = slab->next;
+		free(slab);
+	}
+
+	ul->free = NULL;
+}
+
+static void
+user_slabs_reset(struct user_list *ul)
 {
-	free(u);
+	/* Reset an emptied list's newest slab for reuse, freeing the others,
+	 * such that lists emptied and refilled by single users don't free and
+	 * reallocate their slabs each time */
+
+	struct user_slab *slab;
+
+	if (ul->slabs == NULL)
+		return;
+
+	while ((slab = ul->slabs->next)) {
+		ul->slabs->next = slab->next;
+		free(slab);
+	}
+
+	ul->slabs->used = 0;
+	ul->free = NULL;
 }
 
 static struct user*
-user(const char *nick, struct mode prfxmodes)
+user(struct user_list *ul, const char *nick, struct mode prfxmodes)
 {
-	size_t len = strlen(nick);
+	/* Create a user in the list's slabs, with its own copy of nick
+	 * unless NULL, in which case the user's nick is set when registered */
+
 	struct user *u;
+	struct user_slab *slab;
 
-	if ((u = calloc(1, sizeof(*u) + len + 1)) == NULL)
-		fatal("calloc: %s", strerror(errno));
+	if ((u = ul->free)) {
+		ul->free = TREE_LEFT(u, ul);
+	} else {
+
+		if ((slab = ul->slabs) == NULL || slab->used == slab->size) {
+
+			unsigned size = (slab ? MIN(slab->size * 2, USER_SLAB_MAX) : USER_SLAB_MIN);
+
+			if ((slab = malloc(sizeof(*slab) + sizeof(*u) * size)) == NULL)
+				fatal("malloc: %s", strerror(errno));
+
+			slab->next = ul->slabs;
+			slab->size = size;
+			slab->used = 0;
+
+			ul->slabs = slab;
+		}
+
+		u = &(slab->users[slab->used++]);
+	}
+
+	memset(u, 0, sizeof(*u));
+
+	if (nick) {
+		u->nick = irc_strdup(nick);
+		u->nick_len = strlen(nick);
+	}
 
-	u->nick = memcpy(u->_, nick, len + 1);
-	u->nick_len = len;
 	u->prfxmodes = prfxmodes;
 
 	return u;
@@ -50,15 +231,91 @@ user_list_add(struct user_list *ul, enum casemapping cm, const char *nick, struc
 {
 	/* Create user and add to userlist */
 
+	struct user *u;
+
+	if (ul->batch)
+		user_list_batch_end(ul, cm);
+
 	if (user_list_get(ul, cm, nick, 0) != NULL)
 		return USER_ERR_DUPLICATE;
 
-	AVL_ADD(user_list, ul, user(nick, prfxmodes), &cm);
+	if (ul->registry) {
+		u = user(ul, NULL, prfxmodes);
+		user_registry_casemap(ul->registry, cm);
+		user_registry_link(ul->registry, ul, u, nick);
+	} else {
+		u = user(ul, nick, prfxmodes);
+	}
+
+	AVL_ADD(user_list, ul, u, &cm);
 	ul->count++;
 
 	return USER_ERR_NONE;
 }
 
+enum user_err
+user_list_batch_add(struct user_list *ul, enum casemapping cm, const char *nick, struct mode prfxmodes)
+{
+	/* Create user and add to the list's batch, the list's users are
+	 * sorted once and added at the batch's end. Registered lists only,
+	 * the registry finds duplicates and the batch's users meanwhile */
+
+	struct user *u;
+
+	if (ul->registry == NULL)
+		return user_list_add(ul, cm, nick, prfxmodes);
+
+	if (user_list_get(ul, cm, nick, 0) != NULL)
+		return USER_ERR_DUPLICATE;
+
+	u = user(ul, NULL, prfxmodes);
+	user_registry_casemap(ul->registry, cm);
+	user_registry_link(ul->registry, ul, u, nick);
+
+	TREE_LEFT(u, ul) = ul->batch;
+	ul->batch = u;
+	ul->batch_n++;
+
+	return USER_ERR_NONE;
+}
+
+void
+user_list_batch_end(struct user_list *ul, enum casemapping cm)
+{
+	/* Add the batch's users in sorted order, building the list's tree
+	 * directly when empty */
+
+	struct user *u;
+	struct user_key *keys;
+	size_t n = ul->batch_n;
+
+	if (n == 0)
+		return;
+
+	if ((keys = malloc(sizeof(*keys) * n * 2)) == NULL)
+		fatal("malloc: %s", strerror(errno));
+
+	for (size_t i = 0; (u = ul->batch); i++) {
+		ul->batch = TREE_LEFT(u, ul);
+		keys[i].key = irc_strkey(cm, u->nick);
+		keys[i].u = u;
+	}
+
+	user_keys_sort(keys, keys + n, n, cm);
+
+	if (TREE_EMPTY(ul)) {
+		TREE_ROOT(ul) = user_list_build(keys, n);
+	} else {
+		for (size_t i = 0; i < n; i++)
+			AVL_ADD(user_list, ul, keys[i].u, &cm);
+	}
+
+	ul->batch_n = 0;
+	ul->count += n;
+
+	free(keys);
+}
+
 enum user_err
 user_list_del(struct user_list *ul, enum casemapping cm, const char *nick)
 {
@@ -66,13 +323,19 @@ user_list_del(struct user_list *ul, enum casemapping cm, const char *nick)
 
 	struct user *u;
 
+	if (ul->batch)
+		user_list_batch_end(ul, cm);
+
 	if ((u = user_list_get(ul, cm, nick, 0)) == NULL)
 		return USER_ERR_NOT_FOUND;
 
 	AVL_DEL(user_list, ul, u, &cm);
 	ul->count--;
 
-	user_free(u);
+	user_free(ul, u);
+
+	if (TREE_EMPTY(ul))
+		user_slabs_reset(ul);
 
 	return USER_ERR_NONE;
 }
@@ -84,22 +347,39 @@ user_list_rpl(struct user_list *ul, enum casemapping cm, const char *nick_old, c
 
 	struct user *old, *new;
 
+	if (ul->batch)
+		user_list_batch_end(ul, cm);
+
 	old = user_list_get(ul, cm, nick_old, 0);
 	new = user_list_get(ul, cm, nick_new, 0);
 
 	if (old == NULL)
 		return USER_ERR_NOT_FOUND;
 
-	/* allow nick to change case  */
-	if (new != NULL && irc_strcmp(cm, old->nick, new->nick))
+	if (new != NULL && new != old)
 		return USER_ERR_DUPLICATE;
 
-	new = user(nick_new, old->prfxmodes);
+	/* allow nick to change case, in place, for every list sharing it */
+	if (new == old) {
+		memcpy((char *)old->nick, nick_new, old->nick_len);
+		return USER_ERR_NONE;
+	}
 
 	AVL_DEL(user_list, ul, old, &cm);
+
+	if (ul->registry) {
+		new = user(ul, NULL, old->prfxmodes);
+		user_registry_casemap(ul->registry, cm);
+		user_registry_link(ul->registry, ul, new, nick_new);
+	} else {
+		new = user(ul, nick_new, old->prfxmodes);
+	}
+
+	new->spoke = old->spoke;
+
 	AVL_ADD(user_list, ul, new, &cm);
 
-	user_free(old);
+	user_free(ul, old);
 
 	return USER_ERR_NONE;
 }
@@ -109,13 +389,341 @@ user_list_get(struct user_list *ul, enum casemapping cm, const char *nick, size_
 {
 	struct user u = { .nick = nick };
 
+	if (ul->registry && !prefix_len) {
+
+		/* Find the list's membership in the nick's record */
+
+		struct user_nick *rec;
+
+		if ((rec = user_registry_get(ul->registry, cm, nick)) == NULL)
+			return NULL;
+
+		for (unsigned i = 0; i < rec->chans_n; i++) {
+			if (rec->chans[i].ul == ul)
+				return rec->chans[i].u;
+		}
+
+		return NULL;
+	}
+
+	if (ul->batch)
+		user_list_batch_end(ul, cm);
+
 	return AVL_GET(user_list, ul, &u, &cm, prefix_len);
 }
 
+struct user*
+user_list_iter(struct user_list *ul, struct user_iter *it, enum casemapping cm, const char *prefix, size_t prefix_len)
+{
+	/* Return the first user, in list order, with nick prefix, stacking
+	 * the path to it such that each following user is found in O(1)
+	 * amortized. The prefix must remain valid while iterating */
+
+	struct user *u;
+
+	if (ul->batch)
+		user_list_batch_end(ul, cm);
+
+	it->cm = cm;
+	it->n = 0;
+	it->prefix = prefix;
+	it->prefix_len = prefix_len;
+
+	for (u = TREE_ROOT(ul); u; ) {
+		if (irc_strncmp(cm, prefix, u->nick, prefix_len) > 0) {
+			u = TREE_RIGHT(u, ul);
+		} else {
+			it->stack[it->n++] = u;
+			u = TREE_LEFT(u, ul);
+		}
+	}
+
+	if (it->n == 0 || irc_strncmp(cm, prefix, it->stack[it->n - 1]->nick, prefix_len))
+		return NULL;
+
+	return it->stack[it->n - 1];
+}
+
+struct user*
+user_list_iter_next(struct user_iter *it)
+{
+	/* Return the user following the iterator's last, with nick prefix */
+
+	struct user *u;
+
+	if (it->n == 0)
+		return NULL;
+
+	for (u = TREE_RIGHT(it->stack[--it->n], ul); u; u = TREE_LEFT(u, ul))
+		it->stack[it->n++] = u;
+
+	if (it->n == 0 || irc_strncmp(it->cm, it->prefix, it->stack[it->n - 1]->nick, it->prefix_len)) {
+		it->n = 0;
+		return NULL;
+	}
+
+	return it->stack[it->n - 1];
+}
+
 void
 user_list_free(struct user_list *ul)
 {
-	AVL_FOREACH(user_list, ul, user_free);
+	struct user_registry *registry = ul->registry;
+
+	if (ul->batch)
+		user_list_batch_end(ul, registry->cm);
+
+	AVL_FOREACH(user_list, ul, user_release);
+
+	user_slabs_free(ul);
 
 	memset(ul, 0, sizeof(*ul));
+
+	ul->registry = registry;
+}
+
+void
+user_list_register(struct user_list *ul, struct user_registry *r)
+{
+	/* Add the list's users to a registry, or remove them with NULL */
+
+	if (ul->registry == r)
+		return;
+
+	if (ul->batch)
+		user_list_batch_end(ul, ul->registry->cm);
+
+	if (ul->registry)
+		AVL_FOREACH(user_list, ul, user_registry_unlink_copy);
+
+	if ((ul->registry = r)) {
+
+		if (r->cm == CASEMAPPING_INVALID)
+			r->cm = CASEMAPPING_RFC1459;
+
+		user_registry_link_rec(ul, TREE_ROOT(ul));
+	}
+}
+
+struct user_nick*
+user_registry_get(struct user_registry *r, enum casemapping cm, const char *nick)
+{
+	if (r->count == 0)
+		return NULL;
+
+	user_registry_casemap(r, cm);
+
+	return user_registry_find(r, nick, irc_strhash(cm, nick));
+}
+
+void
+user_registry_free(struct user_registry *r)
+{
+	/* Registered user lists are expected to be freed or unregistered */
+
+	free(r->table);
+
+	memset(r, 0, sizeof(*r));
+}
+
+static struct user_nick*
+user_registry_find(struct user_registry *r, const char *nick, uint32_t hash)
+{
+	struct user_nick *rec;
+
+	if (r->size == 0)
+		return NULL;
+
+	for (rec = r->table[hash & (r->size - 1)]; rec; rec = rec->next) {
+		if (rec->hash == hash && !irc_strcmp(r->cm, rec->nick, nick))
+			return rec;
+	}
+
+	return NULL;
+}
+
+static void
+user_registry_casemap(struct user_registry *r, enum casemapping cm)
+{
+	/* Relink all users when the casemapping changes, nicks that were
+	 * distinct might now compare equal, and vice versa */
+
+	struct user_nick **table = r->table;
+	struct user_nick *rec, *next;
+	unsigned size = r->size;
+
+	if (r->cm == cm)
+		return;
+
+	r->cm = cm;
+
+	if (r->count == 0)
+		return;
+
+	r->table = NULL;
+	r->count = 0;
+	r->size = 0;
+
+	for (unsigned i = 0; i < size; i++) {
+		for (rec = table[i]; rec; rec = next) {
+
+			next = rec->next;
+
+			for (unsigned j = 0; j < rec->chans_n; j++)
+				user_registry_link(r, rec->chans[j].ul, rec->chans[j].u, rec->nick);
+
+			user_nick_free(rec);
+		}
+	}
+
+	free(table);
+}
+
+static void
+user_registry_grow(struct user_registry *r)
+{
+	struct user_nick **table;
+	struct user_nick *rec, *next;
+	unsigned size = (r->size ? r->size * 2 : USER_REGISTRY_SIZE);
+
+	if ((table = calloc(size, sizeof(*table))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	for (unsigned i = 0; i < r->size; i++) {
+		for (rec = r->table[i]; rec; rec = next) {
+			next = rec->next;
+			rec->next = table[rec->hash & (size - 1)];
+			table[rec->hash & (size - 1)] = rec;
+		}
+	}
+
+	free(r->table);
+
+	r->table = table;
+	r->size = size;
+}
+
+static void
+user_registry_link(struct user_registry *r, struct user_list *ul, struct user *u, const char *nick)
+{
+	/* Add a user list's user to its nick's record, the record's
+	 * nick takes the case most recently seen */
+
+	struct user_nick *rec;
+	uint32_t hash = irc_strhash(r->cm, nick);
+
+	if ((rec = user_registry_find(r, nick, hash)) == NULL) {
+
+		size_t len = strlen(nick);
+
+		if (r->count == r->size)
+			user_registry_grow(r);
+
+		if ((rec = calloc(1, sizeof(*rec) + len + 1)) == NULL)
+			fatal("calloc: %s", strerror(errno));
+
+		rec->chans = rec->chans_buf;
+		rec->chans_size = ARR_LEN(rec->chans_buf);
+		rec->hash = hash;
+		rec->nick_len = len;
+		rec->registry = r;
+		rec->next = r->table[hash & (r->size - 1)];
+		r->table[hash & (r->size - 1)] = rec;
+		r->count++;
+	}
+
+	if (rec->nick != nick)
+		memcpy(rec->nick, nick, rec->nick_len + 1);
+
+	if (rec->chans_n == rec->chans_size) {
+
+		struct user_chan *chans = (rec->chans == rec->chans_buf ? NULL : rec->chans);
+
+		rec->chans_size *= 2;
+
+		if ((chans = realloc(chans, sizeof(*chans) * rec->chans_size)) == NULL)
+			fatal("realloc: %s", strerror(errno));
+
+		if (rec->chans == rec->chans_buf)
+			memcpy(chans, rec->chans_buf, sizeof(rec->chans_buf));
+
+		rec->chans = chans;
+	}
+
+	rec->chans[rec->chans_n].ul = ul;
+	rec->chans[rec->chans_n].u = u;
+	rec->chans_n++;
+
+	u->nick = rec->nick;
+	u->nick_len = rec->nick_len;
+	u->rec = rec;
+}
+
+static void
+user_registry_link_rec(struct user_list *ul, struct user *u)
+{
+	/* Add the list's users to the registry, releasing their own copy of their nick */
+
+	if (u) {
+
+		const char *nick = u->nick;
+
+		user_registry_link_rec(ul, TREE_LEFT(u, ul));
+		user_registry_link_rec(ul, TREE_RIGHT(u, ul));
+		user_registry_link(ul->registry, ul, u, nick);
+
+		free((void *)nick);
+	}
+}
+
+static void
+user_registry_unlink(struct user *u)
+{
+	/* Remove a user from its nick's record, freeing the record
+	 * when the nick is no longer a member of any user list */
+
+	struct user_nick *rec = u->rec;
+	struct user_nick **p;
+	struct user_registry *r = rec->registry;
+	unsigned i = 0;
+
+	while (rec->chans[i].u != u)
+		i++;
+
+	/* Memberships are unordered, the last replaces the removed */
+	rec->chans[i] = rec->chans[rec->chans_n - 1];
+
+	u->rec = NULL;
+
+	if (--rec->chans_n)
+		return;
+
+	for (p = &(r->table[rec->hash & (r->size - 1)]); *p != rec; p = &((*p)->next))
+		;
+
+	*p = rec->next;
+	r->count--;
+
+	user_nick_free(rec);
+}
+
+static void
+user_registry_unlink_copy(struct user *u)
+{
+	/* Remove a user from its nick's record, keeping a copy of the nick */
+
+	const char *nick = irc_strdup(u->nick);
+
+	user_registry_unlink(u);
+
+	u->nick = nick;
+}
+
+static void
+user_nick_free(struct user_nick *rec)
+{
+	if (rec->chans != rec->chans_buf)
+		free(rec->chans);
+
+	free(rec);
 }
@@ -5,6 +5,10 @@
 #include "src/utils/tree.h"
 #include "src/utils/utils.h"
 
+/* Depth of a user list iterator's stack, exceeding the height
+ * of any AVL tree with fewer than 2^32 users */
+#define USER_ITER_DEPTH 48
+
 enum user_err
 {
 	USER_ERR_DUPLICATE = -2,
@@ -15,22 +19,80 @@ enum user_err
 struct user
 {
 	TREE_NODE(user) ul;
-	const char *nick;
+	const char *nick; /* The user's own copy, or its record's when registered */
 	size_t nick_len;
 	struct mode prfxmodes;
-	char _[];
+	struct user_nick *rec;
+	unsigned spoke; /* Order of last message, for completing recent speakers first */
 };
 
+struct user_slab;
+
 struct user_list
 {
 	TREE_HEAD(user);
+	struct user_registry *registry;
+	struct user_slab *slabs; /* Users are allocated from, and freed with, the list's slabs */
+	struct user *free;       /* Users freed to the list, linked by their left node */
+	struct user *batch;      /* Users pending a batch's end, linked by their left node */
+	unsigned batch_n;
 	unsigned count;
 };
 
+/* In order iteration of a user list's users by nick prefix */
+struct user_iter
+{
+	const char *prefix;
+	enum casemapping cm;
+	size_t prefix_len;
+	unsigned n;
+	struct user *stack[USER_ITER_DEPTH];
+};
+
+/* A user's membership in a registered user list, the list's user
+ * node carries the user's prefix modes in that list */
+struct user_chan
+{
+	struct user_list *ul;
+	struct user *u;
+};
+
+/* An interned nick, shared by the user nodes of registered user lists
+ * it's a member of, in no particular order. Freed with its last member */
+struct user_nick
+{
+	struct user_chan *chans;
+	struct user_nick *next;
+	struct user_registry *registry;
+	size_t nick_len;
+	uint32_t hash;
+	unsigned chans_n;
+	unsigned chans_size;
+	struct user_chan chans_buf[2]; /* Memberships, until outgrown */
+	char nick[];
+};
+
+/* Registry of nicks across a set of user lists, by casemapped hash */
+struct user_registry
+{
+	struct user_nick **table;
+	enum casemapping cm;
+	unsigned count;
+	unsigned size;
+};
+
 enum user_err user_list_add(struct user_list*, enum casemapping, const char*, struct mode);
+enum user_err user_list_batch_add(struct user_list*, enum casemapping, const char*, struct mode);
+void user_list_batch_end(struct user_list*, enum casemapping);
 enum user_err user_list_del(struct user_list*, enum casemapping, const char*);
 enum user_err user_list_rpl(struct user_list*, enum casemapping, const char*, const char*);
 struct user* user_list_get(struct user_list*, enum casemapping, const char*, size_t);
+struct user* user_list_iter(struct user_list*, struct user_iter*, enum casemapping, const char*, size_t);
+struct user* user_list_iter_next(struct user_iter*);
 void user_list_free(struct user_list*);
+void user_list_register(struct user_list*, struct user_registry*);
+
+struct user_nick* user_registry_get(struct user_registry*, enum casemapping, const char*);
+void user_registry_free(struct user_registry*);
 
 #endif
@@ -0,0 +1,1034 @@
+#include "src/dns.h"
+
+#include "config.h"
+#include "src/utils/utils.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+/* RFC 1035, 4.1.1 */
+#define DNS_HEADER_LEN  12
+#define DNS_FLAG_QR     0x8000
+#define DNS_FLAG_TC     0x0200
+#define DNS_FLAG_RD     0x0100
+#define DNS_OPCODE(F)   (((F) >> 11) & 0xF)
+#define DNS_RCODE(F)    ((F) & 0xF)
+
+#define DNS_CLASS_IN    1
+#define DNS_TYPE_A      1
+#define DNS_TYPE_AAAA   28
+
+#define DNS_RCODE_NOERROR  0
+#define DNS_RCODE_NXDOMAIN 3
+
+/* UDP messages without EDNS, RFC 1035, 2.3.4 */
+#define DNS_MESSAGE_LEN 512
+
+/* TCP messages, length prefixed, RFC 1035, 4.2.2 */
+#define DNS_TCP_LEN (2 + 65535)
+
+/* As the libc resolver's RES_MAXNDOTS */
+#define DNS_NDOTS_MAX 15
+
+/* A and AAAA queries, by index in ids and bit in pending */
+#define DNS_Q_A    0
+#define DNS_Q_AAAA 1
+
+#define DNS_GET16(P) ((uint16_t) (((P)[0] << 8) | (P)[1]))
+#define DNS_GET32(P) ((uint32_t) (((uint32_t) (P)[0] << 24) | ((P)[1] << 16) | ((P)[2] << 8) | (P)[3]))
+
+static int dns_name(const unsigned char*, size_t, size_t, char*, size_t*);
+static int dns_name_copy(char*, const char*);
+static int dns_query_done(struct dns_query*, uint64_t);
+static int dns_query_next(struct dns_query*);
+static int dns_query_send(struct dns_query*, uint64_t);
+static int dns_query_tcp(struct dns_query*, uint64_t);
+static int dns_query_tcp_start(struct dns_query*, uint64_t);
+static int dns_response(struct dns_query*, const unsigned char*, size_t);
+static int dns_servers_read(struct dns_servers*, const char*, int*);
+static size_t dns_message(struct dns_query*, unsigned, unsigned char*);
+static uint16_t dns_random(void);
+static void dns_query_close(struct dns_query*);
+
+const char*
+dns_err(int err)
+{
+	switch (err) {
+		case DNS_ERR_NONE:     return "success";
+		case DNS_ERR_PENDING:  return "query in progress";
+		case DNS_ERR_NAME:     return "invalid host name";
+		case DNS_ERR_NODATA:   return "host has no addresses";
+		case DNS_ERR_NXDOMAIN: return "host not found";
+		case DNS_ERR_SERVFAIL: return "nameserver failure";
+		case DNS_ERR_SYSTEM:   return "system error";
+		case DNS_ERR_TIMEOUT:  return "nameservers not responding";
+		case DNS_ERR_TRUNC:    return "response truncated";
+		default:
+			return "unknown error";
+	}
+}
+
+int
+dns_query(struct dns_query *q, const struct dns_servers *servers, const char *host, int family, uint64_t now)
+{
+	size_t len = strlen(host);
+
+	memset(q, 0, sizeof(*q));
+
+	q->err = DNS_ERR_TIMEOUT;
+	q->family = family;
+	q->fd = -1;
+
+	if (servers->n == 0) {
+		errno = EDESTADDRREQ;
+		return DNS_ERR_SYSTEM;
+	}
+
+	if (len >= sizeof(q->host))
+		return DNS_ERR_NAME;
+
+	memcpy(q->host, host, len + 1);
+
+	q->servers = *servers;
+
+	if (dns_query_next(q) < 0)
+		return DNS_ERR_NAME;
+
+	return dns_query_send(q, now);
+}
+
+int
+dns_query_step(struct dns_query *q, uint64_t now)
+{
+	unsigned char buf[DNS_MESSAGE_LEN];
+	ssize_t ret;
+
+	if (q->fd < 0)
+		return dns_query_done(q, now);
+
+	if (q->tcp)
+		return dns_query_tcp(q, now);
+
+	for (;;) {
+
+		ret = recv(q->fd, buf, sizeof(buf), 0);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+
+		/* Nameserver unreachable, the next is attempted */
+		if (ret < 0 && errno == ECONNREFUSED) {
+			q->deadline = now;
+			break;
+		}
+
+		if (ret < 0)
+			return DNS_ERR_SYSTEM;
+
+		switch (dns_response(q, buf, (size_t) ret)) {
+			case DNS_ERR_NONE:
+				break;
+			case DNS_ERR_SERVFAIL:
+				q->err = DNS_ERR_SERVFAIL;
+				q->deadline = now;
+				break;
+			case DNS_ERR_TRUNC:
+				return dns_query_tcp_start(q, now);
+			default:
+				continue;
+		}
+
+		if (!q->pending || q->deadline <= now)
+			break;
+	}
+
+	if (!q->pending)
+		return dns_query_done(q, now);
+
+	if (q->deadline > now)
+		return DNS_ERR_PENDING;
+
+	return dns_query_send(q, now);
+}
+
+void
+dns_query_free(struct dns_query *q)
+{
+	dns_query_close(q);
+
+	q->pending = 0;
+}
+
+int
+dns_servers(struct dns_servers *s, const char *path)
+{
+	/* Parse the nameservers, search domains, and the timeout, attempts
+	 * and ndots options, defaulting as resolv.conf(5) */
+
+	char host[DNS_NAME_MAX + 2];
+	char *domain;
+	int ret;
+	int search = 0;
+
+	memset(s, 0, sizeof(*s));
+
+	s->attempts = 2;
+	s->ndots = 1;
+	s->timeout = 5000;
+
+	ret = dns_servers_read(s, path, &search);
+
+	if (s->n == 0) {
+
+		struct sockaddr_in *sa = (struct sockaddr_in *) &(s->addrs[0]);
+
+		sa->sin_family = AF_INET;
+		sa->sin_port = htons(53);
+		sa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		s->lens[0] = sizeof(*sa);
+		s->n = 1;
+	}
+
+	host[sizeof(host) - 1] = 0;
+
+	if (!search
+	 && gethostname(host, sizeof(host) - 1) == 0
+	 && (domain = strchr(host, '.'))
+	 && dns_name_copy(s->search[0], domain + 1) == 0)
+		s->nsearch = 1;
+
+	return ret;
+}
+
+unsigned
+dns_hosts(const char *path, const char *host, int family, struct dns_addr *addrs)
+{
+	/* Addresses of the lines listing the host as a name or alias, in the
+	 * file's order, as hosts(5) */
+
+	char line[1024];
+	char name[DNS_NAME_MAX + 1];
+	unsigned n = 0;
+	FILE *f;
+
+	if (dns_name_copy(name, host) < 0)
+		return 0;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return 0;
+
+	while (n < DNS_ADDRS_MAX && fgets(line, sizeof(line), f)) {
+
+		char *addr;
+		char *save;
+		char *tok;
+		int found = 0;
+
+		line[strcspn(line, "#")] = 0;
+
+		if ((addr = strtok_r(line, " \t\r\n", &save)) == NULL)
+			continue;
+
+		while (!found && (tok = strtok_r(NULL, " \t\r\n", &save)))
+			found = !strcasecmp(tok, name);
+
+		if (!found)
+			continue;
+
+		if (family != AF_INET6 && inet_pton(AF_INET, addr, &(addrs[n].u.v4)) == 1)
+			addrs[n++].family = AF_INET;
+		else if (family != AF_INET && inet_pton(AF_INET6, addr, &(addrs[n].u.v6)) == 1)
+			addrs[n++].family = AF_INET6;
+	}
+
+	fclose(f);
+
+	return n;
+}
+
+int
+dns_service(const char *path, const char *name, uint16_t *port)
+{
+	/* Lines of a service's name, port/protocol and aliases, as
+	 * services(5) */
+
+	char line[1024];
+	int found = 0;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return -1;
+
+	while (!found && fgets(line, sizeof(line), f)) {
+
+		char *end;
+		char *proto;
+		char *save;
+		char *tok;
+		unsigned long n;
+
+		line[strcspn(line, "#")] = 0;
+
+		if ((tok = strtok_r(line, " \t\r\n", &save)) == NULL
+		 || (proto = strtok_r(NULL, " \t\r\n", &save)) == NULL)
+			continue;
+
+		found = !strcmp(tok, name);
+
+		while (!found && (tok = strtok_r(NULL, " \t\r\n", &save)))
+			found = !strcmp(tok, name);
+
+		n = strtoul(proto, &end, 10);
+
+		if (end == proto || strcmp(end, "/tcp") || n == 0 || n > 65535)
+			found = 0;
+
+		if (found)
+			*port = (uint16_t) n;
+	}
+
+	fclose(f);
+
+	return (found ? 0 : -1);
+}
+
+unsigned
+dns_cache_get(struct dns_cache *c, const char *host, int family, struct dns_addr *addrs, uint64_t now)
+{
+	char name[DNS_NAME_MAX + 1];
+
+	if (dns_name_copy(name, host) < 0)
+		return 0;
+
+	for (unsigned i = 0; i < DNS_CACHE_MAX; i++) {
+
+		struct dns_cache_entry *e = &(c->entries[i]);
+
+		if (e->expires > now && e->family == family && !strcasecmp(e->name, name)) {
+			memcpy(addrs, e->addrs, e->n * sizeof(*addrs));
+			return e->n;
+		}
+	}
+
+	return 0;
+}
+
+void
+dns_cache_put(
+	struct dns_cache *c,
+	const char *host,
+	int family,
+	const struct dns_addr *addrs,
+	unsigned n,
+	uint32_t ttl,
+	uint64_t now)
+{
+	/* Replace the host's entry, an expired entry, or the entry expiring
+	 * soonest */
+
+	char name[DNS_NAME_MAX + 1];
+	struct dns_cache_entry *e = NULL;
+
+	if (!n || !ttl || !DNS_CACHE_TTL_MAX || dns_name_copy(name, host) < 0)
+		return;
+
+	for (unsigned i = 0; i < DNS_CACHE_MAX; i++) {
+
+		struct dns_cache_entry *entry = &(c->entries[i]);
+
+		if (entry->family == family && !strcasecmp(entry->name, name)) {
+			e = entry;
+			break;
+		}
+
+		if (!e || entry->expires < e->expires)
+			e = entry;
+	}
+
+	memcpy(e->name, name, sizeof(name));
+	memcpy(e->addrs, addrs, MIN(n, DNS_ADDRS_MAX) * sizeof(*addrs));
+
+	e->expires = now + SEC_IN_MS((uint64_t) MIN(ttl, DNS_CACHE_TTL_MAX));
+	e->family = family;
+	e->n = MIN(n, DNS_ADDRS_MAX);
+}
+
+struct addrinfo*
+dns_addrinfo(const struct dns_addr *addrs, unsigned n, uint16_t port)
+{
+	struct dns_addrinfo {
+		struct addrinfo ai;
+		union {
+			struct sockaddr_in v4;
+			struct sockaddr_in6 v6;
+		} sa;
+	} *ais;
+
+	if (n == 0)
+		return NULL;
+
+	if ((ais = calloc(n, sizeof(*ais))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	for (unsigned i = 0; i < n; i++) {
+
+		struct addrinfo *ai = &(ais[i].ai);
+
+		ai->ai_family = addrs[i].family;
+		ai->ai_socktype = SOCK_STREAM;
+		ai->ai_protocol = IPPROTO_TCP;
+		ai->ai_addr = (struct sockaddr *) &(ais[i].sa);
+		ai->ai_next = ((i + 1 < n) ? &(ais[i + 1].ai) : NULL);
+
+		if (addrs[i].family == AF_INET) {
+			ais[i].sa.v4.sin_family = AF_INET;
+			ais[i].sa.v4.sin_port = htons(port);
+			ais[i].sa.v4.sin_addr = addrs[i].u.v4;
+			ai->ai_addrlen = sizeof(ais[i].sa.v4);
+		} else {
+			ais[i].sa.v6.sin6_family = AF_INET6;
+			ais[i].sa.v6.sin6_port = htons(port);
+			ais[i].sa.v6.sin6_addr = addrs[i].u.v6;
+			ai->ai_addrlen = sizeof(ais[i].sa.v6);
+		}
+	}
+
+	return &(ais[0].ai);
+}
+
+static int
+dns_name(const unsigned char *buf, size_t len, size_t off, char *name, size_t *end)
+{
+	/* Read the name at off, following compression pointers, setting end
+	 * to the offset following it in the message. The name is written
+	 * dotted if non-NULL, of size DNS_NAME_MAX + 1 */
+
+	size_t n = 0;
+	unsigned jumps = 0;
+
+	*end = 0;
+
+	while (off < len) {
+
+		unsigned label = buf[off];
+
+		if (label == 0) {
+
+			if (!*end)
+				*end = off + 1;
+
+			if (name)
+				name[n] = 0;
+
+			return 0;
+		}
+
+		/* RFC 1035, 4.1.4 */
+		if ((label & 0xC0) == 0xC0) {
+
+			if (off + 1 >= len || ++jumps > 64)
+				return -1;
+
+			if (!*end)
+				*end = off + 2;
+
+			off = ((label & 0x3F) << 8) | buf[off + 1];
+			continue;
+		}
+
+		if ((label & 0xC0) || off + 1 + label > len || n + label + 1 > DNS_NAME_MAX + 1)
+			return -1;
+
+		if (name) {
+			if (n)
+				name[n - 1] = '.';
+			memcpy(name + n, buf + off + 1, label);
+			name[n + label] = 0;
+		}
+
+		n += label + 1;
+		off += label + 1;
+	}
+
+	return -1;
+}
+
+static int
+dns_name_copy(char *dst, const char *src)
+{
+	/* Copy a host name, less a trailing root label */
+
+	size_t len = strlen(src);
+
+	if (len && src[len - 1] == '.')
+		len--;
+
+	if (len == 0 || len > DNS_NAME_MAX)
+		return -1;
+
+	memcpy(dst, src, len);
+	dst[len] = 0;
+
+	return 0;
+}
+
+static int
+dns_query_done(struct dns_query *q, uint64_t now)
+{
+	/* Query the host's next name if not found, otherwise order IPv6
+	 * addresses first, as preferred by RFC 6724's default policy,
+	 * otherwise as received */
+
+	struct dns_addr addrs[DNS_ADDRS_MAX];
+	unsigned n = 0;
+
+	if (!q->n && (q->err == DNS_ERR_NXDOMAIN || q->err == DNS_ERR_NODATA) && dns_query_next(q) == 0)
+		return dns_query_send(q, now);
+
+	dns_query_free(q);
+
+	for (unsigned i = 0; i < q->n; i++) {
+		if (q->addrs[i].family == AF_INET6)
+			addrs[n++] = q->addrs[i];
+	}
+
+	for (unsigned i = 0; i < q->n; i++) {
+		if (q->addrs[i].family == AF_INET)
+			addrs[n++] = q->addrs[i];
+	}
+
+	memcpy(q->addrs, addrs, n * sizeof(*addrs));
+
+	return (q->n ? DNS_ERR_NONE : q->err);
+}
+
+static int
+dns_query_next(struct dns_query *q)
+{
+	/* Set the next name queried, of the host and its search domains, and
+	 * restart the query's attempts. Hosts with at least ndots dots are
+	 * queried before their search domains, otherwise after, and absolute
+	 * hosts aren't searched, as resolv.conf(5). Returns -1 once all names
+	 * were tried */
+
+	size_t len = strlen(q->host);
+	unsigned dots = 0;
+	unsigned n = q->servers.nsearch + 1;
+
+	for (const char *p = q->host; *p; p++)
+		dots += (*p == '.');
+
+	if (len && q->host[len - 1] == '.')
+		n = 1;
+
+	while (q->search < n) {
+
+		const char *domain = NULL;
+		const char *p;
+		size_t label;
+		unsigned i = q->search++;
+
+		if (n > 1 && dots >= q->servers.ndots && i > 0)
+			domain = q->servers.search[i - 1];
+
+		if (n > 1 && dots < q->servers.ndots && i < n - 1)
+			domain = q->servers.search[i];
+
+		if (domain && len + 1 + strlen(domain) > DNS_NAME_MAX)
+			continue;
+
+		if (domain) {
+			memcpy(q->name, q->host, len);
+			q->name[len] = '.';
+			memcpy(q->name + len + 1, domain, strlen(domain) + 1);
+		} else if (dns_name_copy(q->name, q->host) < 0) {
+			continue;
+		}
+
+		/* Labels are 1 to 63 characters, RFC 1035, 2.3.4 */
+		for (p = q->name; *p; p += label + !!p[label]) {
+			if ((label = strcspn(p, ".")) == 0 || label > 63)
+				break;
+		}
+
+		if (*p)
+			continue;
+
+		q->err = DNS_ERR_TIMEOUT;
+		q->pending = 0;
+		q->try = 0;
+
+		if (q->family != AF_INET6)
+			q->pending |= (1 << DNS_Q_A);
+
+		if (q->family != AF_INET)
+			q->pending |= (1 << DNS_Q_AAAA);
+
+		return 0;
+	}
+
+	return -1;
+}
+
+static int
+dns_query_send(struct dns_query *q, uint64_t now)
+{
+	/* Send the pending queries to the next nameserver attempted, from a
+	 * new socket, such that responses to previous attempts are discarded */
+
+	unsigned char buf[DNS_MESSAGE_LEN];
+	unsigned server;
+
+	dns_query_close(q);
+
+	if (q->try >= q->servers.n * q->servers.attempts)
+		return dns_query_done(q, now);
+
+	server = q->try++ % q->servers.n;
+
+	if ((q->fd = socket(q->servers.addrs[server].ss_family, SOCK_DGRAM, 0)) < 0)
+		return DNS_ERR_SYSTEM;
+
+	if (fcntl(q->fd, F_SETFD, FD_CLOEXEC) < 0
+	 || fcntl(q->fd, F_SETFL, O_NONBLOCK) < 0
+	 || connect(q->fd, (struct sockaddr *) &(q->servers.addrs[server]), q->servers.lens[server]) < 0)
+		goto err;
+
+	for (unsigned i = DNS_Q_A; i <= DNS_Q_AAAA; i++) {
+
+		size_t len;
+
+		if (!(q->pending & (1 << i)))
+			continue;
+
+		len = dns_message(q, i, buf);
+
+		while (send(q->fd, buf, len, 0) < 0) {
+
+			if (errno == EINTR)
+				continue;
+
+			/* Nameserver unreachable, the next is attempted */
+			if (errno == ECONNREFUSED)
+				break;
+
+			goto err;
+		}
+	}
+
+	q->deadline = now + q->servers.timeout;
+	q->events = POLLIN;
+
+	return DNS_ERR_PENDING;
+
+err:
+
+	dns_query_close(q);
+
+	return DNS_ERR_SYSTEM;
+}
+
+static int
+dns_query_tcp(struct dns_query *q, uint64_t now)
+{
+	/* Write the queries once connected, then read the length prefixed
+	 * responses, RFC 1035, 4.2.2. The nameserver failing, or closing the
+	 * connection, is retried with the next as a timeout */
+
+	ssize_t ret;
+	size_t len;
+
+	while (q->events == POLLOUT && q->tcp_off < q->tcp_len) {
+
+		if ((ret = send(q->fd, q->tcp + q->tcp_off, q->tcp_len - q->tcp_off, MSG_NOSIGNAL)) >= 0) {
+			q->tcp_off += (size_t) ret;
+			continue;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		/* Connecting */
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOTCONN)
+			q->deadline = now;
+
+		break;
+	}
+
+	if (q->events == POLLOUT && q->tcp_off == q->tcp_len) {
+		q->events = POLLIN;
+		q->tcp_len = 0;
+		q->tcp_off = 0;
+	}
+
+	while (q->events == POLLIN) {
+
+		ret = recv(q->fd, q->tcp + q->tcp_len, DNS_TCP_LEN - q->tcp_len, 0);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+
+		if (ret <= 0) {
+			q->deadline = now;
+			break;
+		}
+
+		q->tcp_len += (size_t) ret;
+
+		while (q->tcp_len >= 2 && q->tcp_len >= 2 + (len = DNS_GET16(q->tcp))) {
+
+			switch (dns_response(q, q->tcp + 2, len)) {
+				case DNS_ERR_SERVFAIL:
+				case DNS_ERR_TRUNC:
+					q->err = DNS_ERR_SERVFAIL;
+					q->deadline = now;
+					break;
+				default:
+					break;
+			}
+
+			memmove(q->tcp, q->tcp + 2 + len, q->tcp_len - 2 - len);
+
+			q->tcp_len -= 2 + len;
+		}
+
+		if (!q->pending || q->deadline <= now)
+			break;
+	}
+
+	if (!q->pending)
+		return dns_query_done(q, now);
+
+	if (q->deadline > now)
+		return DNS_ERR_PENDING;
+
+	return dns_query_send(q, now);
+}
+
+static int
+dns_query_tcp_start(struct dns_query *q, uint64_t now)
+{
+	/* Retry the pending queries over TCP with the nameserver attempted,
+	 * its response truncated, RFC 7766, 5 */
+
+	unsigned server = (q->try - 1) % q->servers.n;
+
+	dns_query_close(q);
+
+	if ((q->tcp = malloc(DNS_TCP_LEN)) == NULL)
+		fatal("malloc: %s", strerror(errno));
+
+	if ((q->fd = socket(q->servers.addrs[server].ss_family, SOCK_STREAM, 0)) < 0)
+		goto err;
+
+	if (fcntl(q->fd, F_SETFD, FD_CLOEXEC) < 0
+	 || fcntl(q->fd, F_SETFL, O_NONBLOCK) < 0)
+		goto err;
+
+	/* Nameserver unreachable, the next is attempted */
+	if (connect(q->fd, (struct sockaddr *) &(q->servers.addrs[server]), q->servers.lens[server]) < 0
+	 && errno != EINPROGRESS
+	 && errno != EINTR)
+		return dns_query_send(q, now);
+
+	for (unsigned i = DNS_Q_A; i <= DNS_Q_AAAA; i++) {
+
+		size_t len;
+
+		if (!(q->pending & (1 << i)))
+			continue;
+
+		len = dns_message(q, i, q->tcp + q->tcp_len + 2);
+
+		q->tcp[q->tcp_len + 0] = (unsigned char) (len >> 8);
+		q->tcp[q->tcp_len + 1] = (unsigned char) (len);
+		q->tcp_len += 2 + len;
+	}
+
+	q->deadline = now + q->servers.timeout;
+	q->events = POLLOUT;
+
+	return DNS_ERR_PENDING;
+
+err:
+
+	dns_query_close(q);
+
+	return DNS_ERR_SYSTEM;
+}
+
+static int
+dns_response(struct dns_query *q, const unsigned char *buf, size_t len)
+{
+	/* Handle a response to a pending query, returning DNS_ERR_NONE if
+	 * answered, DNS_ERR_SERVFAIL or DNS_ERR_TRUNC if it should be retried,
+	 * or DNS_ERR_PENDING if ignored */
+
+	char name[DNS_NAME_MAX + 1];
+	size_t off;
+	uint16_t flags;
+	uint16_t type;
+	unsigned an;
+	unsigned i;
+
+	if (len < DNS_HEADER_LEN)
+		return DNS_ERR_PENDING;
+
+	for (i = DNS_Q_A; i <= DNS_Q_AAAA; i++) {
+		if ((q->pending & (1 << i)) && q->ids[i] == DNS_GET16(buf))
+			break;
+	}
+
+	if (i > DNS_Q_AAAA)
+		return DNS_ERR_PENDING;
+
+	type = (i == DNS_Q_A ? DNS_TYPE_A : DNS_TYPE_AAAA);
+	flags = DNS_GET16(buf + 2);
+	an = DNS_GET16(buf + 6);
+
+	if (!(flags & DNS_FLAG_QR) || DNS_OPCODE(flags) || DNS_GET16(buf + 4) != 1)
+		return DNS_ERR_PENDING;
+
+	if (flags & DNS_FLAG_TC)
+		return DNS_ERR_TRUNC;
+
+	/* The question must be the query's */
+	if (dns_name(buf, len, DNS_HEADER_LEN, name, &off) < 0
+	 || strcasecmp(name, q->name)
+	 || off + 4 > len
+	 || DNS_GET16(buf + off) != type
+	 || DNS_GET16(buf + off + 2) != DNS_CLASS_IN)
+		return DNS_ERR_PENDING;
+
+	off += 4;
+
+	switch (DNS_RCODE(flags)) {
+		case DNS_RCODE_NOERROR:
+			break;
+		case DNS_RCODE_NXDOMAIN:
+			q->pending &= ~(1U << i);
+			q->err = DNS_ERR_NXDOMAIN;
+			return DNS_ERR_NONE;
+		default:
+			return DNS_ERR_SERVFAIL;
+	}
+
+	/* Answers of the type, following any CNAME records, RFC 1035, 4.1.3 */
+	while (an--) {
+
+		uint16_t rr_class;
+		uint16_t rr_len;
+		uint16_t rr_type;
+		uint32_t rr_ttl;
+
+		if (dns_name(buf, len, off, NULL, &off) < 0 || off + 10 > len)
+			break;
+
+		rr_type = DNS_GET16(buf + off);
+		rr_class = DNS_GET16(buf + off + 2);
+		rr_ttl = DNS_GET32(buf + off + 4);
+		rr_len = DNS_GET16(buf + off + 8);
+
+		off += 10;
+
+		if (off + rr_len > len)
+			break;
+
+		/* TTLs with the most significant bit set are zero, RFC 2181, 8 */
+		if (rr_ttl & 0x80000000)
+			rr_ttl = 0;
+
+		if (rr_class == DNS_CLASS_IN
+		 && rr_type == type
+		 && rr_len == (type == DNS_TYPE_A ? sizeof(struct in_addr) : sizeof(struct in6_addr))
+		 && q->n < DNS_ADDRS_MAX) {
+
+			struct dns_addr *addr = &(q->addrs[q->n++]);
+
+			addr->family = (type == DNS_TYPE_A ? AF_INET : AF_INET6);
+			memcpy(&(addr->u), buf + off, rr_len);
+
+			if (q->n == 1 || rr_ttl < q->ttl)
+				q->ttl = rr_ttl;
+		}
+
+		off += rr_len;
+	}
+
+	if (q->err != DNS_ERR_NXDOMAIN)
+		q->err = DNS_ERR_NODATA;
+
+	q->pending &= ~(1U << i);
+
+	return DNS_ERR_NONE;
+}
+
+static int
+dns_servers_read(struct dns_servers *s, const char *path, int *search)
+{
+	char line[512];
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+
+		char *arg;
+		char *key;
+		char *save;
+
+		if ((key = strtok_r(line, " \t\r\n", &save)) == NULL || *key == '#' || *key == ';')
+			continue;
+
+		if (!strcmp(key, "nameserver") && (arg = strtok_r(NULL, " \t\r\n", &save)) && s->n < DNS_SERVERS_MAX) {
+
+			struct addrinfo *res;
+			struct addrinfo hints = {
+				.ai_flags    = AI_NUMERICHOST | AI_NUMERICSERV,
+				.ai_socktype = SOCK_DGRAM,
+			};
+
+			if (getaddrinfo(arg, "53", &hints, &res))
+				continue;
+
+			memcpy(&(s->addrs[s->n]), res->ai_addr, res->ai_addrlen);
+			s->lens[s->n++] = res->ai_addrlen;
+
+			freeaddrinfo(res);
+		}
+
+		/* The last search or domain line is used */
+		if (!strcmp(key, "search") || !strcmp(key, "domain")) {
+
+			*search = 1;
+			s->nsearch = 0;
+
+			while ((arg = strtok_r(NULL, " \t\r\n", &save)) && s->nsearch < DNS_SEARCH_MAX) {
+
+				if (dns_name_copy(s->search[s->nsearch], arg) == 0)
+					s->nsearch++;
+
+				if (!strcmp(key, "domain"))
+					break;
+			}
+		}
+
+		if (!strcmp(key, "options")) {
+			while ((arg = strtok_r(NULL, " \t\r\n", &save))) {
+
+				unsigned long n;
+
+				if (!strncmp(arg, "timeout:", 8) && (n = strtoul(arg + 8, NULL, 10)))
+					s->timeout = (unsigned) SEC_IN_MS(MIN(n, 30));
+
+				if (!strncmp(arg, "attempts:", 9) && (n = strtoul(arg + 9, NULL, 10)))
+					s->attempts = (unsigned) MIN(n, 5);
+
+				if (!strncmp(arg, "ndots:", 6))
+					s->ndots = (unsigned) MIN(strtoul(arg + 6, NULL, 10), DNS_NDOTS_MAX);
+			}
+		}
+	}
+
+	fclose(f);
+
+	return 0;
+}
+
+static size_t
+dns_message(struct dns_query *q, unsigned i, unsigned char *buf)
+{
+	/* Write the A or AAAA query, of a new id, returning its length.
+	 * Header, RFC 1035, 4.1.1 */
+
+	uint16_t type = (i == DNS_Q_A ? DNS_TYPE_A : DNS_TYPE_AAAA);
+	size_t len = DNS_HEADER_LEN;
+
+	q->ids[i] = dns_random();
+
+	memset(buf, 0, DNS_HEADER_LEN);
+
+	buf[0] = (unsigned char) (q->ids[i] >> 8);
+	buf[1] = (unsigned char) (q->ids[i]);
+	buf[2] = DNS_FLAG_RD >> 8;
+	buf[5] = 1;
+
+	/* Question, RFC 1035, 4.1.2 */
+	for (const char *p = q->name; *p;) {
+
+		size_t label = strcspn(p, ".");
+
+		buf[len++] = (unsigned char) label;
+		memcpy(buf + len, p, label);
+
+		len += label;
+		p += label + !!p[label];
+	}
+
+	buf[len++] = 0;
+	buf[len++] = 0;
+	buf[len++] = (unsigned char) type;
+	buf[len++] = 0;
+	buf[len++] = DNS_CLASS_IN;
+
+	return len;
+}
+
+static uint16_t
+dns_random(void)
+{
+	/* Query ids are random, such that responses are harder to spoof */
+
+	struct timespec ts;
+	uint16_t id;
+	int fd;
+
+	if ((fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) >= 0) {
+
+		ssize_t ret = read(fd, &id, sizeof(id));
+
+		close(fd);
+
+		if (ret == sizeof(id))
+			return id;
+	}
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		fatal("clock_gettime: %s", strerror(errno));
+
+	return (uint16_t) (ts.tv_nsec ^ (ts.tv_nsec >> 16));
+}
+
+static void
+dns_query_close(struct dns_query *q)
+{
+	/* Close the query's socket, and free its TCP messages */
+
+	if (q->fd >= 0)
+		close(q->fd);
+
+	free(q->tcp);
+
+	q->events = 0;
+	q->fd = -1;
+	q->tcp = NULL;
+	q->tcp_len = 0;
+	q->tcp_off = 0;
+}
@@ -0,0 +1,149 @@
+#ifndef RIRC_DNS_H
+#define RIRC_DNS_H
+
+/* Stub resolver, querying the nameservers of resolv.conf for a host's A
+ * and AAAA records over UDP, without blocking.
+ *
+ * A query's socket is polled for its events and its deadline checked when
+ * due, until resolved or failed. Queries time out per nameserver, trying
+ * each in turn for the configured attempts, as the libc resolver does.
+ * Truncated responses are retried over TCP with the same nameserver, and
+ * hosts not found are retried with each search domain, in the order of
+ * resolv.conf's ndots option.
+ *
+ * Hosts files and service names are read as by the libc's files backend,
+ * such that resolving a host never blocks on other nameservices.
+ *
+ * Resolved addresses are cached for their records' TTL, such that
+ * reconnecting resolves the host without querying the network. The cache
+ * isn't locked, callers sharing one between threads serialize its use */
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifndef DNS_CACHE_TTL_MAX
+#define DNS_CACHE_TTL_MAX 3600
+#elif (DNS_CACHE_TTL_MAX < 0 || DNS_CACHE_TTL_MAX > 86400)
+#error "DNS_CACHE_TTL_MAX: [0, 86400]"
+#endif
+
+#define DNS_ADDRS_MAX   32  /* Addresses per resolved host */
+#define DNS_CACHE_MAX   64  /* Cached hosts, by host and address family */
+#define DNS_NAME_MAX    253 /* RFC 1035, 2.3.4, less the root label */
+#define DNS_SEARCH_MAX  6   /* As the libc resolver's MAXDNSRCH */
+#define DNS_SERVERS_MAX 3   /* As the libc resolver's MAXNS */
+
+#ifndef DNS_HOSTS
+#define DNS_HOSTS "/etc/hosts"
+#endif
+
+#ifndef DNS_RESOLV_CONF
+#define DNS_RESOLV_CONF "/etc/resolv.conf"
+#endif
+
+#ifndef DNS_SERVICES
+#define DNS_SERVICES "/etc/services"
+#endif
+
+enum dns_err
+{
+	DNS_ERR_NONE,     /* Resolved */
+	DNS_ERR_PENDING,  /* Awaiting responses, or the query's deadline */
+	DNS_ERR_NAME,     /* Host isn't a valid domain name */
+	DNS_ERR_NODATA,   /* Host has no addresses */
+	DNS_ERR_NXDOMAIN, /* Host doesn't exist */
+	DNS_ERR_SERVFAIL, /* Nameservers failed to resolve the host */
+	DNS_ERR_SYSTEM,   /* System error, errno set */
+	DNS_ERR_TIMEOUT,  /* Nameservers didn't respond */
+	DNS_ERR_TRUNC,    /* Response truncated, retried over TCP */
+};
+
+struct dns_addr
+{
+	int family;
+	union {
+		struct in_addr v4;
+		struct in6_addr v6;
+	} u;
+};
+
+struct dns_servers
+{
+	char search[DNS_SEARCH_MAX][DNS_NAME_MAX + 1];
+	struct sockaddr_storage addrs[DNS_SERVERS_MAX];
+	socklen_t lens[DNS_SERVERS_MAX];
+	unsigned attempts;
+	unsigned n;
+	unsigned ndots;   /* Dots in hosts queried before their search domains */
+	unsigned nsearch;
+	unsigned timeout; /* Milliseconds per nameserver attempt */
+};
+
+struct dns_query
+{
+	char host[DNS_NAME_MAX + 2];
+	char name[DNS_NAME_MAX + 1];
+	struct dns_addr addrs[DNS_ADDRS_MAX];
+	struct dns_servers servers;
+	uint64_t deadline;  /* Monotonic time (ms) of the attempt's timeout */
+	uint32_t ttl;       /* Resolved addresses' lowest TTL */
+	uint16_t ids[2];    /* A and AAAA query ids */
+	unsigned n;         /* Resolved addresses */
+	unsigned char *tcp; /* Length prefixed messages, of a query over TCP */
+	size_t tcp_len;
+	size_t tcp_off;     /* Bytes of tcp written, while POLLOUT */
+	unsigned pending;   /* A and AAAA queries awaiting responses */
+	unsigned search;    /* Names tried, of the host and search domains */
+	unsigned try;       /* Nameserver attempts */
+	int err;            /* Result of a completed A or AAAA query */
+	int family;
+	int fd;
+	short events;       /* Poll events awaited on fd */
+};
+
+struct dns_cache
+{
+	struct dns_cache_entry {
+		char name[DNS_NAME_MAX + 1];
+		struct dns_addr addrs[DNS_ADDRS_MAX];
+		uint64_t expires; /* Monotonic time (ms), or 0 if unused */
+		unsigned n;
+		int family;
+	} entries[DNS_CACHE_MAX];
+};
+
+const char* dns_err(int);
+
+/* Start a query for the host's addresses of the family, or AF_UNSPEC */
+int dns_query(struct dns_query*, const struct dns_servers*, const char*, int, uint64_t);
+
+/* Read responses from the query's socket, and retry if its deadline passed */
+int dns_query_step(struct dns_query*, uint64_t);
+
+void dns_query_free(struct dns_query*);
+
+/* Nameservers, search domains and options of a resolv.conf, 0 on success,
+ * or -1 if unreadable. Without nameservers the local host's is queried,
+ * and without search domains the local host's domain is searched */
+int dns_servers(struct dns_servers*, const char*);
+
+/* Addresses of the host and family listed by a hosts file, copied to the
+ * array of DNS_ADDRS_MAX, returning their count or 0 if none */
+unsigned dns_hosts(const char*, const char*, int, struct dns_addr*);
+
+/* Port of a TCP service name or alias listed by a services file, 0 on
+ * success, or -1 if not listed */
+int dns_service(const char*, const char*, uint16_t*);
+
+/* Cached addresses of the host and family, copied to the array of
+ * DNS_ADDRS_MAX, returning their count or 0 if none */
+unsigned dns_cache_get(struct dns_cache*, const char*, int, struct dns_addr*, uint64_t);
+
+void dns_cache_put(struct dns_cache*, const char*, int, const struct dns_addr*, unsigned, uint32_t, uint64_t);
+
+/* Addresses as an addrinfo list of TCP sockets to the port, allocated as a
+ * single block freed by free() */
+struct addrinfo* dns_addrinfo(const struct dns_addr*, unsigned, uint16_t);
+
+#endif
@@ -8,10 +8,14 @@
 #include "src/utils/utils.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 /* Control sequence initiator */
 #define CSI "\x1b["
@@ -24,6 +28,17 @@
 #define BUFFER_PADDING 1
 #endif
 
+#ifndef DRAW_FPS
+#define DRAW_FPS 30
+#endif
+
+#if DRAW_FPS < 0 || DRAW_FPS > 1000
+#error "DRAW_FPS must be [0, 1000]"
+#endif
+
+/* Milliseconds between deferred frames */
+#define DRAW_FRAME_MS (DRAW_FPS ? 1000 / MAX(DRAW_FPS, 1) : 0)
+
 #define UTF8_CONT(C) (((unsigned char)(C) & 0xC0) == 0x80)
 
 #define ATTR_CODE_BOLD      0x02
@@ -37,6 +52,22 @@
 
 #define DRAW_ATTRS_EMPTY { .bg = -1, .fg = -1, .flush = 1 }
 
+/* Components are drawn to a grid of cells, the back grid, which is diffed
+ * against the front grid of cells last written to the terminal. Frames
+ * write only the changed cells, moving the cursor and changing SGR
+ * attributes only as required, and are written with a single write */
+#define DRAW_CELL_BOLD      0x01
+#define DRAW_CELL_ITALIC    0x02
+#define DRAW_CELL_REVERSE   0x04
+#define DRAW_CELL_STRIKE    0x08
+#define DRAW_CELL_UNDERLINE 0x10
+#define DRAW_CELL_UNKNOWN   0x80 /* Front cell not known to be on the terminal */
+
+#define DRAW_CELL_EMPTY { .c = " ", .bg = -1, .fg = -1 }
+
+/* Bytes of a cell's character, longer UTF-8 sequences are truncated */
+#define DRAW_CELL_LEN 4
+
 /* https://modern.ircdocs.horse/formatting.html#colors
  * https://modern.ircdocs.horse/formatting.html#colors-16-98 */
 static int irc_to_ansi_colour[] = {
@@ -73,6 +104,14 @@ struct coords
 	unsigned rN;
 };
 
+struct draw_cell
+{
+	char c[DRAW_CELL_LEN]; /* NUL padded */
+	int16_t bg;
+	int16_t fg;
+	uint16_t flags;
+};
+
 struct draw_attrs
 {
 	int bg;
@@ -99,18 +138,38 @@ static struct
 		unsigned all;
 	} bits;
 	unsigned bell : 1;
+	unsigned deferred : 1;
 	unsigned scroll_buffer_back : 1;
 	unsigned scroll_buffer_forw : 1;
+	struct draw_cell *back;  /* Cells drawn */
+	struct draw_cell *front; /* Cells written to the terminal */
+	struct draw_cell pen;    /* Attributes of cells drawn */
+	struct draw_cell sgr;    /* Attributes set on the terminal */
+	unsigned char *dirty;    /* Rows of the back grid drawn since last frame */
+	unsigned cols;
+	unsigned rows;
+	unsigned col;            /* Position of cells drawn, from 1 */
+	unsigned row;
+	unsigned cursor_col;     /* Position of the cursor after the frame, from 1 */
+	unsigned cursor_row;
+	unsigned tty_col;        /* Position of the cursor on the terminal, from 1 */
+	unsigned tty_row;
+	char *out;
+	size_t out_len;
+	size_t out_size;
+	uint64_t frame_ms;       /* Time of the last frame */
 } draw_state;
 
 static struct coords coords(unsigned, unsigned, unsigned, unsigned);
-static unsigned nick_col(char*);
+static unsigned nick_col(const char*);
 static unsigned drawf(struct draw_attrs*, unsigned*, const char*, ...);
 
 static const char* draw_buffer_scrollback_status(struct buffer*, char*, size_t);
 static size_t draw_buffer_wrap(const char*, size_t, size_t);
 static unsigned draw_buffer_line_rows(struct buffer_line*, unsigned);
+static uint64_t draw_now(void);
 static void draw_bits(void);
+static void draw_flush(void);
 static void draw_buffer(struct buffer*, struct coords);
 static void draw_buffer_line(struct buffer_line*, struct coords, unsigned, unsigned, unsigned, unsigned);
 static void draw_buffer_line_split(struct buffer_line*, unsigned*, unsigned*, unsigned, unsigned);
@@ -125,12 +184,19 @@ static void draw_char(struct draw_attrs*, int);
 static void draw_clear_full(void);
 static void draw_clear_line(void);
 static void draw_cursor_pos(int, int);
-static void draw_cursor_pos_restore(void);
 static void draw_cursor_pos_save(void);
-static void draw_cursor_hide(void);
-static void draw_cursor_show(void);
 static unsigned draw_parse_irc_colour(const char *code, int *fg, int *bg);
 
+static int draw_cell_blank(const struct draw_cell*);
+static void draw_cell_put(int);
+static void draw_frame(void);
+static void draw_frame_cursor(unsigned, unsigned);
+static void draw_frame_out(const char*, size_t);
+static void draw_frame_outf(const char*, ...);
+static void draw_frame_sgr(const struct draw_cell*);
+static void draw_frame_write(void);
+static void draw_grid(unsigned, unsigned);
+
 static size_t draw_attr_len(const char *str);
 static void draw_attrs(struct draw_attrs*, int);
 static void draw_attr_reset(struct draw_attrs*);
@@ -155,7 +221,16 @@ void
 draw_term(void)
 {
 	draw_state.drawing = 0;
-	draw_clear_full();
+
+	draw_frame_out(CSI "0m" CSI "2J", sizeof(CSI "0m" CSI "2J") - 1);
+	draw_frame_write();
+
+	free(draw_state.back);
+	free(draw_state.front);
+	free(draw_state.dirty);
+	free(draw_state.out);
+
+	memset(&draw_state, 0, sizeof(draw_state));
 }
 
 void
@@ -163,11 +238,13 @@ draw(enum draw_bit bit)
 {
 	switch (bit) {
 		case DRAW_FLUSH:
-			draw_bits();
-			draw_state.bits.all = 0;
-			draw_state.scroll_buffer_back = 0;
-			draw_state.scroll_buffer_forw = 0;
-			draw_state.bell = 0;
+			draw_flush();
+			break;
+		case DRAW_FRAME:
+			if (draw_now() - draw_state.frame_ms < DRAW_FRAME_MS)
+				draw_state.deferred = 1;
+			else
+				draw_flush();
 			break;
 		case DRAW_BELL:
 			draw_state.bell = 1;
@@ -200,63 +277,102 @@ draw(enum draw_bit bit)
 	}
 }
 
+int
+draw_deferred(void)
+{
+	uint64_t elapsed;
+
+	if (!draw_state.deferred)
+		return -1;
+
+	if ((elapsed = draw_now() - draw_state.frame_ms) >= DRAW_FRAME_MS) {
+		draw_flush();
+		return -1;
+	}
+
+	return (int) (DRAW_FRAME_MS - elapsed);
+}
+
 static void
 draw_bits(void)
 {
 	if (!draw_state.drawing)
 		return;
 
-	if (draw_state.bell && BELL_ON_PINGED)
-		putchar('\a');
+	if (draw_state.bits.all) {
 
-	if (!draw_state.bits.all)
-		return;
+		struct channel *c = current_channel();
 
-	struct channel *c = current_channel();
+		unsigned cols = state_cols();
+		unsigned rows = state_rows();
 
-	unsigned cols = state_cols();
-	unsigned rows = state_rows();
+		draw_grid(cols, rows);
 
-	draw_cursor_hide();
-	draw_cursor_pos_save();
+		if (cols < COLS_MIN || rows < ROWS_MIN) {
+			draw_clear_full();
+			draw_cursor_pos(1, 1);
+			draw_cursor_pos_save();
+			goto frame;
+		}
 
-	if (cols < COLS_MIN || rows < ROWS_MIN) {
-		draw_clear_full();
-		draw_cursor_pos(1, 1);
-		goto flush;
-	}
+		/* handle state altering draw functions before drawing components */
 
-	/* handle state altering draw functions before drawing components */
+		if (draw_state.scroll_buffer_back)
+			draw_buffer_scroll_back();
 
-	if (draw_state.scroll_buffer_back)
-		draw_buffer_scroll_back();
+		if (draw_state.scroll_buffer_forw)
+			draw_buffer_scroll_forw();
 
-	if (draw_state.scroll_buffer_forw)
-		draw_buffer_scroll_forw();
+		/* draw components */
 
-	/* draw components */
+		if (draw_state.bits.separators)
+			draw_separators();
 
-	if (draw_state.bits.separators)
-		draw_separators();
+		if (draw_state.bits.buffer)
+			draw_buffer(&c->buffer, coords(1, cols, 3, rows - 2));
 
-	if (draw_state.bits.buffer)
-		draw_buffer(&c->buffer, coords(1, cols, 3, rows - 2));
+		if (draw_state.bits.input)
+			draw_input(&c->input, coords(1, cols, rows, rows));
 
-	if (draw_state.bits.input)
-		draw_input(&c->input, coords(1, cols, rows, rows));
+		if (draw_state.bits.nav)
+			draw_nav(c);
 
-	if (draw_state.bits.nav)
-		draw_nav(c);
+		if (draw_state.bits.status)
+			draw_status(c);
 
-	if (draw_state.bits.status)
-		draw_status(c);
+frame:
 
-flush:
+		draw_frame();
+	}
 
-	draw_cursor_pos_restore();
-	draw_cursor_show();
+	if (draw_state.bell && BELL_ON_PINGED)
+		draw_frame_out("\a", 1);
+
+	draw_frame_write();
+}
+
+static uint64_t
+draw_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		fatal("clock_gettime: %s", strerror(errno));
 
-	fflush(stdout);
+	return ((uint64_t) ts.tv_sec * 1000) + ((uint64_t) ts.tv_nsec / 1000000);
+}
+
+static void
+draw_flush(void)
+{
+	draw_bits();
+
+	draw_state.bits.all = 0;
+	draw_state.scroll_buffer_back = 0;
+	draw_state.scroll_buffer_forw = 0;
+	draw_state.bell = 0;
+	draw_state.deferred = 0;
+	draw_state.frame_ms = draw_now();
 }
 
 static const char*
@@ -1063,7 +1179,7 @@ coords(unsigned c1, unsigned cN, unsigned r1, unsigned rN)
 }
 
 static unsigned
-nick_col(char *nick)
+nick_col(const char *nick)
 {
 	unsigned colour = 0;
 
@@ -1112,12 +1228,14 @@ drawf(struct draw_attrs *attrs, unsigned *cols_p, const char *fmt, ...)
 				case 'd':
 					draw_attrs(attrs, 0);
 					(void) snprintf(buf, sizeof(buf), "%d", va_arg(arg, int));
-					cols -= (unsigned) printf("%.*s", cols, buf);
+					for (const char *str = buf; *str && cols; cols--)
+						draw_char(attrs, *str++);
 					break;
 				case 'u':
 					draw_attrs(attrs, 0);
 					(void) snprintf(buf, sizeof(buf), "%u", va_arg(arg, unsigned));
-					cols -= (unsigned) printf("%.*s", cols, buf);
+					for (const char *str = buf; *str && cols; cols--)
+						draw_char(attrs, *str++);
 					break;
 				case 's':
 					draw_attrs(attrs, 0);
@@ -1147,13 +1265,29 @@ drawf(struct draw_attrs *attrs, unsigned *cols_p, const char *fmt, ...)
 static void
 draw_clear_full(void)
 {
-	printf(CSI "2J");
+	struct draw_cell blank = DRAW_CELL_EMPTY;
+
+	for (unsigned i = 0; i < draw_state.cols * draw_state.rows; i++)
+		draw_state.back[i] = blank;
+
+	memset(draw_state.dirty, 1, draw_state.rows);
 }
 
 static void
 draw_clear_line(void)
 {
-	printf(CSI "2K");
+	struct draw_cell blank = DRAW_CELL_EMPTY;
+	struct draw_cell *row;
+
+	if (draw_state.row < 1 || draw_state.row > draw_state.rows)
+		return;
+
+	row = draw_state.back + (draw_state.row - 1) * draw_state.cols;
+
+	for (unsigned i = 0; i < draw_state.cols; i++)
+		row[i] = blank;
+
+	draw_state.dirty[draw_state.row - 1] = 1;
 }
 
 static void
@@ -1164,41 +1298,317 @@ draw_char(struct draw_attrs *attrs, int c)
 		draw_attr_set_bg(&attrs_cntrl, CNTRL_BG);
 		draw_attr_set_fg(&attrs_cntrl, CNTRL_FG);
 		draw_attrs(&attrs_cntrl, 0);
-		putchar((c | 0x40));
+		draw_cell_put((c | 0x40));
 		draw_attrs(attrs, 1);
 	} else {
-		putchar(c);
+		draw_cell_put(c);
 	}
 }
 
 static void
 draw_cursor_pos(int row, int col)
 {
-	printf(CSI "%d;%dH", row, col);
+	draw_state.row = row;
+	draw_state.col = col;
 }
 
 static void
-draw_cursor_pos_restore(void)
+draw_cursor_pos_save(void)
+{
+	/* Position the cursor here after the frame */
+
+	draw_state.cursor_row = draw_state.row;
+	draw_state.cursor_col = draw_state.col;
+}
+
+static int
+draw_cell_blank(const struct draw_cell *cell)
 {
-	printf(CSI "u");
+	struct draw_cell blank = DRAW_CELL_EMPTY;
+
+	return !memcmp(cell, &blank, sizeof(blank));
 }
 
 static void
-draw_cursor_pos_save(void)
+draw_cell_put(int c)
 {
-	printf(CSI "s");
+	/* Draw a byte at the current position with the current attributes,
+	 * UTF-8 continuation bytes extend the previous cell's character */
+
+	struct draw_cell *cell;
+
+	if (draw_state.row < 1 || draw_state.row > draw_state.rows)
+		return;
+
+	if (UTF8_CONT(c)) {
+
+		size_t len;
+
+		if (draw_state.col < 2 || draw_state.col > draw_state.cols + 1)
+			return;
+
+		cell = draw_state.back + (draw_state.row - 1) * draw_state.cols + (draw_state.col - 2);
+
+		if ((len = strnlen(cell->c, DRAW_CELL_LEN)) < DRAW_CELL_LEN)
+			cell->c[len] = (char) c;
+
+		return;
+	}
+
+	if (draw_state.col < 1 || draw_state.col > draw_state.cols) {
+		draw_state.col++;
+		return;
+	}
+
+	cell = draw_state.back + (draw_state.row - 1) * draw_state.cols + (draw_state.col - 1);
+
+	*cell = draw_state.pen;
+	cell->c[0] = (char) c;
+
+	draw_state.dirty[draw_state.row - 1] = 1;
+	draw_state.col++;
 }
 
 static void
-draw_cursor_hide(void)
+draw_frame(void)
 {
-	printf(CSI "?25l");
+	/* Write the cells of dirty rows differing from the front grid, erasing
+	 * blank row ends, and position the cursor */
+
+	struct draw_cell blank = DRAW_CELL_EMPTY;
+	size_t out_len = draw_state.out_len;
+
+	draw_frame_out(CSI "?25l", sizeof(CSI "?25l") - 1);
+
+	for (unsigned r = 0; r < draw_state.rows; r++) {
+
+		struct draw_cell *back = draw_state.back + r * draw_state.cols;
+		struct draw_cell *front = draw_state.front + r * draw_state.cols;
+		unsigned end = draw_state.cols;
+
+		if (!draw_state.dirty[r])
+			continue;
+
+		draw_state.dirty[r] = 0;
+
+		while (end && draw_cell_blank(&back[end - 1]))
+			end--;
+
+		for (unsigned c = 0; c < draw_state.cols; c++) {
+
+			if (c >= end) {
+
+				/* Erase the blank row end, with the default background */
+
+				unsigned n = c;
+
+				while (n < draw_state.cols && draw_cell_blank(&front[n]))
+					n++;
+
+				if (n == draw_state.cols)
+					break;
+
+				draw_frame_cursor(r + 1, c + 1);
+				draw_frame_sgr(&blank);
+				draw_frame_out(CSI "K", sizeof(CSI "K") - 1);
+
+				while (c < draw_state.cols)
+					front[c++] = blank;
+
+				break;
+			}
+
+			if (!memcmp(&back[c], &front[c], sizeof(back[c])))
+				continue;
+
+			draw_frame_cursor(r + 1, c + 1);
+			draw_frame_sgr(&back[c]);
+			draw_frame_out(back[c].c, strnlen(back[c].c, DRAW_CELL_LEN));
+
+			front[c] = back[c];
+
+			draw_state.tty_col++;
+		}
+	}
+
+	if (draw_state.out_len == out_len + sizeof(CSI "?25l") - 1) {
+		draw_state.out_len = out_len;
+		draw_frame_cursor(draw_state.cursor_row, draw_state.cursor_col);
+	} else {
+		draw_frame_cursor(draw_state.cursor_row, draw_state.cursor_col);
+		draw_frame_out(CSI "?25h", sizeof(CSI "?25h") - 1);
+	}
+}
+
+static void
+draw_frame_cursor(unsigned row, unsigned col)
+{
+	/* Move the terminal's cursor, forward within the row when shorter */
+
+	if (draw_state.tty_row == row && draw_state.tty_col == col)
+		return;
+
+	if (draw_state.tty_row == row && draw_state.tty_col < col)
+		draw_frame_outf(CSI "%uC", col - draw_state.tty_col);
+	else
+		draw_frame_outf(CSI "%u;%uH", row, col);
+
+	draw_state.tty_row = row;
+	draw_state.tty_col = col;
+}
+
+static void
+draw_frame_out(const char *str, size_t len)
+{
+	if (draw_state.out_len + len > draw_state.out_size) {
+
+		while (draw_state.out_len + len > draw_state.out_size)
+			draw_state.out_size = (draw_state.out_size ? draw_state.out_size * 2 : 4096);
+
+		if ((draw_state.out = realloc(draw_state.out, draw_state.out_size)) == NULL)
+			fatal("realloc: %s", strerror(errno));
+	}
+
+	memcpy(draw_state.out + draw_state.out_len, str, len);
+
+	draw_state.out_len += len;
+}
+
+static void
+draw_frame_outf(const char *fmt, ...)
+{
+	char buf[64];
+	int ret;
+	va_list ap;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (ret > 0)
+		draw_frame_out(buf, MIN((size_t) ret, sizeof(buf) - 1));
+}
+
+static void
+draw_frame_sgr(const struct draw_cell *cell)
+{
+	/* Set the terminal's SGR attributes to the cell's, by the attributes
+	 * that differ */
+
+	static const struct {
+		uint16_t flag;
+		const char *on;
+		const char *off;
+	} flags[] = {
+		{ DRAW_CELL_BOLD,      ";1", ";22" },
+		{ DRAW_CELL_ITALIC,    ";3", ";23" },
+		{ DRAW_CELL_REVERSE,   ";7", ";27" },
+		{ DRAW_CELL_STRIKE,    ";9", ";29" },
+		{ DRAW_CELL_UNDERLINE, ";4", ";24" },
+	};
+
+	char buf[64];
+	size_t len = 0;
+	struct draw_cell *sgr = &(draw_state.sgr);
+
+	if (sgr->flags & DRAW_CELL_UNKNOWN) {
+		struct draw_cell reset = DRAW_CELL_EMPTY;
+		len += (size_t) snprintf(buf + len, sizeof(buf) - len, ";0");
+		*sgr = reset;
+	}
+
+	if (sgr->bg != cell->bg) {
+		if (cell->bg < 0)
+			len += (size_t) snprintf(buf + len, sizeof(buf) - len, ";49");
+		else
+			len += (size_t) snprintf(buf + len, sizeof(buf) - len, ";48;5;%d", cell->bg);
+	}
+
+	if (sgr->fg != cell->fg) {
+		if (cell->fg < 0)
+			len += (size_t) snprintf(buf + len, sizeof(buf) - len, ";39");
+		else
+			len += (size_t) snprintf(buf + len, sizeof(buf) - len, ";38;5;%d", cell->fg);
+	}
+
+	for (size_t i = 0; i < ARR_LEN(flags); i++) {
+		if ((sgr->flags ^ cell->flags) & flags[i].flag) {
+			len += (size_t) snprintf(buf + len, sizeof(buf) - len, "%s",
+				((cell->flags & flags[i].flag) ? flags[i].on : flags[i].off));
+		}
+	}
+
+	if (len) {
+		draw_frame_outf(CSI "%sm", buf + 1);
+		sgr->bg = cell->bg;
+		sgr->fg = cell->fg;
+		sgr->flags = cell->flags;
+	}
 }
 
 static void
-draw_cursor_show(void)
+draw_frame_write(void)
 {
-	printf(CSI "?25h");
+	/* Write the frame to the terminal */
+
+	size_t i = 0;
+	ssize_t ret;
+
+	while (i < draw_state.out_len) {
+
+		if ((ret = write(STDOUT_FILENO, draw_state.out + i, draw_state.out_len - i)) < 0) {
+
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		i += (size_t) ret;
+	}
+
+	draw_state.out_len = 0;
+}
+
+static void
+draw_grid(unsigned cols, unsigned rows)
+{
+	/* Size the grids to the terminal, on resizing all components are
+	 * drawn and all cells are written */
+
+	struct draw_cell unknown = { .flags = DRAW_CELL_UNKNOWN };
+
+	if (draw_state.cols == cols && draw_state.rows == rows && draw_state.back)
+		return;
+
+	free(draw_state.back);
+	free(draw_state.front);
+	free(draw_state.dirty);
+
+	draw_state.cols = cols;
+	draw_state.rows = rows;
+
+	if ((draw_state.back = calloc(MAX(cols * rows, 1), sizeof(*draw_state.back))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	if ((draw_state.front = calloc(MAX(cols * rows, 1), sizeof(*draw_state.front))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	if ((draw_state.dirty = calloc(MAX(rows, 1), sizeof(*draw_state.dirty))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	for (unsigned i = 0; i < cols * rows; i++)
+		draw_state.front[i] = unknown;
+
+	draw_clear_full();
+	draw_attr_reset(NULL);
+
+	/* The terminal's cursor and attributes are unknown */
+	draw_state.sgr = unknown;
+	draw_state.tty_col = 0;
+	draw_state.tty_row = 0;
+
+	draw_state.bits.all = -1;
 }
 
 static unsigned
@@ -1275,29 +1685,19 @@ draw_attr_len(const char *str)
 static void
 draw_attrs(struct draw_attrs *draw_attrs, int flush)
 {
-	#define ATTR_BG ";48;5;"
-	#define ATTR_FG ";38;5;"
-
-	char bg[sizeof(ATTR_BG) + 4];
-	char fg[sizeof(ATTR_FG) + 4];
+	/* Set the attributes of cells drawn */
 
 	if (draw_attrs->flush || flush) {
 		draw_attrs->flush = 0;
 
-		if (draw_attrs->bg >= 0 && draw_attrs->bg <= 255)
-			(void) snprintf(bg, sizeof(bg), ATTR_BG "%d", draw_attrs->bg);
-
-		if (draw_attrs->fg >= 0 && draw_attrs->fg <= 255)
-			(void) snprintf(fg, sizeof(fg), ATTR_FG "%d", draw_attrs->fg);
-
-		printf(CSI "0%s%s%s%s%s%s%sm",
-			((draw_attrs->bg >= 0 && draw_attrs->bg <= 255) ? bg : ""),
-			((draw_attrs->fg >= 0 && draw_attrs->fg <= 255) ? fg : ""),
-			(draw_attrs->bold      ? ";1" : ""),
-			(draw_attrs->italic    ? ";3" : ""),
-			(draw_attrs->reverse   ? ";7" : ""),
-			(draw_attrs->strike    ? ";9" : ""),
-			(draw_attrs->underline ? ";4" : ""));
+		draw_state.pen.bg = ((draw_attrs->bg >= 0 && draw_attrs->bg <= 255) ? draw_attrs->bg : -1);
+		draw_state.pen.fg = ((draw_attrs->fg >= 0 && draw_attrs->fg <= 255) ? draw_attrs->fg : -1);
+		draw_state.pen.flags =
+			(draw_attrs->bold      ? DRAW_CELL_BOLD      : 0) |
+			(draw_attrs->italic    ? DRAW_CELL_ITALIC    : 0) |
+			(draw_attrs->reverse   ? DRAW_CELL_REVERSE   : 0) |
+			(draw_attrs->strike    ? DRAW_CELL_STRIKE    : 0) |
+			(draw_attrs->underline ? DRAW_CELL_UNDERLINE : 0);
 	}
 }
 
@@ -1315,7 +1715,8 @@ draw_attr_reset(struct draw_attrs *attrs)
 		attrs->underline = 0;
 		attrs->flush     = 1;
 	} else {
-		printf(CSI "0m");
+		struct draw_cell pen = DRAW_CELL_EMPTY;
+		draw_state.pen = pen;
 	}
 }
 
@@ -5,6 +5,7 @@ enum draw_bit
 {
 	DRAW_INVALID,
 	DRAW_FLUSH,       /* immediately draw all set bits */
+	DRAW_FRAME,       /* draw all set bits, deferred to at most DRAW_FPS frames per second */
 	DRAW_BELL,        /* set bit to print terminal bell */
 	DRAW_BUFFER,      /* set bit to draw buffer */
 	DRAW_BUFFER_BACK, /* set bit to draw buffer scrollback back */
@@ -20,4 +21,7 @@ void draw_term(void);
 
 void draw(enum draw_bit);
 
+/* Draw a deferred frame if due, returning milliseconds until due, or -1 */
+int draw_deferred(void);
+
 #endif
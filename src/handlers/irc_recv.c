@@ -46,6 +46,7 @@ static int irc_numeric_329(struct server*, struct irc_message*);
 static int irc_numeric_332(struct server*, struct irc_message*);
 static int irc_numeric_333(struct server*, struct irc_message*);
 static int irc_numeric_353(struct server*, struct irc_message*);
+static int irc_numeric_366(struct server*, struct irc_message*);
 static int irc_numeric_401(struct server*, struct irc_message*);
 static int irc_numeric_403(struct server*, struct irc_message*);
 static int irc_numeric_433(struct server*, struct irc_message*);
@@ -146,7 +147,7 @@ static const irc_recv_f irc_numerics[] = {
 	[353] = irc_numeric_353,    /* RPL_NAMEREPLY */
 	[364] = irc_generic_info,   /* RPL_LINKS */
 	[365] = irc_generic_ignore, /* RPL_ENDOFLINKS */
-	[366] = irc_generic_ignore, /* RPL_ENDOFNAMES */
+	[366] = irc_numeric_366,    /* RPL_ENDOFNAMES */
 	[367] = irc_generic_info,   /* RPL_BANLIST */
 	[368] = irc_generic_ignore, /* RPL_ENDOFBANLIST */
 	[369] = irc_generic_ignore, /* RPL_ENDOFWHOWAS */
@@ -574,10 +575,30 @@ irc_numeric_353(struct server *s, struct irc_message *m)
 		if (*nick == 0)
 			failf(s, "RPL_NAMEREPLY: invalid nick: '%s'", prefix);
 
-		if (user_list_add(&(c->users), s->casemapping, nick, prfxmode) == USER_ERR_DUPLICATE)
+		if (user_list_batch_add(&(c->users), s->casemapping, nick, prfxmode) == USER_ERR_DUPLICATE)
 			failf(s, "RPL_NAMEREPLY: duplicate nick: '%s'", nick);
 	}
 
+	return 0;
+}
+
+static int
+irc_numeric_366(struct server *s, struct irc_message *m)
+{
+	/* <channel> :End of /NAMES list */
+
+	char *chan;
+	struct channel *c;
+
+	if (!irc_message_param(m, &chan))
+		failf(s, "RPL_ENDOFNAMES: channel is null");
+
+	/* NAMES for channels not joined are replied with 353 errors */
+	if ((c = channel_list_get(&s->clist, chan, s->casemapping)) == NULL)
+		return 0;
+
+	user_list_batch_end(&(c->users), s->casemapping);
+
 	draw(DRAW_STATUS);
 
 	return 0;
@@ -1073,7 +1094,10 @@ recv_nick(struct server *s, struct irc_message *m)
 	/* :nick!user@host NICK <nick> */
 
 	char *nick;
-	struct channel *c = s->channel;
+	int nick_case;
+	struct channel *c;
+	struct user_nick *rec;
+	unsigned i = 0;
 
 	if (!m->from)
 		failf(s, "NICK: old nick is null");
@@ -1087,10 +1111,20 @@ recv_nick(struct server *s, struct irc_message *m)
 		draw(DRAW_STATUS);
 	}
 
-	do {
+	/* Replacing the user removes the channel from the nick's record,
+	 * unless the nick only changes case or is a duplicate */
+	nick_case = !irc_strcmp(s->casemapping, m->from, nick);
+
+	while ((rec = user_registry_get(&(s->clist.registry), s->casemapping, m->from)) && i < rec->chans_n) {
+
 		enum user_err ret;
 
-		if ((ret = user_list_rpl(&(c->users), s->casemapping, m->from, nick)) == USER_ERR_NOT_FOUND)
+		c = CHANNEL_USERS(rec->chans[i].ul);
+
+		if ((ret = user_list_rpl(&(c->users), s->casemapping, m->from, nick)) != USER_ERR_NONE || nick_case)
+			i++;
+
+		if (ret == USER_ERR_NOT_FOUND)
 			continue;
 
 		if (ret == USER_ERR_DUPLICATE)
@@ -1100,8 +1134,7 @@ recv_nick(struct server *s, struct irc_message *m)
 			continue;
 
 		newlinef(c, BUFFER_LINE_NICK, FROM_INFO, "%s  >>  %s", m->from, nick);
-
-	} while ((c = c->next) != s->channel);
+	}
 
 	return 0;
 }
@@ -1252,7 +1285,7 @@ recv_privmsg(struct server *s, struct irc_message *m)
 		failf(s, "PRIVMSG: channel '%s' not found", target);
 	}
 
-	if (irc_pinged(s->casemapping, message, s->nick)) {
+	if (highlight_match(&(s->highlight), s->casemapping, message)) {
 
 		if (c != current_channel())
 			urgent = 1;
@@ -1277,20 +1310,26 @@ recv_quit(struct server *s, struct irc_message *m)
 	/* :nick!user@host QUIT [:message] */
 
 	char *message;
-	struct channel *c = s->channel;
+	struct channel *c;
+	struct user_nick *rec;
 
 	if (!m->from)
 		failf(s, "QUIT: sender's nick is null");
 
 	irc_message_param(m, &message);
 
-	do {
+	while ((rec = user_registry_get(&(s->clist.registry), s->casemapping, m->from))) {
+
 		/* QUIT decrements count, filter first */
 
-		int filter = irc_recv_threshold_filter(threshold_quit, c->users.count);
+		int filter;
+
+		c = CHANNEL_USERS(rec->chans[0].ul);
+
+		filter = irc_recv_threshold_filter(threshold_quit, c->users.count);
 
 		if (user_list_del(&(c->users), s->casemapping, m->from) == USER_ERR_NOT_FOUND)
-			continue;
+			break;
 
 		if (filter)
 			continue;
@@ -1301,8 +1340,7 @@ recv_quit(struct server *s, struct irc_message *m)
 		else
 			newlinef(c, BUFFER_LINE_QUIT, FROM_QUIT, "%s!%s has quit",
 				m->from, m->host);
-
-	} while ((c = c->next) != s->channel);
+	}
 
 	draw(DRAW_STATUS);
 
@@ -1368,7 +1406,8 @@ recv_ircv3_account(struct server *s, struct irc_message *m)
 	/* :nick!user@host ACCOUNT <account> */
 
 	char *account;
-	struct channel *c = s->channel;
+	struct channel *c;
+	struct user_nick *rec;
 
 	if (!m->from)
 		failf(s, "ACCOUNT: sender's nick is null");
@@ -1376,19 +1415,21 @@ recv_ircv3_account(struct server *s, struct irc_message *m)
 	if (!irc_message_param(m, &account))
 		failf(s, "ACCOUNT: account is null");
 
-	do {
-		if (irc_recv_threshold_filter(threshold_account, c->users.count))
-			continue;
+	if ((rec = user_registry_get(&(s->clist.registry), s->casemapping, m->from)) == NULL)
+		return 0;
 
-		if (!user_list_get(&(c->users), s->casemapping, m->from, 0))
+	for (unsigned i = 0; i < rec->chans_n; i++) {
+
+		c = CHANNEL_USERS(rec->chans[i].ul);
+
+		if (irc_recv_threshold_filter(threshold_account, c->users.count))
 			continue;
 
 		if (!strcmp(account, "*"))
 			newlinef(c, 0, FROM_INFO, "%s has logged out", m->from);
 		else
 			newlinef(c, 0, FROM_INFO, "%s has logged in as %s", m->from, account);
-
-	} while ((c = c->next) != s->channel);
+	}
 
 	return 0;
 }
@@ -1399,26 +1440,29 @@ recv_ircv3_away(struct server *s, struct irc_message *m)
 	/* :nick!user@host AWAY [:message] */
 
 	char *message;
-	struct channel *c = s->channel;
+	struct channel *c;
+	struct user_nick *rec;
 
 	if (!m->from)
 		failf(s, "AWAY: sender's nick is null");
 
 	irc_message_param(m, &message);
 
-	do {
-		if (irc_recv_threshold_filter(threshold_away, c->users.count))
-			continue;
+	if ((rec = user_registry_get(&(s->clist.registry), s->casemapping, m->from)) == NULL)
+		return 0;
+
+	for (unsigned i = 0; i < rec->chans_n; i++) {
 
-		if (!user_list_get(&(c->users), s->casemapping, m->from, 0))
+		c = CHANNEL_USERS(rec->chans[i].ul);
+
+		if (irc_recv_threshold_filter(threshold_away, c->users.count))
 			continue;
 
 		if (message)
 			newlinef(c, 0, FROM_INFO, "%s is now away: %s", m->from, message);
 		else
 			newlinef(c, 0, FROM_INFO, "%s is no longer away", m->from);
-
-	} while ((c = c->next) != s->channel);
+	}
 
 	return 0;
 }
@@ -1430,7 +1474,8 @@ recv_ircv3_chghost(struct server *s, struct irc_message *m)
 
 	char *user;
 	char *host;
-	struct channel *c = s->channel;
+	struct channel *c;
+	struct user_nick *rec;
 
 	if (!m->from)
 		failf(s, "CHGHOST: sender's nick is null");
@@ -1441,16 +1486,18 @@ recv_ircv3_chghost(struct server *s, struct irc_message *m)
 	if (!irc_message_param(m, &host))
 		failf(s, "CHGHOST: host is null");
 
-	do {
-		if (irc_recv_threshold_filter(threshold_chghost, c->users.count))
-			continue;
+	if ((rec = user_registry_get(&(s->clist.registry), s->casemapping, m->from)) == NULL)
+		return 0;
+
+	for (unsigned i = 0; i < rec->chans_n; i++) {
+
+		c = CHANNEL_USERS(rec->chans[i].ul);
 
-		if (!user_list_get(&(c->users), s->casemapping, m->from, 0))
+		if (irc_recv_threshold_filter(threshold_chghost, c->users.count))
 			continue;
 
 		newlinef(c, 0, FROM_INFO, "%s has changed user/host: %s/%s", m->from, user, host);
-
-	} while ((c = c->next) != s->channel);
+	}
 
 	return 0;
 }
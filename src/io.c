@@ -1,38 +1,62 @@
 #include "src/io.h"
 
-#include "config.h"
-#include "src/rirc.h"
-#include "src/utils/utils.h"
-
+/* mbedtls headers precede config.h, such that lib/mbedtls.h sees IO_EPOLL
+ * from CFLAGS, as when building mbedtls itself */
 #ifndef NDEBUG
 #include "mbedtls/debug.h"
 #endif
 #include "mbedtls/ctr_drbg.h"
+#include "mbedtls/ecp.h"
 #include "mbedtls/entropy.h"
 #include "mbedtls/error.h"
 #include "mbedtls/net_sockets.h"
 #include "mbedtls/ssl.h"
 #include "mbedtls/x509_crt.h"
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+#include "psa/crypto.h"
+#endif
+
+#include "config.h"
+#include "src/dns.h"
+#include "src/rirc.h"
+#include "src/utils/utils.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(IO_EPOLL) && IO_EPOLL
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#endif
+
 /* RFC 2812, section 2.3 */
 #define IO_MESG_LEN 510
 
+/* Socket read size, the maximum TLS record plaintext length */
+#define IO_READ_SIZE 16384
+
+/* Socket reads per connection per event loop wakeup, with IO_EPOLL */
+#define IO_READ_MAX 4
+
+/* Bytes queued per connection for the socket being writable, with IO_EPOLL */
+#define IO_SEND_MAX 65536
+
 #ifndef IO_PING_MIN
 #define IO_PING_MIN 150
 #elif (IO_PING_MIN < 0 || IO_PING_MIN > 86400)
@@ -69,6 +93,42 @@
 #error "IO_RECONNECT_BACKOFF_MAX: [0, 86400]"
 #endif
 
+#ifndef IO_CONNECT_DELAY
+#define IO_CONNECT_DELAY 250
+#elif (IO_CONNECT_DELAY < 10 || IO_CONNECT_DELAY > 2000)
+#error "IO_CONNECT_DELAY: [10, 2000]"
+#endif
+
+#ifndef IO_CONNECT_TIMEOUT
+#define IO_CONNECT_TIMEOUT 10
+#elif (IO_CONNECT_TIMEOUT < 1 || IO_CONNECT_TIMEOUT > 300)
+#error "IO_CONNECT_TIMEOUT: [1, 300]"
+#endif
+
+/* Connection attempts in flight, per connection */
+#define IO_CONNECT_ATTEMPTS 8
+
+#ifndef IO_TLS_SESSION_DIR
+#define IO_TLS_SESSION_DIR ""
+#endif
+
+/* Persisted TLS session file size limit */
+#define IO_TLS_SESSION_SIZE 16384
+
+#ifndef IO_EPOLL
+#define IO_EPOLL 0
+#elif IO_EPOLL && !defined(__linux__)
+#error "IO_EPOLL: Linux only"
+#endif
+
+/* TLS 1.3 is negotiated when compiled into mbedtls, only with IO_EPOLL set
+ * in CFLAGS, see lib/mbedtls.h */
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3) && IO_EPOLL
+#define IO_TLS_1_3 1
+#else
+#define IO_TLS_1_3 0
+#endif
+
 #define PT_CF(X) \
 	do {                           \
 		int _ptcf = (X);           \
@@ -80,27 +140,21 @@
 #define PT_LK(X) PT_CF(pthread_mutex_lock((X)))
 #define PT_UL(X) PT_CF(pthread_mutex_unlock((X)))
 
-/* IO callback */
-#define IO_CB(C, X) \
-	do { \
-		int callback = 1; \
-		if (((struct connection *)(C))) { \
-			PT_LK(&(((struct connection *)(C))->mtx)); \
-			callback = ((struct connection *)(C))->callback; \
-			PT_UL(&(((struct connection *)(C))->mtx)); \
-		} \
-		if (((struct connection *)(C)) && callback) { \
-			PT_LK(&io_cb_mutex); \
-			(X); \
-			PT_UL(&io_cb_mutex); \
-		} \
-	} while (0)
-
-#define io_cxed(C)       IO_CB(C, io_cb_cxed((C)->obj))
-#define io_dxed(C)       IO_CB(C, io_cb_dxed((C)->obj))
-#define io_error(C, ...) IO_CB(C, io_cb_error((C)->obj,  __VA_ARGS__))
-#define io_info(C, ...)  IO_CB(C, io_cb_info((C)->obj, __VA_ARGS__))
-#define io_ping(C, P)    IO_CB(C, io_cb_ping((C)->obj, P))
+#if IO_EPOLL
+/* IO callbacks, run directly by the event loop */
+#define io_cxed(C)       do { if ((C)->callback) io_cb_cxed((C)->obj); } while (0)
+#define io_dxed(C)       do { if ((C)->callback) io_cb_dxed((C)->obj); } while (0)
+#define io_error(C, ...) do { if ((C)->callback) io_cb_error((C)->obj, __VA_ARGS__); } while (0)
+#define io_info(C, ...)  do { if ((C)->callback) io_cb_info((C)->obj, __VA_ARGS__); } while (0)
+#define io_ping(C, P)    do { unsigned _p = (P); if ((C)->callback) io_cb_ping((C)->obj, _p); } while (0)
+#else
+/* IO callbacks, queued by connection threads for the main thread */
+#define io_cxed(C)       io_ev((C), IO_EV_CXED, 0, NULL, 0)
+#define io_dxed(C)       io_ev((C), IO_EV_DXED, 0, NULL, 0)
+#define io_error(C, ...) io_evf((C), IO_EV_ERROR, __VA_ARGS__)
+#define io_info(C, ...)  io_evf((C), IO_EV_INFO, __VA_ARGS__)
+#define io_ping(C, P)    io_ev((C), IO_EV_PING, (P), NULL, 0)
+#endif
 
 /* state transition */
 #define ST_X(OLD, NEW) (((OLD) << 3) | (NEW))
@@ -117,6 +171,24 @@ enum io_err
 	IO_ERR_TRUNC,
 };
 
+/* Resolved addresses are attempted in order, interleaved by address
+ * family, each started IO_CONNECT_DELAY after the last or as soon as the
+ * last fails, the first to connect winning the race (RFC 8305) */
+struct io_net_race
+{
+	struct addrinfo *ai;     /* Next address to attempt */
+	struct addrinfo *ai_res; /* Resolved addresses */
+	struct io_net_attempt
+	{
+		struct addrinfo *ai;
+		uint64_t timeout;    /* Monotonic time (ms) the attempt is abandoned */
+		int fd;
+	} attempts[IO_CONNECT_ATTEMPTS];
+	uint64_t next;           /* Monotonic time (ms) the next attempt starts */
+	unsigned n;              /* Attempts in flight */
+	int err;                 /* Error of the last failed attempt */
+};
+
 struct connection
 {
 	const void *obj;
@@ -125,6 +197,8 @@ struct connection
 	const char *tls_ca_file;
 	const char *tls_ca_path;
 	const char *tls_cert;
+	const char *tls_ciphers;
+	const char *tls_groups;
 	enum io_state {
 		IO_ST_INVALID,
 		IO_ST_DXED, /* Socket disconnected, passive */
@@ -134,20 +208,98 @@ struct connection
 		IO_ST_PING, /* Socket connected, network state in question */
 	} st_cur, /* current thread state */
 	  st_new; /* new thread state */
-	mbedtls_ctr_drbg_context tls_ctr_drbg;
-	mbedtls_entropy_context tls_entropy;
 	mbedtls_net_context net_ctx;
-	mbedtls_pk_context tls_pk_ctx;
-	mbedtls_ssl_config tls_conf;
 	mbedtls_ssl_context tls_ctx;
-	mbedtls_x509_crt tls_x509_crt_ca;
-	mbedtls_x509_crt tls_x509_crt_client;
+	mbedtls_ssl_session tls_session; /* Session of the last completed handshake */
+	uint64_t tls_handshake;          /* Monotonic time (us) of the handshake's start */
+	struct dns_query dns;            /* Host query, pending while its fd is open */
+	struct io_net_race race;
+#if IO_EPOLL
+	struct connection *next;
+	struct connection *prev;
+	uint64_t deadline;       /* Monotonic time (ms) of the state's timeout, or 0 */
+	unsigned char *sendq;    /* Bytes queued for the socket being writable */
+	size_t sendq_len;
+	size_t sendq_size;
+	size_t sendq_tls;        /* Length of a TLS write that would block, retried as is */
+#else
 	pthread_mutex_t mtx;
+	pthread_mutex_t mtx_io; /* Serializes socket and TLS context reads and writes */
 	pthread_t tid;
+#endif
 	uint32_t flags;
 	unsigned ping;
 	unsigned rx_sleep;
 	unsigned callback : 1;
+	unsigned destroyed : 1; /* Freed once its pending events are discarded */
+	unsigned tls_resume : 1; /* tls_session is set, resumed when reconnecting */
+#if IO_EPOLL
+	unsigned tls_init : 1;  /* TLS contexts initialized */
+	unsigned sendq_watch : 1; /* Socket watched for being writable */
+	unsigned rd_pending : 2; /* Reads deferred by IO_READ_MAX, 2 once due */
+#endif
+};
+
+/* TLS configurations are shared by all connections with the same CA
+ * certs, client cert and verification mode. CA certs and client certs
+ * are each parsed once, when first required by a connection, and kept
+ * read-only for the lifetime of the process. Connections share a single
+ * DRBG, mbedtls being built with MBEDTLS_THREADING_C */
+struct io_tls_ca
+{
+	struct io_tls_ca *next;
+	char *ca_file;
+	char *ca_path;
+	mbedtls_x509_crt crt;
+};
+
+struct io_tls_cert
+{
+	struct io_tls_cert *next;
+	char *cert;
+	mbedtls_pk_context pk;
+	mbedtls_x509_crt crt;
+};
+
+struct io_tls_conf
+{
+	struct io_tls_conf *next;
+	struct io_tls_ca *ca;
+	struct io_tls_cert *cert;
+	char *ciphers;
+	char *groups;
+	int *ciphers_ids;      /* Zero terminated */
+	uint16_t *groups_ids;  /* Zero terminated */
+	uint32_t flags;        /* Verification mode and version */
+	mbedtls_ssl_config conf;
+};
+
+#if !IO_EPOLL
+
+/* Callbacks from connection threads are queued as events in a lock-free
+ * multi-producer, single-consumer queue and dispatched by the main thread,
+ * such that socket reads never wait on callback handling or drawing
+ *
+ * Connection threads push events by atomically swapping the queue head, and
+ * signal the main thread by writing to a pipe when it isn't already signalled.
+ * A connection destroyed by the main thread pushes a final event after its
+ * thread exits, preceded in the queue by all of the connection's events */
+struct io_event
+{
+	struct io_event *_Atomic next;
+	struct connection *cx;
+	enum io_event_type {
+		IO_EV_CXED, /* io_cb_cxed */
+		IO_EV_DXED, /* io_cb_dxed */
+		IO_EV_ERROR, /* io_cb_error */
+		IO_EV_FREE, /* Free destroyed connection */
+		IO_EV_INFO, /* io_cb_info */
+		IO_EV_PING, /* io_cb_ping */
+		IO_EV_READ, /* io_cb_read_soc */
+	} type;
+	unsigned ping;
+	size_t len;
+	char buf[];
 };
 
 static enum io_state io_state_cxed(struct connection*);
@@ -155,31 +307,114 @@ static enum io_state io_state_cxng(struct connection*);
 static enum io_state io_state_ping(struct connection*);
 static enum io_state io_state_rxng(struct connection*);
 static int io_cx_read(struct connection*, uint32_t);
+static struct io_event* io_ev_pop(void);
+static void io_ev(struct connection*, enum io_event_type, unsigned, const char*, size_t);
+static void io_ev_dispatch(void);
+static void io_ev_push(struct io_event*);
+static void io_ev_send(struct connection*, struct io_event*);
+static void io_evf(struct connection*, enum io_event_type, const char*, ...);
 static void io_fatal(const char*, int);
 static void io_sig_handle(int);
 static void io_sig_init(void);
+static void* io_thread(void*);
+
+static volatile sig_atomic_t flag_sigwinch_cb; /* sigwinch callback */
+
+static struct io_event io_ev_stub;
+static struct io_event *_Atomic io_ev_head = &io_ev_stub; /* Newest event, pushed by any thread */
+static struct io_event *io_ev_tail = &io_ev_stub;         /* Oldest event, popped by the main thread */
+static atomic_int io_ev_signalled;
+static int io_ev_pipe[2];
+
+static int io_net_connect(struct connection*);
+static int io_tls_establish(struct connection*);
+#else
+/* Connections, stdin and SIGWINCH are multiplexed by a single epoll instance
+ * on the main thread, with sockets connecting and handshaking non-blocking.
+ * Ping and reconnect timers are per-connection deadlines, the nearest of
+ * which sets the epoll timeout */
+static int io_loop_send(struct connection*);
+static int io_loop_timeout(void);
+static void io_loop_close(struct connection*);
+static void io_loop_connect(struct connection*);
+static void io_loop_handshake(struct connection*);
+static void io_loop_pending(void);
+static void io_loop_poll(struct connection*);
+static void io_loop_race(struct connection*);
+static void io_loop_read(struct connection*);
+static void io_loop_resolve(struct connection*, int);
+static void io_loop_st(struct connection*, enum io_state);
+static void io_loop_stdin(void);
+static void io_loop_timers(void);
+static void io_loop_watch(struct connection*, uint32_t);
+
+static struct connection *io_loop_cxs;  /* Connections with timers or sockets */
+static struct connection *io_loop_free; /* Destroyed connections, freed after dispatch */
+static int io_loop_epfd = -1;
+static int io_loop_sigfd = -1;
+#endif
+
+static unsigned io_rx_sleep(struct connection*);
+static void io_state_cb(struct connection*, enum io_state, enum io_state);
 static void io_tty_init(void);
 static void io_tty_term(void);
 static void io_tty_winsize(void);
-static void* io_thread(void*);
 
 static int io_running;
-static pthread_mutex_t io_cb_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct termios term;
-static volatile sig_atomic_t flag_sigwinch_cb; /* sigwinch callback */
 
 static const char* io_strerror(char*, size_t);
-static int io_net_connect(struct connection*);
+static int io_dns(struct connection*);
+static int io_dns_done(struct connection*, int);
+static int io_dns_port(const char*, uint16_t*);
+static int io_dns_step(struct connection*);
+static int io_net_race(struct connection*, int);
+static int io_net_race_poll(struct connection*, int);
+static struct addrinfo* io_net_sort(struct addrinfo*);
+static uint64_t io_net_race_deadline(struct connection*);
+static uint64_t io_now(void);
 static void io_net_close(int);
+static void io_net_race_free(struct connection*);
+static void io_net_race_init(struct connection*, struct addrinfo*);
+static void io_net_race_remove(struct connection*, unsigned);
+static void io_net_race_start(struct connection*, uint64_t);
 
 /* TLS */
 static const char* io_tls_err(int);
-static int io_tls_establish(struct connection*);
+static const mbedtls_ssl_config* io_tls_conf(struct connection*);
+static int io_tls_init(struct connection*);
+static int io_tls_key(const char*, const char*);
+static int io_tls_list(struct connection*, struct io_tls_conf*);
+static int io_tls_session_path(struct connection*, char*, size_t);
+static int io_tls_verify(struct connection*, int);
 static int io_tls_x509_vrfy(struct connection*);
+static struct io_tls_ca* io_tls_ca(struct connection*);
+static struct io_tls_cert* io_tls_cert(struct connection*);
+static void io_tls_free(struct connection*);
+static void io_tls_session_load(struct connection*);
+static void io_tls_session_save(struct connection*, int);
+static uint64_t io_tls_time(void);
 #ifndef NDEBUG
 static void io_tls_debug(void*, int, const char*, int, const char*);
 #endif
 
+static mbedtls_ctr_drbg_context io_tls_ctr_drbg;
+static mbedtls_entropy_context io_tls_entropy;
+#if !IO_EPOLL
+static pthread_mutex_t io_tls_mtx = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static struct io_tls_ca *io_tls_cas;
+static struct io_tls_cert *io_tls_certs;
+static struct io_tls_conf *io_tls_confs;
+static int io_tls_seeded;
+
+/* Hosts resolved by connections are cached by address family, shared by
+ * all connections for their records' TTL */
+#if !IO_EPOLL
+static pthread_mutex_t io_dns_mtx = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static struct dns_cache io_dns_cache;
+
 const char *default_ca_certs[] = {
 	"/etc/ssl/ca-bundle.pem",
 	"/etc/ssl/cert.pem",
@@ -197,6 +432,8 @@ connection(
 	const char *tls_ca_file,
 	const char *tls_ca_path,
 	const char *tls_cert,
+	const char *tls_ciphers,
+	const char *tls_groups,
 	uint32_t flags)
 {
 	struct connection *cx;
@@ -211,14 +448,93 @@ connection(
 	cx->tls_ca_file = (tls_ca_file ? irc_strdup(tls_ca_file) : NULL);
 	cx->tls_ca_path = (tls_ca_path ? irc_strdup(tls_ca_path) : NULL);
 	cx->tls_cert = (tls_cert ? irc_strdup(tls_cert) : NULL);
+	cx->tls_ciphers = (tls_ciphers ? irc_strdup(tls_ciphers) : NULL);
+	cx->tls_groups = (tls_groups ? irc_strdup(tls_groups) : NULL);
 	cx->st_cur = IO_ST_DXED;
 	cx->st_new = IO_ST_INVALID;
 	cx->callback = 1;
+
+	cx->dns.fd = -1;
+
+	mbedtls_net_init(&(cx->net_ctx));
+	mbedtls_ssl_session_init(&(cx->tls_session));
+
+	if (flags & IO_TLS_ENABLED)
+		io_tls_session_load(cx);
+
+#if IO_EPOLL
+	if ((cx->next = io_loop_cxs))
+		io_loop_cxs->prev = cx;
+
+	io_loop_cxs = cx;
+#else
 	PT_CF(pthread_mutex_init(&(cx->mtx), NULL));
+	PT_CF(pthread_mutex_init(&(cx->mtx_io), NULL));
+#endif
 
 	return cx;
 }
 
+#if IO_EPOLL
+int
+io_cx(struct connection *cx)
+{
+	switch (cx->st_cur) {
+		case IO_ST_DXED:
+		case IO_ST_RXNG:
+			io_loop_st(cx, IO_ST_CXNG);
+			return IO_ERR_NONE;
+		case IO_ST_CXNG:
+			return IO_ERR_CXNG;
+		case IO_ST_CXED:
+		case IO_ST_PING:
+			return IO_ERR_CXED;
+		default:
+			fatal("unknown state");
+	}
+}
+
+int
+io_dx(struct connection *cx, int destroy)
+{
+	if (cx->st_cur == IO_ST_DXED && !destroy)
+		return IO_ERR_DXED;
+
+	cx->callback = !destroy;
+
+	if (cx->st_cur != IO_ST_DXED)
+		io_loop_st(cx, IO_ST_DXED);
+
+	if (destroy) {
+		free((void*)cx->host);
+		free((void*)cx->port);
+		free((void*)cx->tls_ca_file);
+		free((void*)cx->tls_ca_path);
+		free((void*)cx->tls_cert);
+		free((void*)cx->tls_ciphers);
+		free((void*)cx->tls_groups);
+
+		mbedtls_ssl_session_free(&(cx->tls_session));
+
+		if (cx->next)
+			cx->next->prev = cx->prev;
+
+		if (cx->prev)
+			cx->prev->next = cx->next;
+		else
+			io_loop_cxs = cx->next;
+
+		/* Events already returned by epoll for the connection are
+		 * discarded, and the connection is freed after dispatch */
+		cx->destroyed = 1;
+		cx->next = io_loop_free;
+		io_loop_free = cx;
+	}
+
+	return IO_ERR_NONE;
+}
+#else
+
 int
 io_cx(struct connection *cx)
 {
@@ -268,28 +584,36 @@ io_dx(struct connection *cx, int destroy)
 		cx->st_new = IO_ST_DXED;
 		PT_UL(&(cx->mtx));
 
-		/* HACK: temporarily unlock the callback mutex, for cases when the
-		 * connection thread might be already simultaneously waiting on it.
-		 * Setting `destroy` prevents the thread from attempting additional
+		/* Setting `destroy` prevents the thread from queueing additional
 		 * callbacks before moving to the DXED state */
 		PT_CF(pthread_kill(cx->tid, SIGUSR1));
-		PT_UL(&io_cb_mutex);
 		PT_CF(pthread_join(cx->tid, NULL));
-		PT_LK(&io_cb_mutex);
 	}
 
 	if (destroy) {
-		PT_CF(pthread_mutex_destroy(&(cx->mtx)));
 		free((void*)cx->host);
 		free((void*)cx->port);
 		free((void*)cx->tls_ca_file);
 		free((void*)cx->tls_ca_path);
 		free((void*)cx->tls_cert);
-		free(cx);
+		free((void*)cx->tls_ciphers);
+		free((void*)cx->tls_groups);
+
+		mbedtls_ssl_session_free(&(cx->tls_session));
+
+		/* Events already queued for the connection are discarded, and
+		 * the connection is freed once they've been dequeued */
+		cx->destroyed = 1;
+		cx->callback = 1;
+		io_ev(cx, IO_EV_FREE, 0, NULL, 0);
+
+		PT_CF(pthread_mutex_destroy(&(cx->mtx)));
+		PT_CF(pthread_mutex_destroy(&(cx->mtx_io)));
 	}
 
 	return IO_ERR_NONE;
 }
+#endif
 
 int
 io_sendf(struct connection *cx, const char *fmt, ...)
@@ -297,8 +621,11 @@ io_sendf(struct connection *cx, const char *fmt, ...)
 	unsigned char sendbuf[IO_MESG_LEN + 2];
 	int ret;
 	size_t len;
-	size_t written;
 	va_list ap;
+#if !IO_EPOLL
+	size_t written;
+	struct pollfd fd;
+#endif
 
 	if (cx->st_cur != IO_ST_CXED && cx->st_cur != IO_ST_PING)
 		return IO_ERR_DXED;
@@ -320,14 +647,46 @@ io_sendf(struct connection *cx, const char *fmt, ...)
 	sendbuf[len++] = '\r';
 	sendbuf[len++] = '\n';
 
+#if IO_EPOLL
+	/* Bytes are queued after those already pending, and written at once
+	 * when none are. A peer not reading IO_SEND_MAX bytes is reconnected */
+	if (cx->sendq_len + len > IO_SEND_MAX)
+		goto err;
+
+	if (cx->sendq_len + len > cx->sendq_size) {
+
+		size_t size = MIN(MAX(cx->sendq_size * 2, cx->sendq_len + len), IO_SEND_MAX);
+
+		if ((cx->sendq = realloc(cx->sendq, size)) == NULL)
+			fatal("realloc: %s", strerror(errno));
+
+		cx->sendq_size = size;
+	}
+
+	memcpy(cx->sendq + cx->sendq_len, sendbuf, len);
+
+	if ((cx->sendq_len += len) == len && io_loop_send(cx) < 0)
+		goto err;
+#else
 	ret = 0;
 	written = 0;
 
+	/* The connection thread reads the socket concurrently. Writes hold
+	 * mtx_io until complete, waiting at most IO_CONNECT_TIMEOUT for the
+	 * socket, such that reads never interleave a partially written record */
+	PT_LK(&(cx->mtx_io));
+
+	/* Closed by the connection thread, pending its next state */
+	if ((fd.fd = cx->net_ctx.fd) < 0) {
+		PT_UL(&(cx->mtx_io));
+		return IO_ERR_DXED;
+	}
+
 	do {
 		if (cx->flags & IO_TLS_ENABLED) {
-			ret = mbedtls_ssl_write(&(cx->tls_ctx), sendbuf + ret, len - ret);
+			ret = mbedtls_ssl_write(&(cx->tls_ctx), sendbuf + written, len - written);
 		} else {
-			ret = mbedtls_net_send(&(cx->net_ctx), sendbuf + ret, len - ret);
+			ret = mbedtls_net_send(&(cx->net_ctx), sendbuf + written, len - written);
 		}
 
 		if (ret >= 0)
@@ -336,28 +695,142 @@ io_sendf(struct connection *cx, const char *fmt, ...)
 		switch (ret) {
 			case MBEDTLS_ERR_SSL_WANT_READ:
 			case MBEDTLS_ERR_SSL_WANT_WRITE:
+				fd.events = (ret == MBEDTLS_ERR_SSL_WANT_READ ? POLLIN : POLLOUT);
+				while ((ret = poll(&fd, 1, SEC_IN_MS(IO_CONNECT_TIMEOUT))) < 0 && errno == EINTR)
+					;
+				if (ret <= 0)
+					goto err;
 				ret = 0;
 				continue;
 			default:
-				io_dx(cx, 0);
-				io_cx(cx);
-				return IO_ERR_SSL_WRITE;
+				goto err;
 		}
 	} while ((written += ret) < len);
 
+	PT_UL(&(cx->mtx_io));
+#endif
+
 	return IO_ERR_NONE;
+
+err:
+
+#if !IO_EPOLL
+	PT_UL(&(cx->mtx_io));
+#endif
+
+	io_dx(cx, 0);
+	io_cx(cx);
+
+	return IO_ERR_SSL_WRITE;
+}
+
+#if IO_EPOLL
+void
+io_init(void)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	sigset_t sigset;
+
+	io_tty_init();
+
+	/* SIGWINCH is read from a signalfd rather than interrupting epoll */
+	if (sigemptyset(&sigset) < 0 || sigaddset(&sigset, SIGWINCH) < 0)
+		fatal("sigset: %s", strerror(errno));
+
+	if (sigprocmask(SIG_BLOCK, &sigset, NULL) < 0)
+		fatal("sigprocmask: %s", strerror(errno));
+
+	if ((io_loop_sigfd = signalfd(-1, &sigset, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+		fatal("signalfd: %s", strerror(errno));
+
+	if ((io_loop_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		fatal("epoll_create1: %s", strerror(errno));
+
+	ev.data.ptr = NULL;
+
+	if (epoll_ctl(io_loop_epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) < 0)
+		fatal("epoll_ctl: %s", strerror(errno));
+
+	ev.data.ptr = &io_loop_sigfd;
+
+	if (epoll_ctl(io_loop_epfd, EPOLL_CTL_ADD, io_loop_sigfd, &ev) < 0)
+		fatal("epoll_ctl: %s", strerror(errno));
 }
 
+void
+io_start(void)
+{
+	struct connection *cx;
+	struct epoll_event evs[32];
+
+	io_running = 1;
+
+	io_tty_winsize();
+
+	while (io_running) {
+
+		int n;
+		int timeout = io_loop_timeout();
+		int timeout_idle = io_cb_idle();
+
+		if (timeout < 0 || (timeout_idle >= 0 && timeout_idle < timeout))
+			timeout = timeout_idle;
+
+		if ((n = epoll_wait(io_loop_epfd, evs, ARR_LEN(evs), timeout)) < 0) {
+			if (errno != EINTR)
+				fatal("epoll_wait: %s", strerror(errno));
+			continue;
+		}
+
+		for (int i = 0; i < n; i++) {
+
+			if (evs[i].data.ptr == NULL) {
+				io_loop_stdin();
+			} else if (evs[i].data.ptr == &io_loop_sigfd) {
+				struct signalfd_siginfo si;
+				while (read(io_loop_sigfd, &si, sizeof(si)) == sizeof(si))
+					;
+				io_tty_winsize();
+			} else {
+				io_loop_poll(evs[i].data.ptr);
+			}
+		}
+
+		io_loop_timers();
+		io_loop_pending();
+
+		while ((cx = io_loop_free)) {
+			io_loop_free = cx->next;
+			free(cx);
+		}
+	}
+}
+#else
 void
 io_init(void)
 {
 	io_sig_init();
 	io_tty_init();
+
+	if (pipe(io_ev_pipe) < 0)
+		fatal("pipe: %s", strerror(errno));
+
+	for (int i = 0; i < 2; i++) {
+		if (fcntl(io_ev_pipe[i], F_SETFL, O_NONBLOCK) < 0)
+			fatal("fcntl: %s", strerror(errno));
+		if (fcntl(io_ev_pipe[i], F_SETFD, FD_CLOEXEC) < 0)
+			fatal("fcntl: %s", strerror(errno));
+	}
 }
 
 void
 io_start(void)
 {
+	struct pollfd fds[2] = {
+		{ .fd = STDIN_FILENO,   .events = POLLIN },
+		{ .fd = io_ev_pipe[0], .events = POLLIN },
+	};
+
 	io_running = 1;
 
 	io_tty_winsize();
@@ -365,24 +838,40 @@ io_start(void)
 	while (io_running) {
 
 		char buf[128];
-		ssize_t ret = read(STDIN_FILENO, buf, sizeof(buf));
+		ssize_t ret;
+
+		if (poll(fds, 2, io_cb_idle()) < 0) {
+			if (errno != EINTR)
+				fatal("poll: %s", strerror(errno));
+			if (flag_sigwinch_cb) {
+				flag_sigwinch_cb = 0;
+				io_tty_winsize();
+			}
+			continue;
+		}
 
-		if (ret > 0) {
-			PT_LK(&io_cb_mutex);
-			io_cb_read_inp(buf, ret);
-			PT_UL(&io_cb_mutex);
-		} else {
-			if (errno == EINTR) {
-				if (flag_sigwinch_cb) {
-					flag_sigwinch_cb = 0;
-					io_tty_winsize();
-				}
-			} else {
+		if (fds[1].revents & POLLIN) {
+
+			/* Reset the signal before dispatching, such that events
+			 * queued during dispatch signal the main thread again */
+			while (read(io_ev_pipe[0], buf, sizeof(buf)) > 0)
+				;
+
+			atomic_exchange_explicit(&io_ev_signalled, 0, memory_order_acquire);
+
+			io_ev_dispatch();
+		}
+
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+
+			if ((ret = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+				io_cb_read_inp(buf, ret);
+			else if (ret == 0 || errno != EINTR)
 				fatal("read: %s", ret ? strerror(errno) : "EOF");
-			}
 		}
 	}
 }
+#endif
 
 void
 io_stop(void)
@@ -398,9 +887,7 @@ io_tty_winsize(void)
 	if (ioctl(0, TIOCGWINSZ, &tty_ws) < 0)
 		fatal("ioctl: %s", strerror(errno));
 
-	PT_LK(&io_cb_mutex);
 	io_cb_sigwinch(tty_ws.ws_col, tty_ws.ws_row);
-	PT_UL(&io_cb_mutex);
 }
 
 const char*
@@ -420,8 +907,62 @@ io_err(int err)
 	}
 }
 
-static enum io_state
-io_state_rxng(struct connection *cx)
+uint32_t
+io_tls_versions(void)
+{
+	return IO_TLS_VERSION_1_2 | (IO_TLS_1_3 ? IO_TLS_VERSION_1_3 : 0);
+}
+
+static void
+io_state_cb(struct connection *cx, enum io_state st_cur, enum io_state st_new)
+{
+	/* State transition callbacks */
+
+	switch (ST_X(st_cur, st_new)) {
+		case ST_X(IO_ST_DXED, IO_ST_CXNG): /* A1 */
+		case ST_X(IO_ST_RXNG, IO_ST_CXNG): /* A2,C */
+			io_info(cx, "Connecting to %s:%s", cx->host, cx->port);
+			break;
+		case ST_X(IO_ST_CXED, IO_ST_CXNG): /* F1 */
+			io_dxed(cx);
+			break;
+		case ST_X(IO_ST_PING, IO_ST_CXNG): /* F2 */
+			io_error(cx, "Connection timeout (%u)", cx->ping);
+			io_dxed(cx);
+			break;
+		case ST_X(IO_ST_RXNG, IO_ST_DXED): /* B1 */
+		case ST_X(IO_ST_CXNG, IO_ST_DXED): /* B2 */
+			io_info(cx, "Connection cancelled");
+			break;
+		case ST_X(IO_ST_CXED, IO_ST_DXED): /* B3 */
+		case ST_X(IO_ST_PING, IO_ST_DXED): /* B4 */
+			io_info(cx, "Connection closed");
+			io_dxed(cx);
+			break;
+		case ST_X(IO_ST_CXNG, IO_ST_CXED): /* D */
+			io_info(cx, " .. Connection successful");
+			io_cxed(cx);
+			cx->rx_sleep = 0;
+			break;
+		case ST_X(IO_ST_CXNG, IO_ST_RXNG): /* E */
+			io_error(cx, " .. Connection failed -- retrying");
+			break;
+		case ST_X(IO_ST_CXED, IO_ST_PING): /* G */
+			io_ping(cx, (cx->ping = IO_PING_MIN));
+			break;
+		case ST_X(IO_ST_PING, IO_ST_PING): /* H */
+			io_ping(cx, (cx->ping += IO_PING_REFRESH));
+			break;
+		case ST_X(IO_ST_PING, IO_ST_CXED): /* I */
+			io_ping(cx, (cx->ping = 0));
+			break;
+		default:
+			fatal("BAD ST_X from: %d to: %d", st_cur, st_new);
+	}
+}
+
+static unsigned
+io_rx_sleep(struct connection *cx)
 {
 	if (cx->rx_sleep == 0) {
 		cx->rx_sleep = IO_RECONNECT_BACKOFF_BASE;
@@ -436,7 +977,14 @@ io_state_rxng(struct connection *cx)
 		(cx->rx_sleep / 60),
 		(cx->rx_sleep % 60));
 
-	sleep(cx->rx_sleep);
+	return cx->rx_sleep;
+}
+
+#if !IO_EPOLL
+static enum io_state
+io_state_rxng(struct connection *cx)
+{
+	sleep(io_rx_sleep(cx));
 
 	return IO_ST_CXNG;
 }
@@ -450,6 +998,16 @@ io_state_cxng(struct connection *cx)
 	if ((cx->flags & IO_TLS_ENABLED) && io_tls_establish(cx) < 0)
 		return IO_ST_RXNG;
 
+	/* Connected sockets are read and written without blocking, such that
+	 * neither holds mtx_io while waiting on the network */
+	if (mbedtls_net_set_nonblock(&(cx->net_ctx))) {
+		io_error(cx, "Connection error");
+		mbedtls_net_free(&(cx->net_ctx));
+		if (cx->flags & IO_TLS_ENABLED)
+			io_tls_free(cx);
+		return IO_ST_RXNG;
+	}
+
 	return IO_ST_CXED;
 }
 
@@ -488,18 +1046,14 @@ io_state_cxed(struct connection *cx)
 			break;
 	}
 
+	PT_LK(&(cx->mtx_io));
+
 	mbedtls_net_free(&(cx->net_ctx));
 
-	if (cx->flags & IO_TLS_ENABLED) {
-		mbedtls_ctr_drbg_free(&(cx->tls_ctr_drbg));
-		mbedtls_entropy_free(&(cx->tls_entropy));
-		mbedtls_pk_free(&(cx->tls_pk_ctx));
-		mbedtls_ssl_config_free(&(cx->tls_conf));
-		mbedtls_ssl_free(&(cx->tls_ctx));
-		mbedtls_x509_crt_free(&(cx->tls_x509_crt_ca));
-		mbedtls_x509_crt_free(&(cx->tls_x509_crt_client));
+	if (cx->flags & IO_TLS_ENABLED)
+		io_tls_free(cx);
 
-	}
+	PT_UL(&(cx->mtx_io));
 
 	return IO_ST_CXNG;
 }
@@ -533,17 +1087,14 @@ io_state_ping(struct connection *cx)
 			break;
 	}
 
+	PT_LK(&(cx->mtx_io));
+
 	mbedtls_net_free(&(cx->net_ctx));
 
-	if (cx->flags & IO_TLS_ENABLED) {
-		mbedtls_ctr_drbg_free(&(cx->tls_ctr_drbg));
-		mbedtls_entropy_free(&(cx->tls_entropy));
-		mbedtls_pk_free(&(cx->tls_pk_ctx));
-		mbedtls_ssl_config_free(&(cx->tls_conf));
-		mbedtls_ssl_free(&(cx->tls_ctx));
-		mbedtls_x509_crt_free(&(cx->tls_x509_crt_ca));
-		mbedtls_x509_crt_free(&(cx->tls_x509_crt_client));
-	}
+	if (cx->flags & IO_TLS_ENABLED)
+		io_tls_free(cx);
+
+	PT_UL(&(cx->mtx_io));
 
 	return IO_ST_CXNG;
 }
@@ -592,48 +1143,7 @@ io_thread(void *arg)
 
 		PT_UL(&(cx->mtx));
 
-		/* State transitions */
-		switch (ST_X(st_cur, st_new)) {
-			case ST_X(IO_ST_DXED, IO_ST_CXNG): /* A1 */
-			case ST_X(IO_ST_RXNG, IO_ST_CXNG): /* A2,C */
-				io_info(cx, "Connecting to %s:%s", cx->host, cx->port);
-				break;
-			case ST_X(IO_ST_CXED, IO_ST_CXNG): /* F1 */
-				io_dxed(cx);
-				break;
-			case ST_X(IO_ST_PING, IO_ST_CXNG): /* F2 */
-				io_error(cx, "Connection timeout (%u)", cx->ping);
-				io_dxed(cx);
-				break;
-			case ST_X(IO_ST_RXNG, IO_ST_DXED): /* B1 */
-			case ST_X(IO_ST_CXNG, IO_ST_DXED): /* B2 */
-				io_info(cx, "Connection cancelled");
-				break;
-			case ST_X(IO_ST_CXED, IO_ST_DXED): /* B3 */
-			case ST_X(IO_ST_PING, IO_ST_DXED): /* B4 */
-				io_info(cx, "Connection closed");
-				io_dxed(cx);
-				break;
-			case ST_X(IO_ST_CXNG, IO_ST_CXED): /* D */
-				io_info(cx, " .. Connection successful");
-				io_cxed(cx);
-				cx->rx_sleep = 0;
-				break;
-			case ST_X(IO_ST_CXNG, IO_ST_RXNG): /* E */
-				io_error(cx, " .. Connection failed -- retrying");
-				break;
-			case ST_X(IO_ST_CXED, IO_ST_PING): /* G */
-				io_ping(cx, (cx->ping = IO_PING_MIN));
-				break;
-			case ST_X(IO_ST_PING, IO_ST_PING): /* H */
-				io_ping(cx, (cx->ping += IO_PING_REFRESH));
-				break;
-			case ST_X(IO_ST_PING, IO_ST_CXED): /* I */
-				io_ping(cx, (cx->ping = 0));
-				break;
-			default:
-				fatal("BAD ST_X from: %d to: %d", st_cur, st_new);
-		}
+		io_state_cb(cx, st_cur, st_new);
 
 	} while (cx->st_cur != IO_ST_DXED);
 
@@ -643,44 +1153,639 @@ io_thread(void *arg)
 static int
 io_cx_read(struct connection *cx, uint32_t timeout)
 {
+	/* Read the socket once readable, queueing an event sized to the bytes
+	 * read. Partial TLS records are polled for again within the timeout */
+
+	char buf[IO_READ_SIZE];
 	int ret;
-	struct pollfd fd[1];
-	unsigned char buf[1024];
 
-	fd[0].fd = cx->net_ctx.fd;
-	fd[0].events = POLLIN;
+	do {
+		struct pollfd fd = { .fd = cx->net_ctx.fd, .events = POLLIN };
 
-	while ((ret = poll(fd, 1, timeout)) < 0 && errno == EAGAIN)
-		continue;
+		if ((ret = poll(&fd, 1, (int) timeout)) == 0)
+			return MBEDTLS_ERR_SSL_TIMEOUT;
 
-	if (ret == 0)
-		return MBEDTLS_ERR_SSL_TIMEOUT;
+		if (ret < 0 && errno == EINTR)
+			return MBEDTLS_ERR_SSL_WANT_READ;
 
-	if (ret < 0 && errno == EINTR)
-		return MBEDTLS_ERR_SSL_WANT_READ;
+		if (ret < 0)
+			fatal("poll: %s", strerror(errno));
 
-	if (ret < 0)
-		fatal("poll: %s", strerror(errno));
+		PT_LK(&(cx->mtx_io));
 
-	if (cx->flags & IO_TLS_ENABLED) {
-		ret = mbedtls_ssl_read(&(cx->tls_ctx), buf, sizeof(buf));
-	} else {
-		ret = mbedtls_net_recv(&(cx->net_ctx), buf, sizeof(buf));
-	}
+		if (cx->flags & IO_TLS_ENABLED) {
+			ret = mbedtls_ssl_read(&(cx->tls_ctx), (unsigned char *)buf, sizeof(buf));
+		} else {
+			ret = mbedtls_net_recv(&(cx->net_ctx), (unsigned char *)buf, sizeof(buf));
+		}
 
-	if (ret > 0) {
-		PT_LK(&io_cb_mutex);
-		io_cb_read_soc((char *)buf, (size_t)ret,  cx->obj);
-		PT_UL(&io_cb_mutex);
-	}
+		PT_UL(&(cx->mtx_io));
+
+	} while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+
+	if (ret > 0)
+		io_ev(cx, IO_EV_READ, 0, buf, (size_t) ret);
 
 	return ret;
 }
 
 static void
-io_fatal(const char *f, int errnum)
+io_ev(struct connection *cx, enum io_event_type type, unsigned ping, const char *buf, size_t len)
 {
-	char errbuf[512];
+	/* Queue a callback event for the main thread */
+
+	struct io_event *ev;
+
+	if ((ev = malloc(sizeof(*ev) + len + 1)) == NULL)
+		fatal("malloc: %s", strerror(errno));
+
+	ev->type = type;
+	ev->ping = ping;
+	ev->len = len;
+
+	if (len)
+		memcpy(ev->buf, buf, len);
+
+	ev->buf[len] = 0;
+
+	io_ev_send(cx, ev);
+}
+
+static void
+io_ev_send(struct connection *cx, struct io_event *ev)
+{
+	/* Queue an event for the main thread, and signal it */
+
+	int callback;
+
+	PT_LK(&(cx->mtx));
+	callback = cx->callback;
+	PT_UL(&(cx->mtx));
+
+	if (!callback) {
+		free(ev);
+		return;
+	}
+
+	ev->cx = cx;
+
+	io_ev_push(ev);
+
+	if (!atomic_exchange(&io_ev_signalled, 1)) {
+		while (write(io_ev_pipe[1], "", 1) < 0 && errno == EINTR)
+			;
+	}
+}
+
+static void
+io_evf(struct connection *cx, enum io_event_type type, const char *fmt, ...)
+{
+	/* Queue a formatted informational callback event for the main thread */
+
+	char buf[IO_MESG_LEN + 1];
+	int ret;
+	va_list ap;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (ret > 0)
+		io_ev(cx, type, 0, buf, MIN((size_t)ret, sizeof(buf) - 1));
+}
+
+static void
+io_ev_push(struct io_event *ev)
+{
+	/* Push an event to the queue, from any thread */
+
+	struct io_event *prev;
+
+	atomic_store_explicit(&(ev->next), NULL, memory_order_relaxed);
+
+	prev = atomic_exchange_explicit(&io_ev_head, ev, memory_order_acq_rel);
+
+	atomic_store_explicit(&(prev->next), ev, memory_order_release);
+}
+
+static struct io_event*
+io_ev_pop(void)
+{
+	/* Pop the oldest event from the queue, from the main thread only
+	 *
+	 * Returns NULL when the queue is empty, or when the next event's push
+	 * is in progress, in which case its thread has yet to signal the main
+	 * thread. The stub event is re-pushed to separate the last event from
+	 * the head, such that it can be popped */
+
+	struct io_event *tail = io_ev_tail;
+	struct io_event *next = atomic_load_explicit(&(tail->next), memory_order_acquire);
+
+	if (tail == &io_ev_stub) {
+
+		if (next == NULL)
+			return NULL;
+
+		io_ev_tail = tail = next;
+		next = atomic_load_explicit(&(tail->next), memory_order_acquire);
+	}
+
+	if (next == NULL) {
+
+		if (tail != atomic_load_explicit(&io_ev_head, memory_order_acquire))
+			return NULL;
+
+		io_ev_push(&io_ev_stub);
+
+		if ((next = atomic_load_explicit(&(tail->next), memory_order_acquire)) == NULL)
+			return NULL;
+	}
+
+	io_ev_tail = next;
+
+	return tail;
+}
+
+static void
+io_ev_dispatch(void)
+{
+	/* Dispatch all queued events, from the main thread */
+
+	struct io_event *ev;
+
+	while ((ev = io_ev_pop())) {
+
+		struct connection *cx = ev->cx;
+
+		if (cx->destroyed) {
+			if (ev->type == IO_EV_FREE)
+				free(cx);
+			free(ev);
+			continue;
+		}
+
+		switch (ev->type) {
+			case IO_EV_CXED:  io_cb_cxed(cx->obj); break;
+			case IO_EV_DXED:  io_cb_dxed(cx->obj); break;
+			case IO_EV_ERROR: io_cb_error(cx->obj, "%s", ev->buf); break;
+			case IO_EV_INFO:  io_cb_info(cx->obj, "%s", ev->buf); break;
+			case IO_EV_PING:  io_cb_ping(cx->obj, ev->ping); break;
+			case IO_EV_READ:  io_cb_read_soc(ev->buf, ev->len, cx->obj); break;
+			default:
+				fatal("invalid event: %d", ev->type);
+		}
+
+		free(ev);
+	}
+}
+
+#else
+static int
+io_loop_timeout(void)
+{
+	/* Milliseconds until the nearest connection deadline, or -1, or 0
+	 * with reads pending */
+
+	struct connection *cx;
+	uint64_t deadline = 0;
+	uint64_t now;
+
+	for (cx = io_loop_cxs; cx; cx = cx->next) {
+		if (cx->rd_pending)
+			return 0;
+		if (cx->deadline && (!deadline || cx->deadline < deadline))
+			deadline = cx->deadline;
+	}
+
+	if (!deadline)
+		return -1;
+
+	if (deadline <= (now = io_now()))
+		return 0;
+
+	return (int) MIN(deadline - now, (uint64_t) SEC_IN_MS(86400));
+}
+
+static void
+io_loop_close(struct connection *cx)
+{
+	/* Close the connection's socket, its host query, attempts and resolved
+	 * addresses. Closing a socket removes it from the epoll set */
+
+	if (cx->net_ctx.fd >= 0) {
+
+		if (cx->tls_init)
+			io_tls_free(cx);
+
+		mbedtls_net_free(&(cx->net_ctx));
+	}
+
+	dns_query_free(&(cx->dns));
+	io_net_race_free(cx);
+
+	free(cx->sendq);
+
+	cx->sendq = NULL;
+	cx->sendq_len = 0;
+	cx->sendq_size = 0;
+	cx->sendq_tls = 0;
+	cx->sendq_watch = 0;
+	cx->rd_pending = 0;
+	cx->tls_init = 0;
+}
+
+static void
+io_loop_connect(struct connection *cx)
+{
+	io_loop_resolve(cx, io_dns(cx));
+}
+
+static void
+io_loop_handshake(struct connection *cx)
+{
+	int ret;
+
+	switch ((ret = mbedtls_ssl_handshake(&(cx->tls_ctx)))) {
+		case MBEDTLS_ERR_SSL_WANT_READ:
+			io_loop_watch(cx, EPOLLIN);
+			return;
+		case MBEDTLS_ERR_SSL_WANT_WRITE:
+			io_loop_watch(cx, EPOLLOUT);
+			return;
+		default:
+			break;
+	}
+
+	if (io_tls_verify(cx, ret) < 0) {
+		io_error(cx, " .. TLS connection failure");
+		cx->tls_resume = 0;
+		io_loop_st(cx, IO_ST_RXNG);
+		return;
+	}
+
+	io_tls_session_save(cx, 0);
+
+	io_loop_st(cx, IO_ST_CXED);
+}
+
+static void
+io_loop_pending(void)
+{
+	/* Read connections deferred by IO_READ_MAX in an earlier wakeup,
+	 * rescanning after each since its callbacks can modify the connection
+	 * list. Connections deferred again are read after the next wakeup */
+
+	struct connection *cx = io_loop_cxs;
+
+	while (cx) {
+
+		if (cx->rd_pending != 2) {
+			cx = cx->next;
+			continue;
+		}
+
+		io_loop_read(cx);
+
+		cx = io_loop_cxs;
+	}
+
+	for (cx = io_loop_cxs; cx; cx = cx->next) {
+		if (cx->rd_pending)
+			cx->rd_pending = 2;
+	}
+}
+
+static void
+io_loop_poll(struct connection *cx)
+{
+	/* Connection socket ready. Events returned for a socket closed earlier
+	 * in the batch are handled as spurious wakeups of the current socket */
+
+	if (cx->destroyed)
+		return;
+
+	switch (cx->st_cur) {
+		case IO_ST_CXNG:
+			if (cx->tls_init)
+				io_loop_handshake(cx);
+			else if (cx->dns.fd >= 0)
+				io_loop_resolve(cx, io_dns_step(cx));
+			else if (cx->race.n)
+				io_loop_race(cx);
+			break;
+		case IO_ST_CXED:
+		case IO_ST_PING:
+			/* Queued writes are retried on any readiness, since a TLS
+			 * write can also be waiting on the socket being readable */
+			if (cx->sendq_len && io_loop_send(cx) < 0) {
+				io_error(cx, "Connection error");
+				io_loop_st(cx, IO_ST_CXNG);
+				break;
+			}
+			io_loop_read(cx);
+			break;
+		default:
+			break;
+	}
+}
+
+static void
+io_loop_race(struct connection *cx)
+{
+	/* Connection attempts ready or due, the winner's socket continuing
+	 * the connection, watched by epoll since its attempt started */
+
+	char buf[512];
+	int soc;
+
+	if ((soc = io_net_race(cx, 0)) < 0) {
+
+		if (errno != EINPROGRESS) {
+			io_error(cx, " .. Failed to connect: %s", io_strerror(buf, sizeof(buf)));
+			io_loop_st(cx, IO_ST_RXNG);
+			return;
+		}
+
+		for (unsigned i = 0; i < cx->race.n; i++) {
+
+			struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = cx };
+
+			if (epoll_ctl(io_loop_epfd, EPOLL_CTL_ADD, cx->race.attempts[i].fd, &ev) < 0 && errno != EEXIST)
+				fatal("epoll_ctl: %s", strerror(errno));
+		}
+
+		cx->deadline = io_net_race_deadline(cx);
+		return;
+	}
+
+	cx->net_ctx.fd = soc;
+
+	if (!(cx->flags & IO_TLS_ENABLED)) {
+		io_loop_st(cx, IO_ST_CXED);
+		return;
+	}
+
+	/* The handshake is abandoned after IO_CONNECT_TIMEOUT */
+	cx->deadline = io_now() + SEC_IN_MS((uint64_t) IO_CONNECT_TIMEOUT);
+	cx->tls_init = 1;
+
+	if (io_tls_init(cx) < 0) {
+		io_error(cx, " .. TLS connection failure");
+		io_loop_st(cx, IO_ST_RXNG);
+		return;
+	}
+
+	io_loop_handshake(cx);
+}
+
+static void
+io_loop_read(struct connection *cx)
+{
+	/* Read until the socket would block into a buffer shared by all
+	 * connections, its contents being handled before returning. Reads
+	 * are deferred to the next wakeup after IO_READ_MAX, such that a
+	 * busy connection doesn't starve stdin or other connections */
+
+	static unsigned char buf[IO_READ_SIZE + 1];
+
+	int ret;
+	unsigned reads = 0;
+
+	cx->rd_pending = 0;
+
+	do {
+		if (reads++ == IO_READ_MAX) {
+			cx->rd_pending = 1;
+			return;
+		}
+
+		if (cx->flags & IO_TLS_ENABLED) {
+			ret = mbedtls_ssl_read(&(cx->tls_ctx), buf, IO_READ_SIZE);
+		} else {
+			ret = mbedtls_net_recv(&(cx->net_ctx), buf, IO_READ_SIZE);
+		}
+
+		if (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+			io_tls_session_save(cx, 1);
+			continue;
+		}
+
+		if (ret <= 0)
+			break;
+
+		buf[ret] = 0;
+
+		if (cx->st_cur == IO_ST_PING)
+			io_loop_st(cx, IO_ST_CXED);
+		else
+			cx->deadline = io_now() + SEC_IN_MS(IO_PING_MIN);
+
+		io_cb_read_soc((char *)buf, (size_t)ret, cx->obj);
+
+		/* Callbacks can disconnect or destroy the connection */
+		if (cx->destroyed || cx->st_cur != IO_ST_CXED)
+			return;
+
+	} while (1);
+
+	switch (ret) {
+		case MBEDTLS_ERR_SSL_WANT_READ:
+		case MBEDTLS_ERR_SSL_WANT_WRITE:
+			return;
+		case MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY:
+			io_info(cx, "Connection closed gracefully");
+			break;
+		case MBEDTLS_ERR_NET_CONN_RESET:
+		case 0:
+			io_error(cx, "Connection reset by peer");
+			break;
+		default:
+			io_error(cx, "Connection error");
+			break;
+	}
+
+	io_loop_st(cx, IO_ST_CXNG);
+}
+
+static void
+io_loop_resolve(struct connection *cx, int ret)
+{
+	/* Host query started or stepped, racing connections once resolved.
+	 * The socket of each nameserver attempt is watched by epoll until
+	 * responded to or the attempt's deadline */
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = cx };
+
+	if (ret < 0) {
+		io_loop_st(cx, IO_ST_RXNG);
+		return;
+	}
+
+	if (ret == 0) {
+		io_loop_race(cx);
+		return;
+	}
+
+	/* Queries retried over TCP are writable once connected */
+	if (cx->dns.events & POLLOUT)
+		ev.events = EPOLLOUT;
+
+	if (epoll_ctl(io_loop_epfd, EPOLL_CTL_ADD, cx->dns.fd, &ev) < 0
+	 && (errno != EEXIST || epoll_ctl(io_loop_epfd, EPOLL_CTL_MOD, cx->dns.fd, &ev) < 0))
+		fatal("epoll_ctl: %s", strerror(errno));
+
+	cx->deadline = cx->dns.deadline;
+}
+
+static int
+io_loop_send(struct connection *cx)
+{
+	/* Write queued bytes until the socket would block, watching for it
+	 * being writable while bytes remain. A TLS write that would block is
+	 * retried with the same length, as required by mbedtls */
+
+	int ret;
+
+	while (cx->sendq_len) {
+
+		size_t len = (cx->sendq_tls ? cx->sendq_tls : cx->sendq_len);
+
+		if (cx->flags & IO_TLS_ENABLED) {
+			ret = mbedtls_ssl_write(&(cx->tls_ctx), cx->sendq, len);
+		} else {
+			ret = mbedtls_net_send(&(cx->net_ctx), cx->sendq, len);
+		}
+
+		if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+			cx->sendq_tls = ((cx->flags & IO_TLS_ENABLED) ? len : 0);
+			break;
+		}
+
+		if (ret <= 0)
+			return -1;
+
+		cx->sendq_tls = 0;
+		cx->sendq_len -= (size_t) ret;
+
+		memmove(cx->sendq, cx->sendq + ret, cx->sendq_len);
+	}
+
+	if (cx->sendq_watch != !!cx->sendq_len) {
+		cx->sendq_watch = !!cx->sendq_len;
+		io_loop_watch(cx, (cx->sendq_watch ? (EPOLLIN | EPOLLOUT) : EPOLLIN));
+	}
+
+	return 0;
+}
+
+static void
+io_loop_st(struct connection *cx, enum io_state st_new)
+{
+	/* Transition to a new state, and run the state's entry action */
+
+	enum io_state st_cur = cx->st_cur;
+
+	if (st_new == IO_ST_CXNG || st_new == IO_ST_RXNG || st_new == IO_ST_DXED)
+		io_loop_close(cx);
+
+	cx->st_cur = st_new;
+	cx->deadline = 0;
+
+	io_state_cb(cx, st_cur, st_new);
+
+	switch (st_new) {
+		case IO_ST_CXNG:
+			io_loop_connect(cx);
+			break;
+		case IO_ST_RXNG:
+			cx->deadline = io_now() + SEC_IN_MS((uint64_t) io_rx_sleep(cx));
+			break;
+		case IO_ST_CXED:
+			io_loop_watch(cx, (cx->sendq_watch ? (EPOLLIN | EPOLLOUT) : EPOLLIN));
+			if (IO_PING_MIN)
+				cx->deadline = io_now() + SEC_IN_MS(IO_PING_MIN);
+			break;
+		case IO_ST_PING:
+			if (IO_PING_MAX && cx->ping >= IO_PING_MAX)
+				io_loop_st(cx, IO_ST_CXNG);
+			else if (IO_PING_REFRESH)
+				cx->deadline = io_now() + SEC_IN_MS(IO_PING_REFRESH);
+			break;
+		default:
+			break;
+	}
+}
+
+static void
+io_loop_stdin(void)
+{
+	char buf[128];
+	ssize_t ret;
+
+	if ((ret = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+		io_cb_read_inp(buf, ret);
+	else if (ret == 0 || (errno != EINTR && errno != EAGAIN))
+		fatal("read: %s", ret ? strerror(errno) : "EOF");
+}
+
+static void
+io_loop_timers(void)
+{
+	/* Run expired connection deadlines, rescanning after each since
+	 * its callbacks can modify the connection list */
+
+	struct connection *cx = io_loop_cxs;
+	uint64_t now = io_now();
+
+	while (cx) {
+
+		if (!cx->deadline || cx->deadline > now) {
+			cx = cx->next;
+			continue;
+		}
+
+		switch (cx->st_cur) {
+			case IO_ST_CXNG:
+				if (cx->tls_init) {
+					io_error(cx, " .. TLS handshake timed out");
+					io_loop_st(cx, IO_ST_RXNG);
+				} else if (cx->dns.fd >= 0) {
+					io_loop_resolve(cx, io_dns_step(cx));
+				} else {
+					io_loop_race(cx);
+				}
+				break;
+			case IO_ST_RXNG: io_loop_st(cx, IO_ST_CXNG); break;
+			case IO_ST_CXED: io_loop_st(cx, IO_ST_PING); break;
+			case IO_ST_PING: io_loop_st(cx, IO_ST_PING); break;
+			default:
+				cx->deadline = 0;
+				break;
+		}
+
+		cx = io_loop_cxs;
+		now = io_now();
+	}
+}
+
+static void
+io_loop_watch(struct connection *cx, uint32_t events)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = cx };
+
+	if (epoll_ctl(io_loop_epfd, EPOLL_CTL_MOD, cx->net_ctx.fd, &ev) == 0)
+		return;
+
+	if (errno != ENOENT || epoll_ctl(io_loop_epfd, EPOLL_CTL_ADD, cx->net_ctx.fd, &ev) < 0)
+		fatal("epoll_ctl: %s", strerror(errno));
+}
+#endif
+
+#if !IO_EPOLL
+static void
+io_fatal(const char *f, int errnum)
+{
+	char errbuf[128];
 
 	if (strerror_r(errnum, errbuf, sizeof(errbuf)) == 0) {
 		fatal("%s: (%d): %s", f, errnum, errbuf);
@@ -711,6 +1816,7 @@ io_sig_init(void)
 	if (sigaction(SIGUSR1, &sa, NULL) < 0)
 		fatal("sigaction - SIGUSR1: %s", strerror(errno));
 }
+#endif
 
 static void
 io_tty_init(void)
@@ -744,85 +1850,438 @@ io_tty_term(void)
 		fatal_noexit("tcsetattr: %s", strerror(errno));
 }
 
+#if !IO_EPOLL
 static int
 io_net_connect(struct connection *cx)
 {
-	char buf[MAX(INET6_ADDRSTRLEN, 512)];
-	const void *addr;
+	char buf[512];
 	int ret;
-	int soc = -1;
-	struct addrinfo *p, *res;
-	struct addrinfo hints = {
-		.ai_family   = AF_UNSPEC,
-		.ai_flags    = AI_PASSIVE,
-		.ai_protocol = IPPROTO_TCP,
-		.ai_socktype = SOCK_STREAM,
-	};
+	int soc;
+
+	if ((ret = io_dns(cx)) < 0)
+		return -1;
+
+	/* Host query pending, polled until each nameserver attempt's deadline */
+	while (ret > 0) {
+
+		struct pollfd fd = { .fd = cx->dns.fd, .events = cx->dns.events };
+		uint64_t now = io_now();
+
+		if (poll(&fd, 1, (int) (cx->dns.deadline > now ? cx->dns.deadline - now : 0)) < 0) {
+
+			if (errno != EINTR)
+				io_error(cx, " .. Failed to resolve host: %s", io_strerror(buf, sizeof(buf)));
+
+			dns_query_free(&(cx->dns));
+			return -1;
+		}
+
+		if ((ret = io_dns_step(cx)) < 0)
+			return -1;
+	}
+
+	if ((soc = io_net_race(cx, 1)) < 0) {
+
+		if (errno != EINTR)
+			io_error(cx, " .. Failed to connect: %s", io_strerror(buf, sizeof(buf)));
+
+		io_net_race_free(cx);
+		return -1;
+	}
+
+	cx->net_ctx.fd = soc;
+
+	/* Sockets are read and written blocking by connection threads */
+	if ((ret = mbedtls_net_set_block(&(cx->net_ctx)))) {
+		io_error(cx, " .. %s ", io_tls_err(ret));
+		mbedtls_net_free(&(cx->net_ctx));
+		return -1;
+	}
+
+	return soc;
+}
+#endif
+
+static int
+io_dns(struct connection *cx)
+{
+	/* Resolve a numeric host, a host listed in the hosts file, or from
+	 * cache, otherwise start querying its nameservers. Returns 0 once
+	 * resolved, the connection race initialized, 1 while the query is
+	 * pending, or -1 on failure */
+
+	struct dns_addr addrs[DNS_ADDRS_MAX];
+	struct dns_servers servers;
+	uint16_t port;
+	unsigned n = 0;
+	int family = AF_UNSPEC;
 
 	if (cx->flags & IO_IPV_4)
-		hints.ai_family = AF_INET;
+		family = AF_INET;
 
 	if (cx->flags & IO_IPV_6)
-		hints.ai_family = AF_INET6;
+		family = AF_INET6;
+
+	if (io_dns_port(cx->port, &port) < 0) {
+		io_error(cx, " .. Failed to resolve port: %s", cx->port);
+		return -1;
+	}
+
+	if (family != AF_INET6 && inet_pton(AF_INET, cx->host, &(addrs[0].u.v4)) == 1)
+		addrs[n++].family = AF_INET;
+	else if (family != AF_INET && inet_pton(AF_INET6, cx->host, &(addrs[0].u.v6)) == 1)
+		addrs[n++].family = AF_INET6;
+	else
+		n = dns_hosts(DNS_HOSTS, cx->host, family, addrs);
 
-	errno = 0;
+	if (n) {
+		io_net_race_init(cx, dns_addrinfo(addrs, n, port));
+		return 0;
+	}
+
+#if IO_EPOLL
+	n = dns_cache_get(&io_dns_cache, cx->host, family, addrs, io_now());
+#else
+	PT_LK(&io_dns_mtx);
+	n = dns_cache_get(&io_dns_cache, cx->host, family, addrs, io_now());
+	PT_UL(&io_dns_mtx);
+#endif
+
+	if (n) {
+		io_net_race_init(cx, dns_addrinfo(addrs, n, port));
+		return 0;
+	}
 
-	if ((ret = getaddrinfo(cx->host, cx->port, &hints, &res))) {
+	/* Without a readable resolv.conf its defaults are used */
+	(void) dns_servers(&servers, DNS_RESOLV_CONF);
+
+	return io_dns_done(cx, dns_query(&(cx->dns), &servers, cx->host, family, io_now()));
+}
+
+static int
+io_dns_done(struct connection *cx, int ret)
+{
+	/* Cache the resolved addresses and initialize the connection race */
+
+	char buf[512];
+	uint16_t port = 0;
+
+	if (ret == DNS_ERR_PENDING)
+		return 1;
+
+	dns_query_free(&(cx->dns));
+
+	if (ret == DNS_ERR_SYSTEM) {
+		io_error(cx, " .. Failed to resolve host: %s", io_strerror(buf, sizeof(buf)));
+		return -1;
+	}
+
+	if (ret != DNS_ERR_NONE) {
+		io_error(cx, " .. Failed to resolve host: %s", dns_err(ret));
+		return -1;
+	}
 
-		if (ret == EAI_SYSTEM && errno == EINTR)
+#if IO_EPOLL
+	dns_cache_put(&io_dns_cache, cx->host, cx->dns.family, cx->dns.addrs, cx->dns.n, cx->dns.ttl, io_now());
+#else
+	PT_LK(&io_dns_mtx);
+	dns_cache_put(&io_dns_cache, cx->host, cx->dns.family, cx->dns.addrs, cx->dns.n, cx->dns.ttl, io_now());
+	PT_UL(&io_dns_mtx);
+#endif
+
+	/* Port validated when the query started */
+	io_dns_port(cx->port, &port);
+
+	io_net_race_init(cx, dns_addrinfo(cx->dns.addrs, cx->dns.n, port));
+
+	return 0;
+}
+
+static int
+io_dns_port(const char *str, uint16_t *port)
+{
+	/* Numeric port, [1, 65535], or a service listed in the services file */
+
+	unsigned long n = 0;
+
+	if (*str == 0)
+		return -1;
+
+	if (str[strspn(str, "0123456789")])
+		return dns_service(DNS_SERVICES, str, port);
+
+	for (const char *p = str; *p; p++) {
+
+		if ((n = (n * 10) + (unsigned long) (*p - '0')) > 65535)
 			return -1;
+	}
 
-		if (ret == EAI_SYSTEM) {
-			io_error(cx, " .. Failed to resolve host: %s",
-				io_strerror(buf, sizeof(buf)));
-		} else {
-			io_error(cx, " .. Failed to resolve host: %s",
-				gai_strerror(ret));
+	if (n == 0)
+		return -1;
+
+	*port = (uint16_t) n;
+
+	return 0;
+}
+
+static int
+io_dns_step(struct connection *cx)
+{
+	return io_dns_done(cx, dns_query_step(&(cx->dns), io_now()));
+}
+
+static int
+io_net_race(struct connection *cx, int block)
+{
+	/* Start due attempts and poll those in flight, blocking until an
+	 * attempt connects or all fail. Returns the winner's socket, or -1
+	 * with errno set, EINPROGRESS if non-blocking and attempts remain */
+
+	char buf[INET6_ADDRSTRLEN];
+	const void *addr;
+	int soc;
+	struct addrinfo *ai;
+	unsigned i;
+
+	do {
+		uint64_t now = io_now();
+
+		io_net_race_start(cx, now);
+
+		if (cx->race.n == 0) {
+			errno = (cx->race.err ? cx->race.err : EHOSTUNREACH);
+			return -1;
 		}
 
+		soc = io_net_race_poll(cx, (block ? (int) (io_net_race_deadline(cx) - now) : 0));
+
+	} while (soc < 0 && errno == EINPROGRESS && block);
+
+	if (soc < 0)
 		return -1;
+
+	for (i = 0; cx->race.attempts[i].fd != soc; i++)
+		;
+
+	ai = cx->race.attempts[i].ai;
+
+	if (ai->ai_family == AF_INET)
+		addr = &(((struct sockaddr_in*)ai->ai_addr)->sin_addr);
+	else
+		addr = &(((struct sockaddr_in6*)ai->ai_addr)->sin6_addr);
+
+	if (inet_ntop(ai->ai_family, addr, buf, sizeof(buf)))
+		io_info(cx, " .. Connected [%s]", buf);
+
+	/* The winner's socket is kept, losing attempts are closed */
+	cx->race.attempts[i].fd = -1;
+
+	io_net_race_free(cx);
+
+	return soc;
+}
+
+static int
+io_net_race_poll(struct connection *cx, int timeout)
+{
+	/* Poll attempts in flight for timeout ms, returning the first connected
+	 * socket, or -1 with errno EINPROGRESS, or the poll error */
+
+	struct pollfd fds[IO_CONNECT_ATTEMPTS];
+	unsigned n = cx->race.n;
+
+	for (unsigned i = 0; i < n; i++) {
+		fds[i].fd = cx->race.attempts[i].fd;
+		fds[i].events = POLLOUT;
+		fds[i].revents = 0;
 	}
 
-	ret = -1;
+	if (poll(fds, n, MAX(timeout, 0)) < 0)
+		return -1;
+
+	/* Attempts are removed by moving the last in flight to their index,
+	 * such that those not yet checked keep theirs */
+	for (unsigned i = n; i-- > 0;) {
 
-	for (p = res; p; p = p->ai_next) {
+		int err = 0;
+		socklen_t len = sizeof(err);
 
-		if ((soc = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
+		if (!fds[i].revents)
 			continue;
 
-		if (connect(soc, p->ai_addr, p->ai_addrlen) == 0)
-			break;
+		if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			err = errno;
 
-		io_net_close(soc);
+		if (!err)
+			return fds[i].fd;
 
-		if (errno == EINTR)
-			goto err;
+		/* Failing attempts start the next without delay */
+		cx->race.err = err;
+		cx->race.next = 0;
+
+		io_net_race_remove(cx, i);
 	}
 
-	if (!p && soc < 0) {
-		io_error(cx, " .. Failed to obtain socket: %s", io_strerror(buf, sizeof(buf)));
-		goto err;
+	errno = EINPROGRESS;
+
+	return -1;
+}
+
+static struct addrinfo*
+io_net_sort(struct addrinfo *res)
+{
+	/* Interleave addresses by family, starting with the family of the
+	 * first, otherwise preserving the resolver's order (RFC 8305, 4) */
+
+	struct addrinfo *head = NULL;
+	struct addrinfo **tail = &head;
+	struct addrinfo *fam1 = NULL;
+	struct addrinfo *fam2 = NULL;
+	struct addrinfo **fam1_tail = &fam1;
+	struct addrinfo **fam2_tail = &fam2;
+
+	for (struct addrinfo *ai = res, *ai_next; ai; ai = ai_next) {
+
+		ai_next = ai->ai_next;
+		ai->ai_next = NULL;
+
+		if (ai->ai_family == res->ai_family) {
+			*fam1_tail = ai;
+			fam1_tail = &(ai->ai_next);
+		} else {
+			*fam2_tail = ai;
+			fam2_tail = &(ai->ai_next);
+		}
 	}
 
-	if (!p && soc >= 0) {
-		io_error(cx, " .. Failed to connect: %s", io_strerror(buf, sizeof(buf)));
-		goto err;
+	while (fam1 || fam2) {
+
+		if (fam1) {
+			*tail = fam1;
+			tail = &(fam1->ai_next);
+			fam1 = fam1->ai_next;
+		}
+
+		if (fam2) {
+			*tail = fam2;
+			tail = &(fam2->ai_next);
+			fam2 = fam2->ai_next;
+		}
 	}
 
-	if (p->ai_family == AF_INET)
-		addr = &(((struct sockaddr_in*)p->ai_addr)->sin_addr);
-	else
-		addr = &(((struct sockaddr_in6*)p->ai_addr)->sin6_addr);
+	*tail = NULL;
 
-	if (inet_ntop(p->ai_family, addr, buf, sizeof(buf)))
-		io_info(cx, " .. Connected [%s]", buf);
+	return head;
+}
+
+static uint64_t
+io_net_race_deadline(struct connection *cx)
+{
+	/* Monotonic time (ms) of the next attempt's start, or the nearest
+	 * attempt timeout */
+
+	uint64_t deadline = 0;
+
+	if (cx->race.ai && cx->race.n < IO_CONNECT_ATTEMPTS)
+		deadline = cx->race.next;
+
+	for (unsigned i = 0; i < cx->race.n; i++) {
+		if (!deadline || cx->race.attempts[i].timeout < deadline)
+			deadline = cx->race.attempts[i].timeout;
+	}
+
+	return deadline;
+}
+
+static uint64_t
+io_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		fatal("clock_gettime: %s", strerror(errno));
+
+	return ((uint64_t) ts.tv_sec * 1000) + ((uint64_t) ts.tv_nsec / 1000000);
+}
+
+static void
+io_net_race_free(struct connection *cx)
+{
+	for (unsigned i = 0; i < cx->race.n; i++) {
+		if (cx->race.attempts[i].fd >= 0)
+			io_net_close(cx->race.attempts[i].fd);
+	}
+
+	/* Resolved addresses are allocated as a single block, by dns_addrinfo */
+	free(cx->race.ai_res);
+
+	memset(&(cx->race), 0, sizeof(cx->race));
+}
+
+static void
+io_net_race_init(struct connection *cx, struct addrinfo *res)
+{
+	memset(&(cx->race), 0, sizeof(cx->race));
+
+	cx->race.ai = io_net_sort(res);
+	cx->race.ai_res = cx->race.ai;
+}
+
+static void
+io_net_race_remove(struct connection *cx, unsigned i)
+{
+	io_net_close(cx->race.attempts[i].fd);
+
+	cx->race.attempts[i] = cx->race.attempts[--cx->race.n];
+}
+
+static void
+io_net_race_start(struct connection *cx, uint64_t now)
+{
+	/* Abandon timed out attempts, then start the next attempts due: the
+	 * first immediately, then each after IO_CONNECT_DELAY, or immediately
+	 * when none remain in flight */
+
+	for (unsigned i = cx->race.n; i-- > 0;) {
+		if (cx->race.attempts[i].timeout <= now) {
+			cx->race.err = ETIMEDOUT;
+			cx->race.next = 0;
+			io_net_race_remove(cx, i);
+		}
+	}
+
+	while (cx->race.ai
+	    && cx->race.n < IO_CONNECT_ATTEMPTS
+	    && (cx->race.n == 0 || cx->race.next <= now)) {
+
+		struct addrinfo *ai = cx->race.ai;
+		int soc;
+
+		cx->race.ai = ai->ai_next;
+
+		if ((soc = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1) {
+			cx->race.err = errno;
+			continue;
+		}
 
-	ret = soc;
+		if (fcntl(soc, F_SETFD, FD_CLOEXEC) < 0 || fcntl(soc, F_SETFL, O_NONBLOCK) < 0) {
+			cx->race.err = errno;
+			io_net_close(soc);
+			continue;
+		}
 
-err:
-	freeaddrinfo(res);
+		if (connect(soc, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS) {
+			cx->race.err = errno;
+			io_net_close(soc);
+			continue;
+		}
 
-	return (cx->net_ctx.fd = ret);
+		cx->race.attempts[cx->race.n].ai = ai;
+		cx->race.attempts[cx->race.n].fd = soc;
+		cx->race.attempts[cx->race.n].timeout = now + SEC_IN_MS((uint64_t) IO_CONNECT_TIMEOUT);
+		cx->race.next = now + IO_CONNECT_DELAY;
+		cx->race.n++;
+	}
 }
 
 static void
@@ -850,28 +2309,179 @@ static void
 io_tls_debug(void *ctx, int level, const char *file, int line, const char *msg)
 {
 	UNUSED(ctx);
+	UNUSED(file);
 	UNUSED(level);
+	UNUSED(line);
+	UNUSED(msg);
 
 	/* msg minus newline */
 	debug("mbedtls: %s:%04d: %.*s", file, line, (int)(strlen(msg) - 1), msg);
 }
 #endif
 
+#if !IO_EPOLL
 static int
 io_tls_establish(struct connection *cx)
 {
-	const unsigned char pers[] = "rirc-drbg-seed";
+	int ret;
+
+	if (io_tls_init(cx) < 0)
+		goto err;
+
+	while ((ret = mbedtls_ssl_handshake(&(cx->tls_ctx)))) {
+		if (ret != MBEDTLS_ERR_SSL_WANT_READ
+		 && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+			break;
+	}
+
+	if (io_tls_verify(cx, ret) < 0)
+		goto err;
+
+	io_tls_session_save(cx, 0);
+
+	return 0;
+
+err:
+
+	io_error(cx, " .. TLS connection failure");
+
+	io_tls_free(cx);
+	mbedtls_net_free(&(cx->net_ctx));
+
+	cx->tls_resume = 0;
+
+	return -1;
+}
+#endif
+
+static int
+io_tls_init(struct connection *cx)
+{
+	/* Initialize the connection's TLS context, which is freed by
+	 * io_tls_free regardless of success */
+
+	const mbedtls_ssl_config *conf;
 	int ret;
 
 	io_info(cx, " .. Establishing TLS connection");
 
-	mbedtls_ctr_drbg_init(&(cx->tls_ctr_drbg));
-	mbedtls_entropy_init(&(cx->tls_entropy));
-	mbedtls_pk_init(&(cx->tls_pk_ctx));
+	cx->tls_handshake = io_tls_time();
+
 	mbedtls_ssl_init(&(cx->tls_ctx));
-	mbedtls_ssl_config_init(&(cx->tls_conf));
-	mbedtls_x509_crt_init(&(cx->tls_x509_crt_ca));
-	mbedtls_x509_crt_init(&(cx->tls_x509_crt_client));
+
+#if IO_EPOLL
+	conf = io_tls_conf(cx);
+#else
+	PT_LK(&io_tls_mtx);
+	conf = io_tls_conf(cx);
+	PT_UL(&io_tls_mtx);
+#endif
+
+	if (!conf)
+		return -1;
+
+	if ((ret = mbedtls_ssl_setup(&(cx->tls_ctx), conf))) {
+		io_error(cx, " .. %s ", io_tls_err(ret));
+		return -1;
+	}
+
+	if ((ret = mbedtls_ssl_set_hostname(&(cx->tls_ctx), cx->host))) {
+		io_error(cx, " .. %s ", io_tls_err(ret));
+		return -1;
+	}
+
+	/* A session the server no longer accepts results in a full handshake.
+	 * Kept sessions were verified, and are only offered when required */
+	if (cx->tls_resume && !(cx->flags & IO_TLS_VRFY_REQUIRED))
+		cx->tls_resume = 0;
+
+	if (cx->tls_resume && mbedtls_ssl_set_session(&(cx->tls_ctx), &(cx->tls_session)))
+		cx->tls_resume = 0;
+
+	mbedtls_ssl_set_bio(
+		&(cx->tls_ctx),
+		&(cx->net_ctx),
+		mbedtls_net_send,
+		mbedtls_net_recv,
+		NULL);
+
+	return 0;
+}
+
+static const mbedtls_ssl_config*
+io_tls_conf(struct connection *cx)
+{
+	/* Return the connection's shared TLS configuration, initializing
+	 * it when first required. Called with io_tls_mtx locked, without IO_EPOLL */
+
+	const unsigned char pers[] = "rirc-drbg-seed";
+	struct io_tls_ca *ca = NULL;
+	struct io_tls_cert *cert = NULL;
+	struct io_tls_conf *conf;
+	uint32_t flags = (cx->flags & (
+		IO_TLS_VRFY_DISABLED |
+		IO_TLS_VRFY_OPTIONAL |
+		IO_TLS_VRFY_REQUIRED |
+		IO_TLS_VERSION_1_2 |
+		IO_TLS_VERSION_1_3));
+	int ret;
+
+	if (!io_tls_seeded) {
+
+		mbedtls_ctr_drbg_init(&io_tls_ctr_drbg);
+		mbedtls_entropy_init(&io_tls_entropy);
+
+		if ((ret = mbedtls_ctr_drbg_seed(
+				&io_tls_ctr_drbg,
+				mbedtls_entropy_func,
+				&io_tls_entropy,
+				pers,
+				sizeof(pers)))) {
+			io_error(cx, " .. %s ", io_tls_err(ret));
+			mbedtls_ctr_drbg_free(&io_tls_ctr_drbg);
+			mbedtls_entropy_free(&io_tls_entropy);
+			return NULL;
+		}
+
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+		if ((ret = (int) psa_crypto_init()) != PSA_SUCCESS) {
+			io_error(cx, " .. Failed to initialize PSA crypto: %d", ret);
+			mbedtls_ctr_drbg_free(&io_tls_ctr_drbg);
+			mbedtls_entropy_free(&io_tls_entropy);
+			return NULL;
+		}
+#endif
+
+		io_tls_seeded = 1;
+	}
+
+	if ((flags & IO_TLS_VERSION_1_3) && !IO_TLS_1_3) {
+		io_error(cx, " .. TLS 1.3 not supported");
+		return NULL;
+	}
+
+	if (!(flags & IO_TLS_VRFY_DISABLED) && (ca = io_tls_ca(cx)) == NULL)
+		return NULL;
+
+	if (cx->tls_cert && (cert = io_tls_cert(cx)) == NULL)
+		return NULL;
+
+	for (conf = io_tls_confs; conf; conf = conf->next) {
+		if (conf->ca == ca
+		 && conf->cert == cert
+		 && conf->flags == flags
+		 && io_tls_key(conf->ciphers, cx->tls_ciphers)
+		 && io_tls_key(conf->groups, cx->tls_groups))
+			return &(conf->conf);
+	}
+
+	if ((conf = calloc(1, sizeof(*conf))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	mbedtls_ssl_config_init(&(conf->conf));
+
+	if (io_tls_list(cx, conf) < 0)
+		goto err;
 
 #ifndef NDEBUG
 	/* mbedtls debug levels:
@@ -883,11 +2493,11 @@ io_tls_establish(struct connection *cx)
 
 	mbedtls_debug_set_threshold(1);
 
-	mbedtls_ssl_conf_dbg(&(cx->tls_conf), io_tls_debug, NULL);
+	mbedtls_ssl_conf_dbg(&(conf->conf), io_tls_debug, NULL);
 #endif
 
 	if ((ret = mbedtls_ssl_config_defaults(
-			&(cx->tls_conf),
+			&(conf->conf),
 			MBEDTLS_SSL_IS_CLIENT,
 			MBEDTLS_SSL_TRANSPORT_STREAM,
 			MBEDTLS_SSL_PRESET_DEFAULT))) {
@@ -895,44 +2505,107 @@ io_tls_establish(struct connection *cx)
 		goto err;
 	}
 
-	mbedtls_ssl_conf_min_tls_version(&(cx->tls_conf), MBEDTLS_SSL_VERSION_TLS1_2);
-	mbedtls_ssl_conf_max_tls_version(&(cx->tls_conf), MBEDTLS_SSL_VERSION_TLS1_2);
+	if (flags & IO_TLS_VERSION_1_2) {
+		mbedtls_ssl_conf_min_tls_version(&(conf->conf), MBEDTLS_SSL_VERSION_TLS1_2);
+		mbedtls_ssl_conf_max_tls_version(&(conf->conf), MBEDTLS_SSL_VERSION_TLS1_2);
+	} else if (flags & IO_TLS_VERSION_1_3) {
+		mbedtls_ssl_conf_min_tls_version(&(conf->conf), MBEDTLS_SSL_VERSION_TLS1_3);
+		mbedtls_ssl_conf_max_tls_version(&(conf->conf), MBEDTLS_SSL_VERSION_TLS1_3);
+	} else {
+		mbedtls_ssl_conf_min_tls_version(&(conf->conf), MBEDTLS_SSL_VERSION_TLS1_2);
+		mbedtls_ssl_conf_max_tls_version(&(conf->conf),
+			(IO_TLS_1_3 ? MBEDTLS_SSL_VERSION_TLS1_3 : MBEDTLS_SSL_VERSION_TLS1_2));
+	}
+
+	if (conf->ciphers_ids)
+		mbedtls_ssl_conf_ciphersuites(&(conf->conf), conf->ciphers_ids);
 
-	if ((ret = mbedtls_ctr_drbg_seed(
-			&(cx->tls_ctr_drbg),
-			mbedtls_entropy_func,
-			&(cx->tls_entropy),
-			pers,
-			sizeof(pers)))) {
-		io_error(cx, " .. %s ", io_tls_err(ret));
+	if (conf->groups_ids)
+		mbedtls_ssl_conf_groups(&(conf->conf), conf->groups_ids);
+
+	if (cert && (ret = mbedtls_ssl_conf_own_cert(&(conf->conf), &(cert->crt), &(cert->pk)))) {
+		io_error(cx, " .. Failed to configure client cert: '%s': %s", cx->tls_cert, io_tls_err(ret));
 		goto err;
 	}
 
-	ret = -1;
+	mbedtls_ssl_conf_rng(&(conf->conf), mbedtls_ctr_drbg_random, &io_tls_ctr_drbg);
+	mbedtls_ssl_conf_session_tickets(&(conf->conf), MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+
+	if (flags & IO_TLS_VRFY_DISABLED) {
+		mbedtls_ssl_conf_authmode(&(conf->conf), MBEDTLS_SSL_VERIFY_NONE);
+	} else {
+		mbedtls_ssl_conf_ca_chain(&(conf->conf), &(ca->crt), NULL);
+
+		if (flags & IO_TLS_VRFY_OPTIONAL)
+			mbedtls_ssl_conf_authmode(&(conf->conf), MBEDTLS_SSL_VERIFY_OPTIONAL);
+
+		if (flags & IO_TLS_VRFY_REQUIRED)
+			mbedtls_ssl_conf_authmode(&(conf->conf), MBEDTLS_SSL_VERIFY_REQUIRED);
+	}
+
+	conf->ca = ca;
+	conf->cert = cert;
+	conf->ciphers = (cx->tls_ciphers ? irc_strdup(cx->tls_ciphers) : NULL);
+	conf->groups = (cx->tls_groups ? irc_strdup(cx->tls_groups) : NULL);
+	conf->flags = flags;
+	conf->next = io_tls_confs;
+	io_tls_confs = conf;
+
+	return &(conf->conf);
+
+err:
+
+	mbedtls_ssl_config_free(&(conf->conf));
+	free(conf->ciphers_ids);
+	free(conf->groups_ids);
+	free(conf);
+
+	return NULL;
+}
+
+static struct io_tls_ca*
+io_tls_ca(struct connection *cx)
+{
+	/* Return the CA certs for the connection's CA file and path, parsing
+	 * them when first required, or the default CA certs if neither is set.
+	 * Called with io_tls_mtx locked, without IO_EPOLL */
+
+	struct io_tls_ca *ca;
+	int ret = -1;
+
+	for (ca = io_tls_cas; ca; ca = ca->next) {
+		if (io_tls_key(ca->ca_file, cx->tls_ca_file) && io_tls_key(ca->ca_path, cx->tls_ca_path))
+			return ca;
+	}
+
+	if ((ca = calloc(1, sizeof(*ca))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	mbedtls_x509_crt_init(&(ca->crt));
 
 	if (ret < 0 && cx->tls_ca_file) {
-		if ((ret = mbedtls_x509_crt_parse_file(&(cx->tls_x509_crt_ca), cx->tls_ca_file)) < 0) {
+		if ((ret = mbedtls_x509_crt_parse_file(&(ca->crt), cx->tls_ca_file)) < 0) {
 			io_error(cx, " .. Failed to load CA cert file: '%s': %s", cx->tls_ca_file, io_tls_err(ret));
 			goto err;
 		}
 	}
 
 	if (ret < 0 && cx->tls_ca_path) {
-		if ((ret = mbedtls_x509_crt_parse_path(&(cx->tls_x509_crt_ca), cx->tls_ca_path)) < 0) {
+		if ((ret = mbedtls_x509_crt_parse_path(&(ca->crt), cx->tls_ca_path)) < 0) {
 			io_error(cx, " .. Failed to load CA cert path: '%s': %s", cx->tls_ca_path, io_tls_err(ret));
 			goto err;
 		}
 	}
 
 	if (ret < 0 && default_ca_file && *default_ca_file) {
-		if ((ret = mbedtls_x509_crt_parse_file(&(cx->tls_x509_crt_ca), default_ca_file)) < 0) {
+		if ((ret = mbedtls_x509_crt_parse_file(&(ca->crt), default_ca_file)) < 0) {
 			io_error(cx, " .. Failed to load CA cert file: '%s': %s", default_ca_file, io_tls_err(ret));
 			goto err;
 		}
 	}
 
 	if (ret < 0 && default_ca_path && *default_ca_path) {
-		if ((ret = mbedtls_x509_crt_parse_path(&(cx->tls_x509_crt_ca), default_ca_path)) < 0) {
+		if ((ret = mbedtls_x509_crt_parse_path(&(ca->crt), default_ca_path)) < 0) {
 			io_error(cx, " .. Failed to load CA cert path: '%s': %s", default_ca_path, io_tls_err(ret));
 			goto err;
 		}
@@ -943,7 +2616,7 @@ io_tls_establish(struct connection *cx)
 		size_t i;
 
 		for (i = 0; i < ARR_LEN(default_ca_certs); i++) {
-			if ((ret = mbedtls_x509_crt_parse_file(&(cx->tls_x509_crt_ca), default_ca_certs[i])) >= 0)
+			if ((ret = mbedtls_x509_crt_parse_file(&(ca->crt), default_ca_certs[i])) >= 0)
 				break;
 		}
 
@@ -953,75 +2626,146 @@ io_tls_establish(struct connection *cx)
 		}
 	}
 
-	if (cx->tls_cert) {
+	ca->ca_file = (cx->tls_ca_file ? irc_strdup(cx->tls_ca_file) : NULL);
+	ca->ca_path = (cx->tls_ca_path ? irc_strdup(cx->tls_ca_path) : NULL);
+	ca->next = io_tls_cas;
+	io_tls_cas = ca;
 
-		if ((ret = mbedtls_x509_crt_parse_file(&(cx->tls_x509_crt_client), cx->tls_cert)) < 0) {
-			io_error(cx, " .. Failed to load client cert: '%s': %s", cx->tls_cert, io_tls_err(ret));
-			goto err;
-		}
+	return ca;
 
-		if ((ret = mbedtls_pk_parse_keyfile(
-			&(cx->tls_pk_ctx),
-			cx->tls_cert,
-			NULL,
-			mbedtls_ctr_drbg_random,
-			&(cx->tls_ctr_drbg))))
-		{
-			io_error(cx, " .. Failed to load client cert key: '%s': %s", cx->tls_cert, io_tls_err(ret));
-			goto err;
-		}
+err:
 
-		if ((ret = mbedtls_ssl_conf_own_cert(&(cx->tls_conf), &(cx->tls_x509_crt_client), &(cx->tls_pk_ctx)))) {
-			io_error(cx, " .. Failed to configure client cert: '%s': %s", cx->tls_cert, io_tls_err(ret));
-			goto err;
-		}
-	}
+	mbedtls_x509_crt_free(&(ca->crt));
+	free(ca);
 
-	mbedtls_ssl_conf_rng(&(cx->tls_conf), mbedtls_ctr_drbg_random, &(cx->tls_ctr_drbg));
+	return NULL;
+}
 
-	if (cx->flags & IO_TLS_VRFY_DISABLED) {
-		mbedtls_ssl_conf_authmode(&(cx->tls_conf), MBEDTLS_SSL_VERIFY_NONE);
-	} else {
-		mbedtls_ssl_conf_ca_chain(&(cx->tls_conf), &(cx->tls_x509_crt_ca), NULL);
+static struct io_tls_cert*
+io_tls_cert(struct connection *cx)
+{
+	/* Return the connection's client cert and key, parsing them when
+	 * first required. Called with io_tls_mtx locked, without IO_EPOLL */
 
-		if (cx->flags & IO_TLS_VRFY_OPTIONAL)
-			mbedtls_ssl_conf_authmode(&(cx->tls_conf), MBEDTLS_SSL_VERIFY_OPTIONAL);
+	struct io_tls_cert *cert;
+	int ret;
 
-		if (cx->flags & IO_TLS_VRFY_REQUIRED)
-			mbedtls_ssl_conf_authmode(&(cx->tls_conf), MBEDTLS_SSL_VERIFY_REQUIRED);
+	for (cert = io_tls_certs; cert; cert = cert->next) {
+		if (io_tls_key(cert->cert, cx->tls_cert))
+			return cert;
 	}
 
-	if ((ret = mbedtls_net_set_block(&(cx->net_ctx)))) {
-		io_error(cx, " .. %s ", io_tls_err(ret));
+	if ((cert = calloc(1, sizeof(*cert))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	mbedtls_pk_init(&(cert->pk));
+	mbedtls_x509_crt_init(&(cert->crt));
+
+	if ((ret = mbedtls_x509_crt_parse_file(&(cert->crt), cx->tls_cert)) < 0) {
+		io_error(cx, " .. Failed to load client cert: '%s': %s", cx->tls_cert, io_tls_err(ret));
 		goto err;
 	}
 
-	if ((ret = mbedtls_ssl_setup(&(cx->tls_ctx), &(cx->tls_conf)))) {
-		io_error(cx, " .. %s ", io_tls_err(ret));
+	if ((ret = mbedtls_pk_parse_keyfile(
+		&(cert->pk),
+		cx->tls_cert,
+		NULL,
+		mbedtls_ctr_drbg_random,
+		&io_tls_ctr_drbg)))
+	{
+		io_error(cx, " .. Failed to load client cert key: '%s': %s", cx->tls_cert, io_tls_err(ret));
 		goto err;
 	}
 
-	if ((ret = mbedtls_ssl_set_hostname(&(cx->tls_ctx), cx->host))) {
-		io_error(cx, " .. %s ", io_tls_err(ret));
-		goto err;
+	cert->cert = irc_strdup(cx->tls_cert);
+	cert->next = io_tls_certs;
+	io_tls_certs = cert;
+
+	return cert;
+
+err:
+
+	mbedtls_pk_free(&(cert->pk));
+	mbedtls_x509_crt_free(&(cert->crt));
+	free(cert);
+
+	return NULL;
+}
+
+static int
+io_tls_list(struct connection *cx, struct io_tls_conf *conf)
+{
+	/* Parse the connection's comma separated ciphersuites and groups, by
+	 * name, in order of preference */
+
+	const char *p;
+	size_t len;
+	size_t n;
+
+	if ((p = cx->tls_ciphers)) {
+
+		if ((conf->ciphers_ids = calloc(strlen(p) / 2 + 2, sizeof(*conf->ciphers_ids))) == NULL)
+			fatal("calloc: %s", strerror(errno));
+
+		for (n = 0; *p; p += len + !!p[len]) {
+
+			char name[64];
+
+			if ((len = strcspn(p, ",")) == 0)
+				continue;
+
+			(void) snprintf(name, sizeof(name), "%.*s", (int) len, p);
+
+			if (len >= sizeof(name) || (conf->ciphers_ids[n++] = mbedtls_ssl_get_ciphersuite_id(name)) == 0) {
+				io_error(cx, " .. Unknown TLS ciphersuite: '%.*s'", (int) len, p);
+				return -1;
+			}
+		}
 	}
 
-	mbedtls_ssl_set_bio(
-		&(cx->tls_ctx),
-		&(cx->net_ctx),
-		mbedtls_net_send,
-		mbedtls_net_recv,
-		NULL);
+	if ((p = cx->tls_groups)) {
 
-	while ((ret = mbedtls_ssl_handshake(&(cx->tls_ctx)))) {
-		if (ret != MBEDTLS_ERR_SSL_WANT_READ
-		 && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
-			break;
+		if ((conf->groups_ids = calloc(strlen(p) / 2 + 2, sizeof(*conf->groups_ids))) == NULL)
+			fatal("calloc: %s", strerror(errno));
+
+		for (n = 0; *p; p += len + !!p[len]) {
+
+			char name[64];
+			const mbedtls_ecp_curve_info *info;
+
+			if ((len = strcspn(p, ",")) == 0)
+				continue;
+
+			(void) snprintf(name, sizeof(name), "%.*s", (int) len, p);
+
+			if (len >= sizeof(name) || (info = mbedtls_ecp_curve_info_from_name(name)) == NULL) {
+				io_error(cx, " .. Unknown TLS group: '%.*s'", (int) len, p);
+				return -1;
+			}
+
+			conf->groups_ids[n++] = info->tls_id;
+		}
 	}
 
+	return 0;
+}
+
+static int
+io_tls_key(const char *key1, const char *key2)
+{
+	/* Compare optional keys of shared TLS state */
+
+	return ((key1 && key2) ? !strcmp(key1, key2) : key1 == key2);
+}
+
+static int
+io_tls_verify(struct connection *cx, int ret)
+{
+	/* Report the result of a completed handshake */
+
 	if (ret && cx->flags & IO_TLS_VRFY_DISABLED) {
 		io_error(cx, " .. %s ", io_tls_err(ret));
-		goto err;
+		return -1;
 	}
 
 	if (io_tls_x509_vrfy(cx) < 0)
@@ -1029,7 +2773,7 @@ io_tls_establish(struct connection *cx)
 
 	if (ret) {
 		io_error(cx, " .. %s ", io_tls_err(ret));
-		goto err;
+		return -1;
 	}
 
 	switch (mbedtls_ssl_get_version_number(&(cx->tls_ctx))) {
@@ -1046,23 +2790,163 @@ io_tls_establish(struct connection *cx)
 
 	io_info(cx, " .... Version:     %s", mbedtls_ssl_get_version(&(cx->tls_ctx)));
 	io_info(cx, " .... Ciphersuite: %s", mbedtls_ssl_get_ciphersuite(&(cx->tls_ctx)));
+	io_info(cx, " .... Handshake:   %.3f ms", (double) (io_tls_time() - cx->tls_handshake) / 1000);
 
 	return 0;
+}
 
-err:
-
-	io_error(cx, " .. TLS connection failure");
+static void
+io_tls_free(struct connection *cx)
+{
+	/* Shared TLS configurations aren't freed with the connection */
 
-	mbedtls_ctr_drbg_free(&(cx->tls_ctr_drbg));
-	mbedtls_entropy_free(&(cx->tls_entropy));
-	mbedtls_pk_free(&(cx->tls_pk_ctx));
-	mbedtls_ssl_config_free(&(cx->tls_conf));
 	mbedtls_ssl_free(&(cx->tls_ctx));
-	mbedtls_x509_crt_free(&(cx->tls_x509_crt_ca));
-	mbedtls_x509_crt_free(&(cx->tls_x509_crt_client));
-	mbedtls_net_free(&(cx->net_ctx));
+}
 
-	return -1;
+static int
+io_tls_session_path(struct connection *cx, char *path, size_t len)
+{
+	/* Path of the connection's persisted TLS session, keyed by the CA certs
+	 * that verified it and the client cert it authenticated with (FNV-1a) */
+
+	const char *keys[] = { cx->tls_ca_file, cx->tls_ca_path, cx->tls_cert };
+	uint32_t key = 2166136261U;
+	int ret;
+
+	*path = 0;
+
+	if (!*IO_TLS_SESSION_DIR || strchr(cx->host, '/') || strchr(cx->port, '/'))
+		return -1;
+
+	for (size_t i = 0; i < ARR_LEN(keys); i++) {
+
+		for (const char *p = (keys[i] ? keys[i] : ""); *p; p++)
+			key = (key ^ (unsigned char) *p) * 16777619U;
+
+		key = (key ^ 0xFF) * 16777619U;
+	}
+
+	ret = snprintf(path, len, "%s/%s.%s.%08lx.session", IO_TLS_SESSION_DIR, cx->host, cx->port, (unsigned long) key);
+
+	if (ret < 0 || (size_t) ret >= len)
+		return -1;
+
+	return 0;
+}
+
+static void
+io_tls_session_load(struct connection *cx)
+{
+	/* Load the connection's persisted TLS session, if any, resumed by the
+	 * first handshake. Sessions are only persisted by verified handshakes,
+	 * and only resumed by connections requiring verification */
+
+	char path[4096];
+	unsigned char *buf;
+	ssize_t ret;
+	int fd;
+
+	if (!(cx->flags & IO_TLS_VRFY_REQUIRED))
+		return;
+
+	if (io_tls_session_path(cx, path, sizeof(path)) < 0)
+		return;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return;
+
+	if ((buf = malloc(IO_TLS_SESSION_SIZE)) == NULL)
+		fatal("malloc: %s", strerror(errno));
+
+	if ((ret = read(fd, buf, IO_TLS_SESSION_SIZE)) > 0 && ret < IO_TLS_SESSION_SIZE) {
+		if (mbedtls_ssl_session_load(&(cx->tls_session), buf, (size_t) ret) == 0)
+			cx->tls_resume = 1;
+	}
+
+	if (!cx->tls_resume) {
+		mbedtls_ssl_session_free(&(cx->tls_session));
+		mbedtls_ssl_session_init(&(cx->tls_session));
+	}
+
+	free(buf);
+	close(fd);
+}
+
+static void
+io_tls_session_save(struct connection *cx, int ticket)
+{
+	/* Keep the session of a completed handshake, resumed when reconnecting,
+	 * and persisted when IO_TLS_SESSION_DIR is set. The session file is
+	 * replaced by renaming, such that it's never partially written.
+	 *
+	 * Resuming a session skips the server's certificate, so only sessions
+	 * of handshakes requiring and passing verification are kept, any other
+	 * handshake dropping the kept session.
+	 *
+	 * TLS 1.3 sessions are resumed by tickets received after the handshake */
+
+	char path[4096];
+	char path_tmp[4096 + 8];
+	unsigned char *buf;
+	size_t len;
+	int fd;
+
+	if (!ticket && mbedtls_ssl_get_version_number(&(cx->tls_ctx)) == MBEDTLS_SSL_VERSION_TLS1_3)
+		return;
+
+	mbedtls_ssl_session_free(&(cx->tls_session));
+	mbedtls_ssl_session_init(&(cx->tls_session));
+
+	cx->tls_resume = 0;
+
+	if (!(cx->flags & IO_TLS_VRFY_REQUIRED) || mbedtls_ssl_get_verify_result(&(cx->tls_ctx)))
+		return;
+
+	if (mbedtls_ssl_get_session(&(cx->tls_ctx), &(cx->tls_session)))
+		return;
+
+	cx->tls_resume = 1;
+
+	if (io_tls_session_path(cx, path, sizeof(path)) < 0)
+		return;
+
+	if ((buf = malloc(IO_TLS_SESSION_SIZE)) == NULL)
+		fatal("malloc: %s", strerror(errno));
+
+	if (mbedtls_ssl_session_save(&(cx->tls_session), buf, IO_TLS_SESSION_SIZE, &len))
+		goto out;
+
+	(void) snprintf(path_tmp, sizeof(path_tmp), "%s.tmp", path);
+
+	/* Sessions hold the connection's master secret */
+	if ((fd = open(path_tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+		goto out;
+
+	if (write(fd, buf, len) != (ssize_t) len) {
+		close(fd);
+		unlink(path_tmp);
+		goto out;
+	}
+
+	close(fd);
+
+	if (rename(path_tmp, path) < 0)
+		unlink(path_tmp);
+
+out:
+
+	free(buf);
+}
+
+static uint64_t
+io_tls_time(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		fatal("clock_gettime: %s", strerror(errno));
+
+	return ((uint64_t) ts.tv_sec * 1000000) + ((uint64_t) ts.tv_nsec / 1000);
 }
 
 static int
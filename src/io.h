@@ -59,8 +59,19 @@
  *   from stdin:  io_cb_read_inp
  *   from socket: io_cb_read_soc
  *
+ * Socket data is passed in a writable buffer, valid only for the duration
+ * of the callback, which may be modified in place
+ *
  * SIGWINCH results in a non signal-handler context callback io_cb_singwinch
  *
+ * Before waiting for events io_cb_idle is called, returning the maximum
+ * milliseconds to wait, or -1
+ *
+ * All callbacks are serialized on the thread calling io_start, network
+ * callbacks being queued by each connection's thread, or with IO_EPOLL
+ * run directly by a single threaded event loop, in which case io_cx and
+ * io_dx may also result in callbacks before returning
+ *
  * Failed connection attempts enter a retry cycle with exponential
  * backoff time given by:
  *   t(n) = t(n - 1) * factor
@@ -82,6 +93,8 @@
 #define IO_TLS_VRFY_DISABLED (1 << 6)
 #define IO_TLS_VRFY_OPTIONAL (1 << 7)
 #define IO_TLS_VRFY_REQUIRED (1 << 8)
+#define IO_TLS_VERSION_1_2   (1 << 9)
+#define IO_TLS_VERSION_1_3   (1 << 10)
 
 struct connection;
 
@@ -92,6 +105,8 @@ struct connection* connection(
 	const char*, /* tls_ca_file */
 	const char*, /* tls_ca_path */
 	const char*, /* tls_cert */
+	const char*, /* tls_ciphers */
+	const char*, /* tls_groups */
 	uint32_t);   /* flags */
 
 /* Explicit direction of net state */
@@ -104,6 +119,9 @@ int io_sendf(struct connection*, const char*, ...);
 /* IO error string */
 const char* io_err(int);
 
+/* Supported TLS protocol versions, IO_TLS_VERSION flags */
+uint32_t io_tls_versions(void);
+
 /* IO data callback */
 void io_cb_read_inp(char*, size_t);
 void io_cb_read_soc(char*, size_t, const void*);
@@ -114,6 +132,9 @@ void io_cb_dxed(const void*);
 void io_cb_ping(const void*, unsigned);
 void io_cb_sigwinch(unsigned, unsigned);
 
+/* IO idle callback */
+int io_cb_idle(void);
+
 /* IO informational callbacks */
 void io_cb_error(const void*, const char*, ...);
 void io_cb_info(const void*, const char*, ...);
@@ -85,6 +85,9 @@ static const char *const rirc_help =
 "\n      --tls-ca-file=PATH    Set TLS peer certificate file path"
 "\n      --tls-ca-path=PATH    Set TLS peer certificate directory path"
 "\n      --tls-verify=MODE     Set TLS peer certificate verification mode"
+"\n      --tls-version=VERSION Set TLS protocol version"
+"\n      --tls-ciphers=SUITES  Set comma separated list of TLS ciphersuites"
+"\n      --tls-groups=GROUPS   Set comma separated list of TLS key exchange groups"
 "\n      --tls-disable         Set TLS disabled"
 "\n      --sasl=MECHANISM      Authenticate with SASL mechanism"
 "\n      --sasl-user=USER      Authenticate with SASL username"
@@ -122,6 +125,9 @@ rirc_opt_str(char c)
 		case '7': return "--sasl-pass";
 		case '8': return "--ipv4";
 		case '9': return "--ipv6";
+		case 'A': return "--tls-version";
+		case 'B': return "--tls-ciphers";
+		case 'C': return "--tls-groups";
 		default:
 			fatal("unknown option flag '%c'", c);
 	}
@@ -161,12 +167,15 @@ rirc_parse_args(int argc, char **argv)
 		const char *tls_ca_file;
 		const char *tls_ca_path;
 		const char *tls_cert;
+		const char *tls_ciphers;
+		const char *tls_groups;
 		const char *sasl;
 		const char *sasl_user;
 		const char *sasl_pass;
 		int ipv;
 		int tls;
 		int tls_vrfy;
+		int tls_version;
 		struct server *s;
 	} cli_servers[MAX_CLI_SERVERS];
 
@@ -191,6 +200,9 @@ rirc_parse_args(int argc, char **argv)
 		{"sasl-pass",   required_argument, 0, '7'},
 		{"ipv4",        no_argument,       0, '8'},
 		{"ipv6",        no_argument,       0, '9'},
+		{"tls-version", required_argument, 0, 'A'},
+		{"tls-ciphers", required_argument, 0, 'B'},
+		{"tls-groups",  required_argument, 0, 'C'},
 		{0, 0, 0, 0}
 	};
 
@@ -223,12 +235,15 @@ rirc_parse_args(int argc, char **argv)
 				cli_servers[n_servers - 1].tls_ca_file = NULL;
 				cli_servers[n_servers - 1].tls_ca_path = NULL;
 				cli_servers[n_servers - 1].tls_cert    = NULL;
+				cli_servers[n_servers - 1].tls_ciphers = NULL;
+				cli_servers[n_servers - 1].tls_groups  = NULL;
 				cli_servers[n_servers - 1].sasl        = NULL;
 				cli_servers[n_servers - 1].sasl_user   = NULL;
 				cli_servers[n_servers - 1].sasl_pass   = NULL;
 				cli_servers[n_servers - 1].ipv         = IO_IPV_UNSPEC;
 				cli_servers[n_servers - 1].tls         = IO_TLS_ENABLED;
 				cli_servers[n_servers - 1].tls_vrfy    = IO_TLS_VRFY_REQUIRED;
+				cli_servers[n_servers - 1].tls_version = 0;
 				break;
 
 			#define CHECK_SERVER_OPTARG(OPT_C, REQ) \
@@ -346,6 +361,33 @@ rirc_parse_args(int argc, char **argv)
 				cli_servers[n_servers -1].ipv = IO_IPV_6;
 				break;
 
+			case 'A': /* Set TLS protocol version */
+				CHECK_SERVER_OPTARG(opt_c, 1);
+				if (!strcmp(optarg, "1.2")) {
+					cli_servers[n_servers - 1].tls_version = IO_TLS_VERSION_1_2;
+					break;
+				}
+				if (!strcmp(optarg, "1.3")) {
+					if (!(io_tls_versions() & IO_TLS_VERSION_1_3)) {
+						arg_error("TLS version '%s' not supported by this build", optarg);
+						return -1;
+					}
+					cli_servers[n_servers - 1].tls_version = IO_TLS_VERSION_1_3;
+					break;
+				}
+				arg_error("invalid option for '--tls-version' '%s'", optarg);
+				return -1;
+
+			case 'B': /* Set comma separated list of TLS ciphersuites */
+				CHECK_SERVER_OPTARG(opt_c, 1);
+				cli_servers[n_servers - 1].tls_ciphers = optarg;
+				break;
+
+			case 'C': /* Set comma separated list of TLS key exchange groups */
+				CHECK_SERVER_OPTARG(opt_c, 1);
+				cli_servers[n_servers - 1].tls_groups = optarg;
+				break;
+
 			#undef CHECK_SERVER_OPTARG
 
 			case 'h':
@@ -396,9 +438,12 @@ rirc_parse_args(int argc, char **argv)
 			cli_servers[i].tls_ca_file,
 			cli_servers[i].tls_ca_path,
 			cli_servers[i].tls_cert,
+			cli_servers[i].tls_ciphers,
+			cli_servers[i].tls_groups,
 			(cli_servers[i].ipv |
 			 cli_servers[i].tls |
-			 cli_servers[i].tls_vrfy));
+			 cli_servers[i].tls_vrfy |
+			 cli_servers[i].tls_version));
 
 		if (server_list_add(state_server_list(), cli_servers[i].s)) {
 			arg_error("duplicate server: %s:%s", cli_servers[i].host, cli_servers[i].port);
@@ -10,7 +10,10 @@
 #include "src/utils/utils.h"
 
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,12 +22,18 @@
 /* See: https://vt100.net/docs/vt100-ug/chapter3.html */
 #define CTRL(k) ((k) & 0x1f)
 
+#ifndef BUFFER_MEMORY_MAX
+#define BUFFER_MEMORY_MAX 0
+#endif
+
 #define COMMAND_HANDLERS \
 	X(clear) \
 	X(close) \
 	X(connect) \
 	X(disconnect) \
-	X(quit)
+	X(quit) \
+	X(search) \
+	X(set)
 
 #define X(CMD) \
 static void command_##CMD(struct channel*, char*);
@@ -46,6 +55,8 @@ static uint16_t state_complete(char*, uint16_t, uint16_t, int);
 static uint16_t state_complete_list(char*, uint16_t, uint16_t, const char**);
 static uint16_t state_complete_user(char*, uint16_t, uint16_t, int);
 
+static void state_buffer_evict(void);
+static void state_recv(struct server*, char*);
 static void state_channel_clear(int);
 static void state_channel_close(int);
 
@@ -65,6 +76,20 @@ static struct
 	struct channel *current_channel; /* the current channel being drawn */
 	struct channel *default_channel; /* the default rirc channel at startup */
 	struct server_list servers;
+	size_t buffer_memory_max; /* bytes of buffer memory before evicting lines, 0: no limit */
+	unsigned viewed;          /* count of channel views, for least recently viewed eviction */
+	struct channel_views views; /* channels holding buffer lines and the current channel, by last view */
+	unsigned spoke;           /* count of chat lines, for completing recent speakers first */
+	char search[TEXT_LENGTH_MAX + 1]; /* last :search text */
+	struct {
+		struct channel *c;          /* channel of the last nick completion */
+		char prefix[INPUT_LEN_MAX]; /* word completed */
+		char word[INPUT_LEN_MAX];   /* word it was replaced with */
+		uint16_t nick_len;          /* nick of `word`, less its suffix */
+		uint16_t prefix_len;
+		uint16_t word_len;
+		unsigned spoke;             /* order of the nick's last message */
+	} complete;
 } state;
 
 static unsigned state_tty_cols;
@@ -106,6 +131,10 @@ void
 state_init(void)
 {
 	state.default_channel = channel("rirc", CHANNEL_T_RIRC);
+	state.buffer_memory_max = BUFFER_MEMORY_MAX;
+
+	if (highlight_words(HIGHLIGHT_WORDS))
+		fatal("HIGHLIGHT_WORDS exceeds %d characters", HIGHLIGHT_WORDS_MAX);
 
 	newlinef(state.default_channel, 0, FROM_INFO, "      _");
 	newlinef(state.default_channel, 0, FROM_INFO, " _ __(_)_ __ ___");
@@ -129,7 +158,9 @@ state_term(void)
 	struct server *s2;
 
 	channel_free(state.default_channel);
+	highlight_words(NULL);
 
+	state.complete.c = NULL;
 	state.current_channel = NULL;
 	state.default_channel = NULL;
 
@@ -193,7 +224,7 @@ newlinev(struct channel *c, enum buffer_line_type type, const char *from, const
 		text_len = len;
 		from_str = from;
 
-		const struct user *u = NULL;
+		struct user *u = NULL;
 
 		if (type == BUFFER_LINE_CHAT || type == BUFFER_LINE_PINGED) {
 			u = user_list_get(&(c->users), c->server->casemapping, from, 0);
@@ -202,6 +233,7 @@ newlinev(struct channel *c, enum buffer_line_type type, const char *from, const
 		if (u) {
 			prefix = u->prfxmodes.prefix;
 			from_len = u->nick_len;
+			u->spoke = ++state.spoke;
 		} else {
 			from_len = strlen(from);
 		}
@@ -246,6 +278,10 @@ newlinev(struct channel *c, enum buffer_line_type type, const char *from, const
 		text_len,
 		prefix);
 
+	channel_views_add(&(state.views), c);
+
+	state_buffer_evict();
+
 	if (c == current_channel()) {
 		draw(DRAW_BUFFER);
 		draw(DRAW_STATUS);
@@ -343,11 +379,46 @@ state_channel_clear(int action_confirm)
 	if (action_confirm) {
 		action(action_clear, "Clear buffer '%s'?   [y/n]", c->name);
 	} else {
-		memset(&(c->buffer), 0, sizeof(c->buffer));
+		buffer_clear(&(c->buffer));
 		draw(DRAW_BUFFER);
 	}
 }
 
+static void
+state_buffer_evict(void)
+{
+	/* Evict the oldest buffer lines of the least recently viewed
+	 * channels until within the configured buffer memory limit.
+	 * Emptied channels are unlinked from the views list, such that
+	 * eviction stops at once when only the current channel, always
+	 * viewed last, holds lines. The current channel is never evicted
+	 * and may exceed the limit alone */
+
+	struct channel *c;
+
+	while (state.buffer_memory_max && buffer_memory_total() > state.buffer_memory_max) {
+
+		if ((c = state.views.head) == NULL || c == current_channel())
+			break;
+
+		if (buffer_size(&(c->buffer)))
+			buffer_evict(&(c->buffer));
+		else
+			channel_views_del(c);
+	}
+}
+
+static void
+state_recv(struct server *s, char *msg)
+{
+	struct irc_message m;
+
+	if (irc_message_parse(&m, msg) != 0)
+		newlinef(s->channel, 0, FROM_ERROR, "failed to parse message");
+	else
+		irc_recv(s, &m);
+}
+
 static void
 state_channel_close(int action_confirm)
 {
@@ -435,6 +506,10 @@ buffer_scrollback_back(void)
 {
 	struct buffer *b = &(current_channel()->buffer);
 
+	/* Page in spilled lines when scrolling back within a page of the tail */
+	if (b->scrollback - b->tail < state_rows() && buffer_spill_load(b, state_rows()))
+		state_buffer_evict();
+
 	if (buffer_line(b, b->scrollback) != (buffer_tail(b))) {
 		draw(DRAW_BUFFER_BACK);
 		draw(DRAW_BUFFER);
@@ -447,6 +522,11 @@ buffer_scrollback_forw(void)
 {
 	struct buffer *b = &(current_channel()->buffer);
 
+	/* Page in spilled lines released when scrolling back, when scrolling
+	 * forward within a page of the newest paged line */
+	if (b->spill.end - b->scrollback <= state_rows() && buffer_spill_load_forw(b, state_rows()))
+		state_buffer_evict();
+
 	if (buffer_line(b, b->scrollback) != (buffer_head(b))) {
 		draw(DRAW_BUFFER_FORW);
 		draw(DRAW_BUFFER);
@@ -523,7 +603,12 @@ channel_set_current(struct channel *c)
 {
 	/* Set the state to an arbitrary channel */
 
+	state.complete.c = NULL;
 	state.current_channel = c;
+	state.current_channel->viewed = ++state.viewed;
+
+	channel_views_del(c);
+	channel_views_add(&(state.views), c);
 
 	draw(DRAW_ALL);
 }
@@ -547,27 +632,85 @@ state_complete_list(char *str, uint16_t len, uint16_t max, const char **list)
 	return list_len + 1;
 }
 
+static int
+state_complete_user_cmp(const struct user *u, unsigned spoke, const char *nick, size_t len)
+{
+	/* Order a user against a nick, by most recently spoken, then nick */
+
+	int ret;
+
+	if (u->spoke != spoke)
+		return (u->spoke < spoke) - (u->spoke > spoke);
+
+	if ((ret = memcmp(u->nick, nick, MIN(u->nick_len, len))))
+		return ret;
+
+	return (u->nick_len > len) - (u->nick_len < len);
+}
+
 static uint16_t
 state_complete_user(char *str, uint16_t len, uint16_t max, int first)
 {
-	struct user *u;
+	/* Complete a nick by prefix, recent speakers first. Completing the
+	 * word of the last completion cycles through the prefix's matches,
+	 * to the match following the last in order, or the first after the
+	 * last, in a single pass of the prefix's users */
+
+	int cycle = 0;
 	struct channel *c = current_channel();
+	struct user *match = NULL;
+	struct user *next = NULL;
+	struct user *u;
+	struct user_iter it;
+	uint16_t ret = 0;
 
 	if (c->server == NULL)
 		return 0;
 
-	if ((u = user_list_get(&(c->users), c->server->casemapping, str, len)) == NULL)
-		return 0;
+	if (state.complete.c == c
+	 && state.complete.word_len == len
+	 && !memcmp(state.complete.word, str, len)) {
+		cycle = 1;
+	} else {
+		memcpy(state.complete.prefix, str, len);
+		state.complete.prefix_len = len;
+	}
+
+	state.complete.c = NULL;
+
+	u = user_list_iter(&(c->users), &it, c->server->casemapping, state.complete.prefix, state.complete.prefix_len);
+
+	for (; u; u = user_list_iter_next(&it)) {
+
+		if (!match || state_complete_user_cmp(u, match->spoke, match->nick, match->nick_len) < 0)
+			match = u;
+
+		if (cycle
+		 && state_complete_user_cmp(u, state.complete.spoke, state.complete.word, state.complete.nick_len) > 0
+		 && (!next || state_complete_user_cmp(u, next->spoke, next->nick, next->nick_len) < 0))
+			next = u;
+	}
+
+	if (next)
+		match = next;
 
-	if ((u->nick_len + (first != 0)) > max)
+	if (match == NULL || (match->nick_len + (first != 0)) > max)
 		return 0;
 
-	memcpy(str, u->nick, u->nick_len);
+	memcpy(str, match->nick, match->nick_len);
 
 	if (first)
-		str[u->nick_len] = ':';
+		str[match->nick_len] = ':';
 
-	return u->nick_len + (first != 0);
+	ret = match->nick_len + (first != 0);
+
+	memcpy(state.complete.word, str, ret);
+	state.complete.word_len = ret;
+	state.complete.nick_len = match->nick_len;
+	state.complete.spoke = match->spoke;
+	state.complete.c = c;
+
+	return ret;
 }
 
 static uint16_t
@@ -664,12 +807,15 @@ command_connect(struct channel *c, char *args)
 		const char *tls_ca_file = NULL;
 		const char *tls_ca_path = NULL;
 		const char *tls_cert    = NULL;
+		const char *tls_ciphers = NULL;
+		const char *tls_groups  = NULL;
 		const char *sasl        = NULL;
 		const char *sasl_user   = NULL;
 		const char *sasl_pass   = NULL;
 		int ipv                 = IO_IPV_UNSPEC;
 		int tls                 = IO_TLS_ENABLED;
 		int tls_vrfy            = IO_TLS_VRFY_REQUIRED;
+		int tls_version         = 0;
 
 		while ((arg = irc_strsep(&args))) {
 
@@ -740,6 +886,32 @@ command_connect(struct channel *c, char *args)
 					action(action_error, "connect: invalid option for '--tls-verify' '%s'", arg);
 					return;
 				}
+			} else if (!strcmp(arg, "--tls-version")) {
+				if (!(arg = irc_strsep(&args))) {
+					action(action_error, "connect: '--tls-version' requires an argument");
+					return;
+				} else if (!strcmp(arg, "1.2")) {
+					tls_version = IO_TLS_VERSION_1_2;
+				} else if (!strcmp(arg, "1.3")) {
+					tls_version = IO_TLS_VERSION_1_3;
+				} else {
+					action(action_error, "connect: invalid option for '--tls-version' '%s'", arg);
+					return;
+				}
+				if (!(io_tls_versions() & tls_version)) {
+					action(action_error, "connect: TLS version '%s' not supported by this build", arg);
+					return;
+				}
+			} else if (!strcmp(arg, "--tls-ciphers")) {
+				if (!(tls_ciphers = irc_strsep(&args))) {
+					action(action_error, "connect: '--tls-ciphers' requires an argument");
+					return;
+				}
+			} else if (!strcmp(arg, "--tls-groups")) {
+				if (!(tls_groups = irc_strsep(&args))) {
+					action(action_error, "connect: '--tls-groups' requires an argument");
+					return;
+				}
 			} else if (!strcmp(arg, "--tls-disable")) {
 				tls = IO_TLS_DISABLED;
 			} else if (!strcmp(arg, "--sasl")) {
@@ -807,7 +979,9 @@ command_connect(struct channel *c, char *args)
 			tls_ca_file,
 			tls_ca_path,
 			tls_cert,
-			(ipv | tls | tls_vrfy));
+			tls_ciphers,
+			tls_groups,
+			(ipv | tls | tls_vrfy | tls_version));
 
 		if ((ret = io_cx(s->connection)))
 			server_error(s, "failed to connect: %s", io_err(ret));
@@ -851,6 +1025,145 @@ command_quit(struct channel *c, char *args)
 	io_stop();
 }
 
+static void
+command_search(struct channel *c, char *args)
+{
+	/* :search [text]
+	 *
+	 * Search channels for a line containing text, from the current
+	 * channel's newest line, or continuing from the current line when
+	 * repeated without text */
+
+	char *text;
+	struct channel *search = c;
+	unsigned i = c->buffer.head;
+
+	if ((text = irc_strtrim(&args))) {
+		(void) snprintf(state.search, sizeof(state.search), "%s", text);
+	} else if (*state.search) {
+		i = c->buffer.scrollback;
+	} else {
+		action(action_error, ":search <text>");
+		return;
+	}
+
+	do {
+		if (buffer_search(&(search->buffer), state.search, &i)) {
+
+			search->buffer.scrollback = i;
+
+			if (search != c)
+				channel_set_current(search);
+
+			draw(DRAW_BUFFER);
+			draw(DRAW_STATUS);
+			return;
+		}
+
+		search = channel_get_next(search);
+		i = search->buffer.head;
+
+	} while (search != c);
+
+	action(action_error, "search: no match for '%s'", state.search);
+}
+
+static void
+command_set(struct channel *c, char *args)
+{
+	/* :set <option> <value> */
+
+	char *arg;
+	char *end;
+	char *val;
+	unsigned long n;
+
+	if (!(arg = irc_strsep(&args))) {
+		action(action_error, ":set <option> <value>");
+		return;
+	}
+
+	if (strcmp(arg, "highlight") && strcmp(arg, "scrollback") && strcmp(arg, "scrollback-memory")) {
+		action(action_error, "set: unknown option '%s'", arg);
+		return;
+	}
+
+	if (!strcmp(arg, "highlight")) {
+
+		/* Comma separated words highlighting messages, none if unset */
+
+		val = irc_strsep(&args);
+
+		if ((end = irc_strsep(&args))) {
+			action(action_error, "set: Unknown arg '%s'", end);
+			return;
+		}
+
+		if (highlight_words(val)) {
+			action(action_error, "set: invalid value for '%s', exceeds %d characters", arg, HIGHLIGHT_WORDS_MAX);
+			return;
+		}
+
+		return;
+	}
+
+	if (!(val = irc_strsep(&args))) {
+		action(action_error, "set: '%s' requires an argument", arg);
+		return;
+	}
+
+	if ((end = irc_strsep(&args))) {
+		action(action_error, "set: Unknown arg '%s'", end);
+		return;
+	}
+
+	errno = 0;
+
+	if (!isdigit(*val) || ((n = strtoul(val, &end, 10)) == ULONG_MAX && errno)) {
+		action(action_error, "set: invalid value for '%s' '%s'", arg, val);
+		return;
+	}
+
+	if (!strcmp(arg, "scrollback")) {
+
+		/* Lines kept in the current channel's buffer */
+
+		if (*end || n == 0 || n > BUFFER_LINES_LIMIT) {
+			action(action_error, "set: invalid value for '%s' '%s' [1, %u]", arg, val, BUFFER_LINES_LIMIT);
+			return;
+		}
+
+		buffer_set_lines_max(&(c->buffer), n);
+		draw(DRAW_BUFFER);
+		draw(DRAW_STATUS);
+
+	} else {
+
+		/* Bytes of buffer memory across all channels, with optional K/M/G suffix.
+		 * The current channel is never evicted, and may exceed it alone */
+
+		unsigned shift = 0;
+
+		switch (*end) {
+			case 'k': case 'K': shift = 10; end++; break;
+			case 'm': case 'M': shift = 20; end++; break;
+			case 'g': case 'G': shift = 30; end++; break;
+			default:
+				break;
+		}
+
+		if (*end || (shift && n > (SIZE_MAX >> shift))) {
+			action(action_error, "set: invalid value for '%s' '%s'", arg, val);
+			return;
+		}
+
+		state.buffer_memory_max = (size_t)n << shift;
+		state_buffer_evict();
+		draw(DRAW_BUFFER);
+		draw(DRAW_STATUS);
+	}
+}
+
 static int
 state_input_ctrlch(const char *c, size_t len)
 {
@@ -1024,38 +1337,51 @@ io_cb_read_inp(char *buf, size_t len)
 void
 io_cb_read_soc(char *buf, size_t len, const void *cb_obj)
 {
+	/* Messages are framed by LF and parsed in place in the read buffer.
+	 * Only a message split across reads is copied, the partial message
+	 * being buffered until completed by a subsequent read */
+
 	struct server *s = (struct server *)cb_obj;
-	struct channel *c = s->channel;
-	size_t ci = s->read.i;
-	size_t n = len;
+	char *end = buf + len;
+	char *p;
+
+	while ((p = memchr(buf, '\n', (size_t)(end - buf)))) {
 
-	for (size_t i = 0; i < n; i++) {
+		char *msg = buf;
+		size_t n = (size_t)(p - buf);
 
-		char cc = buf[i];
+		buf = p + 1;
 
-		if (ci && cc == '\n' && ((i && buf[i - 1] == '\r') || (!i && s->read.cl == '\r'))) {
+		if (s->read.i) {
+			n = MIN(n, IRC_MESSAGE_LEN - s->read.i);
+			memcpy(s->read.buf + s->read.i, msg, n);
+			msg = s->read.buf;
+			n += s->read.i;
+			s->read.i = 0;
+		}
 
-			s->read.buf[ci] = 0;
+		n = MIN(n, IRC_MESSAGE_LEN);
 
-			debug_recv(ci, s->read.buf);
+		if (n && msg[n - 1] == '\r')
+			n--;
 
-			struct irc_message m;
+		if (n == 0)
+			continue;
 
-			if (irc_message_parse(&m, s->read.buf) != 0)
-				newlinef(c, 0, FROM_ERROR, "failed to parse message");
-			else
-				irc_recv(s, &m);
+		msg[n] = 0;
 
-			ci = 0;
-		} else if (ci < IRC_MESSAGE_LEN && cc && cc != '\n' && cc != '\r') {
-			s->read.buf[ci++] = cc;
-		}
+		debug_recv(n, msg);
+
+		state_recv(s, msg);
 	}
 
-	s->read.cl = buf[n - 1];
-	s->read.i = ci;
+	if (buf < end) {
+		size_t n = MIN((size_t)(end - buf), IRC_MESSAGE_LEN - s->read.i);
+		memcpy(s->read.buf + s->read.i, buf, n);
+		s->read.i += n;
+	}
 
-	draw(DRAW_FLUSH);
+	draw(DRAW_FRAME);
 }
 
 void
@@ -1083,7 +1409,7 @@ io_cb_cxed(const void *cb_obj)
 		server_error(s, "sendf fail: %s", io_err(ret));
 
 	draw(DRAW_STATUS);
-	draw(DRAW_FLUSH);
+	draw(DRAW_FRAME);
 }
 
 void
@@ -1101,7 +1427,7 @@ io_cb_dxed(const void *cb_obj)
 	} while (c != s->channel);
 
 	draw(DRAW_STATUS);
-	draw(DRAW_FLUSH);
+	draw(DRAW_FRAME);
 }
 
 void
@@ -1117,7 +1443,7 @@ io_cb_ping(const void *cb_obj, unsigned ping)
 	else if ((ret = io_sendf(s->connection, "PING :%s", s->host)))
 		server_error(s, "sendf fail: %s", io_err(ret));
 
-	draw(DRAW_FLUSH);
+	draw(DRAW_FRAME);
 }
 
 void
@@ -1130,6 +1456,12 @@ io_cb_sigwinch(unsigned cols, unsigned rows)
 	draw(DRAW_FLUSH);
 }
 
+int
+io_cb_idle(void)
+{
+	return draw_deferred();
+}
+
 void
 io_cb_info(const void *cb_obj, const char *fmt, ...)
 {
@@ -1140,7 +1472,7 @@ io_cb_info(const void *cb_obj, const char *fmt, ...)
 
 	va_end(ap);
 
-	draw(DRAW_FLUSH);
+	draw(DRAW_FRAME);
 }
 
 void
@@ -1153,5 +1485,5 @@ io_cb_error(const void *cb_obj, const char *fmt, ...)
 
 	va_end(ap);
 
-	draw(DRAW_FLUSH);
+	draw(DRAW_FRAME);
 }
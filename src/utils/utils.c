@@ -7,10 +7,52 @@
 #include <string.h>
 #include <strings.h>
 
+/* Casefolding by table per casemapping, RFC 2812, section 2.2
+ *
+ * Because of IRC's Scandinavian origin, the characters {}|^ are
+ * considered to be the lower case equivalents of the characters []\~,
+ * respectively. This is a critical issue when determining the
+ * equivalence of two nicknames or channel names.
+ *
+ * Folded characters keep the sign of char, such that strings compare
+ * by signed byte as before the tables */
+#define CASEFOLD_ASCII(C) \
+	(((C) >= 'a' && (C) <= 'z') ? (C) - ('a' - 'A') : ((C) > 0x7F ? (C) - 0x100 : (C)))
+#define CASEFOLD_STRICT_RFC1459(C) \
+	((C) == '{' ? '[' : (C) == '}' ? ']' : (C) == '|' ? '\\' : CASEFOLD_ASCII(C))
+#define CASEFOLD_RFC1459(C) \
+	((C) == '^' ? '~' : CASEFOLD_STRICT_RFC1459(C))
+#define CASEFOLD_4(F, C) \
+	F(C), F((C) + 1), F((C) + 2), F((C) + 3)
+#define CASEFOLD_16(F, C) \
+	CASEFOLD_4(F, C), CASEFOLD_4(F, (C) + 4), CASEFOLD_4(F, (C) + 8), CASEFOLD_4(F, (C) + 12)
+#define CASEFOLD_64(F, C) \
+	CASEFOLD_16(F, C), CASEFOLD_16(F, (C) + 16), CASEFOLD_16(F, (C) + 32), CASEFOLD_16(F, (C) + 48)
+#define CASEFOLD(F) \
+	{ CASEFOLD_64(F, 0), CASEFOLD_64(F, 64), CASEFOLD_64(F, 128), CASEFOLD_64(F, 192) }
+
+static const signed char irc_casefold_tables[][256] = {
+	[CASEMAPPING_ASCII]          = CASEFOLD(CASEFOLD_ASCII),
+	[CASEMAPPING_RFC1459]        = CASEFOLD(CASEFOLD_RFC1459),
+	[CASEMAPPING_STRICT_RFC1459] = CASEFOLD(CASEFOLD_STRICT_RFC1459),
+};
+
 static inline int irc_ischanchar(char, int);
-static inline int irc_isnickchar(char, int);
 static inline int irc_toupper(enum casemapping, int);
 
+const signed char*
+irc_casefold(enum casemapping cm)
+{
+	switch (cm) {
+		case CASEMAPPING_ASCII:
+		case CASEMAPPING_RFC1459:
+		case CASEMAPPING_STRICT_RFC1459:
+			return irc_casefold_tables[cm];
+		default:
+			fatal("Unknown CASEMAPPING");
+	}
+}
+
 int
 irc_isnick(const char *str)
 {
@@ -25,6 +67,20 @@ irc_isnick(const char *str)
 	return 1;
 }
 
+int
+irc_isnickchar(char c, int first)
+{
+	/* RFC 2812, section 2.3.1
+	 *
+	 * nickname   =  ( letter / special ) *8( letter / digit / special / "-" )
+	 * letter     =  %x41-5A / %x61-7A       ; A-Z / a-z
+	 * digit      =  %x30-39                 ; 0-9
+	 * special    =  %x5B-60 / %x7B-7D       ; "[", "]", "\", "`", "_", "^", "{", "|", "}"
+	 */
+
+	return ((c >= 0x41 && c <= 0x7D) || (!first && ((c >= 0x30 && c <= 0x39) || c == '-')));
+}
+
 int
 irc_ischan(const char *str)
 {
@@ -40,71 +96,91 @@ irc_ischan(const char *str)
 }
 
 int
-irc_pinged(enum casemapping cm, const char *mesg, const char *nick)
+irc_strcmp(enum casemapping cm, const char *s1, const char *s2)
 {
-	size_t len = strlen(nick);
+	/* Case insensitive comparison of strings s1, s2 in accordance
+	 * with RFC 2812, section 2.2 */
 
-	while (*mesg) {
+	const signed char *fold = irc_casefold(cm);
+	int c1, c2;
 
-		while (*mesg && *mesg != *nick && !irc_isnickchar(*mesg, 1))
-			mesg++;
+	for (;; s1++, s2++) {
 
-		if (!irc_strncmp(cm, mesg, nick, len) && !irc_isnickchar(*(mesg + len), 0))
-			return 1;
+		if (*s1 == *s2) {
+			if (*s1 == 0)
+				break;
+			continue;
+		}
+
+		c1 = fold[(unsigned char) *s1];
+		c2 = fold[(unsigned char) *s2];
 
-		while (*mesg && *mesg != ' ')
-			mesg++;
+		if ((c1 -= c2))
+			return -c1;
 	}
 
 	return 0;
 }
 
 int
-irc_strcmp(enum casemapping cm, const char *s1, const char *s2)
+irc_strncmp(enum casemapping cm, const char *s1, const char *s2, size_t n)
 {
 	/* Case insensitive comparison of strings s1, s2 in accordance
-	 * with RFC 2812, section 2.2 */
+	 * with RFC 2812, section 2.2, up to n characters */
 
+	const signed char *fold = irc_casefold(cm);
 	int c1, c2;
 
-	for (;;) {
+	for (; n > 0; n--, s1++, s2++) {
 
-		c1 = irc_toupper(cm, *s1++);
-		c2 = irc_toupper(cm, *s2++);
+		if (*s1 == *s2) {
+			if (*s1 == 0)
+				break;
+			continue;
+		}
+
+		c1 = fold[(unsigned char) *s1];
+		c2 = fold[(unsigned char) *s2];
 
 		if ((c1 -= c2))
 			return -c1;
-
-		if (c2 == 0)
-			break;
 	}
 
 	return 0;
 }
 
-int
-irc_strncmp(enum casemapping cm, const char *s1, const char *s2, size_t n)
+uint32_t
+irc_strhash(enum casemapping cm, const char *str)
 {
-	/* Case insensitive comparison of strings s1, s2 in accordance
-	 * with RFC 2812, section 2.2, up to n characters */
+	/* FNV-1a hash of str, consistent with irc_strcmp */
 
-	int c1, c2;
+	const signed char *fold = irc_casefold(cm);
+	uint32_t hash = 2166136261u;
 
-	while (n > 0) {
+	while (*str) {
+		hash ^= (uint32_t) fold[(unsigned char) *str++];
+		hash *= 16777619u;
+	}
 
-		c1 = irc_toupper(cm, *s1++);
-		c2 = irc_toupper(cm, *s2++);
+	return hash;
+}
 
-		if ((c1 -= c2))
-			return -c1;
+uint64_t
+irc_strkey(enum casemapping cm, const char *str)
+{
+	/* Key of the first 8 casefolded bytes of str, such that keys compare
+	 * as irc_strcmp, or equal when strings share those bytes, i.e.
+	 * descending by signed byte, with shorter strings following */
 
-		if (c2 == 0)
-			break;
+	const signed char *fold = irc_casefold(cm);
+	uint64_t key = 0;
 
-		n--;
+	for (int i = 0; i < 8; i++) {
+		unsigned char c = (unsigned char) (*str ? fold[(unsigned char) *str++] : 0);
+		key = (key << 8) | (c ^ 0x80);
 	}
 
-	return 0;
+	return ~key;
 }
 
 // TODO: reverse return order
@@ -367,42 +443,8 @@ irc_ischanchar(char c, int first)
 	}
 }
 
-static inline int
-irc_isnickchar(char c, int first)
-{
-	/* RFC 2812, section 2.3.1
-	 *
-	 * nickname   =  ( letter / special ) *8( letter / digit / special / "-" )
-	 * letter     =  %x41-5A / %x61-7A       ; A-Z / a-z
-	 * digit      =  %x30-39                 ; 0-9
-	 * special    =  %x5B-60 / %x7B-7D       ; "[", "]", "\", "`", "_", "^", "{", "|", "}"
-	 */
-
-	return ((c >= 0x41 && c <= 0x7D) || (!first && ((c >= 0x30 && c <= 0x39) || c == '-')));
-}
-
 static inline int
 irc_toupper(enum casemapping cm, int c)
 {
-	/* RFC 2812, section 2.2
-	 *
-	 * Because of IRC's Scandinavian origin, the characters {}|^ are
-	 * considered to be the lower case equivalents of the characters []\~,
-	 * respectively. This is a critical issue when determining the
-	 * equivalence of two nicknames or channel names. */
-
-	switch (cm) {
-		case CASEMAPPING_RFC1459:
-			if (c == '^') return '~';
-			/* FALLTHROUGH */
-		case CASEMAPPING_STRICT_RFC1459:
-			if (c == '{') return '[';
-			if (c == '}') return ']';
-			if (c == '|') return '\\';
-			/* FALLTHROUGH */
-		case CASEMAPPING_ASCII:
-			return (c >= 'a' && c <= 'z') ? (c + 'A' - 'a') : c;
-		default:
-			fatal("Unknown CASEMAPPING");
-	}
+	return irc_casefold(cm)[(unsigned char) c];
 }
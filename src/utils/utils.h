@@ -1,6 +1,7 @@
 #ifndef RIRC_UTILS_UTILS_H
 #define RIRC_UTILS_UTILS_H
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -67,11 +68,14 @@ struct irc_message
 	unsigned split : 1;
 };
 
+const signed char* irc_casefold(enum casemapping);
 int irc_ischan(const char*);
 int irc_isnick(const char*);
-int irc_pinged(enum casemapping, const char*, const char*);
+int irc_isnickchar(char, int);
 int irc_strcmp(enum casemapping, const char*, const char*);
 int irc_strncmp(enum casemapping, const char*, const char*, size_t);
+uint32_t irc_strhash(enum casemapping, const char*);
+uint64_t irc_strkey(enum casemapping, const char*);
 char* irc_strdup(const char*);
 char* irc_strsep(char**);
 char* irc_strtrim(char**);
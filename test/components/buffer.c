@@ -1,6 +1,10 @@
 #include <limits.h>
 
 #include "test/test.h"
+
+/* Spilled lines span many segments */
+#define BUFFER_SPILL_SEGMENT_SIZE (1 << 16)
+
 #include "src/components/buffer.c"
 #include "src/utils/utils.c"
 
@@ -25,6 +29,20 @@ t__buffer_newline(struct buffer *buffer, const char *t)
 	buffer_newline(buffer, BUFFER_LINE_OTHER, "", t, 0, strlen(t), 0);
 }
 
+static unsigned
+t__buffer_pages(struct buffer *buffer)
+{
+	/* Count the pages in a buffer's arena */
+
+	struct buffer_page *p;
+	unsigned n = 0;
+
+	for (p = buffer->pages.tail; p; p = p->next)
+		n++;
+
+	return n;
+}
+
 static void
 test_buffer(void)
 {
@@ -86,12 +104,18 @@ test_buffer_line(void)
 {
 	/* Test that retrieving a buffer line fails when i != [tail, head) */
 
+	int i;
+
 	/* Should retrieve null for an empty buffer */
 	assert_eq(buffer_size(b), 0);
 	assert_ptr_null(buffer_line(b, b->head));
 	assert_ptr_null(buffer_line(b, b->tail));
 	assert_ptr_null(buffer_line(b, b->scrollback));
 
+	/* Grow the ring to full size */
+	for (i = 0; i < BUFFER_LINES_MAX; i++)
+		t__buffer_newline(b, t__fmt_int(i));
+
 	/* For any buffer line retrieval, these conditions should always hold */
 	#define CHECK_BUFFER(B) \
 	    assert_fatal(buffer_line((B), (B)->tail - 1)); \
@@ -216,12 +240,11 @@ test_buffer_index_overflow(void)
 	b->scrollback = b->tail;
 
 	assert_eq(buffer_size(b), 1);
-	assert_eq(BUFFER_MASK(b->head), (BUFFER_LINES_MAX - 1));
 
 	t__buffer_newline(b, t__fmt_int(0));
 
 	assert_eq(buffer_size(b), 2);
-	assert_eq(BUFFER_MASK(b->head), 0);
+	assert_eq(BUFFER_MASK(b, b->head), 0);
 
 	t__buffer_newline(b, t__fmt_int(-1));
 
@@ -302,6 +325,546 @@ test_buffer_newline_prefix(void)
 	assert_eq(line->from[FROM_LENGTH_MAX - 1], 'b');
 }
 
+static void
+test_buffer_grow(void)
+{
+	/* Test the ring is allocated on the first newline, and grows in order */
+
+	int i;
+
+	assert_ptr_null(b->buffer_lines);
+	assert_ueq(b->buffer_lines_size, 0);
+
+	t__buffer_newline(b, t__fmt_int(0));
+
+	assert_ptr_not_null(b->buffer_lines);
+	assert_ueq(b->buffer_lines_size, BUFFER_LINES_MIN);
+
+	for (i = 1; i < BUFFER_LINES_MIN; i++)
+		t__buffer_newline(b, t__fmt_int(i));
+
+	assert_ueq(b->buffer_lines_size, BUFFER_LINES_MIN);
+
+	t__buffer_newline(b, t__fmt_int(i));
+
+	assert_ueq(b->buffer_lines_size, BUFFER_LINES_MIN * 2);
+
+	for (i = 0; i <= BUFFER_LINES_MIN; i++)
+		assert_strcmp(buffer_line(b, b->tail + i)->text, t__fmt_int(i));
+
+	/* Test growing a ring whose indices have wrapped */
+	buffer_free(b);
+	buffer(b);
+
+	b->head = UINT_MAX - (BUFFER_LINES_MIN / 2);
+	b->tail = UINT_MAX - (BUFFER_LINES_MIN / 2);
+	b->scrollback = b->tail;
+
+	for (i = 0; i < BUFFER_LINES_MAX; i++)
+		t__buffer_newline(b, t__fmt_int(i));
+
+	assert_ueq(b->buffer_lines_size, BUFFER_LINES_MAX);
+	assert_eq(buffer_size(b), BUFFER_LINES_MAX);
+
+	for (i = 0; i < BUFFER_LINES_MAX; i++)
+		assert_strcmp(buffer_line(b, b->tail + i)->text, t__fmt_int(i));
+
+	/* Test the ring doesn't grow beyond BUFFER_LINES_MAX */
+	t__buffer_newline(b, t__fmt_int(i));
+
+	assert_ueq(b->buffer_lines_size, BUFFER_LINES_MAX);
+	assert_strcmp(buffer_head(b)->text, t__fmt_int(BUFFER_LINES_MAX));
+	assert_strcmp(buffer_tail(b)->text, t__fmt_int(1));
+}
+
+static void
+test_buffer_memory(void)
+{
+	/* Test bytes allocated for empty and partially filled buffers */
+
+	size_t line = sizeof(struct buffer_line);
+	int i;
+
+	/* Empty buffers allocate nothing beyond the struct itself */
+	assert_ueq(buffer_memory(b), sizeof(*b));
+	assert_lt(sizeof(*b), 256);
+
+	t__buffer_newline(b, "a");
+
+	assert_gt(b->index.lines.memory, 0);
+	assert_ueq(buffer_memory(b), sizeof(*b) + line * BUFFER_LINES_MIN + BUFFER_PAGE_SIZE + b->index.lines.memory);
+
+	for (i = 1; i < BUFFER_LINES_MIN * 4; i++)
+		t__buffer_newline(b, "a");
+
+	assert_ueq(buffer_memory(b), sizeof(*b) + line * BUFFER_LINES_MIN * 4 + BUFFER_PAGE_SIZE + b->index.lines.memory);
+
+	/* Full buffer of short lines */
+	for (i = 0; i < BUFFER_LINES_MAX; i++)
+		t__buffer_newline(b, "a");
+
+	assert_ueq(buffer_memory(b), sizeof(*b) + line * BUFFER_LINES_MAX + BUFFER_PAGE_SIZE * b->pages.count + b->index.lines.memory);
+	assert_lt(buffer_memory(b), sizeof(*b) + line * BUFFER_LINES_MAX + BUFFER_PAGE_SIZE * 3 + b->index.lines.memory);
+
+	/* Each line of "a" is indexed once, by a single trigram */
+	assert_ueq(b->index.lines.count, 1);
+	assert_lt(b->index.lines.memory, sizeof(struct buffer_posting) * BUFFER_INDEX_SIZE_MIN + sizeof(unsigned) * BUFFER_LINES_MAX * 2);
+
+	buffer_free(b);
+
+	assert_ueq(buffer_memory(b), sizeof(*b));
+}
+
+static void
+test_buffer_lines_max(void)
+{
+	/* Test setting the number of lines kept by a buffer */
+
+	int i;
+
+	assert_ueq(b->buffer_lines_max, BUFFER_LINES_MAX);
+
+	buffer_set_lines_max(b, 100);
+
+	for (i = 0; i < 1000; i++)
+		t__buffer_newline(b, t__fmt_int(i));
+
+	/* Ring grows to fit the limit, lines are kept up to the limit */
+	assert_eq(buffer_size(b), 100);
+	assert_ueq(b->buffer_lines_size, 128);
+	assert_strcmp(buffer_head(b)->text, t__fmt_int(999));
+	assert_strcmp(buffer_tail(b)->text, t__fmt_int(900));
+
+	/* Lowering the limit removes the oldest lines and shrinks the ring */
+	b->scrollback = b->tail;
+
+	buffer_set_lines_max(b, 20);
+
+	assert_eq(buffer_size(b), 20);
+	assert_ueq(b->buffer_lines_size, 32);
+	assert_strcmp(buffer_head(b)->text, t__fmt_int(999));
+	assert_strcmp(buffer_tail(b)->text, t__fmt_int(980));
+	assert_ptr_eq(buffer_line(b, b->scrollback), buffer_tail(b));
+
+	for (i = 0; i < 20; i++)
+		assert_strcmp(buffer_line(b, b->tail + i)->text, t__fmt_int(980 + i));
+
+	/* Raising the limit grows the ring on demand */
+	buffer_set_lines_max(b, BUFFER_LINES_LIMIT);
+
+	assert_ueq(b->buffer_lines_size, 32);
+
+	for (i = 0; i < 1000; i++)
+		t__buffer_newline(b, t__fmt_int(i));
+
+	assert_eq(buffer_size(b), 1020);
+	assert_ueq(b->buffer_lines_size, 1024);
+
+	/* Clearing a buffer keeps its limit */
+	buffer_clear(b);
+
+	assert_eq(buffer_size(b), 0);
+	assert_ueq(b->buffer_lines_max, BUFFER_LINES_LIMIT);
+
+	assert_fatal(buffer_set_lines_max(b, 0));
+	assert_fatal(buffer_set_lines_max(b, BUFFER_LINES_LIMIT + 1));
+}
+
+static void
+test_buffer_evict(void)
+{
+	/* Test evicting a buffer's oldest lines and memory accounting */
+
+	char text[TEXT_LENGTH_MAX + 1];
+	int i;
+	size_t total = buffer_memory_total();
+	struct buffer_page *page;
+
+	assert_ueq(buffer_evict(b), 0);
+
+	memset(text, 'a', sizeof(text) - 1);
+	text[sizeof(text) - 1] = 0;
+
+	for (i = 0; i < 100; i++)
+		t__buffer_newline(b, text);
+
+	assert_ueq(buffer_memory_total() - total, buffer_memory(b) - sizeof(*b));
+
+	/* Evicting frees exactly the oldest page */
+	page = b->pages.tail;
+
+	assert_ueq(buffer_evict(b), BUFFER_PAGE_SIZE);
+	assert_true(b->pages.tail != page);
+	assert_ptr_eq(buffer_tail(b)->page, b->pages.tail);
+	assert_ueq(buffer_memory_total() - total, buffer_memory(b) - sizeof(*b));
+
+	/* Evicting a mostly empty ring shrinks it */
+	while (buffer_size(b) > 32)
+		assert_gt(buffer_evict(b), 0);
+
+	assert_ueq(b->buffer_lines_size, 64);
+
+	/* Evicting all lines releases the ring and pages */
+	while (buffer_size(b))
+		assert_gt(buffer_evict(b), 0);
+
+	assert_ptr_null(b->buffer_lines);
+	assert_ptr_null(b->pages.head);
+	assert_ueq(buffer_memory(b), sizeof(*b));
+	assert_ueq(buffer_memory_total(), total);
+
+	/* Buffer remains usable */
+	t__buffer_newline(b, "a");
+
+	assert_eq(buffer_size(b), 1);
+	assert_strcmp(buffer_head(b)->text, "a");
+	assert_ptr_eq(buffer_line(b, b->scrollback), buffer_head(b));
+}
+
+static void
+test_buffer_spill(void)
+{
+	/* Test spilling lines removed from the ring and paging them back in */
+
+	char text[TEXT_LENGTH_MAX + 1];
+	char from[] = "nick";
+	int i;
+	unsigned loaded;
+	unsigned mapped;
+	unsigned n = 5000;
+
+	buffer_spill_dir = "/tmp";
+
+	buffer_set_lines_max(b, 16);
+
+	memset(text, 'a', sizeof(text) - 1);
+	text[sizeof(text) - 1] = 0;
+
+	for (i = 0; i < (int)n; i++) {
+		snprintf(text, sizeof(text), "%05d", i);
+		text[5] = 'a';
+		buffer_newline(b, BUFFER_LINE_CHAT, from, text, sizeof(from) - 1, sizeof(text) - 1, '@');
+	}
+
+	assert_eq(buffer_size(b), 16);
+	assert_eq(buffer_spill_size(b), n - 16);
+	assert_gt(b->spill.count, 1);
+
+	/* Only the segment being written to remains mapped */
+	for (mapped = 0, i = 0; i < (int)b->spill.count; i++)
+		mapped += !!b->spill.segments[i].map;
+
+	assert_eq(mapped, 1);
+
+	/* Paging in lines preceding the tail keeps the scrollback line, up to
+	 * the buffer's line limit */
+	b->scrollback = b->tail;
+
+	assert_eq(buffer_spill_load(b, 100), 16);
+	assert_eq(buffer_size(b), 32);
+	assert_eq(buffer_spill_size(b), n - 32);
+	assert_strncmp(buffer_line(b, b->scrollback)->text, "04984", 5);
+	assert_strncmp(buffer_tail(b)->text, "04968", 5);
+	assert_ptr_null(buffer_tail(b)->page);
+
+	/* Paging back through all lines releases the newest paged lines, keeping
+	 * the scrollback line, ring size and mapped segments bounded */
+	do {
+		snprintf(text, sizeof(text), "%.5s", buffer_tail(b)->text);
+
+		b->scrollback = b->tail;
+
+		loaded = buffer_spill_load(b, 10);
+
+		assert_strncmp(buffer_line(b, b->scrollback)->text, text, 5);
+		assert_eq(buffer_size(b), 32);
+		assert_ueq(b->buffer_lines_size, 32);
+
+		for (mapped = 0, i = 0; i < (int)b->spill.count; i++)
+			mapped += !!b->spill.segments[i].map;
+
+		assert_lt(mapped, 4);
+
+	} while (loaded);
+
+	assert_eq(buffer_spill_size(b), 0);
+	assert_eq(buffer_spill_load(b, 1), 0);
+	assert_ueq(b->spill.gap, n - 32);
+
+	for (i = 0; i < 32; i++) {
+		struct buffer_line *line = buffer_line(b, b->tail + i);
+		snprintf(text, sizeof(text), "%05d", (i < 16 ? i : (int)n - 32 + i));
+		assert_strncmp(line->text, text, 5);
+		assert_strcmp(line->from, "@nick");
+		assert_ueq(line->from_len, 5);
+		assert_ueq(line->text_len, TEXT_LENGTH_MAX);
+		assert_eq(line->type, BUFFER_LINE_CHAT);
+		assert_eq(line->text[TEXT_LENGTH_MAX], 0);
+	}
+
+	/* Paging forward through all lines releases the oldest paged lines,
+	 * until the paged lines precede the ring's lines in memory */
+	b->scrollback = b->tail + 15;
+
+	do {
+		snprintf(text, sizeof(text), "%.5s", buffer_line(b, b->scrollback)->text);
+
+		loaded = buffer_spill_load_forw(b, 10);
+
+		assert_strncmp(buffer_line(b, b->scrollback)->text, text, 5);
+		assert_eq(buffer_size(b), 32);
+
+		b->scrollback = b->spill.end - 1;
+
+	} while (loaded);
+
+	assert_ueq(b->spill.gap, 0);
+	assert_eq(buffer_spill_size(b), n - 32);
+
+	for (i = 0; i < 32; i++) {
+		snprintf(text, sizeof(text), "%05d", (int)n - 32 + i);
+		assert_strncmp(buffer_line(b, b->tail + i)->text, text, 5);
+	}
+
+	/* Paged back again, new lines release paged lines while scrolled back */
+	assert_eq(buffer_spill_load(b, 16), 16);
+	assert_eq(buffer_spill_load(b, 16), 16);
+	assert_ueq(b->spill.gap, 32);
+
+	b->scrollback = b->tail;
+
+	buffer_newline(b, BUFFER_LINE_OTHER, "", "new", 0, 3, 0);
+
+	assert_eq(buffer_size(b), 32);
+	assert_eq(buffer_spill_size(b), n - 64 + 1);
+	assert_strncmp(buffer_line(b, b->scrollback)->text, "04937", 5);
+
+	/* Released once scrolled to head, the skipped lines preceding the tail,
+	 * unmapping unreferenced segments */
+	b->scrollback = b->head - 1;
+
+	buffer_newline(b, BUFFER_LINE_OTHER, "", "new", 0, 3, 0);
+
+	assert_eq(buffer_size(b), 16);
+	assert_eq(buffer_spill_size(b), n + 2 - 16);
+	assert_ueq(b->spill.gap, 0);
+	assert_strcmp(buffer_head(b)->text, "new");
+	assert_ptr_eq(buffer_line(b, b->scrollback), buffer_head(b));
+
+	for (mapped = 0, i = 0; i < (int)b->spill.count; i++)
+		mapped += !!b->spill.segments[i].map;
+
+	assert_eq(mapped, 1);
+
+	/* Lines spilled after the skipped lines are paged back in order */
+	b->scrollback = b->tail;
+
+	assert_eq(buffer_spill_load(b, 3), 3);
+	assert_strncmp(buffer_tail(b)->text, "04983", 5);
+	assert_strncmp(buffer_line(b, b->tail + 1)->text, "04984", 5);
+	assert_strncmp(buffer_line(b, b->tail + 2)->text, "04985", 5);
+	assert_strncmp(buffer_line(b, b->tail + 3)->text, "04986", 5);
+
+	/* Paging in from an empty ring sets scrollback to head */
+	while (buffer_size(b))
+		buffer_evict(b);
+
+	assert_eq(buffer_spill_size(b), n + 2);
+	assert_eq(buffer_spill_load(b, 3), 3);
+	assert_strcmp(buffer_head(b)->text, "new");
+	assert_ptr_eq(buffer_line(b, b->scrollback), buffer_head(b));
+	assert_strncmp(buffer_tail(b)->text, "04999", 5);
+
+	/* Clearing a buffer discards spilled lines */
+	buffer_clear(b);
+
+	assert_eq(buffer_spill_size(b), 0);
+	assert_eq(b->spill.fd, -1);
+	assert_ptr_null(b->spill.segments);
+
+	/* Lines are discarded when spilling is disabled */
+	buffer_spill_dir = "";
+
+	buffer_set_lines_max(b, 16);
+
+	for (i = 0; i < 100; i++)
+		t__buffer_newline(b, t__fmt_int(i));
+
+	assert_eq(buffer_size(b), 16);
+	assert_eq(buffer_spill_size(b), 0);
+	assert_eq(buffer_spill_load(b, 1), 0);
+	assert_ptr_null(b->spill.segments);
+}
+
+static void
+test_buffer_search(void)
+{
+	/* Test searching a buffer's lines, ignoring case */
+
+	char text[TEXT_LENGTH_MAX + 1];
+	int i;
+	unsigned index = b->head;
+
+	assert_false(buffer_search(b, "needle", &index));
+
+	buffer_set_lines_max(b, 1 << 12);
+
+	for (i = 0; i < (1 << 12); i++) {
+		if (i == 100 || i == 2000 || i == 3000)
+			snprintf(text, sizeof(text), "line %d with a NeEdLe in it", i);
+		else
+			snprintf(text, sizeof(text), "line %d with a needl in it", i);
+		t__buffer_newline(b, text);
+	}
+
+	assert_gt(b->pages.count, 10);
+
+	index = b->head;
+
+	assert_true(buffer_search(b, "needle", &index));
+	assert_strcmp(buffer_line(b, index)->text, "line 3000 with a NeEdLe in it");
+	assert_true(buffer_search(b, "NEEDLE IN", &index));
+	assert_strcmp(buffer_line(b, index)->text, "line 2000 with a NeEdLe in it");
+	assert_true(buffer_search(b, "needle", &index));
+	assert_strcmp(buffer_line(b, index)->text, "line 100 with a NeEdLe in it");
+	assert_false(buffer_search(b, "needle", &index));
+	assert_strcmp(buffer_line(b, index)->text, "line 100 with a NeEdLe in it");
+
+	/* Short strings */
+	index = b->head;
+
+	assert_true(buffer_search(b, "1 w", &index));
+	assert_strcmp(buffer_line(b, index)->text, "line 4091 with a needl in it");
+	assert_true(buffer_search(b, "9", &index));
+	assert_strcmp(buffer_line(b, index)->text, "line 4090 with a needl in it");
+
+	/* Lines removed from the buffer aren't found */
+	for (i = 0; i < 1500; i++)
+		t__buffer_newline(b, "");
+
+	index = b->head;
+
+	assert_true(buffer_search(b, "needle", &index));
+	assert_strcmp(buffer_line(b, index)->text, "line 3000 with a NeEdLe in it");
+	assert_true(buffer_search(b, "needle", &index));
+	assert_strcmp(buffer_line(b, index)->text, "line 2000 with a NeEdLe in it");
+	assert_false(buffer_search(b, "needle", &index));
+
+	/* Empty and no matches */
+	index = b->head;
+
+	assert_false(buffer_search(b, "", &index));
+	assert_false(buffer_search(b, "haystack", &index));
+	assert_false(buffer_search(b, "zq", &index));
+	assert_false(buffer_search(b, "#", &index));
+	assert_ueq(index, b->head);
+
+	/* Removed lines' postings are freed, short strings don't find them */
+	buffer_clear(b);
+	buffer_set_lines_max(b, 16);
+
+	t__buffer_newline(b, "Q");
+
+	for (i = 0; i < 16; i++)
+		t__buffer_newline(b, "abc");
+
+	assert_ueq(b->index.lines.count, 3);
+
+	index = b->head;
+
+	assert_false(buffer_search(b, "q", &index));
+	assert_false(buffer_search(b, "ca", &index));
+	assert_true(buffer_search(b, "bC", &index));
+	assert_ueq(index, b->head - 1);
+
+	/* Lines paged in from the spill file are indexed as searched */
+	buffer_spill_dir = "/tmp";
+
+	buffer_clear(b);
+
+	for (i = 0; i < 100; i++) {
+		snprintf(text, sizeof(text), "paged %d", i);
+		t__buffer_newline(b, text);
+	}
+
+	b->scrollback = b->tail;
+
+	assert_eq(buffer_spill_load(b, 16), 16);
+	assert_ptr_null(b->index.paged.table);
+
+	index = b->head;
+
+	assert_true(buffer_search(b, "paged 7", &index));
+	assert_strcmp(buffer_line(b, index)->text, "paged 79");
+	assert_ptr_null(buffer_line(b, index)->page);
+	assert_true(buffer_search(b, "7", &index));
+	assert_strcmp(buffer_line(b, index)->text, "paged 78");
+	assert_true(buffer_search(b, "paged 6", &index));
+	assert_strcmp(buffer_line(b, index)->text, "paged 69");
+	assert_true(buffer_search(b, "paged 6", &index));
+	assert_strcmp(buffer_line(b, index)->text, "paged 68");
+	assert_false(buffer_search(b, "paged 6", &index));
+
+	/* Sliding the paged window discards its index */
+	b->scrollback = b->tail;
+
+	assert_eq(buffer_spill_load(b, 16), 16);
+	assert_ptr_null(b->index.paged.table);
+
+	index = b->head;
+
+	assert_false(buffer_search(b, "paged 7", &index));
+	assert_true(buffer_search(b, "paged 6", &index));
+	assert_strcmp(buffer_line(b, index)->text, "paged 67");
+
+	buffer_spill_dir = "";
+}
+
+static void
+test_buffer_pages(void)
+{
+	/* Test buffer line text is stored in, and released from, the page arena */
+
+	char text[TEXT_LENGTH_MAX + 1];
+	int i;
+
+	assert_eq(t__buffer_pages(b), 0);
+
+	t__buffer_newline(b, "a");
+
+	assert_eq(t__buffer_pages(b), 1);
+	assert_ptr_eq(buffer_head(b)->page, b->pages.head);
+
+	/* Short lines share pages, overwritten pages are freed */
+	for (i = 0; i < BUFFER_LINES_MAX * 4; i++)
+		t__buffer_newline(b, t__fmt_int(i));
+
+	assert_ptr_eq(buffer_head(b)->page, b->pages.head);
+	assert_ptr_eq(buffer_tail(b)->page, b->pages.tail);
+	assert_strcmp(buffer_head(b)->text, t__fmt_int(BUFFER_LINES_MAX * 4 - 1));
+	assert_strcmp(buffer_tail(b)->text, t__fmt_int(BUFFER_LINES_MAX * 3));
+	assert_lt(t__buffer_pages(b), (BUFFER_LINES_MAX * 8) / BUFFER_PAGE_DATA + 2);
+
+	/* Maximum length lines */
+	memset(text, 'a', sizeof(text) - 1);
+	text[sizeof(text) - 1] = 0;
+
+	for (i = 0; i < BUFFER_LINES_MAX; i++)
+		t__buffer_newline(b, text);
+
+	assert_ueq(buffer_tail(b)->text_len, TEXT_LENGTH_MAX);
+	assert_strcmp(buffer_tail(b)->text, text);
+
+	/* Full pages, plus the partially overwritten tail page and partially
+	 * filled head page */
+	assert_lt(t__buffer_pages(b), BUFFER_LINES_MAX / (BUFFER_PAGE_DATA / (TEXT_LENGTH_MAX + 2)) + 3);
+
+	buffer_free(b);
+
+	assert_eq(t__buffer_pages(b), 0);
+	assert_ptr_null(b->pages.head);
+}
+
 static int
 test_init(void)
 {
@@ -315,6 +878,7 @@ test_init(void)
 static int
 test_term(void)
 {
+	buffer_free(b);
 	free(b);
 
 	return 0;
@@ -332,6 +896,13 @@ main(void)
 		TESTCASE(test_buffer_index_overflow),
 		TESTCASE(test_buffer_newline),
 		TESTCASE(test_buffer_newline_prefix),
+		TESTCASE(test_buffer_grow),
+		TESTCASE(test_buffer_memory),
+		TESTCASE(test_buffer_lines_max),
+		TESTCASE(test_buffer_evict),
+		TESTCASE(test_buffer_spill),
+		TESTCASE(test_buffer_search),
+		TESTCASE(test_buffer_pages),
 	};
 
 	return run_tests(test_init, test_term, tests);
@@ -44,11 +44,154 @@ test_channel_list(void)
 	channel_free(c3);
 }
 
+static void
+test_channel_list_casemapping(void)
+{
+	/* Test get by casemapping, as the casemapping changes */
+
+	struct channel_list clist;
+	struct channel *c1 = NULL,
+	               *c2 = NULL;
+
+	memset(&clist, 0, sizeof(clist));
+
+	c1 = channel("#abc{}", CHANNEL_T_CHANNEL);
+	c2 = channel("#abc^", CHANNEL_T_CHANNEL);
+
+	channel_list_add(&clist, c1);
+	channel_list_add(&clist, c2);
+
+	assert_ptr_eq(channel_list_get(&clist, "#ABC{}", CASEMAPPING_ASCII), c1);
+	assert_ptr_eq(channel_list_get(&clist, "#ABC[]", CASEMAPPING_ASCII), NULL);
+	assert_ptr_eq(channel_list_get(&clist, "#ABC~", CASEMAPPING_ASCII), NULL);
+
+	assert_ptr_eq(channel_list_get(&clist, "#ABC[]", CASEMAPPING_STRICT_RFC1459), c1);
+	assert_ptr_eq(channel_list_get(&clist, "#ABC~", CASEMAPPING_STRICT_RFC1459), NULL);
+
+	assert_ptr_eq(channel_list_get(&clist, "#ABC[]", CASEMAPPING_RFC1459), c1);
+	assert_ptr_eq(channel_list_get(&clist, "#ABC~", CASEMAPPING_RFC1459), c2);
+
+	assert_ptr_eq(channel_list_get(&clist, "#ABC~", CASEMAPPING_ASCII), NULL);
+
+	channel_list_free(&clist);
+}
+
+static void
+test_channel_list_index(void)
+{
+	/* Test get as the list's index grows, and channels are removed */
+
+	char name[16];
+	struct channel *c;
+	struct channel *chans[200];
+	struct channel_list clist;
+
+	memset(&clist, 0, sizeof(clist));
+
+	for (size_t i = 0; i < ARR_LEN(chans); i++) {
+		snprintf(name, sizeof(name), "#chan%zu", i);
+		chans[i] = channel(name, CHANNEL_T_CHANNEL);
+		channel_list_add(&clist, chans[i]);
+	}
+
+	assert_eq(clist.count, 200);
+	assert_gt(clist.size, 199);
+
+	for (size_t i = 0; i < ARR_LEN(chans); i++) {
+		snprintf(name, sizeof(name), "#CHAN%zu", i);
+		if (channel_list_get(&clist, name, CASEMAPPING_ASCII) != chans[i])
+			test_failf("Failed to get channel: %s", name);
+	}
+
+	for (size_t i = 0; i < ARR_LEN(chans); i += 2) {
+		channel_list_del(&clist, chans[i]);
+		channel_free(chans[i]);
+	}
+
+	for (size_t i = 0; i < ARR_LEN(chans); i++) {
+		snprintf(name, sizeof(name), "#chan%zu", i);
+		c = channel_list_get(&clist, name, CASEMAPPING_RFC1459);
+		if (c != (i % 2 ? chans[i] : NULL))
+			test_failf("Unexpected channel get: %s", name);
+	}
+
+	/* Test navigation order is kept */
+	c = clist.head;
+
+	for (size_t i = 1; i < ARR_LEN(chans); i += 2, c = c->next)
+		assert_ptr_eq(c, chans[i]);
+
+	assert_ptr_eq(c, clist.head);
+
+	channel_list_free(&clist);
+}
+
+static void
+test_channel_views(void)
+{
+	/* Test linking channels in order of last view */
+
+	struct channel_views views = {0};
+	struct channel *c1 = channel("aaa", CHANNEL_T_RIRC);
+	struct channel *c2 = channel("bbb", CHANNEL_T_RIRC);
+	struct channel *c3 = channel("ccc", CHANNEL_T_RIRC);
+
+	c1->viewed = 1;
+	c2->viewed = 2;
+	c3->viewed = 3;
+
+	/* Channels link in order of last view, regardless of order added */
+	channel_views_add(&views, c3);
+	channel_views_add(&views, c1);
+	channel_views_add(&views, c2);
+
+	assert_ptr_eq(views.head, c1);
+	assert_ptr_eq(c1->view_next, c2);
+	assert_ptr_eq(c2->view_next, c3);
+	assert_ptr_eq(views.tail, c3);
+	assert_ptr_eq(c3->view_prev, c2);
+
+	/* Adding a linked channel is a no-op */
+	channel_views_add(&views, c1);
+
+	assert_ptr_eq(views.head, c1);
+	assert_ptr_null(c1->view_prev);
+
+	/* Viewing a channel moves it to the tail */
+	c1->viewed = 4;
+
+	channel_views_del(c1);
+	channel_views_add(&views, c1);
+
+	assert_ptr_eq(views.head, c2);
+	assert_ptr_eq(views.tail, c1);
+	assert_ptr_eq(c3->view_next, c1);
+
+	/* Freeing a channel unlinks it */
+	channel_views_del(c2);
+	channel_views_del(c2);
+	channel_free(c3);
+
+	assert_ptr_null(c2->views);
+	assert_ptr_eq(views.head, c1);
+	assert_ptr_eq(views.tail, c1);
+
+	channel_free(c1);
+
+	assert_ptr_null(views.head);
+	assert_ptr_null(views.tail);
+
+	channel_free(c2);
+}
+
 int
 main(void)
 {
 	struct testcase tests[] = {
-		TESTCASE(test_channel_list)
+		TESTCASE(test_channel_list),
+		TESTCASE(test_channel_list_casemapping),
+		TESTCASE(test_channel_list_index),
+		TESTCASE(test_channel_views)
 	};
 
 	return run_tests(NULL, NULL, tests);
@@ -0,0 +1,144 @@
+#include "test/test.h"
+
+#include "src/components/highlight.c"
+#include "src/utils/utils.c"
+
+#define CHECK_HIGHLIGHT(M, R) \
+	assert_eq(highlight_match(&h, CASEMAPPING_RFC1459, (M)), (R));
+
+static void
+test_highlight_nick(void)
+{
+	/* Test detecting user's nick in message */
+
+	struct highlight h;
+
+	memset(&h, 0, sizeof(h));
+
+	highlight_nick(&h, "nick");
+
+	CHECK_HIGHLIGHT("nick", 1);
+	CHECK_HIGHLIGHT("nick ", 1);
+	CHECK_HIGHLIGHT("nick:", 1);
+	CHECK_HIGHLIGHT("nick: ", 1);
+	CHECK_HIGHLIGHT(" nick", 1);
+	CHECK_HIGHLIGHT(" nick ", 1);
+	CHECK_HIGHLIGHT(" nick:", 1);
+	CHECK_HIGHLIGHT(" nick: ", 1);
+	CHECK_HIGHLIGHT("xxx 'nick'! ", 1);
+	CHECK_HIGHLIGHT("xxx @nick?! xxx", 1);
+	CHECK_HIGHLIGHT("xxx @NICK?! xxx", 1);
+
+	CHECK_HIGHLIGHT("", 0);
+	CHECK_HIGHLIGHT(" ", 0);
+	CHECK_HIGHLIGHT("xxx", 0);
+	CHECK_HIGHLIGHT("xnick", 0);
+	CHECK_HIGHLIGHT("xnick:", 0);
+	CHECK_HIGHLIGHT("xnick: ", 0);
+	CHECK_HIGHLIGHT(" xnick", 0);
+	CHECK_HIGHLIGHT(" xnick:", 0);
+	CHECK_HIGHLIGHT("nicknick", 0);
+	CHECK_HIGHLIGHT("'xnick nick", 1);
+
+	/* Test server assigns a non standard nick */
+	highlight_nick(&h, "000nick");
+
+	CHECK_HIGHLIGHT("000nick", 1);
+	CHECK_HIGHLIGHT("000nick ", 1);
+	CHECK_HIGHLIGHT("000nick:", 1);
+	CHECK_HIGHLIGHT("000nick: ", 1);
+	CHECK_HIGHLIGHT(" 000nick", 1);
+	CHECK_HIGHLIGHT(" 000nick ", 1);
+	CHECK_HIGHLIGHT(" 000nick:", 1);
+	CHECK_HIGHLIGHT(" 000nick: ", 1);
+	CHECK_HIGHLIGHT("xxx '000nick'! ", 1);
+	CHECK_HIGHLIGHT("xxx @000nick?! xxx", 1);
+	CHECK_HIGHLIGHT("xxx @000NICK?! xxx", 1);
+
+	CHECK_HIGHLIGHT("x000nick", 0);
+	CHECK_HIGHLIGHT("x000nick:", 0);
+	CHECK_HIGHLIGHT("x000nick: ", 0);
+	CHECK_HIGHLIGHT(" x000nick", 0);
+	CHECK_HIGHLIGHT(" x000nick:", 0);
+	CHECK_HIGHLIGHT("0000nick", 0);
+
+	/* Test no nick */
+	highlight_nick(&h, NULL);
+
+	CHECK_HIGHLIGHT("nick", 0);
+	CHECK_HIGHLIGHT("", 0);
+
+	highlight_free(&h);
+}
+
+static void
+test_highlight_words(void)
+{
+	/* Test detecting highlight words, and the nick, in message */
+
+	struct highlight h;
+
+	memset(&h, 0, sizeof(h));
+
+	highlight_nick(&h, "nick");
+
+	assert_eq(highlight_words("foo,,bar,ba,nick{,@all"), 0);
+
+	CHECK_HIGHLIGHT("nick", 1);
+	CHECK_HIGHLIGHT("foo", 1);
+	CHECK_HIGHLIGHT("xxx BAR! xxx", 1);
+	CHECK_HIGHLIGHT("xxx ba", 1);
+	CHECK_HIGHLIGHT("xxx nick[", 1);
+	CHECK_HIGHLIGHT("xxx @all: xxx", 1);
+
+	CHECK_HIGHLIGHT("xxx bazbarfoo", 0);
+	CHECK_HIGHLIGHT("xxx foobar", 0);
+	CHECK_HIGHLIGHT("xxx all", 0);
+	CHECK_HIGHLIGHT("xxx ,", 0);
+
+	/* Test changing words, and casemapping, recompiles */
+	assert_eq(highlight_words("baz"), 0);
+
+	CHECK_HIGHLIGHT("foo", 0);
+	CHECK_HIGHLIGHT("baz", 1);
+	CHECK_HIGHLIGHT("nick", 1);
+
+	assert_eq(highlight_words("nick{"), 0);
+
+	CHECK_HIGHLIGHT("nick[", 1);
+	assert_eq(highlight_match(&h, CASEMAPPING_ASCII, "nick["), 0);
+	assert_eq(highlight_match(&h, CASEMAPPING_ASCII, "NICK{"), 1);
+
+	/* Test words exceeding the limit are rejected */
+	char words[HIGHLIGHT_WORDS_MAX + 2];
+
+	memset(words, 'a', sizeof(words) - 1);
+	words[sizeof(words) - 1] = 0;
+
+	assert_eq(highlight_words(words), -1);
+
+	words[sizeof(words) - 2] = 0;
+
+	assert_eq(highlight_words(words), 0);
+
+	CHECK_HIGHLIGHT(words, 1);
+	CHECK_HIGHLIGHT("nick", 1);
+
+	assert_eq(highlight_words(NULL), 0);
+
+	CHECK_HIGHLIGHT(words, 0);
+	CHECK_HIGHLIGHT("nick", 1);
+
+	highlight_free(&h);
+}
+
+int
+main(void)
+{
+	struct testcase tests[] = {
+		TESTCASE(test_highlight_nick),
+		TESTCASE(test_highlight_words)
+	};
+
+	return run_tests(NULL, NULL, tests);
+}
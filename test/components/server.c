@@ -1,6 +1,7 @@
 #include "test/test.h"
 #include "src/components/buffer.c"
 #include "src/components/channel.c"
+#include "src/components/highlight.c"
 #include "src/components/input.c"
 #include "src/components/ircv3.c"
 #include "src/components/mode.c"
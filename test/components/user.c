@@ -89,6 +89,8 @@ test_user_list(void)
 	assert_eq(user_list_del(&ulist, CASEMAPPING_RFC1459, "ddd"), USER_ERR_NONE);
 
 	assert_eq(ulist.count, 0);
+
+	user_list_free(&ulist);
 }
 
 static void
@@ -164,13 +166,431 @@ test_user_list_free(void)
 	user_list_free(&ulist);
 }
 
+static void
+test_user_list_slabs(void)
+{
+	/* Test users are allocated from, and freed to, the list */
+
+	char nick[16];
+	struct user *u;
+	struct user_list ulist;
+	struct user_slab *slab;
+	unsigned size = 0;
+
+	memset(&ulist, 0, sizeof(ulist));
+
+	for (int i = 0; i < 100; i++) {
+		snprintf(nick, sizeof(nick), "nick%d", i);
+		if (user_list_add(&ulist, CASEMAPPING_RFC1459, nick, (struct mode){0}) != USER_ERR_NONE)
+			test_failf("Failed to add user to list: %s", nick);
+	}
+
+	for (slab = ulist.slabs; slab; slab = slab->next)
+		size += slab->size;
+
+	assert_eq(ulist.slabs->size, USER_SLAB_MIN * 8);
+	assert_eq(size, USER_SLAB_MIN * 15);
+
+	/* Test freed users are reused */
+	if ((u = user_list_get(&ulist, CASEMAPPING_RFC1459, "nick50", 0)) == NULL)
+		test_abort("Failed to retrieve 'nick50'");
+
+	assert_eq(user_list_del(&ulist, CASEMAPPING_RFC1459, "nick50"), USER_ERR_NONE);
+	assert_ptr_eq(ulist.free, u);
+	assert_eq(user_list_add(&ulist, CASEMAPPING_RFC1459, "nick", (struct mode){0}), USER_ERR_NONE);
+	assert_ptr_eq(user_list_get(&ulist, CASEMAPPING_RFC1459, "nick", 0), u);
+	assert_ptr_null(ulist.free);
+
+	assert_eq(user_list_rpl(&ulist, CASEMAPPING_RFC1459, "nick", "nick50"), USER_ERR_NONE);
+	assert_ptr_eq(ulist.free, u);
+
+	/* Test the newest slab is kept, reset, with the list's last user */
+	slab = ulist.slabs;
+
+	for (int i = 0; i < 100; i++) {
+		snprintf(nick, sizeof(nick), "nick%d", i);
+		if (user_list_del(&ulist, CASEMAPPING_RFC1459, nick) != USER_ERR_NONE)
+			test_failf("Failed to remove user from list: %s", nick);
+	}
+
+	assert_ptr_eq(ulist.slabs, slab);
+	assert_ptr_null(ulist.slabs->next);
+	assert_eq(ulist.slabs->used, 0);
+	assert_ptr_null(ulist.free);
+
+	/* Test the slab is reused once refilled */
+	assert_eq(user_list_add(&ulist, CASEMAPPING_RFC1459, "nick", (struct mode){0}), USER_ERR_NONE);
+	assert_ptr_eq(user_list_get(&ulist, CASEMAPPING_RFC1459, "nick", 0), &(slab->users[0]));
+	assert_eq(user_list_del(&ulist, CASEMAPPING_RFC1459, "nick"), USER_ERR_NONE);
+	assert_ptr_eq(ulist.slabs, slab);
+
+	user_list_free(&ulist);
+
+	assert_ptr_null(ulist.slabs);
+}
+
+static void
+test_user_list_iter(void)
+{
+	/* Test iterating the users with a nick prefix, in list order */
+
+	char nick[16];
+	struct user *prev;
+	struct user *u;
+	struct user_iter it;
+	struct user_list ulist;
+	enum casemapping cm = CASEMAPPING_RFC1459;
+	unsigned n;
+
+	memset(&ulist, 0, sizeof(ulist));
+
+	/* Test empty list */
+	assert_ptr_null(user_list_iter(&ulist, &it, CASEMAPPING_RFC1459, "a", 1));
+
+	for (int i = 0; i < 1000; i++) {
+		snprintf(nick, sizeof(nick), "%s%d", (i % 2 ? "nick" : "user"), i);
+		if (user_list_add(&ulist, CASEMAPPING_RFC1459, nick, (struct mode){0}) != USER_ERR_NONE)
+			test_failf("Failed to add user to list: %s", nick);
+	}
+
+	/* Test all users with prefix, in order */
+	n = 0;
+	prev = NULL;
+
+	for (u = user_list_iter(&ulist, &it, CASEMAPPING_RFC1459, "NICK", 4); u; u = user_list_iter_next(&it)) {
+
+		if (strncmp(u->nick, "nick", 4))
+			test_failf("Unexpected user: %s", u->nick);
+
+		if (prev && user_cmp(prev, u, &cm) >= 0)
+			test_failf("Users out of order: %s, %s", prev->nick, u->nick);
+
+		prev = u;
+		n++;
+	}
+
+	assert_eq(n, 500);
+
+	n = 0;
+
+	for (u = user_list_iter(&ulist, &it, CASEMAPPING_RFC1459, "user99", 6); u; u = user_list_iter_next(&it))
+		n++;
+
+	/* user990, user992 .. user998 */
+	assert_eq(n, 5);
+
+	/* Test empty prefix iterates all users */
+	n = 0;
+
+	for (u = user_list_iter(&ulist, &it, CASEMAPPING_RFC1459, "", 0); u; u = user_list_iter_next(&it))
+		n++;
+
+	assert_eq(n, 1000);
+
+	/* Test no users with prefix */
+	assert_ptr_null(user_list_iter(&ulist, &it, CASEMAPPING_RFC1459, "a", 1));
+	assert_ptr_null(user_list_iter(&ulist, &it, CASEMAPPING_RFC1459, "nick1x", 6));
+	assert_ptr_null(user_list_iter(&ulist, &it, CASEMAPPING_RFC1459, "z", 1));
+
+	user_list_free(&ulist);
+}
+
+static int
+test_user_list_batch_check(struct user *u, struct user **prev, unsigned *n)
+{
+	/* Returns height of a valid AVL tree in user_cmp order, or -1 */
+
+	enum casemapping cm = CASEMAPPING_RFC1459;
+	int hl, hr;
+
+	if (u == NULL)
+		return 0;
+
+	if ((hl = test_user_list_batch_check(TREE_LEFT(u, ul), prev, n)) < 0)
+		return -1;
+
+	if (*prev && user_cmp(*prev, u, &cm) >= 0)
+		return -1;
+
+	*prev = u;
+	(*n)++;
+
+	if ((hr = test_user_list_batch_check(TREE_RIGHT(u, ul), prev, n)) < 0)
+		return -1;
+
+	if (abs(hl - hr) > 1 || AVL_HEIGHT(u, ul) != 1 + MAX(hl, hr))
+		return -1;
+
+	return AVL_HEIGHT(u, ul);
+}
+
+static void
+test_user_list_batch(void)
+{
+	/* Test batches of users are sorted and added at the batch's end */
+
+	char nick[32];
+	struct user *prev = NULL;
+	struct user_list ulist;
+	struct user_registry r;
+	unsigned n = 0;
+
+	memset(&ulist, 0, sizeof(ulist));
+	memset(&r, 0, sizeof(r));
+
+	user_list_register(&ulist, &r);
+
+	/* Nicks sharing their first 8 bytes, and not */
+	for (int i = 0; i < 500; i++) {
+
+		snprintf(nick, sizeof(nick), (i % 2 ? "nick%d" : "longnick_%d"), (i * 7919) % 500);
+
+		if (user_list_batch_add(&ulist, CASEMAPPING_RFC1459, nick, (struct mode){0}) != USER_ERR_NONE)
+			test_failf("Failed to add user to batch: %s", nick);
+	}
+
+	assert_eq(user_list_batch_add(&ulist, CASEMAPPING_RFC1459, "NICK1", (struct mode){0}), USER_ERR_DUPLICATE);
+	assert_eq(user_list_batch_add(&ulist, CASEMAPPING_RFC1459, "LONGNICK_0", (struct mode){0}), USER_ERR_DUPLICATE);
+
+	/* Test users in the batch are found, not yet counted */
+	assert_ptr_not_null(user_list_get(&ulist, CASEMAPPING_RFC1459, "Nick1", 0));
+	assert_ptr_null(TREE_ROOT(&ulist));
+	assert_eq(ulist.batch_n, 500);
+	assert_eq(ulist.count, 0);
+
+	user_list_batch_end(&ulist, CASEMAPPING_RFC1459);
+
+	assert_ptr_null(ulist.batch);
+	assert_eq(ulist.batch_n, 0);
+	assert_eq(ulist.count, 500);
+	assert_gt(test_user_list_batch_check(TREE_ROOT(&ulist), &prev, &n), 0);
+	assert_eq(n, 500);
+
+	for (int i = 0; i < 500; i++) {
+		snprintf(nick, sizeof(nick), (i % 2 ? "nick%d" : "longnick_%d"), i);
+		if (user_list_get(&ulist, CASEMAPPING_RFC1459, nick, 0) == NULL)
+			test_failf("Failed to retrieve user: %s", nick);
+	}
+
+	/* Test batches are added to non-empty lists, and ended by other changes */
+	assert_eq(user_list_batch_add(&ulist, CASEMAPPING_RFC1459, "{abc}", (struct mode){0}), USER_ERR_NONE);
+	assert_eq(user_list_batch_add(&ulist, CASEMAPPING_RFC1459, "[xyz]", (struct mode){0}), USER_ERR_NONE);
+	assert_eq(user_list_del(&ulist, CASEMAPPING_RFC1459, "nick1"), USER_ERR_NONE);
+
+	assert_ptr_null(ulist.batch);
+	assert_eq(ulist.count, 501);
+
+	prev = NULL;
+	n = 0;
+
+	assert_gt(test_user_list_batch_check(TREE_ROOT(&ulist), &prev, &n), 0);
+	assert_eq(n, 501);
+	assert_ptr_not_null(user_list_get(&ulist, CASEMAPPING_RFC1459, "[ABC]", 4));
+
+	/* Test batches are freed with the list */
+	assert_eq(user_list_batch_add(&ulist, CASEMAPPING_RFC1459, "batched", (struct mode){0}), USER_ERR_NONE);
+
+	user_list_free(&ulist);
+
+	assert_eq(r.count, 0);
+
+	user_registry_free(&r);
+}
+
+static void
+test_user_registry(void)
+{
+	/* Test registered user lists are indexed by nick */
+
+	struct user *u;
+	struct user_list ul1, ul2;
+	struct user_nick *rec;
+	struct user_registry r;
+
+	memset(&ul1, 0, sizeof(ul1));
+	memset(&ul2, 0, sizeof(ul2));
+	memset(&r, 0, sizeof(r));
+
+	assert_eq(user_list_add(&ul1, CASEMAPPING_RFC1459, "aaa", (struct mode){0}), USER_ERR_NONE);
+	assert_eq(user_list_add(&ul1, CASEMAPPING_RFC1459, "bbb", (struct mode){0}), USER_ERR_NONE);
+
+	/* Test registering a list with users */
+	user_list_register(&ul1, &r);
+	user_list_register(&ul2, &r);
+
+	assert_eq(r.count, 2);
+	assert_ptr_null(user_registry_get(&r, CASEMAPPING_RFC1459, "ccc"));
+
+	assert_eq(user_list_add(&ul2, CASEMAPPING_RFC1459, "AAA", (struct mode){0}), USER_ERR_NONE);
+	assert_eq(user_list_add(&ul2, CASEMAPPING_RFC1459, "ccc", (struct mode){0}), USER_ERR_NONE);
+
+	assert_eq(r.count, 3);
+
+	/* Test memberships, in order of adding */
+	if ((rec = user_registry_get(&r, CASEMAPPING_RFC1459, "aAa")) == NULL)
+		test_abort("Failed to retrieve 'aaa'");
+
+	assert_eq(rec->chans_n, 2);
+	assert_ptr_eq(rec->chans[0].ul, &ul1);
+	assert_ptr_eq(rec->chans[1].ul, &ul2);
+	assert_ptr_eq(rec->chans[0].u, user_list_get(&ul1, CASEMAPPING_RFC1459, "aaa", 0));
+	assert_ptr_eq(rec->chans[1].u, user_list_get(&ul2, CASEMAPPING_RFC1459, "aaa", 0));
+
+	/* Test nicks are interned, taking the case most recently added */
+	assert_ptr_eq(rec->chans[0].u->nick, rec->nick);
+	assert_ptr_eq(rec->chans[1].u->nick, rec->nick);
+	assert_strcmp(rec->nick, "AAA");
+
+	/* Test replacing, nick changes case */
+	assert_eq(user_list_rpl(&ul1, CASEMAPPING_RFC1459, "aaa", "aAa"), USER_ERR_NONE);
+
+	assert_ptr_eq(user_registry_get(&r, CASEMAPPING_RFC1459, "aaa"), rec);
+	assert_eq(rec->chans_n, 2);
+	assert_strcmp(rec->chans[0].u->nick, "aAa");
+	assert_strcmp(rec->chans[1].u->nick, "aAa");
+	assert_ptr_eq(rec->chans[0].u->rec, rec);
+
+	/* Test replacing, nick changes */
+	assert_eq(user_list_rpl(&ul1, CASEMAPPING_RFC1459, "aaa", "ccc"), USER_ERR_NONE);
+	assert_eq(user_list_rpl(&ul2, CASEMAPPING_RFC1459, "bbb", "ddd"), USER_ERR_NOT_FOUND);
+	assert_eq(user_list_rpl(&ul2, CASEMAPPING_RFC1459, "aaa", "ccc"), USER_ERR_DUPLICATE);
+
+	if ((rec = user_registry_get(&r, CASEMAPPING_RFC1459, "ccc")) == NULL)
+		test_abort("Failed to retrieve 'ccc'");
+
+	assert_eq(rec->chans_n, 2);
+	assert_ptr_eq(rec->chans[0].ul, &ul2);
+	assert_ptr_eq(rec->chans[1].ul, &ul1);
+
+	if ((rec = user_registry_get(&r, CASEMAPPING_RFC1459, "aaa")) == NULL)
+		test_abort("Failed to retrieve 'aaa'");
+
+	assert_eq(rec->chans_n, 1);
+	assert_ptr_eq(rec->chans[0].ul, &ul2);
+
+	/* Test deleting, record is freed with its last membership */
+	assert_eq(user_list_del(&ul2, CASEMAPPING_RFC1459, "aaa"), USER_ERR_NONE);
+	assert_ptr_null(user_registry_get(&r, CASEMAPPING_RFC1459, "aaa"));
+	assert_eq(r.count, 2);
+
+	/* Test casemapping change, nicks distinct in ascii */
+	assert_eq(user_list_add(&ul1, CASEMAPPING_ASCII, "{}", (struct mode){0}), USER_ERR_NONE);
+	assert_eq(user_list_add(&ul2, CASEMAPPING_ASCII, "[]", (struct mode){0}), USER_ERR_NONE);
+
+	if ((rec = user_registry_get(&r, CASEMAPPING_ASCII, "[]")) == NULL)
+		test_abort("Failed to retrieve '[]'");
+
+	assert_eq(rec->chans_n, 1);
+	assert_ptr_eq(rec->chans[0].ul, &ul2);
+	assert_ptr_null(user_registry_get(&r, CASEMAPPING_ASCII, "{]"));
+	assert_eq(r.count, 4);
+
+	if ((rec = user_registry_get(&r, CASEMAPPING_RFC1459, "{]")) == NULL)
+		test_abort("Failed to retrieve '{]'");
+
+	assert_eq(rec->chans_n, 2);
+	assert_eq(r.count, 3);
+	assert_ptr_eq(user_list_get(&ul1, CASEMAPPING_RFC1459, "[}", 0)->nick, rec->nick);
+	assert_ptr_eq(user_list_get(&ul2, CASEMAPPING_RFC1459, "[}", 0)->nick, rec->nick);
+
+	/* Test freeing and unregistering lists */
+	user_list_free(&ul1);
+
+	assert_ptr_eq(ul1.registry, &r);
+	assert_eq(r.count, 2);
+
+	user_list_register(&ul2, NULL);
+
+	assert_eq(r.count, 0);
+	assert_ptr_null(user_registry_get(&r, CASEMAPPING_ASCII, "ccc"));
+
+	if ((u = user_list_get(&ul2, CASEMAPPING_ASCII, "ccc", 0)) == NULL)
+		test_abort("Failed to retrieve 'ccc'");
+
+	assert_ptr_null(u->rec);
+	assert_strcmp(u->nick, "ccc");
+
+	user_list_free(&ul2);
+	user_registry_free(&r);
+}
+
+static void
+test_user_registry_grow(void)
+{
+	/* Test registry and membership resizing */
+
+	char nick[16];
+	struct user_list ul[4];
+	struct user_nick *rec;
+	struct user_registry r;
+
+	memset(ul, 0, sizeof(ul));
+	memset(&r, 0, sizeof(r));
+
+	for (size_t j = 0; j < ARR_LEN(ul); j++)
+		user_list_register(&ul[j], &r);
+
+	for (int i = 0; i < 1000; i++) {
+		snprintf(nick, sizeof(nick), "nick%d", i);
+		for (size_t j = 0; j < ARR_LEN(ul); j++) {
+			if (user_list_add(&ul[j], CASEMAPPING_RFC1459, nick, (struct mode){0}) != USER_ERR_NONE)
+				test_failf("Failed to add user to list: %s", nick);
+		}
+	}
+
+	assert_eq(r.count, 1000);
+	assert_eq(r.size, 1024);
+
+	for (int i = 0; i < 1000; i++) {
+
+		snprintf(nick, sizeof(nick), "NICK%d", i);
+
+		if ((rec = user_registry_get(&r, CASEMAPPING_RFC1459, nick)) == NULL) {
+			test_failf("Failed to retrieve user: %s", nick);
+			continue;
+		}
+
+		if (rec->chans_n != ARR_LEN(ul))
+			test_failf("Wrong memberships: %s", nick);
+
+		for (size_t j = 0; j < rec->chans_n; j++) {
+			if (rec->chans[j].ul != &ul[j] || strcmp(rec->chans[j].u->nick + 4, nick + 4))
+				test_failf("Wrong membership retrieved: %s", nick);
+		}
+	}
+
+	/* Test removed memberships are replaced by the last */
+	assert_eq(user_list_del(&ul[0], CASEMAPPING_RFC1459, "nick0"), USER_ERR_NONE);
+
+	if ((rec = user_registry_get(&r, CASEMAPPING_RFC1459, "nick0")) == NULL)
+		test_abort("Failed to retrieve 'nick0'");
+
+	assert_eq(rec->chans_n, 3);
+	assert_ptr_eq(rec->chans[0].ul, &ul[3]);
+	assert_ptr_eq(rec->chans[1].ul, &ul[1]);
+	assert_ptr_eq(rec->chans[2].ul, &ul[2]);
+	assert_ptr_eq(rec->chans[0].u, user_list_get(&ul[3], CASEMAPPING_RFC1459, "nick0", 0));
+
+	for (size_t j = 0; j < ARR_LEN(ul); j++)
+		user_list_free(&ul[j]);
+
+	assert_eq(r.count, 0);
+
+	user_registry_free(&r);
+}
+
 int
 main(void)
 {
 	struct testcase tests[] = {
 		TESTCASE(test_user_list),
 		TESTCASE(test_user_list_casemapping),
-		TESTCASE(test_user_list_free)
+		TESTCASE(test_user_list_free),
+		TESTCASE(test_user_list_slabs),
+		TESTCASE(test_user_list_iter),
+		TESTCASE(test_user_list_batch),
+		TESTCASE(test_user_registry),
+		TESTCASE(test_user_registry_grow)
 	};
 
 	return run_tests(NULL, NULL, tests);
@@ -0,0 +1,809 @@
+#include "test/test.h"
+
+#include "src/dns.c"
+#include "src/utils/utils.c"
+
+#include <poll.h>
+
+/* Stub nameserver on the loopback, answering queries over UDP or TCP
+ * with the records of their type */
+
+#define STUB_MANGLE_ID   1
+#define STUB_MANGLE_NAME 2
+
+#define STUB_TYPE_CNAME 5
+
+struct stub_rr
+{
+	uint16_t type;
+	uint32_t ttl;
+	const char *data; /* Address, or CNAME target */
+};
+
+/* Responses over TCP aren't limited to DNS_MESSAGE_LEN */
+#define STUB_MESSAGE_LEN 2048
+
+static int stub_fd = -1;
+static int stub_tcp = -1;
+static struct dns_servers stub_servers;
+
+static size_t
+stub_name(unsigned char *buf, const char *name)
+{
+	size_t len = 0;
+
+	for (const char *p = name; *p;) {
+
+		size_t label = strcspn(p, ".");
+
+		buf[len++] = (unsigned char) label;
+		memcpy(buf + len, p, label);
+
+		len += label;
+		p += label + !!p[label];
+	}
+
+	buf[len++] = 0;
+
+	return len;
+}
+
+static size_t
+stub_response(
+	unsigned char *resp,
+	const unsigned char *query,
+	size_t query_len,
+	uint16_t flags,
+	const struct stub_rr *rrs,
+	size_t n,
+	unsigned mangle)
+{
+	/* Write the response to a query, returning its length */
+
+	size_t len;
+	uint16_t an = 0;
+	uint16_t type;
+
+	if (query_len < DNS_HEADER_LEN + 5)
+		test_abort("Stub nameserver: invalid query");
+
+	type = DNS_GET16(query + query_len - 4);
+
+	memcpy(resp, query, (size_t) query_len);
+
+	resp[2] = (unsigned char) ((DNS_FLAG_QR | DNS_FLAG_RD | flags) >> 8);
+	resp[3] = (unsigned char) (0x80 | (flags & 0xFF));
+
+	if (mangle & STUB_MANGLE_ID)
+		resp[1] ^= 0xFF;
+
+	if (mangle & STUB_MANGLE_NAME)
+		resp[DNS_HEADER_LEN + 1] ^= 0x01;
+
+	len = (size_t) query_len;
+
+	for (size_t i = 0; i < n; i++) {
+
+		unsigned char *rdlen;
+
+		if (rrs[i].type != type && rrs[i].type != STUB_TYPE_CNAME)
+			continue;
+
+		/* Owner is the question's name, by pointer */
+		resp[len++] = 0xC0;
+		resp[len++] = DNS_HEADER_LEN;
+		resp[len++] = (unsigned char) (rrs[i].type >> 8);
+		resp[len++] = (unsigned char) (rrs[i].type);
+		resp[len++] = 0;
+		resp[len++] = DNS_CLASS_IN;
+		resp[len++] = (unsigned char) (rrs[i].ttl >> 24);
+		resp[len++] = (unsigned char) (rrs[i].ttl >> 16);
+		resp[len++] = (unsigned char) (rrs[i].ttl >> 8);
+		resp[len++] = (unsigned char) (rrs[i].ttl);
+
+		rdlen = resp + len;
+		len += 2;
+
+		if (rrs[i].type == DNS_TYPE_A && inet_pton(AF_INET, rrs[i].data, resp + len) == 1) {
+			len += 4;
+		} else if (rrs[i].type == DNS_TYPE_AAAA && inet_pton(AF_INET6, rrs[i].data, resp + len) == 1) {
+			len += 16;
+		} else {
+			len += stub_name(resp + len, rrs[i].data);
+		}
+
+		rdlen[0] = (unsigned char) ((resp + len - rdlen - 2) >> 8);
+		rdlen[1] = (unsigned char) ((resp + len - rdlen - 2));
+
+		an++;
+	}
+
+	resp[6] = (unsigned char) (an >> 8);
+	resp[7] = (unsigned char) (an);
+
+	return len;
+}
+
+static uint16_t
+stub_answer(uint16_t flags, const struct stub_rr *rrs, size_t n, unsigned mangle)
+{
+	/* Answer a query, returning its type */
+
+	unsigned char query[DNS_MESSAGE_LEN];
+	unsigned char resp[STUB_MESSAGE_LEN];
+	struct pollfd pfd = { .fd = stub_fd, .events = POLLIN };
+	struct sockaddr_storage sa;
+	socklen_t sa_len = sizeof(sa);
+	ssize_t query_len;
+	size_t len;
+
+	if (poll(&pfd, 1, 1000) != 1)
+		test_abort("Stub nameserver: no query");
+
+	if ((query_len = recvfrom(stub_fd, query, sizeof(query), 0, (struct sockaddr *) &sa, &sa_len)) < 0)
+		test_abort("Stub nameserver: recvfrom");
+
+	len = stub_response(resp, query, (size_t) query_len, flags, rrs, n, mangle);
+
+	if (sendto(stub_fd, resp, len, 0, (struct sockaddr *) &sa, sa_len) < 0)
+		test_abort("Stub nameserver: sendto");
+
+	return DNS_GET16(query + query_len - 4);
+}
+
+static uint16_t
+stub_answer_tcp(int fd, const struct stub_rr *rrs, size_t n)
+{
+	/* Answer a length prefixed query on a TCP connection, returning its
+	 * type. Queries are read one at a time */
+
+	unsigned char query[2 + DNS_MESSAGE_LEN];
+	unsigned char resp[2 + STUB_MESSAGE_LEN];
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	size_t need = 2;
+	size_t query_len = 0;
+	size_t len;
+	ssize_t ret;
+
+	while (query_len < need) {
+
+		if (poll(&pfd, 1, 1000) != 1)
+			test_abort("Stub nameserver: no query");
+
+		if ((ret = recv(fd, query + query_len, need - query_len, 0)) <= 0)
+			test_abort("Stub nameserver: recv");
+
+		if ((query_len += (size_t) ret) == 2 && (need = 2 + (size_t) DNS_GET16(query)) > sizeof(query))
+			test_abort("Stub nameserver: invalid query");
+	}
+
+	len = stub_response(resp + 2, query + 2, query_len - 2, 0, rrs, n, 0);
+
+	resp[0] = (unsigned char) (len >> 8);
+	resp[1] = (unsigned char) (len);
+
+	if (send(fd, resp, 2 + len, 0) < 0)
+		test_abort("Stub nameserver: send");
+
+	return DNS_GET16(query + query_len - 4);
+}
+
+static void
+stub_drain(void)
+{
+	unsigned char buf[DNS_MESSAGE_LEN];
+
+	while (recv(stub_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+		;
+}
+
+static void
+test_dns_query(void)
+{
+	/* Test A and AAAA queries, answered with a CNAME */
+
+	struct dns_query q;
+	struct stub_rr rrs[] = {
+		{ STUB_TYPE_CNAME, 3600, "irc.test.net" },
+		{ DNS_TYPE_A,      300,  "192.0.2.1" },
+		{ DNS_TYPE_A,      200,  "192.0.2.2" },
+		{ DNS_TYPE_AAAA,   600,  "2001:db8::1" },
+	};
+
+	char buf[INET6_ADDRSTRLEN];
+
+	assert_eq(dns_query(&q, &stub_servers, "irc.test.", AF_UNSPEC, 1000), DNS_ERR_PENDING);
+	assert_eq(dns_query_step(&q, 1000), DNS_ERR_PENDING);
+
+	assert_eq(stub_answer(0, rrs, ARR_LEN(rrs), 0) + stub_answer(0, rrs, ARR_LEN(rrs), 0), DNS_TYPE_A + DNS_TYPE_AAAA);
+
+	assert_eq(dns_query_step(&q, 1001), DNS_ERR_NONE);
+	assert_eq(q.fd, -1);
+	assert_eq(q.n, 3);
+	assert_eq(q.ttl, 200);
+
+	/* IPv6 addresses first */
+	assert_eq(q.addrs[0].family, AF_INET6);
+	assert_eq(q.addrs[1].family, AF_INET);
+	assert_eq(q.addrs[2].family, AF_INET);
+	assert_strcmp(inet_ntop(AF_INET6, &(q.addrs[0].u.v6), buf, sizeof(buf)), "2001:db8::1");
+	assert_strcmp(inet_ntop(AF_INET, &(q.addrs[1].u.v4), buf, sizeof(buf)), "192.0.2.1");
+	assert_strcmp(inet_ntop(AF_INET, &(q.addrs[2].u.v4), buf, sizeof(buf)), "192.0.2.2");
+
+	/* Test a single address family */
+	assert_eq(dns_query(&q, &stub_servers, "irc.test", AF_INET6, 1000), DNS_ERR_PENDING);
+	assert_eq(stub_answer(0, rrs, ARR_LEN(rrs), 0), DNS_TYPE_AAAA);
+	assert_eq(dns_query_step(&q, 1000), DNS_ERR_NONE);
+	assert_eq(q.n, 1);
+	assert_eq(q.ttl, 600);
+	assert_eq(q.addrs[0].family, AF_INET6);
+}
+
+static void
+test_dns_query_error(void)
+{
+	/* Test unresolved hosts and ignored responses */
+
+	struct dns_query q;
+	struct stub_rr rrs[] = {
+		{ DNS_TYPE_A, 300, "192.0.2.1" },
+	};
+
+	/* Host doesn't exist */
+	assert_eq(dns_query(&q, &stub_servers, "irc.test", AF_UNSPEC, 0), DNS_ERR_PENDING);
+	stub_answer(DNS_RCODE_NXDOMAIN, NULL, 0, 0);
+	stub_answer(DNS_RCODE_NXDOMAIN, NULL, 0, 0);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_NXDOMAIN);
+
+	/* Host has no addresses */
+	assert_eq(dns_query(&q, &stub_servers, "irc.test", AF_INET6, 0), DNS_ERR_PENDING);
+	assert_eq(stub_answer(0, rrs, ARR_LEN(rrs), 0), DNS_TYPE_AAAA);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_NODATA);
+
+	/* Responses with another id or question are ignored */
+	assert_eq(dns_query(&q, &stub_servers, "irc.test", AF_INET, 0), DNS_ERR_PENDING);
+	assert_eq(stub_answer(0, rrs, ARR_LEN(rrs), STUB_MANGLE_ID), DNS_TYPE_A);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+	dns_query_free(&q);
+	assert_eq(dns_query(&q, &stub_servers, "irc.test", AF_INET, 0), DNS_ERR_PENDING);
+	assert_eq(stub_answer(0, rrs, ARR_LEN(rrs), STUB_MANGLE_NAME), DNS_TYPE_A);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+	dns_query_free(&q);
+	assert_eq(q.fd, -1);
+
+	/* Invalid names */
+	assert_eq(dns_query(&q, &stub_servers, "", AF_UNSPEC, 0), DNS_ERR_NAME);
+	assert_eq(dns_query(&q, &stub_servers, ".", AF_UNSPEC, 0), DNS_ERR_NAME);
+	assert_eq(dns_query(&q, &stub_servers, "irc..test", AF_UNSPEC, 0), DNS_ERR_NAME);
+	assert_eq(dns_query(&q, &stub_servers, ".irc.test", AF_UNSPEC, 0), DNS_ERR_NAME);
+	assert_eq(dns_query(&q, &stub_servers,
+		"a123456789b123456789c123456789d123456789e123456789f123456789abcd.test", AF_UNSPEC, 0), DNS_ERR_NAME);
+	assert_eq(q.fd, -1);
+}
+
+static void
+test_dns_query_tcp(void)
+{
+	/* Test truncated responses retried over TCP */
+
+	char addrs[DNS_ADDRS_MAX][INET_ADDRSTRLEN];
+	int fd;
+	struct dns_query q;
+	struct pollfd pfd = { .events = POLLIN };
+	struct stub_rr rrs[DNS_ADDRS_MAX];
+
+	/* Responses longer than UDP messages */
+	for (unsigned i = 0; i < DNS_ADDRS_MAX; i++) {
+		snprintf(addrs[i], sizeof(addrs[i]), "192.0.2.%u", i + 1);
+		rrs[i].type = DNS_TYPE_A;
+		rrs[i].ttl = 300;
+		rrs[i].data = addrs[i];
+	}
+
+	assert_eq(dns_query(&q, &stub_servers, "irc.test", AF_INET, 0), DNS_ERR_PENDING);
+	stub_answer(DNS_FLAG_TC, NULL, 0, 0);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+	assert_ptr_not_null(q.tcp);
+	assert_eq(q.events, POLLOUT);
+	assert_ueq(q.deadline, 1000);
+
+	if ((fd = accept(stub_tcp, NULL, NULL)) < 0)
+		test_abort("Stub nameserver: accept");
+
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+	assert_eq(q.events, POLLIN);
+	assert_eq(stub_answer_tcp(fd, rrs, ARR_LEN(rrs)), DNS_TYPE_A);
+
+	/* Polled until the response is read */
+	pfd.fd = q.fd;
+
+	assert_eq(poll(&pfd, 1, 1000), 1);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_NONE);
+	assert_eq(q.n, DNS_ADDRS_MAX);
+	assert_eq(q.fd, -1);
+	assert_ptr_null(q.tcp);
+
+	close(fd);
+
+	/* Nameserver closing the connection, retried as a timeout */
+	stub_servers.attempts = 2;
+
+	assert_eq(dns_query(&q, &stub_servers, "irc.test", AF_INET, 0), DNS_ERR_PENDING);
+	stub_answer(DNS_FLAG_TC, NULL, 0, 0);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+
+	if ((fd = accept(stub_tcp, NULL, NULL)) < 0)
+		test_abort("Stub nameserver: accept");
+
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+	assert_eq(q.events, POLLIN);
+
+	close(fd);
+
+	pfd.fd = q.fd;
+
+	assert_eq(poll(&pfd, 1, 1000), 1);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+	assert_ptr_null(q.tcp);
+	assert_eq(q.try, 2);
+	assert_eq(stub_answer(0, rrs, 1, 0), DNS_TYPE_A);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_NONE);
+	assert_eq(q.n, 1);
+}
+
+static void
+test_dns_query_search(void)
+{
+	/* Test hosts not found retried with search domains */
+
+	struct dns_query q;
+	struct stub_rr rrs[] = {
+		{ DNS_TYPE_A, 300, "192.0.2.1" },
+	};
+
+	strcpy(stub_servers.search[0], "test.net");
+	strcpy(stub_servers.search[1], "test.org");
+	stub_servers.nsearch = 2;
+
+	/* Hosts of fewer dots than ndots, queried after their search domains */
+	assert_eq(dns_query(&q, &stub_servers, "irc", AF_INET, 0), DNS_ERR_PENDING);
+	assert_strcmp(q.name, "irc.test.net");
+	stub_answer(DNS_RCODE_NXDOMAIN, NULL, 0, 0);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+	assert_strcmp(q.name, "irc.test.org");
+	stub_answer(DNS_RCODE_NXDOMAIN, NULL, 0, 0);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+	assert_strcmp(q.name, "irc");
+	stub_answer(0, rrs, ARR_LEN(rrs), 0);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_NONE);
+	assert_eq(q.n, 1);
+
+	/* Hosts of at least ndots dots, queried before, hosts without
+	 * addresses also retried */
+	assert_eq(dns_query(&q, &stub_servers, "irc.example", AF_INET, 0), DNS_ERR_PENDING);
+	assert_strcmp(q.name, "irc.example");
+	stub_answer(0, NULL, 0, 0);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+	assert_strcmp(q.name, "irc.example.test.net");
+	stub_answer(DNS_RCODE_NXDOMAIN, NULL, 0, 0);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+	assert_strcmp(q.name, "irc.example.test.org");
+	stub_answer(DNS_RCODE_NXDOMAIN, NULL, 0, 0);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_NXDOMAIN);
+	assert_eq(q.fd, -1);
+
+	/* Absolute hosts aren't searched */
+	assert_eq(dns_query(&q, &stub_servers, "irc.", AF_INET, 0), DNS_ERR_PENDING);
+	assert_strcmp(q.name, "irc");
+	stub_answer(DNS_RCODE_NXDOMAIN, NULL, 0, 0);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_NXDOMAIN);
+	assert_eq(q.fd, -1);
+}
+
+static void
+test_dns_query_retry(void)
+{
+	/* Test retrying nameservers timing out or failing */
+
+	struct dns_query q;
+	struct stub_rr rrs[] = {
+		{ DNS_TYPE_A, 300, "192.0.2.1" },
+	};
+
+	stub_servers.attempts = 2;
+	stub_servers.timeout = 100;
+
+	/* Timeout, the retry answered */
+	assert_eq(dns_query(&q, &stub_servers, "irc.test", AF_INET, 0), DNS_ERR_PENDING);
+	assert_eq(dns_query_step(&q, 99), DNS_ERR_PENDING);
+	assert_eq(dns_query_step(&q, 100), DNS_ERR_PENDING);
+	assert_ueq(q.deadline, 200);
+
+	/* Responses to the first attempt are discarded */
+	stub_answer(0, rrs, ARR_LEN(rrs), 0);
+	assert_eq(dns_query_step(&q, 150), DNS_ERR_PENDING);
+	stub_answer(0, rrs, ARR_LEN(rrs), 0);
+	assert_eq(dns_query_step(&q, 150), DNS_ERR_NONE);
+	assert_eq(q.n, 1);
+
+	/* Timeout, the retries exhausted */
+	assert_eq(dns_query(&q, &stub_servers, "irc.test", AF_INET, 0), DNS_ERR_PENDING);
+	assert_eq(dns_query_step(&q, 100), DNS_ERR_PENDING);
+	assert_eq(dns_query_step(&q, 200), DNS_ERR_TIMEOUT);
+	assert_eq(q.fd, -1);
+	stub_drain();
+
+	/* Nameserver failure retried immediately */
+	assert_eq(dns_query(&q, &stub_servers, "irc.test", AF_INET, 0), DNS_ERR_PENDING);
+	stub_answer(2, NULL, 0, 0);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+	assert_ueq(q.deadline, 100);
+	stub_answer(2, NULL, 0, 0);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_SERVFAIL);
+	assert_eq(q.fd, -1);
+
+	/* Partially resolved, the AAAA query timing out */
+	assert_eq(dns_query(&q, &stub_servers, "irc.test", AF_UNSPEC, 0), DNS_ERR_PENDING);
+	assert_eq(stub_answer(0, rrs, ARR_LEN(rrs), 0), DNS_TYPE_A);
+	assert_eq(dns_query_step(&q, 0), DNS_ERR_PENDING);
+	assert_eq(dns_query_step(&q, 100), DNS_ERR_PENDING);
+	assert_eq(dns_query_step(&q, 200), DNS_ERR_NONE);
+	assert_eq(q.n, 1);
+	assert_eq(q.addrs[0].family, AF_INET);
+	stub_drain();
+}
+
+static void
+test_dns_servers(void)
+{
+	char path[] = "/tmp/rirc.dns.XXXXXX";
+	char buf[INET6_ADDRSTRLEN];
+	int fd;
+	struct dns_servers s;
+	struct sockaddr_in *sa4;
+	struct sockaddr_in6 *sa6;
+
+	const char conf[] =
+		"# comment\n"
+		"; comment\n"
+		"search test.net\n"
+		"nameserver 192.0.2.53\n"
+		"nameserver invalid\n"
+		"nameserver\n"
+		"nameserver 2001:db8::53 # comment\n"
+		"options ndots:2 timeout:3 attempts:4\n"
+		"nameserver 192.0.2.54\n"
+		"nameserver 192.0.2.55\n";
+
+	const char search[] =
+		"domain test.org\n"
+		"search a.net b.net c.net d.net e.net f.net g.net\n"
+		"options ndots:0\n";
+
+	const char domain[] =
+		"search test.net\n"
+		"domain test.org test.com\n";
+
+	if ((fd = mkstemp(path)) < 0 || write(fd, conf, sizeof(conf) - 1) < 0)
+		test_abort("Failed to write resolv.conf");
+
+	close(fd);
+
+	assert_eq(dns_servers(&s, path), 0);
+	assert_eq(s.n, DNS_SERVERS_MAX);
+	assert_eq(s.timeout, 3000);
+	assert_eq(s.attempts, 4);
+	assert_eq(s.ndots, 2);
+	assert_eq(s.nsearch, 1);
+	assert_strcmp(s.search[0], "test.net");
+
+	sa4 = (struct sockaddr_in *) &(s.addrs[0]);
+	sa6 = (struct sockaddr_in6 *) &(s.addrs[1]);
+
+	assert_eq(sa4->sin_family, AF_INET);
+	assert_eq(ntohs(sa4->sin_port), 53);
+	assert_strcmp(inet_ntop(AF_INET, &(sa4->sin_addr), buf, sizeof(buf)), "192.0.2.53");
+	assert_eq(sa6->sin6_family, AF_INET6);
+	assert_eq(ntohs(sa6->sin6_port), 53);
+	assert_strcmp(inet_ntop(AF_INET6, &(sa6->sin6_addr), buf, sizeof(buf)), "2001:db8::53");
+
+	sa4 = (struct sockaddr_in *) &(s.addrs[2]);
+
+	assert_strcmp(inet_ntop(AF_INET, &(sa4->sin_addr), buf, sizeof(buf)), "192.0.2.54");
+
+	/* Test defaults, without nameservers the local host's */
+	if ((fd = open(path, O_WRONLY | O_TRUNC)) < 0 || write(fd, "search test.net\n", 16) < 0)
+		test_abort("Failed to write resolv.conf");
+
+	close(fd);
+
+	assert_eq(dns_servers(&s, path), 0);
+	assert_eq(s.n, 1);
+	assert_eq(s.timeout, 5000);
+	assert_eq(s.attempts, 2);
+	assert_eq(s.ndots, 1);
+
+	sa4 = (struct sockaddr_in *) &(s.addrs[0]);
+
+	assert_eq(sa4->sin_family, AF_INET);
+	assert_eq(ntohs(sa4->sin_port), 53);
+	assert_strcmp(inet_ntop(AF_INET, &(sa4->sin_addr), buf, sizeof(buf)), "127.0.0.1");
+
+	/* Test the last search or domain line used, and ndots:0 */
+	if ((fd = open(path, O_WRONLY | O_TRUNC)) < 0
+	 || write(fd, search, sizeof(search) - 1) < 0)
+		test_abort("Failed to write resolv.conf");
+
+	close(fd);
+
+	assert_eq(dns_servers(&s, path), 0);
+	assert_eq(s.nsearch, DNS_SEARCH_MAX);
+	assert_strcmp(s.search[0], "a.net");
+	assert_strcmp(s.search[DNS_SEARCH_MAX - 1], "f.net");
+	assert_eq(s.ndots, 0);
+
+	if ((fd = open(path, O_WRONLY | O_TRUNC)) < 0
+	 || write(fd, domain, sizeof(domain) - 1) < 0)
+		test_abort("Failed to write resolv.conf");
+
+	close(fd);
+
+	assert_eq(dns_servers(&s, path), 0);
+	assert_eq(s.nsearch, 1);
+	assert_strcmp(s.search[0], "test.org");
+
+	unlink(path);
+
+	assert_eq(dns_servers(&s, path), -1);
+	assert_eq(s.n, 1);
+}
+
+static void
+test_dns_hosts(void)
+{
+	char path[] = "/tmp/rirc.dns.XXXXXX";
+	char buf[INET6_ADDRSTRLEN];
+	int fd;
+	struct dns_addr addrs[DNS_ADDRS_MAX];
+
+	const char hosts[] =
+		"# irc.comment\n"
+		"127.0.0.1 localhost\n"
+		"::1 localhost ip6-localhost\n"
+		"invalid localhost\n"
+		"192.0.2.1\tirc.test.net irc # irc.alias\n";
+
+	if ((fd = mkstemp(path)) < 0 || write(fd, hosts, sizeof(hosts) - 1) < 0)
+		test_abort("Failed to write hosts");
+
+	close(fd);
+
+	assert_eq(dns_hosts(path, "localhost", AF_UNSPEC, addrs), 2);
+	assert_eq(addrs[0].family, AF_INET);
+	assert_eq(addrs[1].family, AF_INET6);
+	assert_strcmp(inet_ntop(AF_INET, &(addrs[0].u.v4), buf, sizeof(buf)), "127.0.0.1");
+	assert_strcmp(inet_ntop(AF_INET6, &(addrs[1].u.v6), buf, sizeof(buf)), "::1");
+
+	assert_eq(dns_hosts(path, "localhost", AF_INET6, addrs), 1);
+	assert_eq(addrs[0].family, AF_INET6);
+	assert_eq(dns_hosts(path, "ip6-localhost", AF_INET, addrs), 0);
+	assert_eq(dns_hosts(path, "ip6-localhost", AF_UNSPEC, addrs), 1);
+	assert_eq(dns_hosts(path, "IRC.test.net.", AF_UNSPEC, addrs), 1);
+	assert_strcmp(inet_ntop(AF_INET, &(addrs[0].u.v4), buf, sizeof(buf)), "192.0.2.1");
+	assert_eq(dns_hosts(path, "irc", AF_UNSPEC, addrs), 1);
+	assert_eq(dns_hosts(path, "irc.comment", AF_UNSPEC, addrs), 0);
+	assert_eq(dns_hosts(path, "irc.alias", AF_UNSPEC, addrs), 0);
+	assert_eq(dns_hosts(path, "127.0.0.1", AF_UNSPEC, addrs), 0);
+	assert_eq(dns_hosts(path, "test.net", AF_UNSPEC, addrs), 0);
+
+	unlink(path);
+
+	assert_eq(dns_hosts(path, "localhost", AF_UNSPEC, addrs), 0);
+}
+
+static void
+test_dns_service(void)
+{
+	char path[] = "/tmp/rirc.dns.XXXXXX";
+	int fd;
+	uint16_t port = 0;
+
+	const char services[] =
+		"# ircs 1/tcp\n"
+		"domain 53/udp\n"
+		"domain 53/tcp\n"
+		"ircd 6667/tcp # ircs\n"
+		"ircs-u 6697/tcp ircs\n"
+		"invalid x/tcp\n"
+		"overflow 65536/tcp\n";
+
+	if ((fd = mkstemp(path)) < 0 || write(fd, services, sizeof(services) - 1) < 0)
+		test_abort("Failed to write services");
+
+	close(fd);
+
+	assert_eq(dns_service(path, "domain", &port), 0);
+	assert_eq(port, 53);
+	assert_eq(dns_service(path, "ircd", &port), 0);
+	assert_eq(port, 6667);
+	assert_eq(dns_service(path, "ircs", &port), 0);
+	assert_eq(port, 6697);
+	assert_eq(dns_service(path, "IRCD", &port), -1);
+	assert_eq(dns_service(path, "invalid", &port), -1);
+	assert_eq(dns_service(path, "overflow", &port), -1);
+	assert_eq(dns_service(path, "6667", &port), -1);
+	assert_eq(port, 6697);
+
+	unlink(path);
+
+	assert_eq(dns_service(path, "ircd", &port), -1);
+}
+
+static void
+test_dns_cache(void)
+{
+	static struct dns_cache c;
+
+	char name[32];
+	struct dns_addr addrs[DNS_ADDRS_MAX] = {
+		{ .family = AF_INET },
+		{ .family = AF_INET6 },
+	};
+	struct dns_addr cached[DNS_ADDRS_MAX];
+
+	addrs[0].u.v4.s_addr = htonl(0xC0000201);
+
+	assert_eq(dns_cache_get(&c, "irc.test", AF_UNSPEC, cached, 0), 0);
+
+	/* Test expiry */
+	dns_cache_put(&c, "irc.test", AF_UNSPEC, addrs, 2, 10, 1000);
+
+	assert_eq(dns_cache_get(&c, "irc.test", AF_UNSPEC, cached, 1000), 2);
+	assert_eq(cached[0].family, AF_INET);
+	assert_ueq(cached[0].u.v4.s_addr, htonl(0xC0000201));
+	assert_eq(cached[1].family, AF_INET6);
+	assert_eq(dns_cache_get(&c, "IRC.TEST.", AF_UNSPEC, cached, 10999), 2);
+	assert_eq(dns_cache_get(&c, "irc.test", AF_UNSPEC, cached, 11000), 0);
+
+	/* Test hosts cached by family */
+	dns_cache_put(&c, "irc.test", AF_INET, addrs, 1, 10, 11000);
+
+	assert_eq(dns_cache_get(&c, "irc.test", AF_INET, cached, 11000), 1);
+	assert_eq(dns_cache_get(&c, "irc.test", AF_INET6, cached, 11000), 0);
+	assert_eq(dns_cache_get(&c, "irc.test", AF_UNSPEC, cached, 11000), 0);
+
+	/* Test replacing, and TTLs capped by DNS_CACHE_TTL_MAX */
+	dns_cache_put(&c, "irc.test", AF_INET, addrs, 2, UINT32_MAX, 0);
+
+	assert_eq(dns_cache_get(&c, "irc.test", AF_INET, cached, SEC_IN_MS((uint64_t) DNS_CACHE_TTL_MAX) - 1), 2);
+	assert_eq(dns_cache_get(&c, "irc.test", AF_INET, cached, SEC_IN_MS((uint64_t) DNS_CACHE_TTL_MAX)), 0);
+
+	/* Test addresses with a TTL of zero aren't cached */
+	dns_cache_put(&c, "irc.zero", AF_INET, addrs, 2, 0, 0);
+
+	assert_eq(dns_cache_get(&c, "irc.zero", AF_INET, cached, 0), 0);
+
+	/* Test evicting the entry expiring soonest */
+	memset(&c, 0, sizeof(c));
+
+	for (unsigned i = 0; i < DNS_CACHE_MAX; i++) {
+		snprintf(name, sizeof(name), "irc%u.test", i);
+		dns_cache_put(&c, name, AF_INET, addrs, 1, 100 + i, 0);
+	}
+
+	dns_cache_put(&c, "irc.evict", AF_INET, addrs, 1, 100, 0);
+
+	assert_eq(dns_cache_get(&c, "irc.evict", AF_INET, cached, 0), 1);
+	assert_eq(dns_cache_get(&c, "irc0.test", AF_INET, cached, 0), 0);
+	assert_eq(dns_cache_get(&c, "irc1.test", AF_INET, cached, 0), 1);
+}
+
+static void
+test_dns_addrinfo(void)
+{
+	struct addrinfo *ai;
+	struct dns_addr addrs[2] = {
+		{ .family = AF_INET6 },
+		{ .family = AF_INET },
+	};
+
+	addrs[0].u.v6.s6_addr[15] = 1;
+	addrs[1].u.v4.s_addr = htonl(0xC0000201);
+
+	assert_ptr_null(dns_addrinfo(addrs, 0, 6697));
+
+	ai = dns_addrinfo(addrs, 2, 6697);
+
+	assert_eq(ai->ai_family, AF_INET6);
+	assert_eq(ai->ai_socktype, SOCK_STREAM);
+	assert_eq(ai->ai_protocol, IPPROTO_TCP);
+	assert_eq(ai->ai_addrlen, sizeof(struct sockaddr_in6));
+	assert_eq(((struct sockaddr_in6 *) ai->ai_addr)->sin6_family, AF_INET6);
+	assert_eq(ntohs(((struct sockaddr_in6 *) ai->ai_addr)->sin6_port), 6697);
+	assert_eq(((struct sockaddr_in6 *) ai->ai_addr)->sin6_addr.s6_addr[15], 1);
+
+	assert_eq(ai->ai_next->ai_family, AF_INET);
+	assert_eq(ai->ai_next->ai_addrlen, sizeof(struct sockaddr_in));
+	assert_eq(((struct sockaddr_in *) ai->ai_next->ai_addr)->sin_family, AF_INET);
+	assert_eq(ntohs(((struct sockaddr_in *) ai->ai_next->ai_addr)->sin_port), 6697);
+	assert_ueq(((struct sockaddr_in *) ai->ai_next->ai_addr)->sin_addr.s_addr, htonl(0xC0000201));
+	assert_ptr_null(ai->ai_next->ai_next);
+
+	free(ai);
+}
+
+static int
+test_init(void)
+{
+	struct sockaddr_in sa = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(sa);
+	int opt = 1;
+
+	/* UDP and TCP on the same port, retried if the port's UDP is in use */
+	for (unsigned i = 0; stub_fd < 0; i++) {
+
+		if (i == 16)
+			return -1;
+
+		sa.sin_port = 0;
+
+		if ((stub_tcp = socket(AF_INET, SOCK_STREAM, 0)) < 0
+		 || setsockopt(stub_tcp, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0
+		 || bind(stub_tcp, (struct sockaddr *) &sa, sizeof(sa)) < 0
+		 || listen(stub_tcp, 1) < 0
+		 || getsockname(stub_tcp, (struct sockaddr *) &sa, &len) < 0
+		 || (stub_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+			return -1;
+
+		if (bind(stub_fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+			close(stub_fd);
+			close(stub_tcp);
+			stub_fd = -1;
+		}
+	}
+
+	memset(&stub_servers, 0, sizeof(stub_servers));
+	memcpy(&(stub_servers.addrs[0]), &sa, sizeof(sa));
+
+	stub_servers.lens[0] = sizeof(sa);
+	stub_servers.attempts = 1;
+	stub_servers.ndots = 1;
+	stub_servers.timeout = 1000;
+	stub_servers.n = 1;
+
+	return 0;
+}
+
+static int
+test_term(void)
+{
+	close(stub_fd);
+	close(stub_tcp);
+
+	stub_fd = -1;
+	stub_tcp = -1;
+
+	return 0;
+}
+
+int
+main(void)
+{
+	struct testcase tests[] = {
+		TESTCASE(test_dns_query),
+		TESTCASE(test_dns_query_error),
+		TESTCASE(test_dns_query_tcp),
+		TESTCASE(test_dns_query_search),
+		TESTCASE(test_dns_query_retry),
+		TESTCASE(test_dns_servers),
+		TESTCASE(test_dns_hosts),
+		TESTCASE(test_dns_service),
+		TESTCASE(test_dns_cache),
+		TESTCASE(test_dns_addrinfo),
+	};
+
+	return run_tests(test_init, test_term, tests);
+}
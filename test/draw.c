@@ -4,6 +4,7 @@
 
 #include "src/components/buffer.c"
 #include "src/components/channel.c"
+#include "src/components/highlight.c"
 #include "src/components/input.c"
 #include "src/components/ircv3.c"
 #include "src/components/mode.c"
@@ -68,6 +69,7 @@ test_draw_buffer_line_rows(void)
 	/* Greater columns than length should always return one row */
 	assert_eq(draw_buffer_line_rows(buffer_head(b), buffer_head(b)->text_len + 1), 1);
 
+	buffer_free(b);
 	free(b);
 }
 
@@ -77,10 +79,15 @@ test_draw_buffer_scrollback_status(void)
 	/* Test retrieving buffer scrollback status */
 
 	char buf[4];
+	int i;
 	struct buffer *b = malloc(sizeof(*b));
 
 	buffer(b);
 
+	for (i = 0; i < BUFFER_LINES_MAX; i++)
+		t__buffer_newline(b, "");
+
+	b->scrollback = 0;
 	b->head = 100;
 	b->tail = 0;
 	assert_ueq(buffer_size(b), 100);
@@ -135,6 +142,7 @@ test_draw_buffer_scrollback_status(void)
 	assert_ueq(b->buffer_i_top, UINT_MAX);
 	assert_strcmp((draw_buffer_scrollback_status(b, buf, sizeof(buf))), "50");
 
+	buffer_free(b);
 	free(b);
 }
 
@@ -395,6 +403,185 @@ test_draw_irc_colour(void)
 	assert_eq(draw_parse_irc_colour("\x03" "11,22", NULL, NULL), 6);
 }
 
+static const char*
+t__draw_frame(void)
+{
+	/* Diff the grids, returning the frame's output */
+
+	draw_frame();
+	draw_frame_out("", 1);
+	draw_state.out_len = 0;
+
+	return draw_state.out;
+}
+
+static void
+t__draw_row(unsigned row, const char *cells)
+{
+	draw_cursor_pos(row, 1);
+	draw_clear_line();
+
+	while (*cells)
+		draw_cell_put(*cells++);
+}
+
+static void
+test_draw_frame(void)
+{
+	/* Test frames write only cells differing from the terminal */
+
+	struct draw_attrs attrs = DRAW_ATTRS_EMPTY;
+
+	draw_grid(4, 2);
+
+	assert_eq(draw_state.bits.all, -1);
+
+	/* Test the first frame writes all rows, resetting attributes */
+	t__draw_row(1, "ab");
+	draw_cursor_pos(2, 1);
+	draw_cursor_pos_save();
+
+	assert_strcmp(t__draw_frame(),
+		"\x1b[?25l" "\x1b[1;1H" "\x1b[0m" "ab" "\x1b[K" "\x1b[2;1H" "\x1b[K" "\x1b[?25h");
+
+	/* Test redrawing unchanged cells writes nothing */
+	t__draw_row(1, "ab");
+	t__draw_row(2, "");
+
+	assert_strcmp(t__draw_frame(), "");
+
+	/* Test changing a cell writes only that cell and its attributes */
+	draw_attr_set_fg(&attrs, 3);
+	draw_attr_toggle_bold(&attrs);
+
+	draw_cursor_pos(1, 1);
+	draw_cell_put('a');
+	draw_attrs(&attrs, 0);
+	draw_cell_put('c');
+
+	assert_strcmp(t__draw_frame(),
+		"\x1b[?25l" "\x1b[1;2H" "\x1b[38;5;3;1m" "c" "\x1b[2;1H" "\x1b[?25h");
+
+	draw_attr_set_fg(&attrs, -1);
+	draw_attrs(&attrs, 0);
+	draw_cursor_pos(1, 2);
+	draw_cell_put('c');
+
+	assert_strcmp(t__draw_frame(),
+		"\x1b[?25l" "\x1b[1;2H" "\x1b[39m" "c" "\x1b[2;1H" "\x1b[?25h");
+
+	/* Test moving forward within a row, and erasing the row's end */
+	draw_attr_reset(NULL);
+	t__draw_row(2, "x  y");
+
+	assert_strcmp(t__draw_frame(),
+		"\x1b[?25l" "\x1b[22m" "x" "\x1b[2C" "y" "\x1b[2;1H" "\x1b[?25h");
+
+	t__draw_row(2, "x");
+
+	assert_strcmp(t__draw_frame(),
+		"\x1b[?25l" "\x1b[1C" "\x1b[K" "\x1b[2;1H" "\x1b[?25h");
+
+	/* Test only moving the cursor */
+	draw_cursor_pos(1, 3);
+	draw_cursor_pos_save();
+
+	assert_strcmp(t__draw_frame(), "\x1b[1;3H");
+
+	/* Test UTF-8 continuation bytes extend the previous cell */
+	t__draw_row(1, "\xc3\xa9" "a");
+
+	assert_strcmp(draw_state.back[0].c, "\xc3\xa9");
+	assert_strcmp(draw_state.back[1].c, "a");
+	assert_eq(draw_state.col, 3);
+
+	/* Test drawing is clipped to the grid */
+	draw_cursor_pos(2, 4);
+	draw_cell_put('z');
+	draw_cell_put('z');
+	draw_cursor_pos(3, 1);
+	draw_cell_put('z');
+
+	assert_strcmp(draw_state.back[7].c, "z");
+
+	/* Test resizing invalidates the terminal's cells */
+	draw_state.bits.all = 0;
+	draw_grid(4, 2);
+
+	assert_eq(draw_state.bits.all, 0);
+
+	draw_grid(2, 1);
+
+	assert_eq(draw_state.bits.all, -1);
+	assert_eq(draw_state.front[0].flags, DRAW_CELL_UNKNOWN);
+
+	draw_cursor_pos(1, 1);
+	draw_cursor_pos_save();
+
+	assert_strcmp(t__draw_frame(),
+		"\x1b[?25l" "\x1b[1;1H" "\x1b[0m" "\x1b[K" "\x1b[?25h");
+
+	free(draw_state.back);
+	free(draw_state.front);
+	free(draw_state.dirty);
+	free(draw_state.out);
+
+	memset(&draw_state, 0, sizeof(draw_state));
+}
+
+static void
+test_draw_frame_deferred(void)
+{
+	/* Test frames in response to network activity are deferred to at
+	 * most DRAW_FPS per second, and flushing draws immediately */
+
+	draw_state.frame_ms = 0;
+
+	assert_eq(draw_deferred(), -1);
+
+	/* Test a frame is drawn when none was recently */
+	draw(DRAW_BUFFER);
+	draw(DRAW_FRAME);
+
+	assert_eq(draw_state.bits.buffer, 0);
+	assert_eq(draw_state.deferred, 0);
+	assert_gt(draw_state.frame_ms, 0);
+
+	/* Test subsequent frames are deferred, coalescing set bits */
+	draw(DRAW_BUFFER);
+	draw(DRAW_FRAME);
+	draw(DRAW_STATUS);
+	draw(DRAW_FRAME);
+
+	assert_eq(draw_state.bits.buffer, 1);
+	assert_eq(draw_state.bits.status, 1);
+	assert_eq(draw_state.deferred, 1);
+	assert_gt(draw_deferred(), 0);
+	assert_lt(draw_deferred(), DRAW_FRAME_MS + 1);
+
+	/* Test deferred frames are drawn when due */
+	draw_state.frame_ms -= DRAW_FRAME_MS;
+
+	assert_eq(draw_deferred(), -1);
+	assert_eq(draw_state.bits.buffer, 0);
+	assert_eq(draw_state.bits.status, 0);
+	assert_eq(draw_state.deferred, 0);
+
+	/* Test flushing draws deferred frames immediately */
+	draw(DRAW_NAV);
+	draw(DRAW_FRAME);
+
+	assert_eq(draw_state.deferred, 1);
+
+	draw(DRAW_INPUT);
+	draw(DRAW_FLUSH);
+
+	assert_eq(draw_state.bits.nav, 0);
+	assert_eq(draw_state.bits.input, 0);
+	assert_eq(draw_state.deferred, 0);
+	assert_eq(draw_deferred(), -1);
+}
+
 int
 main(void)
 {
@@ -402,6 +589,8 @@ main(void)
 		TESTCASE(test_draw_buffer_line_rows),
 		TESTCASE(test_draw_buffer_scrollback_status),
 		TESTCASE(test_draw_buffer_wrap),
+		TESTCASE(test_draw_frame),
+		TESTCASE(test_draw_frame_deferred),
 		TESTCASE(test_draw_irc_colour),
 	};
 
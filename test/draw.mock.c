@@ -2,6 +2,7 @@
 #define DRAW_MOCK_C
 
 void draw(enum draw_bit b) { UNUSED(b); }
+int draw_deferred(void) { return -1; }
 void draw_init(void) { ; }
 void draw_term(void) { ; }
 
@@ -4,6 +4,7 @@
 
 #include "src/components/buffer.c"
 #include "src/components/channel.c"
+#include "src/components/highlight.c"
 #include "src/components/input.c"
 #include "src/components/ircv3.c"
 #include "src/components/mode.c"
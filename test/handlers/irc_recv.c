@@ -2,6 +2,7 @@
 
 #include "src/components/buffer.c"
 #include "src/components/channel.c"
+#include "src/components/highlight.c"
 #include "src/components/channel.h"
 #include "src/components/input.c"
 #include "src/components/ircv3.c"
@@ -307,6 +308,35 @@ test_irc_numeric_353(void)
 	assert_eq(u4->prfxmodes.lower, (mode_bit('o') | mode_bit('v')));
 }
 
+static void
+test_irc_numeric_366(void)
+{
+	/* 366 <nick> <channel> :End of /NAMES list */
+
+	/* test errors */
+	CHECK_RECV("366 me", 1, 1, 0);
+	assert_strcmp(mock_chan[0], "host");
+	assert_strcmp(mock_line[0], "RPL_ENDOFNAMES: channel is null");
+
+	/* test channel not found */
+	CHECK_RECV("366 me #x :End of /NAMES list", 0, 0, 0);
+
+	/* test users are counted at the end of names */
+	channel_reset(c1);
+	CHECK_RECV("353 me = #c1 :@n1 +n2 n3", 0, 0, 0);
+	CHECK_RECV("353 me = #c1 :n4", 0, 0, 0);
+
+	assert_eq(c1->users.count, 0);
+	assert_ptr_not_null(user_list_get(&(c1->users), s->casemapping, "n4", 0));
+
+	CHECK_RECV("366 me #c1 :End of /NAMES list", 0, 0, 0);
+
+	assert_eq(c1->users.count, 4);
+	assert_ptr_not_null(user_list_get(&(c1->users), s->casemapping, "n", 1));
+
+	channel_reset(c1);
+}
+
 static void
 test_irc_numeric_401(void)
 {
@@ -1423,6 +1453,7 @@ main(void)
 		TESTCASE(test_irc_generic_unknown),
 		TESTCASE(test_irc_numeric_001),
 		TESTCASE(test_irc_numeric_353),
+		TESTCASE(test_irc_numeric_366),
 		TESTCASE(test_irc_numeric_401),
 		TESTCASE(test_irc_numeric_403),
 		TESTCASE(test_recv),
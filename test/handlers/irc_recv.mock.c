@@ -1,7 +1,16 @@
+#define MOCK_RECV_LEN 512
+#define MOCK_RECV_N   10
+
+static char mock_recv[MOCK_RECV_N][MOCK_RECV_LEN];
+static unsigned mock_recv_n;
+
 int
 irc_recv(struct server *s, struct irc_message *m)
 {
 	UNUSED(s);
-	UNUSED(m);
+
+	snprintf(mock_recv[mock_recv_n++ % MOCK_RECV_N], MOCK_RECV_LEN, "%s %s",
+		m->command, (m->params ? m->params : ""));
+
 	return 0;
 }
@@ -1,17 +1,603 @@
 #include "test/test.h"
 
+#include "src/dns.c"
+#include "src/io.c"
+#include "src/utils/utils.c"
+
+const char *default_ca_file;
+const char *default_ca_path;
+
+static unsigned test_error;
+static size_t test_read_soc;
+
+void io_cb_cxed(const void *obj) { UNUSED(obj); }
+void io_cb_dxed(const void *obj) { UNUSED(obj); }
+void io_cb_error(const void *obj, const char *fmt, ...) { UNUSED(obj); UNUSED(fmt); test_error++; }
+void io_cb_info(const void *obj, const char *fmt, ...) { UNUSED(obj); UNUSED(fmt); }
+void io_cb_ping(const void *obj, unsigned ping) { UNUSED(obj); UNUSED(ping); }
+void io_cb_read_inp(char *buf, size_t len) { UNUSED(buf); UNUSED(len); }
+void io_cb_read_soc(char *buf, size_t len, const void *obj) { UNUSED(buf); UNUSED(obj); test_read_soc += len; }
+void io_cb_sigwinch(unsigned cols, unsigned rows) { UNUSED(cols); UNUSED(rows); }
+int io_cb_idle(void) { return -1; }
+
+/* Loopback ports listening for, and refusing, connections */
+static int test_listen_fd;
+static uint16_t test_listen_port;
+static uint16_t test_refuse_port;
+
+static uint16_t
+test_port(int listening)
+{
+	struct sockaddr_in sa = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(sa);
+	int fd;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+	 || bind(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0
+	 || (listening && listen(fd, 16) < 0)
+	 || getsockname(fd, (struct sockaddr *) &sa, &len) < 0)
+		abort();
+
+	if (listening)
+		test_listen_fd = fd;
+	else
+		close(fd);
+
+	return ntohs(sa.sin_port);
+}
+
+static struct addrinfo*
+test_addrs(const char *families, uint16_t port)
+{
+	/* Loopback addresses of each family in order, '4' or '6', numbered
+	 * by their index in the last byte */
+
+	struct dns_addr addrs[DNS_ADDRS_MAX] = {0};
+	unsigned n;
+
+	for (n = 0; families[n]; n++) {
+		if (families[n] == '4') {
+			addrs[n].family = AF_INET;
+			addrs[n].u.v4.s_addr = htonl(INADDR_LOOPBACK & ~0xFFu) | htonl(n + 1);
+		} else {
+			addrs[n].family = AF_INET6;
+			addrs[n].u.v6.s6_addr[15] = (unsigned char) (n + 1);
+		}
+	}
+
+	return dns_addrinfo(addrs, n, port);
+}
+
+static unsigned
+test_addr_n(const struct addrinfo *ai)
+{
+	if (ai->ai_family == AF_INET)
+		return ntohl(((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr) & 0xFF;
+	else
+		return ((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr.s6_addr[15];
+}
+
+static void
+test_io_net_sort(void)
+{
+	/* Test addresses are interleaved by family, starting with the family
+	 * of the first, otherwise in the resolver's order */
+
+	#define CHECK_SORT(IN, OUT) \
+	do { \
+		char buf[sizeof(IN)] = {0}; \
+		size_t i = 0; \
+		struct addrinfo *ai; \
+		struct addrinfo *res = test_addrs((IN), 6667); \
+		assert_ptr_eq((ai = io_net_sort(res)), res); \
+		for (; ai && i < sizeof(buf) - 1; ai = ai->ai_next) \
+			buf[i++] = (char) ('0' + test_addr_n(ai)); \
+		assert_ptr_null(ai); \
+		assert_strcmp(buf, (OUT)); \
+		free(res); \
+	} while (0)
+
+	/* Mixed families */
+	CHECK_SORT("66446", "13245");
+	CHECK_SORT("466", "123");
+	CHECK_SORT("44466", "14253");
+	CHECK_SORT("6446", "1243");
+	CHECK_SORT("64", "12");
+
+	/* Single family */
+	CHECK_SORT("4", "1");
+	CHECK_SORT("444", "123");
+	CHECK_SORT("666", "123");
+
+	#undef CHECK_SORT
+
+	assert_ptr_null(io_net_sort(NULL));
+}
+
+static void
+test_io_net_race_start(void)
+{
+	/* Test attempts start IO_CONNECT_DELAY apart, up to IO_CONNECT_ATTEMPTS
+	 * in flight, and are abandoned after IO_CONNECT_TIMEOUT */
+
+	struct connection cx = {0};
+	uint64_t t = 1000;
+	uint64_t timeout = SEC_IN_MS((uint64_t) IO_CONNECT_TIMEOUT);
+	struct addrinfo *ai;
+	struct addrinfo *res;
+	unsigned i;
+
+	/* Attempts connect to the listening port, and aren't polled */
+	res = test_addrs("4444444444", test_listen_port);
+
+	for (ai = res; ai; ai = ai->ai_next)
+		((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	io_net_race_init(&cx, res);
+
+	io_net_race_start(&cx, t);
+	assert_ueq(cx.race.n, 1);
+	assert_ueq(io_net_race_deadline(&cx), t + IO_CONNECT_DELAY);
+
+	io_net_race_start(&cx, t + IO_CONNECT_DELAY - 1);
+	assert_ueq(cx.race.n, 1);
+
+	io_net_race_start(&cx, t + IO_CONNECT_DELAY);
+	assert_ueq(cx.race.n, 2);
+	assert_ueq(io_net_race_deadline(&cx), t + IO_CONNECT_DELAY * 2);
+
+	/* A single attempt starts per call, however late */
+	io_net_race_start(&cx, t + IO_CONNECT_DELAY * 4);
+	assert_ueq(cx.race.n, 3);
+	assert_ueq(io_net_race_deadline(&cx), t + IO_CONNECT_DELAY * 5);
+
+	for (i = 5; i < IO_CONNECT_ATTEMPTS + 5; i++)
+		io_net_race_start(&cx, t + IO_CONNECT_DELAY * i);
+
+	/* Attempts in flight are limited, the nearest timeout is then due */
+	assert_ueq(cx.race.n, IO_CONNECT_ATTEMPTS);
+	assert_ptr_not_null(cx.race.ai);
+	assert_ueq(io_net_race_deadline(&cx), t + timeout);
+
+	for (i = 0; i < cx.race.n; i++)
+		assert_gt(cx.race.attempts[i].fd, -1);
+
+	/* A timed out attempt is abandoned, starting the next without delay */
+	io_net_race_start(&cx, t + timeout);
+	assert_ueq(cx.race.n, IO_CONNECT_ATTEMPTS);
+	assert_eq(cx.race.err, ETIMEDOUT);
+
+	/* Two more time out, only one address remains to start */
+	io_net_race_start(&cx, t + timeout + IO_CONNECT_DELAY * 4);
+	assert_ueq(cx.race.n, IO_CONNECT_ATTEMPTS - 1);
+	assert_ptr_null(cx.race.ai);
+
+	io_net_race_start(&cx, UINT64_MAX);
+	assert_ueq(cx.race.n, 0);
+
+	io_net_race_free(&cx);
+
+	assert_ptr_null(cx.race.ai_res);
+	assert_ueq(cx.race.n, 0);
+}
+
+static void
+test_io_net_race(void)
+{
+	/* Test failed attempts start the next without delay, the first to
+	 * connect winning */
+
+	struct connection cx = {0};
+	struct addrinfo *res;
+	struct sockaddr_in *sa;
+	int soc;
+
+	/* The first two addresses refuse connections */
+	res = test_addrs("444", test_refuse_port);
+	sa = (struct sockaddr_in *) res->ai_next->ai_next->ai_addr;
+	sa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa->sin_port = htons(test_listen_port);
+
+	io_net_race_init(&cx, res);
+
+	assert_gt((soc = io_net_race(&cx, 1)), -1);
+	assert_ptr_null(cx.race.ai_res);
+	assert_ueq(cx.race.n, 0);
+
+	close(soc);
+
+	/* All refuse connections */
+	io_net_race_init(&cx, test_addrs("44", test_refuse_port));
+
+	assert_eq(io_net_race(&cx, 1), -1);
+	assert_eq(errno, ECONNREFUSED);
+	assert_ueq(cx.race.n, 0);
+
+	io_net_race_free(&cx);
+
+	/* No addresses */
+	io_net_race_init(&cx, NULL);
+
+	assert_eq(io_net_race(&cx, 1), -1);
+	assert_eq(errno, EHOSTUNREACH);
+}
+
+#if !IO_EPOLL
+#define TEST_PRODUCERS 4
+#define TEST_EVENTS    20000
+
+static struct io_event*
+test_ev(size_t producer, unsigned seq)
+{
+	struct io_event *ev;
+
+	if ((ev = malloc(sizeof(*ev))) == NULL)
+		abort();
+
+	ev->len = producer;
+	ev->ping = seq;
+
+	return ev;
+}
+
+static void*
+test_producer(void *arg)
+{
+	size_t producer = (size_t) arg;
+
+	for (unsigned i = 0; i < TEST_EVENTS; i++)
+		io_ev_push(test_ev(producer, i));
+
+	return NULL;
+}
+
+static void
+test_io_ev_queue(void)
+{
+	/* Test events are popped in the order pushed, including events pushed
+	 * after the queue was emptied */
+
+	struct io_event *ev;
+
+	assert_ptr_null(io_ev_pop());
+
+	io_ev_push(test_ev(0, 0));
+	io_ev_push(test_ev(0, 1));
+	io_ev_push(test_ev(0, 2));
+
+	for (unsigned i = 0; i < 3; i++) {
+		assert_ptr_not_null((ev = io_ev_pop()));
+		assert_ueq(ev->ping, i);
+		free(ev);
+	}
+
+	assert_ptr_null(io_ev_pop());
+	assert_ptr_null(io_ev_pop());
+
+	io_ev_push(test_ev(0, 3));
+
+	assert_ptr_not_null((ev = io_ev_pop()));
+	assert_ueq(ev->ping, 3);
+	free(ev);
+
+	assert_ptr_null(io_ev_pop());
+}
+
+static void
+test_io_cx_read_sendf(void)
+{
+	/* Test reads queue events sized to the bytes read, and writes to a
+	 * non-blocking socket */
+
+	char buf[64];
+	int ret;
+	int sv[2];
+	struct connection *cx;
+	struct io_event *ev;
+
+	assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+	assert_eq(fcntl(sv[0], F_SETFL, O_NONBLOCK), 0);
+
+	cx = connection(NULL, "host", "port", NULL, NULL, NULL, NULL, NULL, 0);
+	cx->net_ctx.fd = sv[0];
+	cx->st_cur = IO_ST_CXED;
+
+	assert_eq(write(sv[1], "abc", 3), 3);
+	assert_eq(io_cx_read(cx, 1000), 3);
+
+	assert_ptr_not_null((ev = io_ev_pop()));
+	assert_eq(ev->type, IO_EV_READ);
+	assert_ueq(ev->len, 3);
+	assert_strcmp(ev->buf, "abc");
+	free(ev);
+
+	assert_eq(io_cx_read(cx, 0), MBEDTLS_ERR_SSL_TIMEOUT);
+	assert_ptr_null(io_ev_pop());
+
+	ret = io_sendf(cx, "PING :%s", "host");
+
+	assert_eq(ret, IO_ERR_NONE);
+	assert_eq(read(sv[1], buf, sizeof(buf)), 12);
+	assert_eq(memcmp(buf, "PING :host\r\n", 12), 0);
+
+	cx->st_cur = IO_ST_DXED;
+	cx->net_ctx.fd = -1;
+
+	assert_eq(io_dx(cx, 1), IO_ERR_NONE);
+	assert_ptr_not_null((ev = io_ev_pop()));
+	assert_eq(ev->type, IO_EV_FREE);
+	free(ev->cx);
+	free(ev);
+
+	close(sv[0]);
+	close(sv[1]);
+}
+
+static void
+test_io_ev_queue_producers(void)
+{
+	/* Test events pushed by concurrent producers are each popped once, in
+	 * the order pushed by their producer */
+
+	pthread_t tids[TEST_PRODUCERS];
+	unsigned next[TEST_PRODUCERS] = {0};
+	unsigned popped = 0;
+	unsigned unordered = 0;
+
+	for (size_t i = 0; i < TEST_PRODUCERS; i++)
+		PT_CF(pthread_create(&(tids[i]), NULL, test_producer, (void *) i));
+
+	while (popped < TEST_PRODUCERS * TEST_EVENTS) {
+
+		struct io_event *ev;
+
+		if ((ev = io_ev_pop()) == NULL)
+			continue;
+
+		if (ev->len >= TEST_PRODUCERS || ev->ping != next[ev->len]++)
+			unordered++;
+
+		popped++;
+		free(ev);
+	}
+
+	for (size_t i = 0; i < TEST_PRODUCERS; i++)
+		PT_CF(pthread_join(tids[i], NULL));
+
+	assert_ueq(unordered, 0);
+	assert_ptr_null(io_ev_pop());
+
+	for (size_t i = 0; i < TEST_PRODUCERS; i++)
+		assert_ueq(next[i], TEST_EVENTS);
+}
+#endif
+
+#if IO_EPOLL
+static struct connection*
+test_cx(int soc, uint32_t flags)
+{
+	/* Connected to the socket, watched by epoll */
+
+	struct connection *cx;
+
+	cx = connection(NULL, "127.0.0.1", "1", NULL, NULL, NULL, NULL, NULL, flags);
+	cx->net_ctx.fd = soc;
+	cx->st_cur = IO_ST_CXED;
+
+	if (fcntl(soc, F_SETFL, O_NONBLOCK) < 0)
+		abort();
+
+	io_loop_watch(cx, EPOLLIN);
+
+	return cx;
+}
+
+static void
+test_cx_free(struct connection *cx)
+{
+	struct connection *cx_free;
+
+	io_dx(cx, 1);
+
+	while ((cx_free = io_loop_free)) {
+		io_loop_free = cx_free->next;
+		free(cx_free);
+	}
+}
+
+static void
+test_io_loop_send(void)
+{
+	/* Test writes are queued while the socket would block, written in
+	 * order once writable, and limited to IO_SEND_MAX */
+
+	static char expected[IO_SEND_MAX * 2];
+	static char received[IO_SEND_MAX * 2];
+
+	char port[8];
+	int ret;
+	int sndbuf = 4096;
+	int sv[2];
+	size_t n_expected = 0;
+	size_t n_received = 0;
+	struct connection *cx;
+	struct epoll_event ev;
+	unsigned i;
+
+	assert_gt((io_loop_epfd = epoll_create1(0)), -1);
+	assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+	assert_eq(setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)), 0);
+
+	cx = test_cx(sv[0], 0);
+
+	/* Until the socket would block, then queued */
+	for (i = 0; !cx->sendq_len || i % 10; i++) {
+		ret = io_sendf(cx, "PRIVMSG #c :%0400u", i);
+		assert_eq(ret, IO_ERR_NONE);
+		n_expected += (size_t) snprintf(expected + n_expected, sizeof(expected) - n_expected, "PRIVMSG #c :%0400u\r\n", i);
+	}
+
+	assert_true(cx->sendq_watch);
+	assert_eq(epoll_wait(io_loop_epfd, &ev, 1, 0), 0);
+
+	while (n_received < n_expected) {
+
+		ssize_t n;
+
+		if ((n = read(sv[1], received + n_received, sizeof(received) - n_received)) > 0)
+			n_received += (size_t) n;
+
+		if (epoll_wait(io_loop_epfd, &ev, 1, 0) == 1) {
+			assert_ptr_eq(ev.data.ptr, cx);
+			io_loop_poll(cx);
+		}
+	}
+
+	assert_ueq(n_received, n_expected);
+	assert_eq(memcmp(received, expected, n_expected), 0);
+	assert_ueq(cx->sendq_len, 0);
+	assert_false(cx->sendq_watch);
+	assert_eq(epoll_wait(io_loop_epfd, &ev, 1, 0), 0);
+
+	/* Until the queue is full, reconnecting to a port refusing connections */
+	snprintf(port, sizeof(port), "%u", test_refuse_port);
+	free((void *) cx->port);
+	cx->port = strdup(port);
+
+	while ((ret = io_sendf(cx, "PRIVMSG #c :%0400u", 0)) == IO_ERR_NONE)
+		assert_true(cx->sendq_len <= IO_SEND_MAX);
+
+	assert_eq(ret, IO_ERR_SSL_WRITE);
+	assert_ptr_null(cx->sendq);
+	assert_false(cx->sendq_watch);
+
+	test_cx_free(cx);
+
+	close(sv[1]);
+	close(io_loop_epfd);
+}
+
 static void
-test_dummy(void)
+test_io_loop_read(void)
 {
-	test_pass();
+	/* Test reads are deferred after IO_READ_MAX per wakeup */
+
+	static char buf[IO_READ_SIZE * (IO_READ_MAX + 1)];
+
+	int sv[2];
+	struct connection *cx;
+
+	assert_gt((io_loop_epfd = epoll_create1(0)), -1);
+	assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+	cx = test_cx(sv[0], 0);
+
+	assert_eq(write(sv[1], buf, sizeof(buf)), (ssize_t) sizeof(buf));
+
+	test_read_soc = 0;
+
+	io_loop_read(cx);
+
+	assert_ueq(test_read_soc, IO_READ_SIZE * IO_READ_MAX);
+	assert_eq(cx->rd_pending, 1);
+	assert_eq(io_loop_timeout(), 0);
+
+	/* Deferred reads are due after the next wakeup */
+	io_loop_pending();
+
+	assert_ueq(test_read_soc, IO_READ_SIZE * IO_READ_MAX);
+	assert_eq(cx->rd_pending, 2);
+
+	io_loop_pending();
+
+	assert_ueq(test_read_soc, sizeof(buf));
+	assert_eq(cx->rd_pending, 0);
+	assert_gt(io_loop_timeout(), 0);
+
+	test_cx_free(cx);
+
+	close(sv[1]);
+	close(io_loop_epfd);
+}
+
+static void
+test_io_loop_handshake_timeout(void)
+{
+	/* Test a TLS handshake is abandoned after IO_CONNECT_TIMEOUT */
+
+	int sv[2];
+	struct connection *cx;
+
+	assert_gt((io_loop_epfd = epoll_create1(0)), -1);
+	assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+	cx = test_cx(sv[0], IO_TLS_ENABLED);
+	cx->st_cur = IO_ST_CXNG;
+	cx->tls_init = 1;
+	cx->deadline = io_now() + SEC_IN_MS((uint64_t) IO_CONNECT_TIMEOUT);
+
+	test_error = 0;
+
+	io_loop_timers();
+
+	assert_eq(cx->st_cur, IO_ST_CXNG);
+
+	cx->deadline = io_now();
+
+	io_loop_timers();
+
+	assert_eq(cx->st_cur, IO_ST_RXNG);
+	assert_eq(cx->net_ctx.fd, -1);
+	assert_false(cx->tls_init);
+	/* Timed out, and retrying */
+	assert_ueq(test_error, 2);
+	assert_gt(cx->deadline, io_now());
+
+	test_cx_free(cx);
+
+	close(sv[1]);
+	close(io_loop_epfd);
+}
+#endif
+
+static int
+test_init(void)
+{
+	test_listen_port = test_port(1);
+	test_refuse_port = test_port(0);
+
+	return 0;
+}
+
+static int
+test_term(void)
+{
+	close(test_listen_fd);
+
+	return 0;
 }
 
 int
 main(void)
 {
 	struct testcase tests[] = {
-		TESTCASE(test_dummy)
+		TESTCASE(test_io_net_sort),
+		TESTCASE(test_io_net_race_start),
+		TESTCASE(test_io_net_race),
+#if !IO_EPOLL
+		TESTCASE(test_io_cx_read_sendf),
+		TESTCASE(test_io_ev_queue),
+		TESTCASE(test_io_ev_queue_producers),
+#endif
+#if IO_EPOLL
+		TESTCASE(test_io_loop_send),
+		TESTCASE(test_io_loop_read),
+		TESTCASE(test_io_loop_handshake_timeout),
+#endif
 	};
 
-	return run_tests(NULL, NULL, tests);
+	return run_tests(test_init, test_term, tests);
 }
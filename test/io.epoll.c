@@ -0,0 +1,4 @@
+/* The epoll event loop, tested with all backend independent io tests */
+#define IO_EPOLL 1
+
+#include "test/io.c"
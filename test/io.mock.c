@@ -6,6 +6,7 @@
 static char mock_send[MOCK_SEND_N][MOCK_SEND_LEN];
 static unsigned mock_send_i;
 static unsigned mock_send_n;
+static uint32_t mock_tls_versions = IO_TLS_VERSION_1_2 | IO_TLS_VERSION_1_3;
 static int cxed;
 
 void
@@ -14,6 +15,7 @@ mock_reset_io(void)
 	mock_send_i = 0;
 	mock_send_n = 0;
 	memset(mock_send, 0, MOCK_SEND_LEN * MOCK_SEND_N);
+	mock_tls_versions = IO_TLS_VERSION_1_2 | IO_TLS_VERSION_1_3;
 	cxed = 0;
 }
 
@@ -30,7 +32,7 @@ io_sendf(struct connection *c, const char *fmt, ...)
 
 	mock_send_n++;
 
-	if (mock_send_i++ == MOCK_SEND_N)
+	if (++mock_send_i == MOCK_SEND_N)
 		mock_send_i = 0;
 
 	return 0;
@@ -44,6 +46,8 @@ connection(
 	const char *caf,
 	const char *cap,
 	const char *cl,
+	const char *cs,
+	const char *gs,
 	uint32_t f)
 {
 	UNUSED(o);
@@ -52,6 +56,8 @@ connection(
 	UNUSED(caf);
 	UNUSED(cap);
 	UNUSED(cl);
+	UNUSED(cs);
+	UNUSED(gs);
 	UNUSED(f);
 	return NULL;
 }
@@ -90,6 +96,7 @@ io_err(int err)
 	return (cxed ? "cxed" : "dxed");
 }
 
+uint32_t io_tls_versions(void) { return mock_tls_versions; }
 unsigned io_tty_cols(void) { return 0; }
 unsigned io_tty_rows(void) { return 0; }
 void io_init(void) { ; }
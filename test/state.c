@@ -2,6 +2,7 @@
 
 #include "src/components/buffer.c"
 #include "src/components/channel.c"
+#include "src/components/highlight.c"
 #include "src/components/input.c"
 #include "src/components/ircv3.c"
 #include "src/components/mode.c"
@@ -271,6 +272,21 @@ test_command_connect(void)
 	assert_strcmp(current_channel()->name, "host-1");
 	INP_C(0x0A);
 
+	INP_COMMAND(":connect host --tls-version");
+	assert_strcmp(action_message(), "connect: '--tls-version' requires an argument");
+	assert_strcmp(current_channel()->name, "host-1");
+	INP_C(0x0A);
+
+	INP_COMMAND(":connect host --tls-ciphers");
+	assert_strcmp(action_message(), "connect: '--tls-ciphers' requires an argument");
+	assert_strcmp(current_channel()->name, "host-1");
+	INP_C(0x0A);
+
+	INP_COMMAND(":connect host --tls-groups");
+	assert_strcmp(action_message(), "connect: '--tls-groups' requires an argument");
+	assert_strcmp(current_channel()->name, "host-1");
+	INP_C(0x0A);
+
 	INP_COMMAND(":connect host --sasl");
 	assert_strcmp(action_message(), "connect: '--sasl' requires an argument");
 	assert_strcmp(current_channel()->name, "host-1");
@@ -302,6 +318,18 @@ test_command_connect(void)
 	assert_strcmp(current_channel()->name, "host-1");
 	INP_C(0x0A);
 
+	INP_COMMAND(":connect host --tls-version 1.1");
+	assert_strcmp(action_message(), "connect: invalid option for '--tls-version' '1.1'");
+	assert_strcmp(current_channel()->name, "host-1");
+	INP_C(0x0A);
+
+	mock_tls_versions = IO_TLS_VERSION_1_2;
+	INP_COMMAND(":connect host --tls-version 1.3");
+	assert_strcmp(action_message(), "connect: TLS version '1.3' not supported by this build");
+	assert_strcmp(current_channel()->name, "host-1");
+	INP_C(0x0A);
+	mock_tls_versions = IO_TLS_VERSION_1_2 | IO_TLS_VERSION_1_3;
+
 	INP_COMMAND(":connect host --sasl xyz");
 	assert_strcmp(action_message(), "connect: invalid option for '--sasl' 'xyz'");
 	assert_strcmp(current_channel()->name, "host-1");
@@ -383,6 +411,20 @@ test_command_connect(void)
 	assert_ptr_not_null(channel_list_get(&(s->clist), "#a1", s->casemapping));
 	assert_ptr_not_null(channel_list_get(&(s->clist), "b2", s->casemapping));
 	assert_ptr_not_null(channel_list_get(&(s->clist), "#c3", s->casemapping));
+
+	/* Test TLS version, ciphersuites and groups */
+	INP_COMMAND(":connect host-4"
+		" --tls-version 1.2"
+		" --tls-version 1.3"
+		" --tls-ciphers TLS1-3-AES-128-GCM-SHA256"
+		" --tls-groups x25519,secp256r1"
+	);
+
+	assert_strcmp(action_message(), NULL);
+
+	s = current_channel()->server;
+
+	assert_strcmp(s->host, "host-4");
 }
 
 static void
@@ -452,6 +494,412 @@ test_command_quit(void)
 	assert_ptr_null(action_message());
 }
 
+static void
+test_command_search(void)
+{
+	struct channel *c1 = channel("#c1", CHANNEL_T_CHANNEL);
+	struct channel *c2 = channel("#c2", CHANNEL_T_CHANNEL);
+	struct server *s = server("host", "port", NULL, "user", "real", NULL);
+
+	if (!s || !c1 || !c2)
+		test_abort("Failed to create server and channels");
+
+	c1->server = s;
+	c2->server = s;
+	channel_list_add(&(s->clist), c1);
+	channel_list_add(&(s->clist), c2);
+
+	if (server_list_add(state_server_list(), s))
+		test_abort("Failed to add server");
+
+	newlinef(c1, 0, "", "a foo");
+	newlinef(c1, 0, "", "b");
+	newlinef(c2, 0, "", "c FOO bar");
+	newlinef(c2, 0, "", "d");
+
+	channel_set_current(c1);
+
+	INP_COMMAND(":search");
+
+	assert_strcmp(action_message(), ":search <text>");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":search nomatch");
+
+	assert_strcmp(action_message(), "search: no match for 'nomatch'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":search foo");
+
+	assert_ptr_null(action_message());
+	assert_ptr_eq(current_channel(), c1);
+	assert_strcmp(buffer_line(&(c1->buffer), c1->buffer.scrollback)->text, "a foo");
+
+	/* Continue search across channels */
+	INP_COMMAND(":search");
+
+	assert_ptr_null(action_message());
+	assert_ptr_eq(current_channel(), c2);
+	assert_strcmp(buffer_line(&(c2->buffer), c2->buffer.scrollback)->text, "c FOO bar");
+
+	INP_COMMAND(":search");
+
+	assert_ptr_null(action_message());
+	assert_ptr_eq(current_channel(), c1);
+	assert_strcmp(buffer_line(&(c1->buffer), c1->buffer.scrollback)->text, "a foo");
+
+	INP_COMMAND(":search   foo bar");
+
+	assert_ptr_null(action_message());
+	assert_ptr_eq(current_channel(), c2);
+	assert_strcmp(buffer_line(&(c2->buffer), c2->buffer.scrollback)->text, "c FOO bar");
+}
+
+static void
+test_command_set(void)
+{
+	char buf[64];
+	char text[201];
+	int i;
+	size_t c1_size;
+	size_t c2_size;
+	struct channel *c1 = channel("#c1", CHANNEL_T_CHANNEL);
+	struct channel *c2 = channel("#c2", CHANNEL_T_CHANNEL);
+	struct server *s = server("host", "port", NULL, "user", "real", NULL);
+
+	if (!s || !c1 || !c2)
+		test_abort("Failed to create server and channels");
+
+	c1->server = s;
+	c2->server = s;
+	channel_list_add(&(s->clist), c1);
+	channel_list_add(&(s->clist), c2);
+
+	if (server_list_add(state_server_list(), s))
+		test_abort("Failed to add server");
+
+	INP_COMMAND(":set");
+
+	assert_strcmp(action_message(), ":set <option> <value>");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":set unknown 1");
+
+	assert_strcmp(action_message(), "set: unknown option 'unknown'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":set scrollback");
+
+	assert_strcmp(action_message(), "set: 'scrollback' requires an argument");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":set scrollback 1 2");
+
+	assert_strcmp(action_message(), "set: Unknown arg '2'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":set scrollback 0");
+
+	assert_strcmp(action_message(), "set: invalid value for 'scrollback' '0' [1, 1048576]");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":set scrollback 1x");
+
+	assert_strcmp(action_message(), "set: invalid value for 'scrollback' '1x' [1, 1048576]");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":set scrollback-memory -1");
+
+	assert_strcmp(action_message(), "set: invalid value for 'scrollback-memory' '-1'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":set scrollback-memory 1t");
+
+	assert_strcmp(action_message(), "set: invalid value for 'scrollback-memory' '1t'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	/* Test setting the current channel's scrollback */
+	memset(text, 'a', sizeof(text) - 1);
+	text[sizeof(text) - 1] = 0;
+
+	channel_set_current(c1);
+
+	for (i = 0; i < 100; i++)
+		newlinef(c1, 0, "", "%s", text);
+
+	channel_set_current(c2);
+
+	for (i = 0; i < 100; i++)
+		newlinef(c2, 0, "", "%s", text);
+
+	INP_COMMAND(":set scrollback 50");
+
+	assert_ptr_null(action_message());
+	assert_ueq(c1->buffer.buffer_lines_max, BUFFER_LINES_MAX);
+	assert_ueq(c2->buffer.buffer_lines_max, 50);
+	assert_gt(buffer_size(&(c1->buffer)), 50);
+	assert_eq(buffer_size(&(c2->buffer)), 50);
+
+	/* Test evicting lines from the least recently viewed channel */
+	channel_set_current(s->channel);
+
+	newlinef(s->channel, 0, "", "%s", text);
+
+	c1_size = buffer_size(&(c1->buffer));
+	c2_size = buffer_size(&(c2->buffer));
+
+	snprintf(buf, sizeof(buf), ":set scrollback-memory %zu", buffer_memory_total() - 1);
+
+	INP_COMMAND(buf);
+
+	assert_ptr_null(action_message());
+	assert_true(buffer_size(&(c1->buffer)) < c1_size);
+	assert_true(buffer_size(&(c2->buffer)) == c2_size);
+
+	/* Test evicting lines as new lines are added, to the current channel
+	 * such that memory grows regardless of page boundaries */
+	c1_size = buffer_size(&(c1->buffer));
+
+	for (i = 0; i < 20; i++)
+		newlinef(s->channel, 0, "", "%s", text);
+
+	assert_true(buffer_size(&(c1->buffer)) < c1_size);
+	assert_true(buffer_size(&(c2->buffer)) == c2_size);
+	assert_true(buffer_memory_total() <= state.buffer_memory_max);
+
+	/* Test the current channel is never evicted */
+	INP_COMMAND(":set scrollback-memory 1k");
+
+	assert_ptr_null(action_message());
+	assert_ueq(state.buffer_memory_max, 1024);
+	assert_eq(buffer_size(&(c1->buffer)), 0);
+	assert_eq(buffer_size(&(c2->buffer)), 0);
+	assert_gt(buffer_size(&(s->channel->buffer)), 0);
+
+	/* Test emptied channels are unlinked from the views list, such that
+	 * eviction stops at once at the current channel */
+	assert_ptr_eq(state.views.head, s->channel);
+	assert_ptr_eq(state.views.tail, s->channel);
+	assert_ptr_null(c1->views);
+
+	newlinef(c1, 0, "", "%s", text);
+
+	assert_eq(buffer_size(&(c1->buffer)), 0);
+	assert_ptr_eq(state.views.head, s->channel);
+
+	newlinef(s->channel, 0, "", "%s", text);
+
+	assert_gt(buffer_memory_total(), state.buffer_memory_max);
+	assert_ptr_eq(state.views.head, s->channel);
+
+	INP_COMMAND(":set scrollback-memory 0");
+
+	/* Test lines link channels in order of last view */
+	newlinef(c2, 0, "", "%s", text);
+	newlinef(c1, 0, "", "%s", text);
+
+	assert_ptr_eq(state.views.head, c1);
+	assert_ptr_eq(c1->view_next, c2);
+	assert_ptr_eq(c2->view_next, s->channel);
+
+	assert_ptr_null(action_message());
+	assert_ueq(state.buffer_memory_max, 0);
+
+	/* Test setting highlight words */
+	server_nick_set(s, "me");
+
+	INP_COMMAND(":set highlight foo,bar baz");
+
+	assert_strcmp(action_message(), "set: Unknown arg 'baz'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":set highlight foo,bar");
+
+	assert_ptr_null(action_message());
+	assert_eq(highlight_match(&(s->highlight), s->casemapping, "xxx bar"), 1);
+	assert_eq(highlight_match(&(s->highlight), s->casemapping, "me: xxx"), 1);
+
+	INP_COMMAND(":set highlight");
+
+	assert_ptr_null(action_message());
+	assert_eq(highlight_match(&(s->highlight), s->casemapping, "xxx bar"), 0);
+	assert_eq(highlight_match(&(s->highlight), s->casemapping, "me: xxx"), 1);
+}
+
+static void
+test_io_cb_read_soc(void)
+{
+	char buf[1024];
+	struct server *s = server("host", "port", NULL, "user", "real", NULL);
+
+	s->channel = channel("host", CHANNEL_T_SERVER);
+
+	mock_recv_n = 0;
+
+	/* Messages framed in a single read */
+	strcpy(buf, "PING :1\r\nPING :2\r\n");
+	io_cb_read_soc(buf, strlen(buf), s);
+
+	assert_eq(mock_recv_n, 2);
+	assert_strcmp(mock_recv[0], "PING :1");
+	assert_strcmp(mock_recv[1], "PING :2");
+
+	/* Messages split across reads, including between CR and LF */
+	strcpy(buf, "PING :3\r\nPI");
+	io_cb_read_soc(buf, strlen(buf), s);
+	strcpy(buf, "NG :4\r");
+	io_cb_read_soc(buf, strlen(buf), s);
+
+	assert_eq(mock_recv_n, 3);
+	assert_strcmp(mock_recv[2], "PING :3");
+
+	strcpy(buf, "\nPING :5\n\r\n");
+	io_cb_read_soc(buf, strlen(buf), s);
+
+	assert_eq(mock_recv_n, 5);
+	assert_strcmp(mock_recv[3], "PING :4");
+	assert_strcmp(mock_recv[4], "PING :5");
+
+	/* Messages exceeding IRC_MESSAGE_LEN are truncated */
+	memset(buf, 'a', sizeof(buf));
+	memcpy(buf, "PING :", 6);
+	io_cb_read_soc(buf, 600, s);
+	strcpy(buf, "aaa\r\n");
+	io_cb_read_soc(buf, strlen(buf), s);
+
+	assert_eq(mock_recv_n, 6);
+	assert_eq(strlen(mock_recv[5]), IRC_MESSAGE_LEN);
+	assert_eq(s->read.i, 0);
+
+	channel_free(s->channel);
+	server_free(s);
+}
+
+static void
+test_complete_user(void)
+{
+	/* Test nick completion orders recent speakers first, and cycles
+	 * through the matches of the completed word */
+
+	char buf[INPUT_LEN_MAX + 1];
+	struct channel *c;
+	struct server *s;
+
+	c = channel("#c", CHANNEL_T_CHANNEL);
+	s = server("host", "port", NULL, "user", "real", NULL);
+
+	if (!c || !s)
+		test_abort("Failed to create server and channel");
+
+	c->server = s;
+	channel_list_add(&(s->clist), c);
+
+	if (server_list_add(state_server_list(), s))
+		test_abort("Failed to add server");
+
+	assert_eq(user_list_add(&(c->users), CASEMAPPING_RFC1459, "nick1", (struct mode){0}), USER_ERR_NONE);
+	assert_eq(user_list_add(&(c->users), CASEMAPPING_RFC1459, "nick2", (struct mode){0}), USER_ERR_NONE);
+	assert_eq(user_list_add(&(c->users), CASEMAPPING_RFC1459, "nick3", (struct mode){0}), USER_ERR_NONE);
+	assert_eq(user_list_add(&(c->users), CASEMAPPING_RFC1459, "other", (struct mode){0}), USER_ERR_NONE);
+
+	channel_set_current(c);
+
+	/* Nicks ordered when no user has spoken */
+	INP_S("ni");
+	INP_C(0x09);
+	buf[input_write(&(c->input), buf, sizeof(buf), 0)] = 0;
+	assert_strcmp(buf, "nick1:");
+
+	INP_C(0x09);
+	buf[input_write(&(c->input), buf, sizeof(buf), 0)] = 0;
+	assert_strcmp(buf, "nick2:");
+
+	INP_C(0x09);
+	INP_C(0x09);
+	buf[input_write(&(c->input), buf, sizeof(buf), 0)] = 0;
+	assert_strcmp(buf, "nick1:");
+
+	input_reset(&(c->input));
+
+	/* Recent speakers first */
+	newlinef(c, BUFFER_LINE_CHAT, "nick2", "1");
+	newlinef(c, BUFFER_LINE_CHAT, "nick3", "2");
+
+	INP_S("NI");
+	INP_C(0x09);
+	buf[input_write(&(c->input), buf, sizeof(buf), 0)] = 0;
+	assert_strcmp(buf, "nick3:");
+
+	INP_C(0x09);
+	buf[input_write(&(c->input), buf, sizeof(buf), 0)] = 0;
+	assert_strcmp(buf, "nick2:");
+
+	INP_C(0x09);
+	buf[input_write(&(c->input), buf, sizeof(buf), 0)] = 0;
+	assert_strcmp(buf, "nick1:");
+
+	input_reset(&(c->input));
+
+	/* Users leaving between completions, cycling from the last match */
+	INP_S("ni");
+	INP_C(0x09);
+	INP_C(0x09);
+	buf[input_write(&(c->input), buf, sizeof(buf), 0)] = 0;
+	assert_strcmp(buf, "nick2:");
+
+	assert_eq(user_list_del(&(c->users), CASEMAPPING_RFC1459, "nick2"), USER_ERR_NONE);
+
+	INP_C(0x09);
+	buf[input_write(&(c->input), buf, sizeof(buf), 0)] = 0;
+	assert_strcmp(buf, "nick1:");
+
+	assert_eq(user_list_del(&(c->users), CASEMAPPING_RFC1459, "nick1"), USER_ERR_NONE);
+
+	INP_C(0x09);
+	buf[input_write(&(c->input), buf, sizeof(buf), 0)] = 0;
+	assert_strcmp(buf, "nick3:");
+
+	input_reset(&(c->input));
+
+	/* No match */
+	INP_S("xyz");
+	INP_C(0x09);
+	buf[input_write(&(c->input), buf, sizeof(buf), 0)] = 0;
+	assert_strcmp(buf, "xyz");
+
+	input_reset(&(c->input));
+
+	/* Not the first word */
+	INP_S("hi ot");
+	INP_C(0x09);
+	buf[input_write(&(c->input), buf, sizeof(buf), 0)] = 0;
+	assert_strcmp(buf, "hi other");
+
+	input_reset(&(c->input));
+}
+
 static void
 test_state(void)
 {
@@ -504,6 +952,7 @@ test_init(void)
 {
 	state_init();
 
+	buffer_free(&(current_channel()->buffer));
 	buffer(&(current_channel()->buffer));
 
 	return 0;
@@ -527,6 +976,10 @@ main(void)
 		TESTCASE(test_command_connect),
 		TESTCASE(test_command_disconnect),
 		TESTCASE(test_command_quit),
+		TESTCASE(test_command_search),
+		TESTCASE(test_command_set),
+		TESTCASE(test_complete_user),
+		TESTCASE(test_io_cb_read_soc),
 		TESTCASE(test_state),
 	};
 
@@ -88,6 +88,60 @@ test_irc_message_param(void)
 	CHECK_IRC_MESSAGE_PARSE(mesg6, 0);
 	CHECK_IRC_MESSAGE_PARAM(0, NULL);
 
+	/* Test params modified between calls */
+	char mesg7[] = "CMD arg1   arg2 :trailing arg";
+
+	CHECK_IRC_MESSAGE_PARSE(mesg7, 0);
+	CHECK_IRC_MESSAGE_PARAM(1, "arg1");
+	assert_strcmp(irc_strtrim(&m.params), "arg2 :trailing arg");
+	CHECK_IRC_MESSAGE_PARAM(1, "arg2");
+	CHECK_IRC_MESSAGE_PARAM(1, "trailing arg");
+	CHECK_IRC_MESSAGE_PARAM(0, NULL);
+
+	/* Test message exceeding 512 bytes */
+	char mesg8[1024] = ":nick!user@host.domain.tld CMD arg1 ";
+	char *p = mesg8 + strlen(mesg8);
+
+	memset(p, 'a', 600);
+	strcpy(p + 600, " arg3 :trailing arg");
+
+	CHECK_IRC_MESSAGE_PARSE(mesg8, 0);
+	CHECK_IRC_MESSAGE_PARAM(1, "arg1");
+	assert_eq(irc_message_param(&m, &param), 1);
+	assert_eq(strlen(param), 600);
+	CHECK_IRC_MESSAGE_PARAM(1, "arg3");
+	CHECK_IRC_MESSAGE_PARAM(1, "trailing arg");
+	CHECK_IRC_MESSAGE_PARAM(0, NULL);
+
+	/* Test message at each alignment */
+	for (size_t i = 0; i < 64; i++) {
+
+		char mesg9[256] = {0};
+
+		strcpy(mesg9 + i, ":nick!user@host CMD a1 a2 a3 a4 a5 a6 a7 a8 a9 a10 a11 a12 a13 a14 a15 a16");
+
+		CHECK_IRC_MESSAGE_PARSE(mesg9 + i, 0);
+		assert_strcmp(m.from, "nick");
+		assert_strcmp(m.host, "user@host");
+		assert_strcmp(m.command, "CMD");
+		CHECK_IRC_MESSAGE_PARAM(1, "a1");
+		CHECK_IRC_MESSAGE_PARAM(1, "a2");
+		CHECK_IRC_MESSAGE_PARAM(1, "a3");
+		CHECK_IRC_MESSAGE_PARAM(1, "a4");
+		CHECK_IRC_MESSAGE_PARAM(1, "a5");
+		CHECK_IRC_MESSAGE_PARAM(1, "a6");
+		CHECK_IRC_MESSAGE_PARAM(1, "a7");
+		CHECK_IRC_MESSAGE_PARAM(1, "a8");
+		CHECK_IRC_MESSAGE_PARAM(1, "a9");
+		CHECK_IRC_MESSAGE_PARAM(1, "a10");
+		CHECK_IRC_MESSAGE_PARAM(1, "a11");
+		CHECK_IRC_MESSAGE_PARAM(1, "a12");
+		CHECK_IRC_MESSAGE_PARAM(1, "a13");
+		CHECK_IRC_MESSAGE_PARAM(1, "a14");
+		CHECK_IRC_MESSAGE_PARAM(1, "a15 a16");
+		CHECK_IRC_MESSAGE_PARAM(0, NULL);
+	}
+
 #undef CHECK_IRC_MESSAGE_PARAM
 #undef CHECK_IRC_MESSAGE_PARSE
 }
@@ -362,63 +416,6 @@ test_irc_message_split(void)
 #undef CHECK_IRC_MESSAGE_SPLIT
 }
 
-static void
-test_irc_pinged(void)
-{
-	/* Test detecting user's nick in message */
-
-	const char *nick;
-
-#define CHECK_IRC_PINGED(M, R) \
-	assert_eq(irc_pinged(CASEMAPPING_RFC1459, (M), nick), (R));
-
-	nick = "nick";
-
-	CHECK_IRC_PINGED("nick", 1);
-	CHECK_IRC_PINGED("nick ", 1);
-	CHECK_IRC_PINGED("nick:", 1);
-	CHECK_IRC_PINGED("nick: ", 1);
-	CHECK_IRC_PINGED(" nick", 1);
-	CHECK_IRC_PINGED(" nick ", 1);
-	CHECK_IRC_PINGED(" nick:", 1);
-	CHECK_IRC_PINGED(" nick: ", 1);
-	CHECK_IRC_PINGED("xxx 'nick'! ", 1);
-	CHECK_IRC_PINGED("xxx @nick?! xxx", 1);
-	CHECK_IRC_PINGED("xxx @NICK?! xxx", 1);
-
-	CHECK_IRC_PINGED("", 0);
-	CHECK_IRC_PINGED(" ", 0);
-	CHECK_IRC_PINGED("xxx", 0);
-	CHECK_IRC_PINGED("xnick", 0);
-	CHECK_IRC_PINGED("xnick:", 0);
-	CHECK_IRC_PINGED("xnick: ", 0);
-	CHECK_IRC_PINGED(" xnick", 0);
-	CHECK_IRC_PINGED(" xnick:", 0);
-
-	/* Test server assigns a non standard nick */
-	nick = "000nick";
-
-	CHECK_IRC_PINGED("000nick", 1);
-	CHECK_IRC_PINGED("000nick ", 1);
-	CHECK_IRC_PINGED("000nick:", 1);
-	CHECK_IRC_PINGED("000nick: ", 1);
-	CHECK_IRC_PINGED(" 000nick", 1);
-	CHECK_IRC_PINGED(" 000nick ", 1);
-	CHECK_IRC_PINGED(" 000nick:", 1);
-	CHECK_IRC_PINGED(" 000nick: ", 1);
-	CHECK_IRC_PINGED("xxx '000nick'! ", 1);
-	CHECK_IRC_PINGED("xxx @000nick?! xxx", 1);
-	CHECK_IRC_PINGED("xxx @000NICK?! xxx", 1);
-
-	CHECK_IRC_PINGED("x000nick", 0);
-	CHECK_IRC_PINGED("x000nick:", 0);
-	CHECK_IRC_PINGED("x000nick: ", 0);
-	CHECK_IRC_PINGED(" x000nick", 0);
-	CHECK_IRC_PINGED(" x000nick:", 0);
-
-#undef CHECK_IRC_PINGED
-}
-
 static void
 test_irc_strcmp(void)
 {
@@ -453,6 +450,53 @@ test_irc_strcmp(void)
 	assert_eq(irc_strcmp(CASEMAPPING_RFC1459, "abc123", "ABC123"), 0);
 	assert_eq(irc_strcmp(CASEMAPPING_STRICT_RFC1459, "abc123", "ABC123"), 0);
 	assert_eq(irc_strcmp(CASEMAPPING_ASCII, "abc123", "ABC123"), 0);
+
+	/* Test bytes above 0x7F are unfolded and rank as signed */
+	assert_eq(irc_strcmp(CASEMAPPING_RFC1459, "a\xe9", "A\xe9"), 0);
+	assert_gt(irc_strcmp(CASEMAPPING_RFC1459, "a\xc9", "a\xe9"), 0);
+	assert_gt(irc_strcmp(CASEMAPPING_RFC1459, "\x80", "a"), 0);
+	assert_lt(irc_strcmp(CASEMAPPING_ASCII, "\xff", "\x80"), 0);
+}
+
+static void
+test_irc_strhash(void)
+{
+	/* Test hashes are equal for strings equal by casemapping */
+
+	assert_eq(irc_strhash(CASEMAPPING_RFC1459, "abc{}|^"), irc_strhash(CASEMAPPING_RFC1459, "ABC[]\\~"));
+	assert_eq(irc_strhash(CASEMAPPING_STRICT_RFC1459, "abc{}|"), irc_strhash(CASEMAPPING_STRICT_RFC1459, "ABC[]\\"));
+	assert_eq(irc_strhash(CASEMAPPING_ASCII, "abc"), irc_strhash(CASEMAPPING_ASCII, "ABC"));
+
+	assert_true(irc_strhash(CASEMAPPING_ASCII, "abc{") != irc_strhash(CASEMAPPING_ASCII, "ABC["));
+	assert_true(irc_strhash(CASEMAPPING_RFC1459, "abc") != irc_strhash(CASEMAPPING_RFC1459, "abcd"));
+}
+
+static void
+test_irc_strkey(void)
+{
+	/* Test keys compare as irc_strcmp, unless strings share 8 casefolded bytes */
+
+	const char *strs[] = {
+		"", "0", "9", "a", "A", "z", "`", "{", "[", "~", "^", "\x80", "\xff",
+		"ab", "abc", "abcdefgh", "ABCDEFGHi", "abcdefghj", "abcdefg",
+		"nick-1", "nick_1", "nick1", "nick10", "NICK2", "n{}|^", "N[]\\~",
+	};
+
+	for (size_t i = 0; i < ARR_LEN(strs); i++) {
+		for (size_t j = 0; j < ARR_LEN(strs); j++) {
+
+			uint64_t k1 = irc_strkey(CASEMAPPING_RFC1459, strs[i]);
+			uint64_t k2 = irc_strkey(CASEMAPPING_RFC1459, strs[j]);
+			int cmp = irc_strcmp(CASEMAPPING_RFC1459, strs[i], strs[j]);
+
+			if (k1 == k2) {
+				if (irc_strncmp(CASEMAPPING_RFC1459, strs[i], strs[j], 8))
+					test_failf("Keys equal: '%s', '%s'", strs[i], strs[j]);
+			} else if ((k1 < k2) != (cmp < 0)) {
+				test_failf("Keys unordered: '%s', '%s'", strs[i], strs[j]);
+			}
+		}
+	}
 }
 
 static void
@@ -550,8 +594,9 @@ main(void)
 		TESTCASE(test_irc_message_param),
 		TESTCASE(test_irc_message_parse),
 		TESTCASE(test_irc_message_split),
-		TESTCASE(test_irc_pinged),
 		TESTCASE(test_irc_strcmp),
+		TESTCASE(test_irc_strhash),
+		TESTCASE(test_irc_strkey),
 		TESTCASE(test_irc_strncmp),
 		TESTCASE(test_irc_strsep),
 		TESTCASE(test_irc_strtrim),